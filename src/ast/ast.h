@@ -49,7 +49,15 @@ namespace LangUMS
         EventDeclaration,
         RepeatTemplate,
         UnitProperties,
-        UnitProperty
+        UnitProperty,
+        SwitchStatement,
+        SwitchCase,
+        ConstDeclaration,
+        SpawnTaskStatement,
+        YieldStatement,
+        TriggersBlock,
+        RawTrigger,
+        RawTriggerAction
     };
 
     inline std::string ASTNodeTypeToName(ASTNodeType nodeType)
@@ -98,6 +106,22 @@ namespace LangUMS
                 return "UnitProperties";
             case ASTNodeType::UnitProperty:
                 return "UnitProperty";
+            case ASTNodeType::SwitchStatement:
+                return "SwitchStatement";
+            case ASTNodeType::SwitchCase:
+                return "SwitchCase";
+            case ASTNodeType::ConstDeclaration:
+                return "ConstDeclaration";
+            case ASTNodeType::SpawnTaskStatement:
+                return "SpawnTaskStatement";
+            case ASTNodeType::YieldStatement:
+                return "YieldStatement";
+            case ASTNodeType::TriggersBlock:
+                return "TriggersBlock";
+            case ASTNodeType::RawTrigger:
+                return "RawTrigger";
+            case ASTNodeType::RawTriggerAction:
+                return "RawTriggerAction";
         }
 
         return "UnknownType";
@@ -381,6 +405,53 @@ namespace LangUMS
         }
     };
 
+    class ASTSwitchStatement : public IASTNode
+    {
+        public:
+        ASTSwitchStatement(unsigned int charIndex) : IASTNode(charIndex, ASTNodeType::SwitchStatement) {}
+
+        const std::shared_ptr<IASTNode>& GetExpression() const
+        {
+            return GetChild(0);
+        }
+
+        size_t GetCaseCount() const
+        {
+            return GetChildCount() - 1;
+        }
+
+        const std::shared_ptr<IASTNode>& GetCase(size_t index) const
+        {
+            return GetChild(index + 1);
+        }
+    };
+
+    class ASTSwitchCase : public IASTNode
+    {
+        public:
+        ASTSwitchCase(const std::vector<int>& values, bool isDefault, unsigned int charIndex) :
+            m_Values(values), m_IsDefault(isDefault), IASTNode(charIndex, ASTNodeType::SwitchCase) {}
+
+        const std::vector<int>& GetValues() const
+        {
+            return m_Values;
+        }
+
+        bool IsDefault() const
+        {
+            return m_IsDefault;
+        }
+
+        const std::shared_ptr<IASTNode>& GetBody() const
+        {
+            return GetChild(0);
+        }
+
+        private:
+        std::vector<int> m_Values;
+        bool m_IsDefault = false;
+    };
+
     class ASTBlockStatement : public IASTNode
     {
         public:
@@ -398,6 +469,27 @@ namespace LangUMS
         }
     };
 
+    class ASTSpawnTaskStatement : public IASTNode
+    {
+        public:
+        ASTSpawnTaskStatement(const std::string& functionName, unsigned int charIndex) :
+            m_FunctionName(functionName), IASTNode(charIndex, ASTNodeType::SpawnTaskStatement) {}
+
+        const std::string& GetFunctionName() const
+        {
+            return m_FunctionName;
+        }
+
+        private:
+        std::string m_FunctionName;
+    };
+
+    class ASTYieldStatement : public IASTNode
+    {
+        public:
+        ASTYieldStatement(unsigned int charIndex) : IASTNode(charIndex, ASTNodeType::YieldStatement) {}
+    };
+
     class ASTFunctionDeclaration : public IASTNode
     {
         public:
@@ -466,8 +558,8 @@ namespace LangUMS
     class ASTVariableDeclaration : public IASTNode
     {
         public:
-        ASTVariableDeclaration(const std::string& name, unsigned int arraySize, unsigned int charIndex) :
-            m_Name(name), m_ArraySize(arraySize), IASTNode(charIndex, ASTNodeType::VariableDeclaration) {}
+        ASTVariableDeclaration(const std::string& name, unsigned int arraySize, bool isArray, unsigned int charIndex) :
+            m_Name(name), m_ArraySize(arraySize), m_IsArray(isArray), IASTNode(charIndex, ASTNodeType::VariableDeclaration) {}
 
         const std::string& GetName() const
         {
@@ -484,9 +576,37 @@ namespace LangUMS
             return m_ArraySize;
         }
 
+        // foo[1] is an array of one element while foo is not an array at all
+        bool IsArray() const
+        {
+            return m_IsArray;
+        }
+
         private:
         std::string m_Name;
         unsigned int m_ArraySize;
+        bool m_IsArray;
+    };
+
+    class ASTConstDeclaration : public IASTNode
+    {
+        public:
+        ASTConstDeclaration(const std::string& name, const std::vector<int>& values, unsigned int charIndex) :
+            m_Name(name), m_Values(values), IASTNode(charIndex, ASTNodeType::ConstDeclaration) {}
+
+        const std::string& GetName() const
+        {
+            return m_Name;
+        }
+
+        const std::vector<int>& GetValues() const
+        {
+            return m_Values;
+        }
+
+        private:
+        std::string m_Name;
+        std::vector<int> m_Values;
     };
 
     class ASTEventCondition : public IASTNode
@@ -535,6 +655,62 @@ namespace LangUMS
         }
     };
 
+    class ASTTriggersBlock : public IASTNode
+    {
+        public:
+        ASTTriggersBlock(unsigned int charIndex) : IASTNode(charIndex, ASTNodeType::TriggersBlock) {}
+    };
+
+    class ASTRawTrigger : public IASTNode
+    {
+        public:
+        ASTRawTrigger(unsigned int conditionsCount, unsigned int charIndex) :
+            m_ConditionsCount(conditionsCount), IASTNode(charIndex, ASTNodeType::RawTrigger) {}
+
+        unsigned int GetConditionsCount() const
+        {
+            return m_ConditionsCount;
+        }
+
+        unsigned int GetActionsCount() const
+        {
+            return (unsigned int)GetChildCount() - m_ConditionsCount;
+        }
+
+        const std::shared_ptr<IASTNode>& GetCondition(int index) const
+        {
+            return GetChild(index);
+        }
+
+        const std::shared_ptr<IASTNode>& GetAction(int index) const
+        {
+            return GetChild(m_ConditionsCount + index);
+        }
+
+        private:
+        unsigned int m_ConditionsCount = 0;
+    };
+
+    class ASTRawTriggerAction : public IASTNode
+    {
+        public:
+        ASTRawTriggerAction(const std::string& name, unsigned int charIndex) :
+            m_Name(name), IASTNode(charIndex, ASTNodeType::RawTriggerAction) {}
+
+        const std::string& GetName() const
+        {
+            return m_Name;
+        }
+
+        const std::shared_ptr<IASTNode>& GetArgument(int index) const
+        {
+            return GetChild(index);
+        }
+
+        private:
+        std::string m_Name;
+    };
+
     class ASTRepeatTemplate : public IASTNode
     {
         public:
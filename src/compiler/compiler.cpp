@@ -1,5 +1,6 @@
 #include <cctype>
 #include <algorithm>
+#include <map>
 
 #include "../log.h"
 #include "compiler.h"
@@ -46,6 +47,9 @@ namespace LangUMS
         m_Triggers.clear();
         m_Triggers.reserve(MAX_TRIGGERS_COUNT);
         m_JmpPatchups.clear();
+        m_OwnerChanges.clear();
+        m_CurrentOwner = m_TriggersOwner;
+        m_NextRegionOwner = 0;
 
         m_File = &chk;
         m_StringsChunk = chk.GetFirstChunk<STRChunk>(ChunkType::STR);
@@ -71,6 +75,12 @@ namespace LangUMS
         auto nextCuwpSlot = 0;
 
         m_StackPointer = g_RegisterMap.size() - 1;
+        m_LowestStackPointer = m_StackPointer;
+
+        m_CurrentCounterRegId = Reg_InstructionCounter;
+        m_CopyStorageRegId = Reg_CopyStorage;
+        m_MulLeftRegId = Reg_MulLeft;
+        m_MulRightRegId = Reg_MulRight;
 
         for (auto i = 0u; i < instructions.size(); i++)
         {
@@ -197,7 +207,7 @@ namespace LangUMS
                     throw CompilerException("Malformed input. Event with zero conditions", evnt);
                 }
 
-                TriggerBuilder eventTrigger(-1, nullptr, m_TriggersOwner);
+                TriggerBuilder eventTrigger(-1, nullptr, m_TriggersOwner, m_CurrentCounterRegId);
                 eventTrigger.Cond_TestSwitch(Switch_EventsMutex, false);
 
                 auto switchId = evnt->GetSwitchId();
@@ -207,164 +217,10 @@ namespace LangUMS
                 {
                     i++;
 
-                    auto& condition = instructions[i];
-                    if (condition->GetType() == IRInstructionType::RegCond)
-                    {
-                        auto reg = (IRRegCondInstruction*)condition.get();
-
-                        TriggerComparisonType comparison;
-                        switch (reg->GetComparison())
-                        {
-                        case ConditionComparison::Exactly:
-                            comparison = TriggerComparisonType::Exactly;
-                            break;
-                        case ConditionComparison::AtLeast:
-                            comparison = TriggerComparisonType::AtLeast;
-                            break;
-                        case ConditionComparison::AtMost:
-                            comparison = TriggerComparisonType::AtMost;
-                            break;
-                        }
-
-                        eventTrigger.Cond_TestReg(reg->GetRegisterId(), reg->GetQuantity(), comparison);
-                    }
-                    else if (condition->GetType() == IRInstructionType::BringCond)
-                    {
-                        auto bring = (IRBringCondInstruction*)condition.get();
-                        auto locationId = GetLocationIdByName(bring->GetLocationName(), instruction.get());
-
-                        eventTrigger.SetOwner(bring->GetPlayerId() + 1);
-
-                        eventTrigger.Cond_Bring(
-                            bring->GetPlayerId(),
-                            (TriggerComparisonType)bring->GetComparison(),
-                            bring->GetUnitId(),
-                            locationId,
-                            bring->GetQuantity()
-                        );
-                    }
-                    else if (condition->GetType() == IRInstructionType::AccumCond)
-                    {
-                        auto accum = (IRAccumCondInstruction*)condition.get();
-
-                        eventTrigger.SetOwner(accum->GetPlayerId() + 1);
-
-                        eventTrigger.Cond_Accumulate(
-                            accum->GetPlayerId(),
-                            (TriggerComparisonType)accum->GetComparison(),
-                            accum->GetResourceType(),
-                            accum->GetQuantity()
-                        );
-                    }
-                    else if (condition->GetType() == IRInstructionType::LeastResCond)
-                    {
-                        auto leastRes = (IRLeastResCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(leastRes->GetPlayerId() + 1);
-                        eventTrigger.Cond_LeastResources(leastRes->GetPlayerId(), leastRes->GetResourceType());
-                    }
-                    else if (condition->GetType() == IRInstructionType::MostResCond)
-                    {
-                        auto mostRes = (IRMostResCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(mostRes->GetPlayerId() + 1);
-                        eventTrigger.Cond_MostResources(mostRes->GetPlayerId(), mostRes->GetResourceType());
-                    }
-                    else if (condition->GetType() == IRInstructionType::ScoreCond)
-                    {
-                        auto score = (IRScoreCondInstruction*)condition.get();
-
-                        eventTrigger.Cond_Score(
-                            score->GetPlayerId(),
-                            (TriggerComparisonType)score->GetComparison(),
-                            score->GetScoreType(),
-                            score->GetQuantity()
-                        );
-                    }
-                    else if (condition->GetType() == IRInstructionType::LowScoreCond)
-                    {
-                        auto lowScore = (IRLowScoreCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(lowScore->GetPlayerId() + 1);
-                        eventTrigger.Cond_LowestScore(lowScore->GetPlayerId(), lowScore->GetScoreType());
-                    }
-                    else if (condition->GetType() == IRInstructionType::HiScoreCond)
-                    {
-                        auto highScore = (IRHiScoreCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(highScore->GetPlayerId() + 1);
-                        eventTrigger.Cond_LowestScore(highScore->GetPlayerId(), highScore->GetScoreType());
-                    }
-                    else if (condition->GetType() == IRInstructionType::TimeCond)
-                    {
-                        auto time = (IRTimeCondInstruction*)condition.get();
-
-                        eventTrigger.Cond_ElapsedTime((TriggerComparisonType)time->GetComparison(), time->GetQuantity());
-                    }
-                    else if (condition->GetType() == IRInstructionType::CmdCond)
-                    {
-                        auto cmd = (IRCmdCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(cmd->GetPlayerId() + 1);
-                        eventTrigger.Cond_Commands(cmd->GetPlayerId(), (TriggerComparisonType)cmd->GetComparison(), cmd->GetUnitId(), cmd->GetQuantity());
-                    }
-                    else if (condition->GetType() == IRInstructionType::CmdLeastCond)
-                    {
-                        auto cmdLeast = (IRCmdLeastCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(cmdLeast->GetPlayerId() + 1);
-
-                        auto locationId = -1;
-                        auto& locationName = cmdLeast->GetLocationName();
-
-                        if (locationName.length() > 0)
-                        {
-                            locationId = GetLocationIdByName(locationName, instruction.get());
-                        }
-
-                        eventTrigger.Cond_CommandsLeast(cmdLeast->GetPlayerId(), cmdLeast->GetUnitId(), locationId);
-                    }
-                    else if (condition->GetType() == IRInstructionType::CmdMostCond)
-                    {
-                        auto cmdMost = (IRCmdMostCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(cmdMost->GetPlayerId() + 1);
-
-                        auto locationId = -1;
-                        auto& locationName = cmdMost->GetLocationName();
-
-                        if (locationName.length() > 0)
-                        {
-                            locationId = GetLocationIdByName(locationName, instruction.get());
-                        }
-
-                        eventTrigger.Cond_CommandsMost(cmdMost->GetPlayerId(), cmdMost->GetUnitId(), locationId);
-                    }
-                    else if (condition->GetType() == IRInstructionType::KillCond)
+                    auto owner = CodeGen_Condition(eventTrigger, instructions[i].get(), instruction.get());
+                    if (owner != -1)
                     {
-                        auto kill = (IRKillCondInstruction*)condition.get();
-                        eventTrigger.Cond_Kills(kill->GetPlayerId(), (TriggerComparisonType)kill->GetComparison(), kill->GetUnitId(), kill->GetQuantity());
-                    }
-                    else if (condition->GetType() == IRInstructionType::KillLeastCond)
-                    {
-                        auto killLeast = (IRKillLeastCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(killLeast->GetPlayerId() + 1);
-                        eventTrigger.Cond_KillsLeast(killLeast->GetPlayerId(), killLeast->GetUnitId());
-                    }
-                    else if (condition->GetType() == IRInstructionType::KillMostCond)
-                    {
-                        auto killMost = (IRKillMostCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(killMost->GetPlayerId() + 1);
-                        eventTrigger.Cond_KillsMost(killMost->GetPlayerId(), killMost->GetUnitId());
-                    }
-                    else if (condition->GetType() == IRInstructionType::DeathCond)
-                    {
-                        auto death = (IRDeathCondInstruction*)condition.get();
-                        eventTrigger.Cond_Deaths(death->GetPlayerId(), (TriggerComparisonType)death->GetComparison(), death->GetUnitId(), death->GetQuantity());
-                    }
-                    else if (condition->GetType() == IRInstructionType::CountdownCond)
-                    {
-                        auto countdown = (IRCountdownCondInstruction*)condition.get();
-                        eventTrigger.Cond_Countdown((TriggerComparisonType)countdown->GetComparison(), countdown->GetTime());
-                    }
-                    else if (condition->GetType() == IRInstructionType::OpponentsCond)
-                    {
-                        auto opponents = (IROpponentsCondInstruction*)condition.get();
-                        eventTrigger.SetOwner(opponents->GetPlayerId() + 1);
-                        eventTrigger.Cond_Opponents(opponents->GetPlayerId(), (TriggerComparisonType)opponents->GetComparison(), opponents->GetQuantity());
+                        eventTrigger.SetOwner(owner);
                     }
                 }
 
@@ -372,7 +228,32 @@ namespace LangUMS
             }
         }
 
+        // sleeping code waits for its timer to run out, every timer counts down once per trigger cycle
+        std::set<unsigned int> sleepTimers;
+        for (auto& instruction : instructions)
+        {
+            if (instruction->GetType() == IRInstructionType::Sleep)
+            {
+                sleepTimers.insert(((IRSleepInstruction*)instruction.get())->GetTimerRegisterId());
+            }
+        }
+
+        for (auto timerRegId : sleepTimers)
+        {
+            TriggerBuilder tick(-1, nullptr, m_TriggersOwner, m_CurrentCounterRegId);
+            tick.Cond_TestReg(timerRegId, 1, TriggerComparisonType::AtLeast);
+            tick.Action_DecReg(timerRegId, 1);
+            PushTriggers(tick.GetTriggers());
+        }
+
         m_JumpTargets.clear();
+        m_CallSites.clear();
+        m_ReturnAddresses.clear();
+        m_TaskAddresses.clear();
+        m_YieldAddresses.clear();
+
+        // event handler entry index -> register the handler returns through
+        std::map<unsigned int, unsigned int> eventHandlers;
 
         for (auto i = 0u; i < instructions.size(); i++)
         {
@@ -426,6 +307,30 @@ namespace LangUMS
                 auto jmp = (IRJmpIfSwSetInstruction*)instruction.get();
                 targetIndex = jmp->IsAbsolute() ? jmp->GetOffset() : (int)i + jmp->GetOffset();
             }
+            else if (type == IRInstructionType::JmpTable)
+            {
+                auto jmpTable = (IRJmpTableInstruction*)instruction.get();
+                for (auto& entry : jmpTable->GetEntries())
+                {
+                    auto entryIndex = std::min((int)i + entry.m_Offset, (int)instructions.size() - 1);
+                    m_JumpTargets.insert(instructions[entryIndex].get());
+                }
+
+                targetIndex = (int)i + jmpTable->GetDefaultOffset();
+            }
+            else if (type == IRInstructionType::Call)
+            {
+                auto call = (IRCallInstruction*)instruction.get();
+                targetIndex = std::min((int)call->GetTarget(), (int)instructions.size() - 1);
+                m_CallSites[instructions[targetIndex].get()].push_back(instruction.get());
+
+                // calls guarded by an event switch go to the handlers shared by every poll_events()
+                if (i > 0 && instructions[i - 1]->GetType() == IRInstructionType::JmpIfSwNotSet &&
+                    ((IRJmpIfSwNotSetInstruction*)instructions[i - 1].get())->GetSwitchId() >= Switch_ReservedEnd)
+                {
+                    eventHandlers[targetIndex] = call->GetReturnRegisterId();
+                }
+            }
 
             if (targetIndex >= 0)
             {
@@ -439,19 +344,68 @@ namespace LangUMS
             }
         }
 
+        // each handler runs on the main instruction counter from its entry up to its return,
+        // when it moves to another player the code after it goes back to the triggers owner
+        if (!m_RegionOwners.empty())
+        {
+            for (auto& handler : eventHandlers)
+            {
+                m_OwnerChanges[instructions[handler.first].get()] = GetNextRegionOwner();
+            }
+
+            for (auto& handler : eventHandlers)
+            {
+                for (auto i = handler.first; i < instructions.size(); i++)
+                {
+                    if (instructions[i]->GetType() != IRInstructionType::Ret ||
+                        ((IRRetInstruction*)instructions[i].get())->GetReturnRegisterId() != handler.second)
+                    {
+                        continue;
+                    }
+
+                    if (i + 1 < instructions.size() && m_OwnerChanges.find(instructions[i + 1].get()) == m_OwnerChanges.end())
+                    {
+                        m_OwnerChanges[instructions[i + 1].get()] = m_TriggersOwner;
+                    }
+
+                    break;
+                }
+            }
+        }
+
         auto nextAddress = 0u;
 
         bool hasMulInstructions = false;
+        bool hasMinMaxInstructions = false;
+        bool hasISqrtInstructions = false;
+        IRPowInstruction* powInstruction = nullptr;
+
         for (auto& instruction : instructions)
         {
             if (instruction->GetType() == IRInstructionType::Mul)
             {
                 hasMulInstructions = true;
-                break;
+            }
+            else if (instruction->GetType() == IRInstructionType::Math)
+            {
+                if (((IRMathInstruction*)instruction.get())->GetFunction() == MathFunction::ISqrt)
+                {
+                    hasISqrtInstructions = true;
+                }
+                else
+                {
+                    hasMinMaxInstructions = true;
+                }
+            }
+            else if (instruction->GetType() == IRInstructionType::Pow)
+            {
+                // pow() multiplies through the shared multiply routine
+                powInstruction = (IRPowInstruction*)instruction.get();
+                hasMulInstructions = true;
             }
         }
 
-        auto current = TriggerBuilder(nextAddress++, instructions[0].get(), m_TriggersOwner);
+        auto current = TriggerBuilder(nextAddress++, instructions[0].get(), m_CurrentOwner, m_CurrentCounterRegId);
         if (m_Debug)
         {
             auto address = nextAddress++;
@@ -461,33 +415,109 @@ namespace LangUMS
             current.Action_JumpTo(address);
             PushTriggers(current.GetTriggers());
 
-            current = TriggerBuilder(address, instructions[0].get(), m_TriggersOwner);
+            current = TriggerBuilder(address, instructions[0].get(), m_CurrentOwner, m_CurrentCounterRegId);
             current.Cond_Deaths(0, TriggerComparisonType::Exactly, 0, 0);
             current.Action_JumpTo(address2);
             PushTriggers(current.GetTriggers());
 
-            current = TriggerBuilder(address2, instructions[0].get(), m_TriggersOwner);
+            current = TriggerBuilder(address2, instructions[0].get(), m_CurrentOwner, m_CurrentCounterRegId);
+        }
+
+        // the return sites are allocated up front because subroutines come before their callers
+        for (auto& callSites : m_CallSites)
+        {
+            for (auto call : callSites.second)
+            {
+                m_ReturnAddresses[call] = nextAddress++;
+            }
+        }
+
+        // tasks are started by code that comes before them so their entries are allocated up front as well
+        for (auto& instruction : instructions)
+        {
+            if (instruction->GetType() == IRInstructionType::Task)
+            {
+                m_TaskAddresses[instruction.get()] = nextAddress++;
+            }
         }
 
         bool needsIndirectJumps = false;
 
         if (hasMulInstructions)
         {
+            // the multiply routine and the indirect jump back to its caller share one player's triggers
+            m_CurrentOwner = GetNextRegionOwner();
             EmitMulInstructionCode(nextAddress);
             needsIndirectJumps = true;
         }
 
+        if (hasMinMaxInstructions)
+        {
+            m_CurrentOwner = GetNextRegionOwner();
+            EmitMinMaxInstructionCode(nextAddress);
+            needsIndirectJumps = true;
+        }
+
+        if (hasISqrtInstructions)
+        {
+            m_CurrentOwner = GetNextRegionOwner();
+            EmitISqrtInstructionCode(nextAddress);
+            needsIndirectJumps = true;
+        }
+
+        if (powInstruction != nullptr)
+        {
+            m_CurrentOwner = GetNextRegionOwner();
+            EmitPowInstructionCode(powInstruction, nextAddress);
+            needsIndirectJumps = true;
+        }
+
         if (needsIndirectJumps)
         {
             EmitIndirectJumpCode(nextAddress);
         }
 
+        m_CurrentOwner = m_TriggersOwner;
+
+        EmitYieldTriggers(instructions, 0, nextAddress);
+
         for (auto i = 0u; i < instructions.size(); i++)
         {
             auto& instruction = instructions[i];
+            m_LowestStackPointer = std::min(m_LowestStackPointer, m_StackPointer);
+
+            if (instruction->GetType() == IRInstructionType::Task)
+            {
+                // the code up to the next task runs on the task's own instruction counter and gets its own stack
+                // and scratch registers below everything used so far, so tasks can be interrupted anywhere
+                if (current.HasChanges())
+                {
+                    PushTriggers(current.GetTriggers());
+                }
+
+                auto task = (IRTaskInstruction*)instruction.get();
+                m_CurrentCounterRegId = task->GetCounterRegisterId();
+
+                m_CopyStorageRegId = m_LowestStackPointer - 1;
+                m_MulLeftRegId = m_LowestStackPointer - 2;
+                m_MulRightRegId = m_LowestStackPointer - 3;
+                m_StackPointer = m_LowestStackPointer - 4;
+                m_LowestStackPointer = m_StackPointer;
+
+                m_CurrentOwner = GetNextRegionOwner();
+                EmitYieldTriggers(instructions, i + 1, nextAddress);
+
+                auto address = m_TaskAddresses[instruction.get()];
+                m_JumpAddresses[instruction.get()] = address;
+                current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                continue;
+            }
 
             if (m_JumpTargets.find(instruction.get()) != m_JumpTargets.end())
             {
+                auto ownerChange = m_OwnerChanges.find(instruction.get());
+                auto owner = ownerChange != m_OwnerChanges.end() ? ownerChange->second : m_CurrentOwner;
+
                 if (current.HasChanges())
                 {
                     auto address = nextAddress++;
@@ -495,11 +525,18 @@ namespace LangUMS
 
                     current.Action_JumpTo(address);
                     PushTriggers(current.GetTriggers());
-                    current = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    m_CurrentOwner = owner;
+                    current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
                 else
                 {
                     m_JumpAddresses[instruction.get()] = current.GetAddress();
+
+                    if (owner != m_CurrentOwner)
+                    {
+                        m_CurrentOwner = owner;
+                        current = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    }
                 }
             }
 
@@ -508,7 +545,7 @@ namespace LangUMS
                 auto address = nextAddress++;
                 current.Action_JumpTo(address);
                 PushTriggers(current.GetTriggers());
-                current = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
             }
 
             if (instruction->GetType() == IRInstructionType::Push)
@@ -528,11 +565,23 @@ namespace LangUMS
                     auto stackTop = m_StackPointer--;
                     auto copyAddress = CodeGen_CopyReg(stackTop, push->GetRegisterId(), nextAddress, retAddress, instruction.get());
 
-                    // clear storage and jump to step 1
-                    current.Action_SetReg(Reg_CopyStorage, 0);
-                    current.Action_JumpTo(copyAddress);
-                    PushTriggers(current.GetTriggers());
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    if (m_CostModel.ShouldUseTableCopy())
+                    {
+                        // jump to the lookup table which falls back to step 1 for large values
+                        auto tableAddress = nextAddress++;
+                        current.Action_JumpTo(tableAddress);
+                        PushTriggers(current.GetTriggers());
+                        CodeGen_TableCopyReg(stackTop, push->GetRegisterId(), tableAddress, copyAddress, retAddress, instruction.get());
+                    }
+                    else
+                    {
+                        // clear storage and jump to step 1
+                        current.Action_SetReg(m_CopyStorageRegId, 0);
+                        current.Action_JumpTo(copyAddress);
+                        PushTriggers(current.GetTriggers());
+                    }
+
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::Pop)
@@ -556,14 +605,14 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto copy = TriggerBuilder(copyAddress, instruction.get(), m_TriggersOwner);
+                        auto copy = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         copy.Cond_TestReg(stackTop, i, TriggerComparisonType::AtLeast);
                         copy.Action_DecReg(stackTop, i);
                         copy.Action_IncReg(regId, i);
                         PushTriggers(copy.GetTriggers());
                     }
 
-                    current = TriggerBuilder(copyAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     current.Cond_TestReg(stackTop, 0, TriggerComparisonType::Exactly);
                 }
             }
@@ -626,119 +675,534 @@ namespace LangUMS
 
                 auto copyAddress = CodeGen_CopyReg(dstId, srcId, nextAddress, retAddress, instruction.get());
 
-                // clear storage and jump to step 1
-                current.Action_SetReg(Reg_CopyStorage, 0);
-                current.Action_JumpTo(copyAddress);
+                if (m_CostModel.ShouldUseTableCopy())
+                {
+                    // jump to the lookup table which falls back to step 1 for large values
+                    auto tableAddress = nextAddress++;
+                    current.Action_JumpTo(tableAddress);
 
-                PushTriggers(current.GetTriggers());
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    PushTriggers(current.GetTriggers());
+                    CodeGen_TableCopyReg(dstId, srcId, tableAddress, copyAddress, retAddress, instruction.get());
+                }
+                else
+                {
+                    // clear storage and jump to step 1
+                    current.Action_SetReg(m_CopyStorageRegId, 0);
+                    current.Action_JumpTo(copyAddress);
+
+                    PushTriggers(current.GetTriggers());
+                }
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
             }
-            else if (instruction->GetType() == IRInstructionType::Add)
+            else if (instruction->GetType() == IRInstructionType::FusedCopy)
             {
                 current.AssociateInstruction(instruction.get());
-                auto addAddress = nextAddress++;
-                current.Action_JumpTo(addAddress);
+                auto fusedCopy = (IRFusedCopyInstruction*)instruction.get();
+                auto& entries = fusedCopy->GetEntries();
 
-                PushTriggers(current.GetTriggers());
-                auto retAddress = nextAddress++;
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                if (entries.size() > MAX_FUSED_COPIES)
+                {
+                    throw CompilerException(SafePrintf("Malformed IR. Fused copy with more than % entries", MAX_FUSED_COPIES), instruction.get());
+                }
 
-                auto left = ++m_StackPointer;
-                auto right = m_StackPointer + 1;
+                std::vector<unsigned int> dstRegIds;
+                for (auto& entry : entries)
+                {
+                    dstRegIds.push_back(entry.m_IsPush ? m_StackPointer-- : entry.m_DstRegId);
+                }
 
-                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                // every copy needs its own storage, the free slots below the stack top are used past the first one
+                std::vector<unsigned int> storage;
+                for (auto q = 0u; q < entries.size(); q++)
                 {
-                    auto add = TriggerBuilder(addAddress, instruction.get(), m_TriggersOwner);
-                    add.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
-                    add.Action_DecReg(left, i);
-                    add.Action_IncReg(right, i);
-                    PushTriggers(add.GetTriggers());
+                    storage.push_back(q == 0 ? m_CopyStorageRegId : m_StackPointer - (q - 1));
                 }
 
-                auto finishAdd = TriggerBuilder(addAddress, instruction.get(), m_TriggersOwner);
-                finishAdd.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
-                finishAdd.Action_JumpTo(retAddress);
-                PushTriggers(finishAdd.GetTriggers());
-            }
-            else if (instruction->GetType() == IRInstructionType::Sub)
-            {
-                current.AssociateInstruction(instruction.get());
-                auto subAddress = nextAddress++;
-                current.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::ClearSwitch);
-                current.Action_JumpTo(subAddress);
+                m_LowestStackPointer = std::min(m_LowestStackPointer, storage.back());
 
-                PushTriggers(current.GetTriggers());
-                auto retAddress = nextAddress++;
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                if (current.GetActionCount() + storage.size() >= 62)
+                {
+                    auto address = nextAddress++;
+                    current.Action_JumpTo(address);
+                    PushTriggers(current.GetTriggers());
+                    current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                }
 
-                auto left = ++m_StackPointer;
-                auto right = m_StackPointer + 1;
+                auto retAddress = nextAddress++;
+                auto copyAddress = CodeGen_FusedCopy(entries, dstRegIds, storage, nextAddress, retAddress, instruction.get());
 
-                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                // clear storage and jump to step 1
+                for (auto regId : storage)
                 {
-                    auto sub = TriggerBuilder(subAddress, instruction.get(), m_TriggersOwner);
-                    sub.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
-                    sub.Cond_TestReg(right, i, TriggerComparisonType::AtLeast);
-                    sub.Action_DecReg(left, i);
-                    sub.Action_DecReg(right, i);
-                    PushTriggers(sub.GetTriggers());
+                    current.Action_SetReg(regId, 0);
                 }
 
-                auto finishSub = TriggerBuilder(subAddress, instruction.get(), m_TriggersOwner);
-                finishSub.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
-                finishSub.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::ClearSwitch);
-                finishSub.Action_JumpTo(retAddress);
-                PushTriggers(finishSub.GetTriggers());
+                current.Action_JumpTo(copyAddress);
 
-                finishSub = TriggerBuilder(subAddress, instruction.get(), m_TriggersOwner);
-                finishSub.Cond_TestReg(left, 1, TriggerComparisonType::AtLeast);
-                finishSub.Cond_TestReg(right, 0, TriggerComparisonType::Exactly);
-                finishSub.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::SetSwitch);
-                finishSub.Action_JumpTo(retAddress);
-                PushTriggers(finishSub.GetTriggers());
+                PushTriggers(current.GetTriggers());
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
             }
-            else if (instruction->GetType() == IRInstructionType::Mul)
+            else if (instruction->GetType() == IRInstructionType::Fill)
             {
                 current.AssociateInstruction(instruction.get());
-                auto left = ++m_StackPointer;
-                auto right = m_StackPointer + 1;
-
-                auto mulAddress = ++nextAddress;
-                auto mul2Address = ++nextAddress;
-                auto mul3Address = ++nextAddress;
+                auto fill = (IRFillInstruction*)instruction.get();
+                auto srcRegId = fill->GetSourceRegisterId();
+                auto& dstRegIds = fill->GetDestinationRegisterIds();
 
-                current.Action_SetReg(Reg_MulLeft, 0);
-                current.Action_SetReg(Reg_MulRight, 0);
-                current.Action_JumpTo(mulAddress);
-                PushTriggers(current.GetTriggers());
+                if (dstRegIds.size() > MAX_FILL_REGISTERS)
+                {
+                    throw CompilerException(SafePrintf("Malformed IR. Fill with more than % destinations", MAX_FILL_REGISTERS), instruction.get());
+                }
 
+                auto copyAddress = nextAddress++;
+                auto copy2Address = nextAddress++;
                 auto retAddress = nextAddress++;
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
 
+                // clear storage and jump to step 1
+                current.Action_SetReg(m_CopyStorageRegId, 0);
+                current.Action_JumpTo(copyAddress);
+                PushTriggers(current.GetTriggers());
+
+                // step 1 - move the source to storage
                 for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                 {
-                    auto moveLeft = TriggerBuilder(mulAddress, instruction.get(), m_TriggersOwner);
-                    moveLeft.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
-                    moveLeft.Action_DecReg(left, i);
-                    moveLeft.Action_IncReg(Reg_MulLeft, i);
-                    PushTriggers(moveLeft.GetTriggers());
+                    auto copyToStorageTrigger = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    copyToStorageTrigger.Cond_TestReg(srcRegId, i, TriggerComparisonType::AtLeast);
+                    copyToStorageTrigger.Action_DecReg(srcRegId, i);
+                    copyToStorageTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                    PushTriggers(copyToStorageTrigger.GetTriggers());
                 }
 
-                auto moveLeftFinish = TriggerBuilder(mulAddress, instruction.get(), m_TriggersOwner);
-                moveLeftFinish.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
-                moveLeftFinish.Action_JumpTo(mul2Address);
-                PushTriggers(moveLeftFinish.GetTriggers());
-
-                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                // step 1 (finish) - clear the destinations and jump to step 2
+                auto finishCopyTrigger = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finishCopyTrigger.Cond_TestReg(srcRegId, 0, TriggerComparisonType::Exactly);
+                for (auto dstRegId : dstRegIds)
                 {
-                    auto moveRight = TriggerBuilder(mul2Address, instruction.get(), m_TriggersOwner);
-                    moveRight.Cond_TestReg(right, i, TriggerComparisonType::AtLeast);
-                    moveRight.Action_DecReg(right, i);
-                    moveRight.Action_IncReg(Reg_MulRight, i);
-                    PushTriggers(moveRight.GetTriggers());
+                    finishCopyTrigger.Action_SetReg(dstRegId, 0);
                 }
 
-                auto moveRightFinish = TriggerBuilder(mul2Address, instruction.get(), m_TriggersOwner);
+                finishCopyTrigger.Action_JumpTo(copy2Address);
+                PushTriggers(finishCopyTrigger.GetTriggers());
+
+                // step 2 - a single loop restores the source and writes every destination at once
+                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                {
+                    auto copyFromStorageTrigger = TriggerBuilder(copy2Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    copyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, i, TriggerComparisonType::AtLeast);
+                    copyFromStorageTrigger.Action_DecReg(m_CopyStorageRegId, i);
+                    copyFromStorageTrigger.Action_IncReg(srcRegId, i);
+                    for (auto dstRegId : dstRegIds)
+                    {
+                        copyFromStorageTrigger.Action_IncReg(dstRegId, i);
+                    }
+
+                    PushTriggers(copyFromStorageTrigger.GetTriggers());
+                }
+
+                // step 2 (finish)
+                auto finishCopyFromStorageTrigger = TriggerBuilder(copy2Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finishCopyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, 0, TriggerComparisonType::Exactly);
+                finishCopyFromStorageTrigger.Action_JumpTo(retAddress);
+                PushTriggers(finishCopyFromStorageTrigger.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Sum)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto sum = (IRSumInstruction*)instruction.get();
+                auto& regIds = sum->GetRegisterIds();
+
+                if (regIds.size() > MAX_FUSED_COPIES)
+                {
+                    throw CompilerException(SafePrintf("Malformed IR. Sum with more than % registers", MAX_FUSED_COPIES), instruction.get());
+                }
+
+                auto stackTop = m_StackPointer--;
+
+                // every element needs its own storage, the free slots below the stack top are used past the first one
+                std::vector<unsigned int> storage;
+                for (auto q = 0u; q < regIds.size(); q++)
+                {
+                    storage.push_back(q == 0 ? m_CopyStorageRegId : m_StackPointer - (q - 1));
+                }
+
+                m_LowestStackPointer = std::min(m_LowestStackPointer, storage.back());
+
+                if (current.GetActionCount() + storage.size() + 1 >= 62)
+                {
+                    auto address = nextAddress++;
+                    current.Action_JumpTo(address);
+                    PushTriggers(current.GetTriggers());
+                    current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                }
+
+                auto sumAddress = nextAddress++;
+                auto restoreAddress = nextAddress++;
+                auto retAddress = nextAddress++;
+
+                // clear the result and storage and jump to step 1
+                current.Action_SetReg(stackTop, 0);
+                for (auto regId : storage)
+                {
+                    current.Action_SetReg(regId, 0);
+                }
+
+                current.Action_JumpTo(sumAddress);
+                PushTriggers(current.GetTriggers());
+
+                // step 1 - drain every element into the result and its storage, all loops drain in the same scan
+                for (auto q = 0u; q < regIds.size(); q++)
+                {
+                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    {
+                        auto sumTrigger = TriggerBuilder(sumAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        sumTrigger.Cond_TestReg(regIds[q], i, TriggerComparisonType::AtLeast);
+                        sumTrigger.Action_DecReg(regIds[q], i);
+                        sumTrigger.Action_IncReg(stackTop, i);
+                        sumTrigger.Action_IncReg(storage[q], i);
+                        PushTriggers(sumTrigger.GetTriggers());
+                    }
+                }
+
+                // step 1 (finish)
+                auto finishSumTrigger = TriggerBuilder(sumAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                for (auto regId : regIds)
+                {
+                    finishSumTrigger.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
+                }
+
+                finishSumTrigger.Action_JumpTo(restoreAddress);
+                PushTriggers(finishSumTrigger.GetTriggers());
+
+                // step 2 - give the elements back their values
+                for (auto q = 0u; q < regIds.size(); q++)
+                {
+                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    {
+                        auto restoreTrigger = TriggerBuilder(restoreAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        restoreTrigger.Cond_TestReg(storage[q], i, TriggerComparisonType::AtLeast);
+                        restoreTrigger.Action_DecReg(storage[q], i);
+                        restoreTrigger.Action_IncReg(regIds[q], i);
+                        PushTriggers(restoreTrigger.GetTriggers());
+                    }
+                }
+
+                // step 2 (finish)
+                auto finishRestoreTrigger = TriggerBuilder(restoreAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                for (auto regId : storage)
+                {
+                    finishRestoreTrigger.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
+                }
+
+                finishRestoreTrigger.Action_JumpTo(retAddress);
+                PushTriggers(finishRestoreTrigger.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Triggers)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto triggers = (IRTriggersInstruction*)instruction.get();
+
+                // the block gets an address of its own so its triggers run in order every cycle until one exits
+                auto address = nextAddress++;
+                auto retAddress = nextAddress++;
+
+                current.Action_JumpTo(address);
+                PushTriggers(current.GetTriggers());
+
+                for (auto& rawTrigger : triggers->GetTriggers())
+                {
+                    auto trigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                    // the player a condition would move an event trigger to is ignored, the block stays with its code
+                    // and IRCompiler::EmitTriggersBlock() rejects the conditions which depend on the player running them
+                    for (auto& condition : rawTrigger.m_Conditions)
+                    {
+                        CodeGen_Condition(trigger, condition.get(), instruction.get());
+                    }
+
+                    for (auto& action : rawTrigger.m_Actions)
+                    {
+                        CodeGen_RawTriggerAction(trigger, action.get());
+                    }
+
+                    if (rawTrigger.m_Exits)
+                    {
+                        trigger.Action_JumpTo(retAddress);
+                    }
+
+                    PushTriggers(trigger.GetTriggers());
+                }
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::PushIndexed)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto push = (IRPushIndexedInstruction*)instruction.get();
+
+                auto retAddress = nextAddress++;
+
+                auto stackTop = m_StackPointer--;
+                auto copyAddress = CodeGen_IndexedCopy(stackTop, push->GetIndexRegisterId(), push->GetElementRegisterIds(), nextAddress, retAddress, instruction.get());
+
+                // clear storage and jump to step 1
+                current.Action_SetReg(m_CopyStorageRegId, 0);
+                current.Action_JumpTo(copyAddress);
+                PushTriggers(current.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::PopIndexed)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto pop = (IRPopIndexedInstruction*)instruction.get();
+                auto indexRegId = pop->GetIndexRegisterId();
+                auto& elementRegIds = pop->GetElementRegisterIds();
+
+                auto clearAddress = nextAddress++;
+                auto copyAddress = nextAddress++;
+                auto stackTop = ++m_StackPointer;
+
+                current.Action_JumpTo(clearAddress);
+                PushTriggers(current.GetTriggers());
+
+                // clear the selected element, an index past the end drops the value instead
+                for (auto k = 0u; k < elementRegIds.size(); k++)
+                {
+                    auto clear = TriggerBuilder(clearAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    clear.Cond_TestReg(indexRegId, k, TriggerComparisonType::Exactly);
+                    clear.Action_SetReg(elementRegIds[k], 0);
+                    clear.Action_JumpTo(copyAddress);
+                    PushTriggers(clear.GetTriggers());
+                }
+
+                auto outOfRange = TriggerBuilder(clearAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                outOfRange.Cond_TestReg(indexRegId, (int)elementRegIds.size(), TriggerComparisonType::AtLeast);
+                outOfRange.Action_SetReg(stackTop, 0);
+                outOfRange.Action_JumpTo(copyAddress);
+                PushTriggers(outOfRange.GetTriggers());
+
+                for (auto k = 0u; k < elementRegIds.size(); k++)
+                {
+                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    {
+                        auto copy = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        copy.Cond_TestReg(indexRegId, k, TriggerComparisonType::Exactly);
+                        copy.Cond_TestReg(stackTop, i, TriggerComparisonType::AtLeast);
+                        copy.Action_DecReg(stackTop, i);
+                        copy.Action_IncReg(elementRegIds[k], i);
+                        PushTriggers(copy.GetTriggers());
+                    }
+                }
+
+                current = TriggerBuilder(copyAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                current.Cond_TestReg(stackTop, 0, TriggerComparisonType::Exactly);
+            }
+            else if (instruction->GetType() == IRInstructionType::SetIndexed)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto setIndexed = (IRSetIndexedInstruction*)instruction.get();
+                auto indexRegId = setIndexed->GetIndexRegisterId();
+                auto& elementRegIds = setIndexed->GetElementRegisterIds();
+
+                auto setAddress = nextAddress++;
+                auto retAddress = nextAddress++;
+
+                current.Action_JumpTo(setAddress);
+                PushTriggers(current.GetTriggers());
+
+                for (auto k = 0u; k < elementRegIds.size(); k++)
+                {
+                    auto set = TriggerBuilder(setAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    set.Cond_TestReg(indexRegId, k, TriggerComparisonType::Exactly);
+                    set.Action_SetReg(elementRegIds[k], setIndexed->GetValue());
+                    set.Action_JumpTo(retAddress);
+                    PushTriggers(set.GetTriggers());
+                }
+
+                auto outOfRange = TriggerBuilder(setAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                outOfRange.Cond_TestReg(indexRegId, (int)elementRegIds.size(), TriggerComparisonType::AtLeast);
+                outOfRange.Action_JumpTo(retAddress);
+                PushTriggers(outOfRange.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::TableLoad)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto tableLoad = (IRTableLoadInstruction*)instruction.get();
+                auto indexRegId = tableLoad->GetIndexRegisterId();
+                auto& values = tableLoad->GetValues();
+
+                unsigned int dstRegId;
+                if (tableLoad->GetDestinationRegisterId() == -1)
+                {
+                    dstRegId = m_StackPointer--;
+                }
+                else
+                {
+                    dstRegId = tableLoad->GetDestinationRegisterId();
+                }
+
+                auto loadAddress = nextAddress++;
+                auto retAddress = nextAddress++;
+
+                current.Action_JumpTo(loadAddress);
+                PushTriggers(current.GetTriggers());
+
+                // one trigger per run of equal values, the first match moves the instruction counter
+                // so the whole lookup finishes in the same cycle
+                for (auto k = 0u; k < values.size();)
+                {
+                    auto last = k;
+                    while (last + 1 < values.size() && values[last + 1] == values[k])
+                    {
+                        last++;
+                    }
+
+                    auto load = TriggerBuilder(loadAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                    if (last == k)
+                    {
+                        load.Cond_TestReg(indexRegId, k, TriggerComparisonType::Exactly);
+                    }
+                    else
+                    {
+                        load.Cond_TestReg(indexRegId, k, TriggerComparisonType::AtLeast);
+                        load.Cond_TestReg(indexRegId, last, TriggerComparisonType::AtMost);
+                    }
+
+                    load.Action_SetReg(dstRegId, values[k]);
+                    load.Action_JumpTo(retAddress);
+                    PushTriggers(load.GetTriggers());
+                    k = last + 1;
+                }
+
+                // an index past the end of the table reads as 0
+                auto outOfRange = TriggerBuilder(loadAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                outOfRange.Cond_TestReg(indexRegId, (int)values.size(), TriggerComparisonType::AtLeast);
+                outOfRange.Action_SetReg(dstRegId, 0);
+                outOfRange.Action_JumpTo(retAddress);
+                PushTriggers(outOfRange.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Add)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto addAddress = nextAddress++;
+                current.Action_JumpTo(addAddress);
+
+                PushTriggers(current.GetTriggers());
+                auto retAddress = nextAddress++;
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                auto left = ++m_StackPointer;
+                auto right = m_StackPointer + 1;
+
+                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                {
+                    auto add = TriggerBuilder(addAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    add.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
+                    add.Action_DecReg(left, i);
+                    add.Action_IncReg(right, i);
+                    PushTriggers(add.GetTriggers());
+                }
+
+                auto finishAdd = TriggerBuilder(addAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finishAdd.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
+                finishAdd.Action_JumpTo(retAddress);
+                PushTriggers(finishAdd.GetTriggers());
+            }
+            else if (instruction->GetType() == IRInstructionType::Sub)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto subAddress = nextAddress++;
+                current.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::ClearSwitch);
+                current.Action_JumpTo(subAddress);
+
+                PushTriggers(current.GetTriggers());
+                auto retAddress = nextAddress++;
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                auto left = ++m_StackPointer;
+                auto right = m_StackPointer + 1;
+
+                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                {
+                    auto sub = TriggerBuilder(subAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    sub.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
+                    sub.Cond_TestReg(right, i, TriggerComparisonType::AtLeast);
+                    sub.Action_DecReg(left, i);
+                    sub.Action_DecReg(right, i);
+                    PushTriggers(sub.GetTriggers());
+                }
+
+                auto finishSub = TriggerBuilder(subAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finishSub.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
+                finishSub.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::ClearSwitch);
+                finishSub.Action_JumpTo(retAddress);
+                PushTriggers(finishSub.GetTriggers());
+
+                finishSub = TriggerBuilder(subAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finishSub.Cond_TestReg(left, 1, TriggerComparisonType::AtLeast);
+                finishSub.Cond_TestReg(right, 0, TriggerComparisonType::Exactly);
+                finishSub.Action_SetSwitch(Switch_ArithmeticUnderflow, TriggerActionState::SetSwitch);
+                finishSub.Action_JumpTo(retAddress);
+                PushTriggers(finishSub.GetTriggers());
+            }
+            else if (instruction->GetType() == IRInstructionType::Mul)
+            {
+                if (m_CurrentCounterRegId != Reg_InstructionCounter)
+                {
+                    // the shared multiply routine returns through an indirect jump of the main instruction counter
+                    throw CompilerException("Multiplying two variables is not supported inside of a task", instruction.get());
+                }
+
+                current.AssociateInstruction(instruction.get());
+                auto left = ++m_StackPointer;
+                auto right = m_StackPointer + 1;
+
+                auto mulAddress = ++nextAddress;
+                auto mul2Address = ++nextAddress;
+                auto mul3Address = ++nextAddress;
+
+                current.Action_SetReg(Reg_MulLeft, 0);
+                current.Action_SetReg(Reg_MulRight, 0);
+                current.Action_JumpTo(mulAddress);
+                PushTriggers(current.GetTriggers());
+
+                auto retAddress = nextAddress++;
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                {
+                    auto moveLeft = TriggerBuilder(mulAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    moveLeft.Cond_TestReg(left, i, TriggerComparisonType::AtLeast);
+                    moveLeft.Action_DecReg(left, i);
+                    moveLeft.Action_IncReg(Reg_MulLeft, i);
+                    PushTriggers(moveLeft.GetTriggers());
+                }
+
+                auto moveLeftFinish = TriggerBuilder(mulAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                moveLeftFinish.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
+                moveLeftFinish.Action_JumpTo(mul2Address);
+                PushTriggers(moveLeftFinish.GetTriggers());
+
+                for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                {
+                    auto moveRight = TriggerBuilder(mul2Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    moveRight.Cond_TestReg(right, i, TriggerComparisonType::AtLeast);
+                    moveRight.Action_DecReg(right, i);
+                    moveRight.Action_IncReg(Reg_MulRight, i);
+                    PushTriggers(moveRight.GetTriggers());
+                }
+
+                auto moveRightFinish = TriggerBuilder(mul2Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 moveRightFinish.Cond_TestReg(right, 0, TriggerComparisonType::Exactly);
                 moveRightFinish.Action_SetReg(Reg_IndirectJumpAddress, mul3Address);
                 moveRightFinish.Action_JumpTo(m_MultiplyAddress);
@@ -746,18 +1210,147 @@ namespace LangUMS
 
                 for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                 {
-                    auto push = TriggerBuilder(mul3Address, instruction.get(), m_TriggersOwner);
+                    auto push = TriggerBuilder(mul3Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     push.Cond_TestReg(Reg_MulRight, i, TriggerComparisonType::AtLeast);
                     push.Action_DecReg(Reg_MulRight, i);
                     push.Action_IncReg(right, i);
                     PushTriggers(push.GetTriggers());
                 }
 
-                auto pushDone = TriggerBuilder(mul3Address, instruction.get(), m_TriggersOwner);
+                auto pushDone = TriggerBuilder(mul3Address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 pushDone.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
                 pushDone.Action_JumpTo(retAddress);
                 PushTriggers(pushDone.GetTriggers());
             }
+            else if (instruction->GetType() == IRInstructionType::Math)
+            {
+                if (m_CurrentCounterRegId != Reg_InstructionCounter)
+                {
+                    throw CompilerException("Built-in math functions are not supported inside of a task", instruction.get());
+                }
+
+                current.AssociateInstruction(instruction.get());
+                auto function = ((IRMathInstruction*)instruction.get())->GetFunction();
+
+                if (function == MathFunction::ISqrt)
+                {
+                    auto regId = m_StackPointer + 1;
+                    auto moveAddress = nextAddress++;
+                    auto resultAddress = nextAddress++;
+
+                    current.Action_SetReg(Reg_MulLeft, 0);
+                    current.Action_JumpTo(moveAddress);
+                    PushTriggers(current.GetTriggers());
+
+                    auto retAddress = nextAddress++;
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                    CodeGen_Drain(moveAddress, regId, { Reg_MulLeft }, instruction.get());
+
+                    auto moveFinish = TriggerBuilder(moveAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    moveFinish.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
+                    moveFinish.Action_SetReg(Reg_IndirectJumpAddress, resultAddress);
+                    moveFinish.Action_JumpTo(m_ISqrtAddress);
+                    PushTriggers(moveFinish.GetTriggers());
+
+                    CodeGen_Drain(resultAddress, Reg_MulRight, { regId }, instruction.get());
+
+                    auto resultFinish = TriggerBuilder(resultAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    resultFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+                    resultFinish.Action_JumpTo(retAddress);
+                    PushTriggers(resultFinish.GetTriggers());
+                    continue;
+                }
+
+                auto left = ++m_StackPointer;
+                auto right = m_StackPointer + 1;
+                auto moveAddress = nextAddress++;
+                auto resultAddress = nextAddress++;
+
+                current.Action_SetReg(Reg_MulLeft, 0);
+                current.Action_SetReg(Reg_MulRight, 0);
+                current.Action_JumpTo(moveAddress);
+                PushTriggers(current.GetTriggers());
+
+                auto retAddress = nextAddress++;
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                CodeGen_Drain(moveAddress, left, { Reg_MulLeft }, instruction.get());
+                CodeGen_Drain(moveAddress, right, { Reg_MulRight }, instruction.get());
+
+                auto moveFinish = TriggerBuilder(moveAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                moveFinish.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
+                moveFinish.Cond_TestReg(right, 0, TriggerComparisonType::Exactly);
+                moveFinish.Action_SetReg(Reg_IndirectJumpAddress, resultAddress);
+                moveFinish.Action_JumpTo(m_MinMaxAddress);
+                PushTriggers(moveFinish.GetTriggers());
+
+                // the routine leaves the smaller operand in Temp0 and what is left of the larger one in MulLeft or MulRight
+                std::vector<unsigned int> resultRegIds;
+                if (function == MathFunction::Min || function == MathFunction::Max)
+                {
+                    resultRegIds.push_back(Reg_Temp0);
+                }
+
+                if (function == MathFunction::Max || function == MathFunction::AbsDiff)
+                {
+                    resultRegIds.push_back(Reg_MulLeft);
+                    resultRegIds.push_back(Reg_MulRight);
+                }
+
+                auto resultFinish = TriggerBuilder(resultAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                for (auto regId : resultRegIds)
+                {
+                    CodeGen_Drain(resultAddress, regId, { right }, instruction.get());
+                    resultFinish.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
+                }
+
+                resultFinish.Action_JumpTo(retAddress);
+                PushTriggers(resultFinish.GetTriggers());
+            }
+            else if (instruction->GetType() == IRInstructionType::Pow)
+            {
+                if (m_CurrentCounterRegId != Reg_InstructionCounter)
+                {
+                    throw CompilerException("Built-in math functions are not supported inside of a task", instruction.get());
+                }
+
+                current.AssociateInstruction(instruction.get());
+                auto pow = (IRPowInstruction*)instruction.get();
+                auto baseRegId = pow->GetBaseRegisterId();
+                auto exponentRegId = pow->GetExponentRegisterId();
+                auto resultRegId = pow->GetResultRegisterId();
+
+                auto left = ++m_StackPointer;
+                auto right = m_StackPointer + 1;
+                auto moveAddress = nextAddress++;
+                auto resultAddress = nextAddress++;
+
+                current.Action_SetReg(baseRegId, 0);
+                current.Action_SetReg(exponentRegId, 0);
+                current.Action_JumpTo(moveAddress);
+                PushTriggers(current.GetTriggers());
+
+                auto retAddress = nextAddress++;
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                CodeGen_Drain(moveAddress, left, { exponentRegId }, instruction.get());
+                CodeGen_Drain(moveAddress, right, { baseRegId }, instruction.get());
+
+                auto moveFinish = TriggerBuilder(moveAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                moveFinish.Cond_TestReg(left, 0, TriggerComparisonType::Exactly);
+                moveFinish.Cond_TestReg(right, 0, TriggerComparisonType::Exactly);
+                moveFinish.Action_SetReg(pow->GetReturnRegisterId(), resultAddress);
+                moveFinish.Action_JumpTo(m_PowAddress);
+                PushTriggers(moveFinish.GetTriggers());
+
+                CodeGen_Drain(resultAddress, resultRegId, { right }, instruction.get());
+
+                auto resultFinish = TriggerBuilder(resultAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                resultFinish.Cond_TestReg(resultRegId, 0, TriggerComparisonType::Exactly);
+                resultFinish.Action_JumpTo(retAddress);
+                PushTriggers(resultFinish.GetTriggers());
+            }
             else if (instruction->GetType() == IRInstructionType::MulConst)
             {
                 current.AssociateInstruction(instruction.get());
@@ -775,40 +1368,40 @@ namespace LangUMS
                 auto mulAddress = ++nextAddress;
                 auto mulAddress2 = ++nextAddress;
 
-                current.Action_SetReg(Reg_MulLeft, 0);
-                current.Action_SetReg(Reg_MulRight, 0);
+                current.Action_SetReg(m_MulLeftRegId, 0);
+                current.Action_SetReg(m_MulRightRegId, 0);
                 current.Action_JumpTo(mulAddress);
                 PushTriggers(current.GetTriggers());
 
                 auto retAddress = nextAddress++;
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                 for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                 {
-                    auto copy = TriggerBuilder(mulAddress, instruction.get(), m_TriggersOwner);
+                    auto copy = TriggerBuilder(mulAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     copy.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                     copy.Action_DecReg(regId, i);
-                    copy.Action_IncReg(Reg_MulLeft, i);
-                    copy.Action_IncReg(Reg_MulRight, i);
+                    copy.Action_IncReg(m_MulLeftRegId, i);
+                    copy.Action_IncReg(m_MulRightRegId, i);
                     PushTriggers(copy.GetTriggers());
                 }
 
-                auto copyFinish = TriggerBuilder(mulAddress, instruction.get(), m_TriggersOwner);
+                auto copyFinish = TriggerBuilder(mulAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 copyFinish.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
                 copyFinish.Action_JumpTo(mulAddress2);
                 PushTriggers(copyFinish.GetTriggers());
 
                 for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                 {
-                    auto mul = TriggerBuilder(mulAddress2, instruction.get(), m_TriggersOwner);
-                    mul.Cond_TestReg(Reg_MulLeft, i, TriggerComparisonType::AtLeast);
-                    mul.Action_DecReg(Reg_MulLeft, i);
+                    auto mul = TriggerBuilder(mulAddress2, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    mul.Cond_TestReg(m_MulLeftRegId, i, TriggerComparisonType::AtLeast);
+                    mul.Action_DecReg(m_MulLeftRegId, i);
                     mul.Action_IncReg(regId, i * (int)pow(2, numShifts));
                     PushTriggers(mul.GetTriggers());
                 }
 
-                auto mulFinish = TriggerBuilder(mulAddress2, instruction.get(), m_TriggersOwner);
-                mulFinish.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
+                auto mulFinish = TriggerBuilder(mulAddress2, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                mulFinish.Cond_TestReg(m_MulLeftRegId, 0, TriggerComparisonType::Exactly);
 
                 auto mulAddress3 = -1;
 
@@ -828,15 +1421,15 @@ namespace LangUMS
                 {
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto addOdd = TriggerBuilder(mulAddress3, instruction.get(), m_TriggersOwner);
-                        addOdd.Cond_TestReg(Reg_MulRight, i, TriggerComparisonType::AtLeast);
-                        addOdd.Action_DecReg(Reg_MulRight, i);
+                        auto addOdd = TriggerBuilder(mulAddress3, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        addOdd.Cond_TestReg(m_MulRightRegId, i, TriggerComparisonType::AtLeast);
+                        addOdd.Action_DecReg(m_MulRightRegId, i);
                         addOdd.Action_IncReg(regId, i);
                         PushTriggers(addOdd.GetTriggers());
                     }
 
-                    auto addOddFinish = TriggerBuilder(mulAddress3, instruction.get(), m_TriggersOwner);
-                    addOddFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+                    auto addOddFinish = TriggerBuilder(mulAddress3, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    addOddFinish.Cond_TestReg(m_MulRightRegId, 0, TriggerComparisonType::Exactly);
                     addOddFinish.Action_JumpTo(retAddress);
                     PushTriggers(addOddFinish.GetTriggers());
                 }
@@ -861,20 +1454,94 @@ namespace LangUMS
 
                 PushTriggers(current.GetTriggers());
                 auto retAddress = nextAddress++;
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                 for (auto i = 0; i < 8; i++)
                 {
-                    auto rnd = TriggerBuilder(rndAddress, instruction.get(), m_TriggersOwner);
+                    auto rnd = TriggerBuilder(rndAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     rnd.Cond_TestSwitch(Switch_Random0 + i, true);
                     rnd.Action_IncReg(stackTop, (1 << i));
                     PushTriggers(rnd.GetTriggers());
                 }
 
-                auto finish = TriggerBuilder(rndAddress, instruction.get(), m_TriggersOwner);
+                auto finish = TriggerBuilder(rndAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 finish.Action_JumpTo(retAddress);
                 PushTriggers(finish.GetTriggers());
             }
+            else if (instruction->GetType() == IRInstructionType::Rnd)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto rnd = (IRRndInstruction*)instruction.get();
+                auto range = rnd->GetRange();
+
+                auto dstRegId = rnd->GetDestinationRegisterId();
+                if (dstRegId == -1)
+                {
+                    dstRegId = m_StackPointer--;
+                }
+
+                auto bits = 0u;
+                while ((1u << bits) < range)
+                {
+                    bits++;
+                }
+
+                if (bits == 0)
+                {
+                    current.Action_SetReg(dstRegId, 0);
+                }
+                else
+                {
+                    auto rndAddress = nextAddress++;
+                    auto retAddress = nextAddress++;
+                    auto isPowerOfTwo = (1u << bits) == range;
+
+                    if (isPowerOfTwo)
+                    {
+                        for (auto i = 0u; i < bits; i++)
+                        {
+                            current.Action_SetSwitch(Switch_Random0 + i, TriggerActionState::RandomizeSwitch);
+                        }
+
+                        current.Action_SetReg(dstRegId, 0);
+                    }
+
+                    current.Action_JumpTo(rndAddress);
+                    PushTriggers(current.GetTriggers());
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                    if (!isPowerOfTwo)
+                    {
+                        // values out of range are rejected by staying at this address, the next cycle
+                        // randomizes the switches again and reads them in the same cycle
+                        auto roll = TriggerBuilder(rndAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        for (auto i = 0u; i < bits; i++)
+                        {
+                            roll.Action_SetSwitch(Switch_Random0 + i, TriggerActionState::RandomizeSwitch);
+                        }
+
+                        roll.Action_SetReg(dstRegId, 0);
+                        PushTriggers(roll.GetTriggers());
+                    }
+
+                    for (auto i = 0u; i < bits; i++)
+                    {
+                        auto accumulate = TriggerBuilder(rndAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                        accumulate.Cond_TestSwitch(Switch_Random0 + i, true);
+                        accumulate.Action_IncReg(dstRegId, (1 << i));
+                        PushTriggers(accumulate.GetTriggers());
+                    }
+
+                    auto finish = TriggerBuilder(rndAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    if (!isPowerOfTwo)
+                    {
+                        finish.Cond_TestReg(dstRegId, range - 1, TriggerComparisonType::AtMost);
+                    }
+
+                    finish.Action_JumpTo(retAddress);
+                    PushTriggers(finish.GetTriggers());
+                }
+            }
             else if (instruction->GetType() == IRInstructionType::Jmp)
             {
                 current.AssociateInstruction(instruction.get());
@@ -891,7 +1558,7 @@ namespace LangUMS
                 PushTriggers(current.GetTriggers(), targetInstruction);
                 auto trigger = &m_Triggers.back();
 
-                current = TriggerBuilder(nextAddress++, instruction.get(), m_TriggersOwner);
+                current = TriggerBuilder(nextAddress++, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
             }
             else if (instruction->GetType() == IRInstructionType::JmpIfEq)
             {
@@ -1148,6 +1815,115 @@ namespace LangUMS
                 ifFalse.Cond_TestSwitch(switchId, true);
                 PushTriggers(ifFalse.GetTriggers(), instructions[targetIndex].get());
             }
+            else if (instruction->GetType() == IRInstructionType::JmpTable)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto jmpTable = (IRJmpTableInstruction*)instruction.get();
+
+                auto regId = jmpTable->GetRegisterId();
+
+                if (regId > Reg_StackTop)
+                {
+                    throw CompilerException("Malformed IR. Testing past top of the stack", instruction.get());
+                }
+
+                if (regId == Reg_StackTop)
+                {
+                    regId = m_StackPointer + 1;
+                }
+
+                auto dispatchAddress = nextAddress++;
+                current.Action_JumpTo(dispatchAddress);
+                PushTriggers(current.GetTriggers());
+
+                auto entries = jmpTable->GetEntries();
+                std::sort(entries.begin(), entries.end(), [](const JmpTableEntry& a, const JmpTableEntry& b)
+                {
+                    return a.m_Value < b.m_Value;
+                });
+
+                // the dispatch triggers come after the jump into them and every case is further down
+                // so the whole switch resolves in the same cycle regardless of the number of cases
+                for (auto q = 0u; q < entries.size();)
+                {
+                    // runs of consecutive values going to the same case share a single range test
+                    auto last = q;
+                    while (last + 1 < entries.size() &&
+                        entries[last + 1].m_Value == entries[last].m_Value + 1 &&
+                        entries[last + 1].m_Offset == entries[q].m_Offset)
+                    {
+                        last++;
+                    }
+
+                    auto dispatch = TriggerBuilder(dispatchAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+
+                    if (last == q)
+                    {
+                        dispatch.Cond_TestReg(regId, entries[q].m_Value, TriggerComparisonType::Exactly);
+                    }
+                    else
+                    {
+                        dispatch.Cond_TestReg(regId, entries[q].m_Value, TriggerComparisonType::AtLeast);
+                        dispatch.Cond_TestReg(regId, entries[last].m_Value, TriggerComparisonType::AtMost);
+                    }
+
+                    auto targetIndex = std::min((int)i + entries[q].m_Offset, (int)instructions.size() - 1);
+                    PushTriggers(dispatch.GetTriggers(), instructions[targetIndex].get());
+                    q = last + 1;
+                }
+
+                // a matching case has already moved the instruction counter so this only fires when nothing matched
+                auto fallback = TriggerBuilder(dispatchAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                auto defaultIndex = std::min((int)i + jmpTable->GetDefaultOffset(), (int)instructions.size() - 1);
+                PushTriggers(fallback.GetTriggers(), instructions[defaultIndex].get());
+
+                current = TriggerBuilder(nextAddress++, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Call)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto call = (IRCallInstruction*)instruction.get();
+
+                auto targetIndex = std::min((int)call->GetTarget(), (int)instructions.size() - 1);
+                auto target = instructions[targetIndex].get();
+
+                // the return register holds the index of the call site among the calls to the same subroutine
+                auto& callSites = m_CallSites[target];
+                auto siteId = std::find(callSites.begin(), callSites.end(), instruction.get()) - callSites.begin();
+
+                current.Action_SetReg(call->GetReturnRegisterId(), (int)siteId);
+                PushTriggers(current.GetTriggers(), target);
+
+                current = TriggerBuilder(m_ReturnAddresses[instruction.get()], instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Ret)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto ret = (IRRetInstruction*)instruction.get();
+                auto retRegId = ret->GetReturnRegisterId();
+
+                auto entryIndex = (int)i + ret->GetEntryOffset();
+                if (entryIndex < 0 || entryIndex >= (int)instructions.size())
+                {
+                    throw CompilerException("Malformed IR. Return from outside of a subroutine", instruction.get());
+                }
+
+                auto dispatchAddress = nextAddress++;
+                current.Action_JumpTo(dispatchAddress);
+                PushTriggers(current.GetTriggers());
+
+                // every call site is further down so returning does not cost a cycle
+                auto& callSites = m_CallSites[instructions[entryIndex].get()];
+                for (auto q = 0u; q < callSites.size(); q++)
+                {
+                    auto dispatch = TriggerBuilder(dispatchAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                    dispatch.Cond_TestReg(retRegId, q, TriggerComparisonType::Exactly);
+                    dispatch.Action_JumpTo(m_ReturnAddresses[callSites[q]]);
+                    PushTriggers(dispatch.GetTriggers());
+                }
+
+                current = TriggerBuilder(nextAddress++, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
             else if (instruction->GetType() == IRInstructionType::SetSw)
             {
                 current.AssociateInstruction(instruction.get());
@@ -1166,18 +1942,18 @@ namespace LangUMS
 
                 current.Action_JumpTo(startAddress);
                 PushTriggers(current.GetTriggers());
-                current = TriggerBuilder(startAddress, instruction.get(), m_TriggersOwner);
-                current.Action_SetSwitch(Switch_Player1 + m_TriggersOwner - 1, TriggerActionState::SetSwitch);
+                current = TriggerBuilder(startAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                current.Action_SetSwitch(Switch_Player1 + m_CurrentOwner - 1, TriggerActionState::SetSwitch);
                 current.Action_Wait(0);
 
                 for (auto i = 0u; i < 8; i++)
                 {
-                    if (i + 1 == m_TriggersOwner)
+                    if (i + 1 == m_CurrentOwner)
                     {
                         continue;
                     }
 
-                    auto checkIfPlayerActive = TriggerBuilder(startAddress, instruction.get(), i + 1);
+                    auto checkIfPlayerActive = TriggerBuilder(startAddress, instruction.get(), i + 1, m_CurrentCounterRegId);
                     checkIfPlayerActive.Action_SetSwitch(Switch_Player1 + i, TriggerActionState::SetSwitch);
                     PushTriggers(checkIfPlayerActive.GetTriggers());
                 }
@@ -1197,20 +1973,20 @@ namespace LangUMS
                 current.Action_SetReg(stackTop, 0);
                 PushTriggers(current.GetTriggers());
 
-                auto checkPresent = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                auto checkPresent = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 checkPresent.Action_Wait(0);
                 checkPresent.Action_JumpTo(retAddress);
                 PushTriggers(checkPresent.GetTriggers());
 
                 for (auto& playerId : playerIds)
                 {
-                    auto countPresent = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto countPresent = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     countPresent.Cond_TestSwitch(Switch_Player1 + playerId, true);
                     countPresent.Action_IncReg(stackTop, 1);
                     PushTriggers(countPresent.GetTriggers());
                 }
 
-                current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
             }
             else if (instruction->GetType() == IRInstructionType::DisplayMsg)
             {
@@ -1219,7 +1995,7 @@ namespace LangUMS
                 auto playerId = displayMsgReg->GetPlayerId();
                 auto stringId = m_StringsChunk->InsertString(displayMsgReg->GetMessage());
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_DisplayMsg(stringId);
                 }
@@ -1230,7 +2006,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -1239,10 +2015,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto msgTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto msgTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     msgTrigger.Action_DisplayMsg(stringId);
 
                     if (all)
@@ -1252,14 +2028,29 @@ namespace LangUMS
 
                     PushTriggers(msgTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::Wait)
             {
                 current.AssociateInstruction(instruction.get());
-                auto wait = (IRWaitInstruction*)instruction.get();
-                current.Action_Wait(wait->GetMilliseconds());
+                auto wait = (IRWaitInstruction*)instruction.get();
+                current.Action_Wait(wait->GetMilliseconds());
+            }
+            else if (instruction->GetType() == IRInstructionType::Sleep)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto sleep = (IRSleepInstruction*)instruction.get();
+                auto timerRegId = sleep->GetTimerRegisterId();
+
+                // the instruction counter parks at the resume address until the timer has been counted down to zero
+                auto resumeAddress = nextAddress++;
+                current.Action_SetReg(timerRegId, m_CostModel.GetSleepCycles(sleep->GetMilliseconds()));
+                current.Action_JumpTo(resumeAddress);
+                PushTriggers(current.GetTriggers());
+
+                current = TriggerBuilder(resumeAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                current.Cond_TestReg(timerRegId, 0, TriggerComparisonType::Exactly);
             }
             else if (instruction->GetType() == IRInstructionType::Spawn)
             {
@@ -1278,14 +2069,27 @@ namespace LangUMS
                     auto regId = spawn->GetRegisterId();
                     if (regId != Reg_StackTop)
                     {
-                        throw CompilerException(SafePrintf("Malformed IR! Spawn expects the quantity on top of the stack."), instruction.get());
+                        auto address = CodeGen_BeginInPlaceQuantity(current, nextAddress);
+
+                        for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
+                        {
+                            auto spawnTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                            spawnTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
+                            spawnTrigger.Action_DecReg(regId, i);
+                            spawnTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                            spawnTrigger.Action_CreateUnit(spawn->GetPlayerId(), spawn->GetUnitId(), i, locationId, unitSlot);
+                            PushTriggers(spawnTrigger.GetTriggers());
+                        }
+
+                        current = CodeGen_EndInPlaceQuantity(regId, address, nextAddress, instruction.get());
+                        continue;
                     }
 
                     regId = ++m_StackPointer;
 
-                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
                     {
-                        auto spawnTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto spawnTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         spawnTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         spawnTrigger.Action_DecReg(regId, i);
                         spawnTrigger.Action_CreateUnit(spawn->GetPlayerId(), spawn->GetUnitId(), i, locationId, unitSlot);
@@ -1316,14 +2120,27 @@ namespace LangUMS
                     auto regId = kill->GetRegisterId();
                     if (regId != Reg_StackTop)
                     {
-                        throw CompilerException(SafePrintf("Malformed IR! Kill expects the quantity on top of the stack."), instruction.get());
+                        auto address = CodeGen_BeginInPlaceQuantity(current, nextAddress);
+
+                        for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
+                        {
+                            auto killTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                            killTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
+                            killTrigger.Action_DecReg(regId, i);
+                            killTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                            killTrigger.Action_KillUnit(kill->GetPlayerId(), kill->GetUnitId(), i, locationId);
+                            PushTriggers(killTrigger.GetTriggers());
+                        }
+
+                        current = CodeGen_EndInPlaceQuantity(regId, address, nextAddress, instruction.get());
+                        continue;
                     }
 
                     regId = ++m_StackPointer;
 
-                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
                     {
-                        auto killTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto killTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         killTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         killTrigger.Action_DecReg(regId, i);
                         killTrigger.Action_KillUnit(kill->GetPlayerId(), kill->GetUnitId(), i, locationId);
@@ -1354,14 +2171,27 @@ namespace LangUMS
                     auto regId = remove->GetRegisterId();
                     if (regId != Reg_StackTop)
                     {
-                        throw CompilerException(SafePrintf("Malformed IR! Remove expects the quantity on top of the stack."), instruction.get());
+                        auto address = CodeGen_BeginInPlaceQuantity(current, nextAddress);
+
+                        for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
+                        {
+                            auto removeTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                            removeTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
+                            removeTrigger.Action_DecReg(regId, i);
+                            removeTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                            removeTrigger.Action_RemoveUnit(remove->GetPlayerId(), remove->GetUnitId(), i, locationId);
+                            PushTriggers(removeTrigger.GetTriggers());
+                        }
+
+                        current = CodeGen_EndInPlaceQuantity(regId, address, nextAddress, instruction.get());
+                        continue;
                     }
 
                     regId = ++m_StackPointer;
 
-                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
                     {
-                        auto removeTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto removeTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         removeTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         removeTrigger.Action_DecReg(regId, i);
                         removeTrigger.Action_RemoveUnit(remove->GetPlayerId(), remove->GetUnitId(), i, locationId);
@@ -1393,9 +2223,9 @@ namespace LangUMS
 
                     regId = ++m_StackPointer;
 
-                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
                     {
-                        auto moveTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto moveTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         moveTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         moveTrigger.Action_DecReg(regId, i);
                         current.Action_MoveUnit(move->GetPlayerId(), move->GetUnitId(), i, srcLocationId, dstLocationId);
@@ -1456,7 +2286,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto modifyTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto modifyTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         modifyTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         modifyTrigger.Action_DecReg(regId, i);
 
@@ -1502,14 +2332,27 @@ namespace LangUMS
                     auto regId = give->GetRegisterId();
                     if (regId != Reg_StackTop)
                     {
-                        throw CompilerException(SafePrintf("Malformed IR! Give expects the quantity on top of the stack."), instruction.get());
+                        auto address = CodeGen_BeginInPlaceQuantity(current, nextAddress);
+
+                        for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
+                        {
+                            auto giveTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                            giveTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
+                            giveTrigger.Action_DecReg(regId, i);
+                            giveTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                            giveTrigger.Action_GiveUnits(srcPlayerId, dstPlayerId, unitId, i, locationId);
+                            PushTriggers(giveTrigger.GetTriggers());
+                        }
+
+                        current = CodeGen_EndInPlaceQuantity(regId, address, nextAddress, instruction.get());
+                        continue;
                     }
 
                     regId = ++m_StackPointer;
 
-                    for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+                    for (auto i = CostModel::GetUnitQuantityBatchSize(); i >= 1; i /= 2)
                     {
-                        auto giveTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto giveTrigger = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         giveTrigger.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         giveTrigger.Action_DecReg(regId, i);
                         giveTrigger.Action_GiveUnits(srcPlayerId, dstPlayerId, unitId, i, locationId);
@@ -1537,7 +2380,7 @@ namespace LangUMS
                 auto type = endGame->GetEndGameType();
                 auto playerId = endGame->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     if (type == EndGameType::Victory)
                     {
@@ -1559,7 +2402,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -1568,10 +2411,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto endGameTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto endGameTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
 
                     if (type == EndGameType::Victory)
                     {
@@ -1593,7 +2436,7 @@ namespace LangUMS
 
                     PushTriggers(endGameTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::CenterView)
@@ -1604,7 +2447,7 @@ namespace LangUMS
                 auto locationId = GetLocationIdByName(centerView->GetLocationName(), instruction.get());
                 auto playerId = centerView->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_CenterView(locationId + 1);
                 }
@@ -1615,7 +2458,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -1624,10 +2467,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto centerTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto centerTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     centerTrigger.Action_CenterView(locationId + 1);
 
                     if (all)
@@ -1637,7 +2480,7 @@ namespace LangUMS
 
                     PushTriggers(centerTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::Ping)
@@ -1648,7 +2491,7 @@ namespace LangUMS
                 auto locationId = GetLocationIdByName(ping->GetLocationName(), instruction.get());
                 auto playerId = ping->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_Ping(locationId + 1);
                 }
@@ -1659,7 +2502,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -1668,10 +2511,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto pingTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto pingTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     pingTrigger.Action_Ping(locationId + 1);
 
                     if (all)
@@ -1681,7 +2524,7 @@ namespace LangUMS
 
                     PushTriggers(pingTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::SetResource)
@@ -1711,18 +2554,18 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         add.Action_SetResources(playerId, i, TriggerActionState::Add, setResource->GetResourceType());
                         PushTriggers(add.GetTriggers());
                     }
 
-                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     finishAdd.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
                     finishAdd.Action_JumpTo(retAddress);
                     PushTriggers(finishAdd.GetTriggers());
@@ -1751,7 +2594,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         add.Action_SetResources(playerId, i, TriggerActionState::Add, setResource->GetResourceType());
@@ -1784,7 +2627,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto sub = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto sub = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         sub.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         sub.Action_DecReg(regId, i);
                         sub.Action_SetResources(playerId, i, TriggerActionState::Subtract, setResource->GetResourceType());
@@ -1821,18 +2664,18 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetScore(playerId, i, TriggerActionState::Add, setScore->GetScoreType());
                         PushTriggers(add.GetTriggers());
                     }
 
-                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     finishAdd.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
                     finishAdd.Action_JumpTo(retAddress);
                     PushTriggers(finishAdd.GetTriggers());
@@ -1861,7 +2704,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetScore(playerId, i, TriggerActionState::Add, incScore->GetScoreType());
@@ -1894,7 +2737,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetScore(playerId, i, TriggerActionState::Subtract, incScore->GetScoreType());
@@ -1930,18 +2773,18 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         add.Action_SetCountdown(i, TriggerActionState::Add);
                         PushTriggers(add.GetTriggers());
                     }
 
-                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     finishAdd.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
                     finishAdd.Action_JumpTo(retAddress);
                     PushTriggers(finishAdd.GetTriggers());
@@ -1969,7 +2812,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         add.Action_SetCountdown(i, TriggerActionState::Add);
@@ -2001,7 +2844,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         add.Action_SetCountdown(i, TriggerActionState::Subtract);
@@ -2066,18 +2909,18 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetDeaths(playerId, setDeaths->GetUnitId(), i, TriggerActionState::Add);
                         PushTriggers(add.GetTriggers());
                     }
 
-                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto finishAdd = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     finishAdd.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
                     finishAdd.Action_JumpTo(retAddress);
                     PushTriggers(finishAdd.GetTriggers());
@@ -2106,7 +2949,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetDeaths(playerId, incDeaths->GetUnitId(), i, TriggerActionState::Add);
@@ -2139,7 +2982,7 @@ namespace LangUMS
 
                     for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
                     {
-                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_TriggersOwner);
+                        auto add = TriggerBuilder(current.GetAddress(), instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                         add.Cond_TestReg(regId, i, TriggerComparisonType::AtLeast);
                         add.Action_DecReg(regId, i);
                         current.Action_SetDeaths(playerId, decDeaths->GetUnitId(), i, TriggerActionState::Subtract);
@@ -2156,7 +2999,7 @@ namespace LangUMS
 
                 auto playerId = talk->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_TalkingPortrait(talk->GetUnitId(), talk->GetTime());
                 }
@@ -2167,7 +3010,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -2176,10 +3019,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto talkTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto talkTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     talkTrigger.Action_TalkingPortrait(talk->GetUnitId(), talk->GetTime());
 
                     if (all)
@@ -2189,7 +3032,7 @@ namespace LangUMS
 
                     PushTriggers(talkTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::SetDoodad)
@@ -2222,7 +3065,7 @@ namespace LangUMS
                     locationId = GetLocationIdByName(locName, instruction.get());
                 }
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_RunAIScript(playerId, aiScript->GetScriptName(), locationId);
                 }
@@ -2233,7 +3076,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -2242,10 +3085,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto aiTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto aiTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     aiTrigger.Action_RunAIScript(aiScript->GetPlayerId(), aiScript->GetScriptName(), locationId);
 
                     if (all)
@@ -2255,7 +3098,7 @@ namespace LangUMS
 
                     PushTriggers(aiTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::SetAlly)
@@ -2266,7 +3109,7 @@ namespace LangUMS
                 auto playerId = setAlly->GetPlayerId();
                 auto targetPlayerId = setAlly->GetTargetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_SetAllianceStatus(playerId, targetPlayerId, setAlly->GetAllianceStatus());
                 }
@@ -2277,7 +3120,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -2286,10 +3129,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto allyTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto allyTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     allyTrigger.Action_SetAllianceStatus(setAlly->GetPlayerId(), targetPlayerId, setAlly->GetAllianceStatus());
 
                     if (all)
@@ -2299,7 +3142,7 @@ namespace LangUMS
 
                     PushTriggers(allyTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::SetObj)
@@ -2309,7 +3152,7 @@ namespace LangUMS
                 auto stringId = m_StringsChunk->InsertString(setObj->GetText());
                 auto playerId = setObj->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_SetMissionObjectives(stringId);
                 }
@@ -2320,7 +3163,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -2329,10 +3172,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto setObjTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto setObjTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     setObjTrigger.Action_SetMissionObjectives(stringId);
 
                     if (all)
@@ -2342,7 +3185,7 @@ namespace LangUMS
 
                     PushTriggers(setObjTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::PauseGame)
@@ -2451,7 +3294,7 @@ namespace LangUMS
                 auto wavTime = playWav->GetWavTime();
                 auto playerId = playWav->GetPlayerId();
 
-                if (playerId + 1 == m_TriggersOwner)
+                if (playerId + 1 == m_CurrentOwner)
                 {
                     current.Action_PlayWAV(wavStringId, wavTime);
                 }
@@ -2462,7 +3305,7 @@ namespace LangUMS
                     PushTriggers(current.GetTriggers());
 
                     auto retAddress = nextAddress++;
-                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    auto waitTrigger = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                     waitTrigger.Action_Wait(0);
                     waitTrigger.Action_JumpTo(retAddress);
                     PushTriggers(waitTrigger.GetTriggers());
@@ -2471,10 +3314,10 @@ namespace LangUMS
                     if (playerId == -1 || playerId == (int)PlayerId::AllPlayers)
                     {
                         all = true;
-                        playerId = m_TriggersOwner - 1;
+                        playerId = m_CurrentOwner - 1;
                     }
 
-                    auto wavTrigger = TriggerBuilder(address, instruction.get(), playerId + 1);
+                    auto wavTrigger = TriggerBuilder(address, instruction.get(), playerId + 1, m_CurrentCounterRegId);
                     wavTrigger.Action_PlayWAV(wavStringId, wavTime);
 
                     if (all)
@@ -2484,7 +3327,7 @@ namespace LangUMS
 
                     PushTriggers(wavTrigger.GetTriggers());
 
-                    current = TriggerBuilder(retAddress, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if (instruction->GetType() == IRInstructionType::Transmission)
@@ -2500,6 +3343,47 @@ namespace LangUMS
                 auto time = transmission->GetTime();
                 current.Action_Transmission(stringId, transmission->GetUnitId(), locationId, time, TriggerActionState::SetTo, wavStringId, transmission->GetWavTime());
             }
+            else if (instruction->GetType() == IRInstructionType::StartTask)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto startTask = (IRStartTaskInstruction*)instruction.get();
+                auto counterRegId = startTask->GetCounterRegisterId();
+
+                auto target = instructions[startTask->GetTarget()].get();
+                if (m_TaskAddresses.find(target) == m_TaskAddresses.end())
+                {
+                    throw CompilerException("Malformed IR. Task start does not point to a task", instruction.get());
+                }
+
+                auto startAddress = nextAddress++;
+                auto retAddress = nextAddress++;
+
+                current.Action_JumpTo(startAddress);
+                PushTriggers(current.GetTriggers());
+
+                // a task which is already running is left alone
+                auto start = TriggerBuilder(startAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                start.Cond_TestReg(counterRegId, 0, TriggerComparisonType::Exactly);
+                start.Action_SetReg(counterRegId, m_TaskAddresses[target]);
+                PushTriggers(start.GetTriggers());
+
+                auto finish = TriggerBuilder(startAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+                finish.Action_JumpTo(retAddress);
+                PushTriggers(finish.GetTriggers());
+
+                current = TriggerBuilder(retAddress, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
+            else if (instruction->GetType() == IRInstructionType::Yield)
+            {
+                current.AssociateInstruction(instruction.get());
+                auto& addresses = m_YieldAddresses[instruction.get()];
+
+                // the parking trigger comes before this one in the list so it only fires in the next cycle
+                current.Action_JumpTo(addresses.first);
+                PushTriggers(current.GetTriggers());
+
+                current = TriggerBuilder(addresses.second, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
+            }
             else if (instruction->GetType() == IRInstructionType::DebugBrk)
             {
                 if (m_Debug)
@@ -2511,7 +3395,7 @@ namespace LangUMS
                     current.Action_JumpTo(address);
                     PushTriggers(current.GetTriggers());
 
-                    current = TriggerBuilder(address, instruction.get(), m_TriggersOwner);
+                    current = TriggerBuilder(address, instruction.get(), m_CurrentOwner, m_CurrentCounterRegId);
                 }
             }
             else if
@@ -2547,126 +3431,617 @@ namespace LangUMS
                 throw CompilerException("Unknown instruction type", instruction.get());
             }
         }
-
-        PushTriggers(current.GetTriggers());
-
-        for (auto& patchup : m_JmpPatchups)
+
+        PushTriggers(current.GetTriggers());
+
+        for (auto& patchup : m_JmpPatchups)
+        {
+            auto targetInstruction = patchup.second.first;
+
+            if (m_JumpAddresses.find(targetInstruction) == m_JumpAddresses.end())
+            {
+                throw CompilerException("Internal error. Failed to find address for jump target", targetInstruction);
+            }
+
+            auto targetAddress = m_JumpAddresses[targetInstruction];
+
+            auto& trigger = *patchup.first;
+            auto actionId = GetLastTriggerActionId(trigger);
+            if (actionId == -1)
+            {
+                throw CompilerException("Internal error. Trigger action buffer is full", targetInstruction);
+            }
+
+            Action_JumpTo(targetAddress, patchup.second.second, trigger.m_Actions[actionId]);
+        }
+
+        if (m_Triggers.back().m_Actions[1].m_ActionType == TriggerActionType::NoAction)
+        {
+            m_Triggers.pop_back();
+        }
+
+        if (!m_RegionOwners.empty())
+        {
+            VerifyTriggerOwners();
+        }
+
+        auto hyperTriggerOwners = m_CostModel.GetHyperTriggerOwners();
+        if (hyperTriggerOwners.empty())
+        {
+            hyperTriggerOwners.push_back(m_TriggersOwner);
+        }
+
+        std::vector<Trigger> hyperTriggers;
+        for (auto q = 0u; q < m_HyperTriggerCount; q++)
+        {
+            Trigger hyperTrigger;
+            hyperTrigger.m_ExecutionFlags = 0;
+            hyperTrigger.m_ExecutionMask[hyperTriggerOwners[q % hyperTriggerOwners.size()] - 1] = 1;
+
+            Cond_Always(hyperTrigger.m_Conditions[0]);
+            Action_PreserveTrigger(hyperTrigger.m_Actions[0]);
+
+            for (auto i = 1; i < 64; i++)
+            {
+                Action_Wait(0, hyperTrigger.m_Actions[i]);
+            }
+
+            hyperTriggers.push_back(hyperTrigger);
+        }
+
+        auto placement = m_CostModel.GetHyperTriggerPlacement();
+        if (placement == HyperTriggerPlacement::Start)
+        {
+            m_Triggers.insert(m_Triggers.begin(), hyperTriggers.begin(), hyperTriggers.end());
+        }
+        else if (placement == HyperTriggerPlacement::AfterProgram)
+        {
+            m_Triggers.insert(m_Triggers.end(), hyperTriggers.begin(), hyperTriggers.end());
+        }
+
+        auto triggersChunk = chk.GetFirstChunk<TRIGChunk>(ChunkType::TRIG);
+        auto oldBytes = triggersChunk->GetBytes();
+        auto triggerCount = m_Triggers.size();
+        if (preserveTriggers)
+        {
+            triggerCount += triggersChunk->GetTriggersCount();
+        }
+
+        if (placement == HyperTriggerPlacement::End)
+        {
+            triggerCount += hyperTriggers.size();
+        }
+
+        std::vector<char> bytes;
+        bytes.resize(triggerCount * sizeof(Trigger));
+        memcpy(bytes.data(), m_Triggers.data(), m_Triggers.size() * sizeof(Trigger));
+        auto offset = m_Triggers.size() * sizeof(Trigger);
+
+        if (preserveTriggers)
+        {
+            memcpy(bytes.data() + offset, oldBytes.data(), oldBytes.size());
+            offset += oldBytes.size();
+        }
+
+        if (placement == HyperTriggerPlacement::End && !hyperTriggers.empty())
+        {
+            memcpy(bytes.data() + offset, hyperTriggers.data(), hyperTriggers.size() * sizeof(Trigger));
+        }
+
+        triggersChunk->SetBytes(bytes);
+
+        return true;
+    }
+
+    void Compiler::Cond_Always(TriggerCondition& retCondition)
+    {
+        using namespace CHK;
+
+        retCondition.m_Condition = TriggerConditionType::Always;
+        retCondition.m_Flags = 16;
+    }
+
+    unsigned int Compiler::CodeGen_CopyReg(unsigned int dstReg, unsigned int srcReg, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        auto copyAddress = nextAddress++;
+        auto copy2Address = nextAddress++;
+
+        // step 1 - copy to storage
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto copyToStorageTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            copyToStorageTrigger.Cond_TestReg(srcReg, i, TriggerComparisonType::AtLeast);
+            copyToStorageTrigger.Action_DecReg(srcReg, i);
+            copyToStorageTrigger.Action_IncReg(m_CopyStorageRegId, i);
+            PushTriggers(copyToStorageTrigger.GetTriggers());
+        }
+
+        // step 1 (finish) - finish copy and jump to step 2
+        auto finishCopyTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        finishCopyTrigger.Cond_TestReg(srcReg, 0, TriggerComparisonType::Exactly);
+        finishCopyTrigger.Action_SetReg(dstReg, 0);
+        finishCopyTrigger.Action_JumpTo(copy2Address);
+        PushTriggers(finishCopyTrigger.GetTriggers());
+
+        // step 3 - copy from storage
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto copyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            copyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, i, TriggerComparisonType::AtLeast);
+            copyFromStorageTrigger.Action_DecReg(m_CopyStorageRegId, i);
+            copyFromStorageTrigger.Action_IncReg(srcReg, i);
+            copyFromStorageTrigger.Action_IncReg(dstReg, i);
+            PushTriggers(copyFromStorageTrigger.GetTriggers());
+        }
+
+        // step 3 (finish)
+        auto finishCopyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        finishCopyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, 0, TriggerComparisonType::Exactly);
+        finishCopyFromStorageTrigger.Action_JumpTo(retAddress);
+        PushTriggers(finishCopyFromStorageTrigger.GetTriggers());
+
+        return copyAddress;
+    }
+
+    void Compiler::CodeGen_Drain(unsigned int address, unsigned int srcReg, const std::vector<unsigned int>& dstRegs, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto drain = TriggerBuilder(address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            drain.Cond_TestReg(srcReg, i, TriggerComparisonType::AtLeast);
+            drain.Action_DecReg(srcReg, i);
+
+            for (auto dstReg : dstRegs)
+            {
+                drain.Action_IncReg(dstReg, i);
+            }
+
+            PushTriggers(drain.GetTriggers());
+        }
+    }
+
+    void Compiler::CodeGen_ShiftRight(unsigned int address, unsigned int srcReg, unsigned int dstReg, unsigned int bits, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto shift = TriggerBuilder(address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            shift.Cond_TestReg(srcReg, i << bits, TriggerComparisonType::AtLeast);
+            shift.Action_DecReg(srcReg, i << bits);
+            shift.Action_IncReg(dstReg, i);
+            PushTriggers(shift.GetTriggers());
+        }
+    }
+
+    unsigned int Compiler::CodeGen_IndexedCopy(unsigned int dstReg, unsigned int indexReg, const std::vector<unsigned int>& elementRegs, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        auto copyAddress = nextAddress++;
+        auto copy2Address = nextAddress++;
+
+        // every trigger tests the index register instead of copying it, all elements share the same two addresses
+        // so the selected element is copied in the same cycle as a plain register copy
+        for (auto k = 0u; k < elementRegs.size(); k++)
+        {
+            auto srcReg = elementRegs[k];
+
+            // step 1 - copy to storage
+            for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+            {
+                auto copyToStorageTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+                copyToStorageTrigger.Cond_TestReg(indexReg, k, TriggerComparisonType::Exactly);
+                copyToStorageTrigger.Cond_TestReg(srcReg, i, TriggerComparisonType::AtLeast);
+                copyToStorageTrigger.Action_DecReg(srcReg, i);
+                copyToStorageTrigger.Action_IncReg(m_CopyStorageRegId, i);
+                PushTriggers(copyToStorageTrigger.GetTriggers());
+            }
+
+            // step 1 (finish) - finish copy and jump to step 2
+            auto finishCopyTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            finishCopyTrigger.Cond_TestReg(indexReg, k, TriggerComparisonType::Exactly);
+            finishCopyTrigger.Cond_TestReg(srcReg, 0, TriggerComparisonType::Exactly);
+            finishCopyTrigger.Action_SetReg(dstReg, 0);
+            finishCopyTrigger.Action_JumpTo(copy2Address);
+            PushTriggers(finishCopyTrigger.GetTriggers());
+        }
+
+        // an index past the end of the array reads as 0
+        auto outOfRangeTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        outOfRangeTrigger.Cond_TestReg(indexReg, (int)elementRegs.size(), TriggerComparisonType::AtLeast);
+        outOfRangeTrigger.Action_SetReg(dstReg, 0);
+        outOfRangeTrigger.Action_JumpTo(retAddress);
+        PushTriggers(outOfRangeTrigger.GetTriggers());
+
+        // step 2 - copy from storage
+        for (auto k = 0u; k < elementRegs.size(); k++)
+        {
+            for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+            {
+                auto copyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+                copyFromStorageTrigger.Cond_TestReg(indexReg, k, TriggerComparisonType::Exactly);
+                copyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, i, TriggerComparisonType::AtLeast);
+                copyFromStorageTrigger.Action_DecReg(m_CopyStorageRegId, i);
+                copyFromStorageTrigger.Action_IncReg(elementRegs[k], i);
+                copyFromStorageTrigger.Action_IncReg(dstReg, i);
+                PushTriggers(copyFromStorageTrigger.GetTriggers());
+            }
+        }
+
+        // step 2 (finish)
+        auto finishCopyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        finishCopyFromStorageTrigger.Cond_TestReg(m_CopyStorageRegId, 0, TriggerComparisonType::Exactly);
+        finishCopyFromStorageTrigger.Action_JumpTo(retAddress);
+        PushTriggers(finishCopyFromStorageTrigger.GetTriggers());
+
+        return copyAddress;
+    }
+
+    void Compiler::CodeGen_TableCopyReg(unsigned int dstReg, unsigned int srcReg, unsigned int tableAddress, unsigned int fallbackAddress, unsigned int retAddress, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        // the table is pushed after the jump into it so it runs in the same cycle, the source is left untouched
+        for (auto value = 0u; value < m_TableCopyRange; value++)
+        {
+            auto lookup = TriggerBuilder(tableAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            lookup.Cond_TestReg(srcReg, value, TriggerComparisonType::Exactly);
+            lookup.Action_SetReg(dstReg, value);
+            lookup.Action_JumpTo(retAddress);
+            PushTriggers(lookup.GetTriggers());
+        }
+
+        // values outside of the table go through the regular copy loop, only that needs storage cleared
+        auto fallback = TriggerBuilder(tableAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        fallback.Cond_TestReg(srcReg, m_TableCopyRange, TriggerComparisonType::AtLeast);
+        fallback.Action_SetReg(m_CopyStorageRegId, 0);
+        fallback.Action_JumpTo(fallbackAddress);
+        PushTriggers(fallback.GetTriggers());
+    }
+
+    int Compiler::CodeGen_Condition(TriggerBuilder& trigger, IIRInstruction* condition, IIRInstruction* instruction)
+    {
+        using namespace CHK;
+
+        // conditions on the current player have to run as the player they test, the caller moves the trigger there
+        auto owner = -1;
+
+        if (condition->GetType() == IRInstructionType::RegCond)
+        {
+            auto reg = (IRRegCondInstruction*)condition;
+
+            TriggerComparisonType comparison;
+            switch (reg->GetComparison())
+            {
+            case ConditionComparison::Exactly:
+                comparison = TriggerComparisonType::Exactly;
+                break;
+            case ConditionComparison::AtLeast:
+                comparison = TriggerComparisonType::AtLeast;
+                break;
+            case ConditionComparison::AtMost:
+                comparison = TriggerComparisonType::AtMost;
+                break;
+            }
+
+            trigger.Cond_TestReg(reg->GetRegisterId(), reg->GetQuantity(), comparison);
+        }
+        else if (condition->GetType() == IRInstructionType::BringCond)
+        {
+            auto bring = (IRBringCondInstruction*)condition;
+            auto locationId = GetLocationIdByName(bring->GetLocationName(), instruction);
+
+            owner = bring->GetPlayerId() + 1;
+
+            trigger.Cond_Bring(
+                bring->GetPlayerId(),
+                (TriggerComparisonType)bring->GetComparison(),
+                bring->GetUnitId(),
+                locationId,
+                bring->GetQuantity()
+            );
+        }
+        else if (condition->GetType() == IRInstructionType::AccumCond)
+        {
+            auto accum = (IRAccumCondInstruction*)condition;
+
+            owner = accum->GetPlayerId() + 1;
+
+            trigger.Cond_Accumulate(
+                accum->GetPlayerId(),
+                (TriggerComparisonType)accum->GetComparison(),
+                accum->GetResourceType(),
+                accum->GetQuantity()
+            );
+        }
+        else if (condition->GetType() == IRInstructionType::LeastResCond)
+        {
+            auto leastRes = (IRLeastResCondInstruction*)condition;
+            owner = leastRes->GetPlayerId() + 1;
+            trigger.Cond_LeastResources(leastRes->GetPlayerId(), leastRes->GetResourceType());
+        }
+        else if (condition->GetType() == IRInstructionType::MostResCond)
+        {
+            auto mostRes = (IRMostResCondInstruction*)condition;
+            owner = mostRes->GetPlayerId() + 1;
+            trigger.Cond_MostResources(mostRes->GetPlayerId(), mostRes->GetResourceType());
+        }
+        else if (condition->GetType() == IRInstructionType::ScoreCond)
+        {
+            auto score = (IRScoreCondInstruction*)condition;
+
+            trigger.Cond_Score(
+                score->GetPlayerId(),
+                (TriggerComparisonType)score->GetComparison(),
+                score->GetScoreType(),
+                score->GetQuantity()
+            );
+        }
+        else if (condition->GetType() == IRInstructionType::LowScoreCond)
+        {
+            auto lowScore = (IRLowScoreCondInstruction*)condition;
+            owner = lowScore->GetPlayerId() + 1;
+            trigger.Cond_LowestScore(lowScore->GetPlayerId(), lowScore->GetScoreType());
+        }
+        else if (condition->GetType() == IRInstructionType::HiScoreCond)
+        {
+            auto highScore = (IRHiScoreCondInstruction*)condition;
+            owner = highScore->GetPlayerId() + 1;
+            trigger.Cond_LowestScore(highScore->GetPlayerId(), highScore->GetScoreType());
+        }
+        else if (condition->GetType() == IRInstructionType::TimeCond)
         {
-            auto targetInstruction = patchup.second;
+            auto time = (IRTimeCondInstruction*)condition;
 
-            if (m_JumpAddresses.find(targetInstruction) == m_JumpAddresses.end())
-            {
-                throw CompilerException("Internal error. Failed to find address for jump target", targetInstruction);
-            }
+            trigger.Cond_ElapsedTime((TriggerComparisonType)time->GetComparison(), time->GetQuantity());
+        }
+        else if (condition->GetType() == IRInstructionType::CmdCond)
+        {
+            auto cmd = (IRCmdCondInstruction*)condition;
+            owner = cmd->GetPlayerId() + 1;
+            trigger.Cond_Commands(cmd->GetPlayerId(), (TriggerComparisonType)cmd->GetComparison(), cmd->GetUnitId(), cmd->GetQuantity());
+        }
+        else if (condition->GetType() == IRInstructionType::CmdLeastCond)
+        {
+            auto cmdLeast = (IRCmdLeastCondInstruction*)condition;
+            owner = cmdLeast->GetPlayerId() + 1;
 
-            auto targetAddress = m_JumpAddresses[targetInstruction];
+            auto locationId = -1;
+            auto& locationName = cmdLeast->GetLocationName();
 
-            auto& trigger = *patchup.first;
-            auto actionId = GetLastTriggerActionId(trigger);
-            if (actionId == -1)
+            if (locationName.length() > 0)
             {
-                throw CompilerException("Internal error. Trigger action buffer is full", targetInstruction);
+                locationId = GetLocationIdByName(locationName, instruction);
             }
 
-            Action_JumpTo(targetAddress, trigger.m_Actions[actionId]);
-        }
-
-        if (m_Triggers.back().m_Actions[1].m_ActionType == TriggerActionType::NoAction)
-        {
-            m_Triggers.pop_back();
+            trigger.Cond_CommandsLeast(cmdLeast->GetPlayerId(), cmdLeast->GetUnitId(), locationId);
         }
-
-        for (auto q = 0u; q < m_HyperTriggerCount; q++)
+        else if (condition->GetType() == IRInstructionType::CmdMostCond)
         {
-            Trigger hyperTrigger;
-            hyperTrigger.m_ExecutionFlags = 0;
-            hyperTrigger.m_ExecutionMask[m_TriggersOwner - 1] = 1;
+            auto cmdMost = (IRCmdMostCondInstruction*)condition;
+            owner = cmdMost->GetPlayerId() + 1;
 
-            Cond_Always(hyperTrigger.m_Conditions[0]);
-            Action_PreserveTrigger(hyperTrigger.m_Actions[0]);
+            auto locationId = -1;
+            auto& locationName = cmdMost->GetLocationName();
 
-            for (auto i = 1; i < 64; i++)
+            if (locationName.length() > 0)
             {
-                Action_Wait(0, hyperTrigger.m_Actions[i]);
+                locationId = GetLocationIdByName(locationName, instruction);
             }
 
-            m_Triggers.push_back(hyperTrigger);
+            trigger.Cond_CommandsMost(cmdMost->GetPlayerId(), cmdMost->GetUnitId(), locationId);
         }
-
-        auto triggersChunk = chk.GetFirstChunk<TRIGChunk>(ChunkType::TRIG);
-        auto oldBytes = triggersChunk->GetBytes();
-        auto triggerCount = m_Triggers.size();
-        if (preserveTriggers)
+        else if (condition->GetType() == IRInstructionType::KillCond)
         {
-            triggerCount += triggersChunk->GetTriggersCount();
+            auto kill = (IRKillCondInstruction*)condition;
+            trigger.Cond_Kills(kill->GetPlayerId(), (TriggerComparisonType)kill->GetComparison(), kill->GetUnitId(), kill->GetQuantity());
         }
-
-        std::vector<char> bytes;
-        bytes.resize(triggerCount * sizeof(Trigger));
-        memcpy(bytes.data(), m_Triggers.data(), m_Triggers.size() * sizeof(Trigger));
-
-        if (preserveTriggers)
+        else if (condition->GetType() == IRInstructionType::KillLeastCond)
         {
-            memcpy(bytes.data() + m_Triggers.size() * sizeof(Trigger), oldBytes.data(), oldBytes.size());
+            auto killLeast = (IRKillLeastCondInstruction*)condition;
+            owner = killLeast->GetPlayerId() + 1;
+            trigger.Cond_KillsLeast(killLeast->GetPlayerId(), killLeast->GetUnitId());
+        }
+        else if (condition->GetType() == IRInstructionType::KillMostCond)
+        {
+            auto killMost = (IRKillMostCondInstruction*)condition;
+            owner = killMost->GetPlayerId() + 1;
+            trigger.Cond_KillsMost(killMost->GetPlayerId(), killMost->GetUnitId());
+        }
+        else if (condition->GetType() == IRInstructionType::DeathCond)
+        {
+            auto death = (IRDeathCondInstruction*)condition;
+            trigger.Cond_Deaths(death->GetPlayerId(), (TriggerComparisonType)death->GetComparison(), death->GetUnitId(), death->GetQuantity());
+        }
+        else if (condition->GetType() == IRInstructionType::CountdownCond)
+        {
+            auto countdown = (IRCountdownCondInstruction*)condition;
+            trigger.Cond_Countdown((TriggerComparisonType)countdown->GetComparison(), countdown->GetTime());
+        }
+        else if (condition->GetType() == IRInstructionType::OpponentsCond)
+        {
+            auto opponents = (IROpponentsCondInstruction*)condition;
+            owner = opponents->GetPlayerId() + 1;
+            trigger.Cond_Opponents(opponents->GetPlayerId(), (TriggerComparisonType)opponents->GetComparison(), opponents->GetQuantity());
         }
 
-        triggersChunk->SetBytes(bytes);
-
-        return true;
+        return owner;
     }
 
-    void Compiler::Cond_Always(TriggerCondition& retCondition)
+    void Compiler::CodeGen_RawTriggerAction(TriggerBuilder& trigger, IIRInstruction* action)
     {
         using namespace CHK;
 
-        retCondition.m_Condition = TriggerConditionType::Always;
-        retCondition.m_Flags = 16;
+        if (action->GetType() == IRInstructionType::SetReg)
+        {
+            auto setReg = (IRSetRegInstruction*)action;
+            trigger.Action_SetReg(setReg->GetRegisterId(), setReg->GetValue());
+        }
+        else if (action->GetType() == IRInstructionType::IncReg)
+        {
+            auto incReg = (IRIncRegInstruction*)action;
+            trigger.Action_IncReg(incReg->GetRegisterId(), incReg->GetAmount());
+        }
+        else if (action->GetType() == IRInstructionType::DecReg)
+        {
+            auto decReg = (IRDecRegInstruction*)action;
+            trigger.Action_DecReg(decReg->GetRegisterId(), decReg->GetAmount());
+        }
+        else if (action->GetType() == IRInstructionType::SetDeaths)
+        {
+            auto setDeaths = (IRSetDeathsInstruction*)action;
+            trigger.Action_SetDeaths(setDeaths->GetPlayerId(), setDeaths->GetUnitId(), setDeaths->GetRegisterId(), TriggerActionState::SetTo);
+        }
+        else if (action->GetType() == IRInstructionType::IncDeaths)
+        {
+            auto incDeaths = (IRIncDeathsInstruction*)action;
+            trigger.Action_SetDeaths(incDeaths->GetPlayerId(), incDeaths->GetUnitId(), incDeaths->GetRegisterId(), TriggerActionState::Add);
+        }
+        else if (action->GetType() == IRInstructionType::DecDeaths)
+        {
+            auto decDeaths = (IRDecDeathsInstruction*)action;
+            trigger.Action_SetDeaths(decDeaths->GetPlayerId(), decDeaths->GetUnitId(), decDeaths->GetRegisterId(), TriggerActionState::Subtract);
+        }
+        else
+        {
+            throw CompilerException("Malformed IR. Unsupported action in triggers block", action);
+        }
     }
 
-    unsigned int Compiler::CodeGen_CopyReg(unsigned int dstReg, unsigned int srcReg, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction)
+    unsigned int Compiler::CodeGen_FusedCopy(const std::vector<FusedCopyEntry>& entries, const std::vector<unsigned int>& dstRegIds, const std::vector<unsigned int>& storage, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction)
     {
         using namespace CHK;
 
         auto copyAddress = nextAddress++;
         auto copy2Address = nextAddress++;
 
-        // step 1 - copy to storage
-        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        // step 1 - copy every source to its storage, all loops live at the same address and drain in the same scan
+        for (auto q = 0u; q < entries.size(); q++)
         {
-            auto copyToStorageTrigger = TriggerBuilder(copyAddress, instruction, m_TriggersOwner);
-            copyToStorageTrigger.Cond_TestReg(srcReg, i, TriggerComparisonType::AtLeast);
-            copyToStorageTrigger.Action_DecReg(srcReg, i);
-            copyToStorageTrigger.Action_IncReg(Reg_CopyStorage, i);
-            PushTriggers(copyToStorageTrigger.GetTriggers());
+            auto& entry = entries[q];
+            auto srcReg = entry.m_SrcRegId;
+
+            // spawns create the drained units on the way, a single action can create at most the quantity limit
+            auto batchSize = m_CopyBatchSize;
+            auto locationId = 0;
+            if (entry.m_IsSpawn)
+            {
+                batchSize = std::min(batchSize, CostModel::GetUnitQuantityBatchSize());
+                locationId = GetLocationIdByName(entry.m_LocationName, instruction);
+            }
+
+            for (auto i = batchSize; i >= 1; i /= 2)
+            {
+                auto copyToStorageTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+                copyToStorageTrigger.Cond_TestReg(srcReg, i, TriggerComparisonType::AtLeast);
+                copyToStorageTrigger.Action_DecReg(srcReg, i);
+                copyToStorageTrigger.Action_IncReg(storage[q], i);
+
+                if (entry.m_IsSpawn)
+                {
+                    copyToStorageTrigger.Action_CreateUnit(entry.m_PlayerId, entry.m_UnitId, i, locationId, entry.m_PropsSlot);
+                }
+
+                PushTriggers(copyToStorageTrigger.GetTriggers());
+            }
+        }
+
+        // step 1 (finish) - once all sources are drained clear the destinations and jump to step 2
+        auto finishCopyTrigger = TriggerBuilder(copyAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        for (auto& entry : entries)
+        {
+            finishCopyTrigger.Cond_TestReg(entry.m_SrcRegId, 0, TriggerComparisonType::Exactly);
+        }
+
+        for (auto q = 0u; q < entries.size(); q++)
+        {
+            // additions keep the destination, spawns have none
+            if (!entries[q].m_IsAdd && !entries[q].m_IsSpawn)
+            {
+                finishCopyTrigger.Action_SetReg(dstRegIds[q], 0);
+            }
         }
 
-        // step 1 (finish) - finish copy and jump to step 2
-        auto finishCopyTrigger = TriggerBuilder(copyAddress, instruction, m_TriggersOwner);
-        finishCopyTrigger.Cond_TestReg(srcReg, 0, TriggerComparisonType::Exactly);
-        finishCopyTrigger.Action_SetReg(dstReg, 0);
         finishCopyTrigger.Action_JumpTo(copy2Address);
         PushTriggers(finishCopyTrigger.GetTriggers());
 
-        // step 3 - copy from storage
-        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        // step 2 - copy from storage back to the sources and to the destinations
+        for (auto q = 0u; q < entries.size(); q++)
         {
-            auto copyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_TriggersOwner);
-            copyFromStorageTrigger.Cond_TestReg(Reg_CopyStorage, i, TriggerComparisonType::AtLeast);
-            copyFromStorageTrigger.Action_DecReg(Reg_CopyStorage, i);
-            copyFromStorageTrigger.Action_IncReg(srcReg, i);
-            copyFromStorageTrigger.Action_IncReg(dstReg, i);
-            PushTriggers(copyFromStorageTrigger.GetTriggers());
+            auto srcReg = entries[q].m_SrcRegId;
+
+            for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+            {
+                auto copyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+                copyFromStorageTrigger.Cond_TestReg(storage[q], i, TriggerComparisonType::AtLeast);
+                copyFromStorageTrigger.Action_DecReg(storage[q], i);
+                copyFromStorageTrigger.Action_IncReg(srcReg, i);
+
+                if (!entries[q].m_IsSpawn)
+                {
+                    copyFromStorageTrigger.Action_IncReg(dstRegIds[q], i);
+                }
+
+                PushTriggers(copyFromStorageTrigger.GetTriggers());
+            }
+        }
+
+        // step 2 (finish)
+        auto finishCopyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        for (auto regId : storage)
+        {
+            finishCopyFromStorageTrigger.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
         }
 
-        // step 3 (finish)
-        auto finishCopyFromStorageTrigger = TriggerBuilder(copy2Address, instruction, m_TriggersOwner);
-        finishCopyFromStorageTrigger.Cond_TestReg(Reg_CopyStorage, 0, TriggerComparisonType::Exactly);
         finishCopyFromStorageTrigger.Action_JumpTo(retAddress);
         PushTriggers(finishCopyFromStorageTrigger.GetTriggers());
 
         return copyAddress;
     }
 
+    unsigned int Compiler::CodeGen_BeginInPlaceQuantity(TriggerBuilder& current, unsigned int& nextAddress)
+    {
+        // the pending actions have to run first since they might set the variable
+        auto address = nextAddress++;
+        current.Action_SetReg(m_CopyStorageRegId, 0);
+        current.Action_JumpTo(address);
+        PushTriggers(current.GetTriggers());
+        return address;
+    }
+
+    TriggerBuilder Compiler::CodeGen_EndInPlaceQuantity(unsigned int regId, unsigned int address, unsigned int& nextAddress, IIRInstruction* instruction)
+    {
+        // quantities above the limit keep the unit action triggers running for more scans,
+        // storage is only given back once the variable is empty
+        auto restoreAddress = nextAddress++;
+        auto drained = TriggerBuilder(address, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        drained.Cond_TestReg(regId, 0, TriggerComparisonType::Exactly);
+        drained.Action_JumpTo(restoreAddress);
+        PushTriggers(drained.GetTriggers());
+
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto restore = TriggerBuilder(restoreAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            restore.Cond_TestReg(m_CopyStorageRegId, i, TriggerComparisonType::AtLeast);
+            restore.Action_DecReg(m_CopyStorageRegId, i);
+            restore.Action_IncReg(regId, i);
+            PushTriggers(restore.GetTriggers());
+        }
+
+        auto retAddress = nextAddress++;
+        auto finish = TriggerBuilder(restoreAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+        finish.Cond_TestReg(m_CopyStorageRegId, 0, TriggerComparisonType::Exactly);
+        finish.Action_JumpTo(retAddress);
+        PushTriggers(finish.GetTriggers());
+
+        return TriggerBuilder(retAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+    }
+
     void Compiler::Action_PreserveTrigger(TriggerAction& retAction)
     {
         using namespace CHK;
@@ -2682,13 +4057,13 @@ namespace LangUMS
         retAction.m_Flags = 16;
     }
 
-    void Compiler::Action_JumpTo(unsigned int address, TriggerAction& retAction)
+    void Compiler::Action_JumpTo(unsigned int address, unsigned int counterRegId, TriggerAction& retAction)
     {
         using namespace CHK;
         retAction.m_ActionType = TriggerActionType::SetDeaths;
         retAction.m_Modifier = (uint8_t)TriggerActionState::SetTo;
 
-        auto& regDef = g_RegisterMap[Reg_InstructionCounter];
+        auto& regDef = g_RegisterMap[counterRegId];
 
         retAction.m_Flags = 16;
         retAction.m_Group = regDef.m_PlayerId;
@@ -2722,7 +4097,7 @@ namespace LangUMS
             if (jmpTarget != nullptr)
             {
                 auto ptr = &m_Triggers.back();
-                m_JmpPatchups.insert(std::make_pair(ptr, jmpTarget));
+                m_JmpPatchups.insert(std::make_pair(ptr, std::make_pair(jmpTarget, m_CurrentCounterRegId)));
             }
         }
     }
@@ -2764,7 +4139,7 @@ namespace LangUMS
     {
         for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
         {
-            auto indirectJump = TriggerBuilder(-1, nullptr, m_TriggersOwner);
+            auto indirectJump = TriggerBuilder(-1, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             indirectJump.Cond_TestSwitch(Switch_InstructionCounterMutex, true);
             indirectJump.Cond_TestReg(Reg_IndirectJumpAddress, i, TriggerComparisonType::AtLeast);
             indirectJump.Action_DecReg(Reg_IndirectJumpAddress, i);
@@ -2772,13 +4147,194 @@ namespace LangUMS
             PushTriggers(indirectJump.GetTriggers());
         }
 
-        auto indirectJumpFinish = TriggerBuilder(-1, nullptr, m_TriggersOwner);
+        auto indirectJumpFinish = TriggerBuilder(-1, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         indirectJumpFinish.Cond_TestSwitch(Switch_InstructionCounterMutex, true);
         indirectJumpFinish.Cond_TestReg(Reg_IndirectJumpAddress, 0, TriggerComparisonType::Exactly);
         indirectJumpFinish.Action_SetSwitch(Switch_InstructionCounterMutex, TriggerActionState::ClearSwitch);
         PushTriggers(indirectJumpFinish.GetTriggers());
     }
 
+    uint8_t Compiler::GetNextRegionOwner()
+    {
+        if (m_RegionOwners.empty())
+        {
+            return m_TriggersOwner;
+        }
+
+        return m_RegionOwners[m_NextRegionOwner++ % m_RegionOwners.size()];
+    }
+
+    // the errors below point at the code a trigger was emitted for, the address alone means nothing to the user
+    static IIRInstruction* FindInstructionAtAddress(unsigned int address)
+    {
+        auto it = g_AddressToInstructionMap.find(address);
+        if (it == g_AddressToInstructionMap.end())
+        {
+            return nullptr;
+        }
+
+        for (auto instruction : it->second)
+        {
+            if (instruction->GetASTNode() != nullptr)
+            {
+                return instruction;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static std::string GetOwnerMaskPlayers(unsigned int ownerMask)
+    {
+        std::string players;
+        for (auto i = 0u; i < 8; i++)
+        {
+            if ((ownerMask & (1 << i)) == 0)
+            {
+                continue;
+            }
+
+            if (!players.empty())
+            {
+                players.append(", ");
+            }
+
+            players.append(std::to_string(i + 1));
+        }
+
+        return players;
+    }
+
+    void Compiler::VerifyTriggerOwners()
+    {
+        using namespace CHK;
+
+        std::set<unsigned int> counterRegIds;
+        counterRegIds.insert(Reg_InstructionCounter);
+
+        for (auto& task : m_TaskAddresses)
+        {
+            counterRegIds.insert(((IRTaskInstruction*)task.first)->GetCounterRegisterId());
+        }
+
+        // the lists of different players run one after another so the triggers which advance a counter
+        // from one address must all belong to the same player or their order within a cycle is lost
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> addressOwners;
+
+        for (auto& trigger : m_Triggers)
+        {
+            auto& addressCondition = trigger.m_Conditions[0];
+            if (addressCondition.m_Condition != TriggerConditionType::Deaths || addressCondition.m_Comparison != TriggerComparisonType::Exactly)
+            {
+                continue;
+            }
+
+            auto counterRegId = -1;
+            for (auto regId : counterRegIds)
+            {
+                auto& regDef = g_RegisterMap[regId];
+                if (addressCondition.m_Group == regDef.m_PlayerId && addressCondition.m_UnitId == regDef.m_Index)
+                {
+                    counterRegId = (int)regId;
+                    break;
+                }
+            }
+
+            if (counterRegId == -1)
+            {
+                continue;
+            }
+
+            auto address = addressCondition.m_Quantity;
+
+            // code on the main instruction counter must stay blocked while an indirect jump rebuilds it
+            if (counterRegId == Reg_InstructionCounter)
+            {
+                auto hasMutex = false;
+                for (auto& condition : trigger.m_Conditions)
+                {
+                    if (condition.m_Condition == TriggerConditionType::Switch &&
+                        condition.m_Arg0 == Switch_InstructionCounterMutex &&
+                        condition.m_Comparison == TriggerComparisonType::SwitchCleared)
+                    {
+                        hasMutex = true;
+                        break;
+                    }
+                }
+
+                if (!hasMutex)
+                {
+                    throw CompilerException(SafePrintf("Internal error. Trigger at address % ignores the instruction counter mutex", address), FindInstructionAtAddress(address));
+                }
+            }
+
+            auto& counterDef = g_RegisterMap[counterRegId];
+            auto advancesCounter = false;
+            for (auto& action : trigger.m_Actions)
+            {
+                if (action.m_ActionType == TriggerActionType::SetDeaths && action.m_Group == counterDef.m_PlayerId && action.m_Arg1 == counterDef.m_Index)
+                {
+                    advancesCounter = true;
+                    break;
+                }
+            }
+
+            if (!advancesCounter)
+            {
+                continue;
+            }
+
+            auto ownerMask = 0u;
+            for (auto i = 0u; i < 8; i++)
+            {
+                if (trigger.m_ExecutionMask[i])
+                {
+                    ownerMask |= 1 << i;
+                }
+            }
+
+            auto key = std::make_pair((unsigned int)counterRegId, address);
+            auto it = addressOwners.find(key);
+            if (it == addressOwners.end())
+            {
+                addressOwners[key] = ownerMask;
+            }
+            else if (it->second != ownerMask)
+            {
+                auto error = SafePrintf("This code is split between the trigger lists of players % and % and would lose its order, "
+                    "move it out of the event handler or task or compile without --distribute-triggers", GetOwnerMaskPlayers(it->second), GetOwnerMaskPlayers(ownerMask));
+                throw CompilerException(error, FindInstructionAtAddress(address));
+            }
+        }
+    }
+
+    void Compiler::EmitYieldTriggers(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, unsigned int startIndex, unsigned int& nextAddress)
+    {
+        // every yield up to the next task parks at a trigger pushed before any of its code, jumping back
+        // to it can only happen in the next cycle which then resumes right after the yield
+        for (auto i = startIndex; i < instructions.size(); i++)
+        {
+            auto instruction = instructions[i].get();
+            if (instruction->GetType() == IRInstructionType::Task)
+            {
+                break;
+            }
+
+            if (instruction->GetType() != IRInstructionType::Yield)
+            {
+                continue;
+            }
+
+            auto parkAddress = nextAddress++;
+            auto resumeAddress = nextAddress++;
+            m_YieldAddresses[instruction] = std::make_pair(parkAddress, resumeAddress);
+
+            auto park = TriggerBuilder(parkAddress, instruction, m_CurrentOwner, m_CurrentCounterRegId);
+            park.Action_JumpTo(resumeAddress);
+            PushTriggers(park.GetTriggers());
+        }
+    }
+
     void Compiler::EmitMulInstructionCode(unsigned int& nextAddress)
     {
         auto mulAddress = nextAddress++;
@@ -2790,26 +4346,26 @@ namespace LangUMS
 
         m_MultiplyAddress = nextAddress++;
 
-        auto prepare = TriggerBuilder(m_MultiplyAddress, nullptr, m_TriggersOwner);
+        auto prepare = TriggerBuilder(m_MultiplyAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         prepare.Action_SetReg(Reg_Temp0, 0);
         prepare.Action_SetReg(Reg_Temp1, 0);
         prepare.Action_JumpTo(mulAddress);
         PushTriggers(prepare.GetTriggers());
 
         // handle multiply by zero
-        auto zeroR = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+        auto zeroR = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         zeroR.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
         DoIndirectJump(zeroR);
         PushTriggers(zeroR.GetTriggers());
 
-        auto zeroL = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+        auto zeroL = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         zeroL.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
         zeroL.Action_SetReg(Reg_MulRight, 0);
         DoIndirectJump(zeroL);
         PushTriggers(zeroL.GetTriggers());
 
         // handle multiply by one
-        auto oneL = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+        auto oneL = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         oneL.Cond_TestReg(Reg_MulLeft, 1, TriggerComparisonType::Exactly);
         DoIndirectJump(oneL);
         PushTriggers(oneL.GetTriggers());
@@ -2817,7 +4373,7 @@ namespace LangUMS
         // count bits
         for (auto i = m_CopyBatchSize; i >= 2; i /= 2)
         {
-            auto countBits = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+            auto countBits = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             countBits.Cond_TestReg(Reg_MulRight, i, TriggerComparisonType::AtLeast);
             countBits.Action_DecReg(Reg_MulRight, i);
             countBits.Action_IncReg(Reg_Temp0, (int)std::log2(i));
@@ -2826,13 +4382,13 @@ namespace LangUMS
 
         auto copyAddress = CodeGen_CopyReg(Reg_Temp2, Reg_MulLeft, nextAddress, checkAddress, nullptr);
 
-        auto finishCountBits = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+        auto finishCountBits = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         finishCountBits.Cond_TestReg(Reg_MulRight, 1, TriggerComparisonType::Exactly);
         finishCountBits.Action_SetReg(Reg_Temp2, 0);
         finishCountBits.Action_JumpTo(copyAddress);
         PushTriggers(finishCountBits.GetTriggers());
 
-        auto finishCountBits2 = TriggerBuilder(mulAddress, nullptr, m_TriggersOwner);
+        auto finishCountBits2 = TriggerBuilder(mulAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         finishCountBits2.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
         finishCountBits2.Action_SetReg(Reg_Temp2, 0);
         finishCountBits2.Action_JumpTo(checkAddress);
@@ -2840,14 +4396,14 @@ namespace LangUMS
 
         for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
         {
-            auto shiftA = TriggerBuilder(rightToLeftAddress, nullptr, m_TriggersOwner);
+            auto shiftA = TriggerBuilder(rightToLeftAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             shiftA.Cond_TestReg(Reg_MulRight, i, TriggerComparisonType::AtLeast);
             shiftA.Action_DecReg(Reg_MulRight, i);
             shiftA.Action_IncReg(Reg_MulLeft, i * 2);
             PushTriggers(shiftA.GetTriggers());
         }
 
-        auto shiftAFinish = TriggerBuilder(rightToLeftAddress, nullptr, m_TriggersOwner);
+        auto shiftAFinish = TriggerBuilder(rightToLeftAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         shiftAFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
         shiftAFinish.Action_SetReg(Reg_Temp1, 0);
         shiftAFinish.Action_JumpTo(checkAddress);
@@ -2855,14 +4411,14 @@ namespace LangUMS
 
         for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
         {
-            auto shiftB = TriggerBuilder(leftToRightAddress, nullptr, m_TriggersOwner);
+            auto shiftB = TriggerBuilder(leftToRightAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             shiftB.Cond_TestReg(Reg_MulLeft, i, TriggerComparisonType::AtLeast);
             shiftB.Action_DecReg(Reg_MulLeft, i);
             shiftB.Action_IncReg(Reg_MulRight, i * 2);
             PushTriggers(shiftB.GetTriggers());
         }
 
-        auto shiftBFinish = TriggerBuilder(leftToRightAddress, nullptr, m_TriggersOwner);
+        auto shiftBFinish = TriggerBuilder(leftToRightAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         shiftBFinish.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
         shiftBFinish.Action_SetReg(Reg_Temp1, 1);
         shiftBFinish.Action_JumpTo(checkAddress);
@@ -2870,31 +4426,31 @@ namespace LangUMS
 
         for (auto i = m_CopyBatchSize; i >= 1; i /= 2) // next we'll use the counter from step 1 to multiply the other operand that many times by 2
         {
-            auto move = TriggerBuilder(moveAddress, nullptr, m_TriggersOwner);
+            auto move = TriggerBuilder(moveAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             move.Cond_TestReg(Reg_MulLeft, i, TriggerComparisonType::AtLeast);
             move.Action_DecReg(Reg_MulLeft, i);
             move.Action_IncReg(Reg_MulRight, i);
             PushTriggers(move.GetTriggers());
         }
 
-        auto moveFinish = TriggerBuilder(moveAddress, nullptr, m_TriggersOwner);
+        auto moveFinish = TriggerBuilder(moveAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         moveFinish.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
         moveFinish.Action_JumpTo(finishAddress);
         PushTriggers(moveFinish.GetTriggers());
 
-        auto checkA = TriggerBuilder(checkAddress, nullptr, m_TriggersOwner);
+        auto checkA = TriggerBuilder(checkAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         checkA.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
         checkA.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
         checkA.Action_JumpTo(moveAddress);
         PushTriggers(checkA.GetTriggers());
 
-        auto checkB = TriggerBuilder(checkAddress, nullptr, m_TriggersOwner);
+        auto checkB = TriggerBuilder(checkAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         checkB.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
         checkB.Cond_TestReg(Reg_Temp1, 1, TriggerComparisonType::Exactly);
         checkB.Action_JumpTo(finishAddress);
         PushTriggers(checkB.GetTriggers());
 
-        auto checkNotDoneA = TriggerBuilder(checkAddress, nullptr, m_TriggersOwner);
+        auto checkNotDoneA = TriggerBuilder(checkAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         checkNotDoneA.Cond_TestReg(Reg_Temp0, 1, TriggerComparisonType::AtLeast);
         checkNotDoneA.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
         checkNotDoneA.Action_DecReg(Reg_Temp0, 1);
@@ -2902,7 +4458,7 @@ namespace LangUMS
         checkNotDoneA.Action_JumpTo(leftToRightAddress);
         PushTriggers(checkNotDoneA.GetTriggers());
 
-        auto checkNotDoneB = TriggerBuilder(checkAddress, nullptr, m_TriggersOwner);
+        auto checkNotDoneB = TriggerBuilder(checkAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         checkNotDoneB.Cond_TestReg(Reg_Temp0, 1, TriggerComparisonType::AtLeast);
         checkNotDoneB.Cond_TestReg(Reg_Temp1, 1, TriggerComparisonType::Exactly);
         checkNotDoneB.Action_DecReg(Reg_Temp0, 1);
@@ -2912,17 +4468,316 @@ namespace LangUMS
 
         for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
         {
-            auto finish = TriggerBuilder(finishAddress, nullptr, m_TriggersOwner);
+            auto finish = TriggerBuilder(finishAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
             finish.Cond_TestReg(Reg_Temp2, i, TriggerComparisonType::AtLeast);
             finish.Action_DecReg(Reg_Temp2, i);
             finish.Action_IncReg(Reg_MulRight, i);
             PushTriggers(finish.GetTriggers());
         }
 
-        auto finishMul = TriggerBuilder(finishAddress, nullptr, m_TriggersOwner);
+        auto finishMul = TriggerBuilder(finishAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
         finishMul.Cond_TestReg(Reg_Temp2, 0, TriggerComparisonType::Exactly);
         DoIndirectJump(finishMul);
         PushTriggers(finishMul.GetTriggers());
     }
 
+    void Compiler::EmitMinMaxInstructionCode(unsigned int& nextAddress)
+    {
+        // both operands are drained in parallel until one of them runs out, what was drained is the smaller one
+        // and what is left over is the difference, min(), max() and abs_diff() pick their result from those
+        auto drainAddress = nextAddress++;
+        m_MinMaxAddress = nextAddress++;
+
+        auto prepare = TriggerBuilder(m_MinMaxAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        prepare.Action_SetReg(Reg_Temp0, 0);
+        prepare.Action_JumpTo(drainAddress);
+        PushTriggers(prepare.GetTriggers());
+
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto drain = TriggerBuilder(drainAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+            drain.Cond_TestReg(Reg_MulLeft, i, TriggerComparisonType::AtLeast);
+            drain.Cond_TestReg(Reg_MulRight, i, TriggerComparisonType::AtLeast);
+            drain.Action_DecReg(Reg_MulLeft, i);
+            drain.Action_DecReg(Reg_MulRight, i);
+            drain.Action_IncReg(Reg_Temp0, i);
+            PushTriggers(drain.GetTriggers());
+        }
+
+        auto finishLeft = TriggerBuilder(drainAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        finishLeft.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
+        DoIndirectJump(finishLeft);
+        PushTriggers(finishLeft.GetTriggers());
+
+        auto finishRight = TriggerBuilder(drainAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        finishRight.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+        DoIndirectJump(finishRight);
+        PushTriggers(finishRight.GetTriggers());
+    }
+
+    void Compiler::EmitISqrtInstructionCode(unsigned int& nextAddress)
+    {
+        // integer square root by extracting one binary digit of the result per iteration
+        // x = MulLeft, result = MulRight, bit = Temp0, x - (result + bit) is tested through Temp1,
+        // Temp2 holds the bit and Reg_CopyStorage holds the result while they are being copied
+        auto loopAddress = nextAddress++;
+        auto copyAddress = nextAddress++;
+        auto restoreAddress = nextAddress++;
+        auto compareAddress = nextAddress++;
+        auto greaterAddress = nextAddress++;
+        auto greater2Address = nextAddress++;
+        auto lessAddress = nextAddress++;
+        auto less2Address = nextAddress++;
+        auto quarterAddress = nextAddress++;
+
+        m_ISqrtAddress = nextAddress++;
+
+        // start at the highest power of four not above x
+        for (auto i = 15; i >= 0; i--)
+        {
+            auto start = TriggerBuilder(m_ISqrtAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+            start.Cond_TestReg(Reg_MulLeft, 1u << (i * 2), TriggerComparisonType::AtLeast);
+            start.Action_SetReg(Reg_MulRight, 0);
+            start.Action_SetReg(Reg_Temp0, 1u << (i * 2));
+            start.Action_SetReg(Reg_Temp1, 0);
+            start.Action_SetReg(Reg_Temp2, 0);
+            start.Action_SetReg(Reg_CopyStorage, 0);
+            start.Action_JumpTo(loopAddress);
+            PushTriggers(start.GetTriggers());
+        }
+
+        auto zero = TriggerBuilder(m_ISqrtAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        zero.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
+        zero.Action_SetReg(Reg_MulRight, 0);
+        DoIndirectJump(zero);
+        PushTriggers(zero.GetTriggers());
+
+        auto done = TriggerBuilder(loopAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        done.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        DoIndirectJump(done);
+        PushTriggers(done.GetTriggers());
+
+        auto next = TriggerBuilder(loopAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        next.Cond_TestReg(Reg_Temp0, 1, TriggerComparisonType::AtLeast);
+        next.Action_JumpTo(copyAddress);
+        PushTriggers(next.GetTriggers());
+
+        // Temp1 = result + bit
+        CodeGen_Drain(copyAddress, Reg_MulRight, { Reg_Temp1, Reg_CopyStorage }, nullptr);
+        CodeGen_Drain(copyAddress, Reg_Temp0, { Reg_Temp1, Reg_Temp2 }, nullptr);
+
+        auto copyFinish = TriggerBuilder(copyAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        copyFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+        copyFinish.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        copyFinish.Action_JumpTo(restoreAddress);
+        PushTriggers(copyFinish.GetTriggers());
+
+        CodeGen_Drain(restoreAddress, Reg_CopyStorage, { Reg_MulRight }, nullptr);
+        CodeGen_Drain(restoreAddress, Reg_Temp2, { Reg_Temp0 }, nullptr);
+
+        auto restoreFinish = TriggerBuilder(restoreAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        restoreFinish.Cond_TestReg(Reg_CopyStorage, 0, TriggerComparisonType::Exactly);
+        restoreFinish.Cond_TestReg(Reg_Temp2, 0, TriggerComparisonType::Exactly);
+        restoreFinish.Action_JumpTo(compareAddress);
+        PushTriggers(restoreFinish.GetTriggers());
+
+        // subtract result + bit from x, Reg_CopyStorage keeps what was subtracted in case it doesn't fit
+        for (auto i = m_CopyBatchSize; i >= 1; i /= 2)
+        {
+            auto compare = TriggerBuilder(compareAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+            compare.Cond_TestReg(Reg_MulLeft, i, TriggerComparisonType::AtLeast);
+            compare.Cond_TestReg(Reg_Temp1, i, TriggerComparisonType::AtLeast);
+            compare.Action_DecReg(Reg_MulLeft, i);
+            compare.Action_DecReg(Reg_Temp1, i);
+            compare.Action_IncReg(Reg_CopyStorage, i);
+            PushTriggers(compare.GetTriggers());
+        }
+
+        auto greater = TriggerBuilder(compareAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        greater.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
+        greater.Action_SetReg(Reg_CopyStorage, 0);
+        greater.Action_JumpTo(greaterAddress);
+        PushTriggers(greater.GetTriggers());
+
+        auto less = TriggerBuilder(compareAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        less.Cond_TestReg(Reg_MulLeft, 0, TriggerComparisonType::Exactly);
+        less.Cond_TestReg(Reg_Temp1, 1, TriggerComparisonType::AtLeast);
+        less.Action_SetReg(Reg_Temp1, 0);
+        less.Action_JumpTo(lessAddress);
+        PushTriggers(less.GetTriggers());
+
+        // x >= result + bit, result = result / 2 + bit
+        CodeGen_ShiftRight(greaterAddress, Reg_MulRight, Reg_Temp1, 1, nullptr);
+
+        auto greaterFinish = TriggerBuilder(greaterAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        greaterFinish.Cond_TestReg(Reg_MulRight, 1, TriggerComparisonType::AtMost);
+        greaterFinish.Action_SetReg(Reg_MulRight, 0);
+        greaterFinish.Action_JumpTo(greater2Address);
+        PushTriggers(greaterFinish.GetTriggers());
+
+        CodeGen_Drain(greater2Address, Reg_Temp1, { Reg_MulRight }, nullptr);
+        CodeGen_Drain(greater2Address, Reg_Temp0, { Reg_MulRight, Reg_Temp2 }, nullptr);
+
+        auto greater2Finish = TriggerBuilder(greater2Address, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        greater2Finish.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
+        greater2Finish.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        greater2Finish.Action_JumpTo(quarterAddress);
+        PushTriggers(greater2Finish.GetTriggers());
+
+        // x < result + bit, put x back and result = result / 2
+        CodeGen_Drain(lessAddress, Reg_CopyStorage, { Reg_MulLeft }, nullptr);
+        CodeGen_ShiftRight(lessAddress, Reg_MulRight, Reg_Temp1, 1, nullptr);
+        CodeGen_Drain(lessAddress, Reg_Temp0, { Reg_Temp2 }, nullptr);
+
+        auto lessFinish = TriggerBuilder(lessAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        lessFinish.Cond_TestReg(Reg_CopyStorage, 0, TriggerComparisonType::Exactly);
+        lessFinish.Cond_TestReg(Reg_MulRight, 1, TriggerComparisonType::AtMost);
+        lessFinish.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        lessFinish.Action_SetReg(Reg_MulRight, 0);
+        lessFinish.Action_JumpTo(less2Address);
+        PushTriggers(lessFinish.GetTriggers());
+
+        CodeGen_Drain(less2Address, Reg_Temp1, { Reg_MulRight }, nullptr);
+
+        auto less2Finish = TriggerBuilder(less2Address, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        less2Finish.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
+        less2Finish.Action_JumpTo(quarterAddress);
+        PushTriggers(less2Finish.GetTriggers());
+
+        // bit = bit / 4
+        CodeGen_ShiftRight(quarterAddress, Reg_Temp2, Reg_Temp0, 2, nullptr);
+
+        auto quarterFinish = TriggerBuilder(quarterAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        quarterFinish.Cond_TestReg(Reg_Temp2, 3, TriggerComparisonType::AtMost);
+        quarterFinish.Action_SetReg(Reg_Temp2, 0);
+        quarterFinish.Action_JumpTo(loopAddress);
+        PushTriggers(quarterFinish.GetTriggers());
+    }
+
+    void Compiler::EmitPowInstructionCode(IRPowInstruction* pow, unsigned int& nextAddress)
+    {
+        // exponentiation by squaring on top of the shared multiply routine, which clobbers all scratch registers
+        // so the routine keeps its state in registers of its own and returns through the one it was given
+        auto baseRegId = pow->GetBaseRegisterId();
+        auto exponentRegId = pow->GetExponentRegisterId();
+        auto resultRegId = pow->GetResultRegisterId();
+        auto returnRegId = pow->GetReturnRegisterId();
+
+        auto loopAddress = nextAddress++;
+        auto returnAddress = nextAddress++;
+        auto halveAddress = nextAddress++;
+        auto oddAddress = nextAddress++;
+        auto odd2Address = nextAddress++;
+        auto oddResultAddress = nextAddress++;
+        auto evenAddress = nextAddress++;
+        auto squareAddress = nextAddress++;
+        auto square2Address = nextAddress++;
+        auto squareResultAddress = nextAddress++;
+
+        m_PowAddress = nextAddress++;
+
+        auto prepare = TriggerBuilder(m_PowAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        prepare.Action_SetReg(resultRegId, 1);
+        prepare.Action_JumpTo(loopAddress);
+        PushTriggers(prepare.GetTriggers());
+
+        auto done = TriggerBuilder(loopAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        done.Cond_TestReg(exponentRegId, 0, TriggerComparisonType::Exactly);
+        done.Action_SetReg(Reg_IndirectJumpAddress, 0);
+        done.Action_JumpTo(returnAddress);
+        PushTriggers(done.GetTriggers());
+
+        auto next = TriggerBuilder(loopAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        next.Cond_TestReg(exponentRegId, 1, TriggerComparisonType::AtLeast);
+        next.Action_SetReg(Reg_Temp0, 0);
+        next.Action_JumpTo(halveAddress);
+        PushTriggers(next.GetTriggers());
+
+        CodeGen_Drain(returnAddress, returnRegId, { Reg_IndirectJumpAddress }, nullptr);
+
+        auto returnFinish = TriggerBuilder(returnAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        returnFinish.Cond_TestReg(returnRegId, 0, TriggerComparisonType::Exactly);
+        DoIndirectJump(returnFinish);
+        PushTriggers(returnFinish.GetTriggers());
+
+        // split off the lowest bit of the exponent
+        CodeGen_ShiftRight(halveAddress, exponentRegId, Reg_Temp0, 1, nullptr);
+
+        auto odd = TriggerBuilder(halveAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        odd.Cond_TestReg(exponentRegId, 1, TriggerComparisonType::Exactly);
+        odd.Action_SetReg(exponentRegId, 0);
+        odd.Action_SetReg(Reg_MulLeft, 0);
+        odd.Action_SetReg(Reg_MulRight, 0);
+        odd.Action_SetReg(Reg_Temp1, 0);
+        odd.Action_JumpTo(oddAddress);
+        PushTriggers(odd.GetTriggers());
+
+        auto even = TriggerBuilder(halveAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        even.Cond_TestReg(exponentRegId, 0, TriggerComparisonType::Exactly);
+        even.Action_JumpTo(evenAddress);
+        PushTriggers(even.GetTriggers());
+
+        // result = result * base
+        CodeGen_Drain(oddAddress, Reg_Temp0, { exponentRegId }, nullptr);
+        CodeGen_Drain(oddAddress, baseRegId, { Reg_MulLeft, Reg_Temp1 }, nullptr);
+        CodeGen_Drain(oddAddress, resultRegId, { Reg_MulRight }, nullptr);
+
+        auto oddFinish = TriggerBuilder(oddAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        oddFinish.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        oddFinish.Cond_TestReg(baseRegId, 0, TriggerComparisonType::Exactly);
+        oddFinish.Cond_TestReg(resultRegId, 0, TriggerComparisonType::Exactly);
+        oddFinish.Action_JumpTo(odd2Address);
+        PushTriggers(oddFinish.GetTriggers());
+
+        CodeGen_Drain(odd2Address, Reg_Temp1, { baseRegId }, nullptr);
+
+        auto odd2Finish = TriggerBuilder(odd2Address, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        odd2Finish.Cond_TestReg(Reg_Temp1, 0, TriggerComparisonType::Exactly);
+        odd2Finish.Action_SetReg(Reg_IndirectJumpAddress, oddResultAddress);
+        odd2Finish.Action_JumpTo(m_MultiplyAddress);
+        PushTriggers(odd2Finish.GetTriggers());
+
+        CodeGen_Drain(oddResultAddress, Reg_MulRight, { resultRegId }, nullptr);
+
+        auto oddResultFinish = TriggerBuilder(oddResultAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        oddResultFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+        oddResultFinish.Action_JumpTo(squareAddress);
+        PushTriggers(oddResultFinish.GetTriggers());
+
+        CodeGen_Drain(evenAddress, Reg_Temp0, { exponentRegId }, nullptr);
+
+        auto evenFinish = TriggerBuilder(evenAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        evenFinish.Cond_TestReg(Reg_Temp0, 0, TriggerComparisonType::Exactly);
+        evenFinish.Action_JumpTo(squareAddress);
+        PushTriggers(evenFinish.GetTriggers());
+
+        // base = base * base, skipped after the last bit
+        auto skipSquare = TriggerBuilder(squareAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        skipSquare.Cond_TestReg(exponentRegId, 0, TriggerComparisonType::Exactly);
+        skipSquare.Action_JumpTo(loopAddress);
+        PushTriggers(skipSquare.GetTriggers());
+
+        auto square = TriggerBuilder(squareAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        square.Cond_TestReg(exponentRegId, 1, TriggerComparisonType::AtLeast);
+        square.Action_SetReg(Reg_MulLeft, 0);
+        square.Action_SetReg(Reg_MulRight, 0);
+        square.Action_JumpTo(square2Address);
+        PushTriggers(square.GetTriggers());
+
+        CodeGen_Drain(square2Address, baseRegId, { Reg_MulLeft, Reg_MulRight }, nullptr);
+
+        auto square2Finish = TriggerBuilder(square2Address, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        square2Finish.Cond_TestReg(baseRegId, 0, TriggerComparisonType::Exactly);
+        square2Finish.Action_SetReg(Reg_IndirectJumpAddress, squareResultAddress);
+        square2Finish.Action_JumpTo(m_MultiplyAddress);
+        PushTriggers(square2Finish.GetTriggers());
+
+        CodeGen_Drain(squareResultAddress, Reg_MulRight, { baseRegId }, nullptr);
+
+        auto squareResultFinish = TriggerBuilder(squareResultAddress, nullptr, m_CurrentOwner, m_CurrentCounterRegId);
+        squareResultFinish.Cond_TestReg(Reg_MulRight, 0, TriggerComparisonType::Exactly);
+        squareResultFinish.Action_JumpTo(loopAddress);
+        PushTriggers(squareResultFinish.GetTriggers());
+    }
+
 }
@@ -8,6 +8,7 @@
 #include "ir.h"
 #include "../libchk/src/chk.h"
 #include "triggerbuilder.h"
+#include "cost_model.h"
 
 #define MAX_TRIGGERS_COUNT 16384
 
@@ -36,9 +37,13 @@ namespace LangUMS
         public:
         Compiler(bool debug);
 
-        void SetCopyBatchSize(uint32_t copyBatchSize)
+        void SetCostModel(const CostModel& costModel)
         {
-            m_CopyBatchSize = copyBatchSize;
+            m_CostModel = costModel;
+            m_CopyBatchSize = costModel.GetCopyBatchSize();
+            m_HyperTriggerCount = costModel.GetHyperTriggerCount();
+            m_TableCopyRange = costModel.GetTableCopyRange();
+            m_RegionOwners = costModel.GetRegionOwners();
         }
 
         void SetTriggersOwner(uint8_t owner)
@@ -57,13 +62,29 @@ namespace LangUMS
         void Cond_Always(TriggerCondition& retCondition);
 
         unsigned int CodeGen_CopyReg(unsigned int dstRegId, unsigned int srcRegId, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction);
+        unsigned int CodeGen_IndexedCopy(unsigned int dstRegId, unsigned int indexRegId, const std::vector<unsigned int>& elementRegIds, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction);
+        void CodeGen_TableCopyReg(unsigned int dstRegId, unsigned int srcRegId, unsigned int tableAddress, unsigned int fallbackAddress, unsigned int retAddress, IIRInstruction* instruction);
+        int CodeGen_Condition(TriggerBuilder& trigger, IIRInstruction* condition, IIRInstruction* instruction);
+        void CodeGen_RawTriggerAction(TriggerBuilder& trigger, IIRInstruction* action);
+        void CodeGen_Drain(unsigned int address, unsigned int srcReg, const std::vector<unsigned int>& dstRegs, IIRInstruction* instruction);
+        void CodeGen_ShiftRight(unsigned int address, unsigned int srcReg, unsigned int dstReg, unsigned int bits, IIRInstruction* instruction);
+        unsigned int CodeGen_FusedCopy(const std::vector<FusedCopyEntry>& entries, const std::vector<unsigned int>& dstRegIds, const std::vector<unsigned int>& storage, unsigned int& nextAddress, unsigned int retAddress, IIRInstruction* instruction);
+        unsigned int CodeGen_BeginInPlaceQuantity(TriggerBuilder& current, unsigned int& nextAddress);
+        TriggerBuilder CodeGen_EndInPlaceQuantity(unsigned int regId, unsigned int address, unsigned int& nextAddress, IIRInstruction* instruction);
         void Action_PreserveTrigger(TriggerAction& retAction);
         void Action_Wait(unsigned int milliseconds, TriggerAction& retAction);
-        void Action_JumpTo(unsigned int address, TriggerAction& retAction);
+        void Action_JumpTo(unsigned int address, unsigned int counterRegId, TriggerAction& retAction);
 
         void DoIndirectJump(TriggerBuilder& trigger);
         void EmitIndirectJumpCode(unsigned int& nextAddress);
         void EmitMulInstructionCode(unsigned int& nextAddress);
+        void EmitMinMaxInstructionCode(unsigned int& nextAddress);
+        void EmitISqrtInstructionCode(unsigned int& nextAddress);
+        void EmitPowInstructionCode(IRPowInstruction* pow, unsigned int& nextAddress);
+        void EmitYieldTriggers(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, unsigned int startIndex, unsigned int& nextAddress);
+
+        uint8_t GetNextRegionOwner();
+        void VerifyTriggerOwners();
 
         unsigned int GetLocationIdByName(const std::string& name, IIRInstruction* instruction);
         int GetLastTriggerActionId(const Trigger& trigger);
@@ -71,13 +92,24 @@ namespace LangUMS
         void PushTriggers(const std::vector<Trigger>& triggers, IIRInstruction* jmpTarget = nullptr);
 
         std::vector<Trigger> m_Triggers;
-        std::unordered_map<Trigger*, IIRInstruction*> m_JmpPatchups;
+        std::unordered_map<Trigger*, std::pair<IIRInstruction*, unsigned int>> m_JmpPatchups;
         std::set<IIRInstruction*> m_JumpTargets;
         std::unordered_map<IIRInstruction*, unsigned int> m_JumpAddresses;
+        std::unordered_map<IIRInstruction*, std::vector<IIRInstruction*>> m_CallSites;
+        std::unordered_map<IIRInstruction*, unsigned int> m_ReturnAddresses;
+        std::unordered_map<IIRInstruction*, unsigned int> m_TaskAddresses;
+        std::unordered_map<IIRInstruction*, std::pair<unsigned int, unsigned int>> m_YieldAddresses;
+        std::unordered_map<IIRInstruction*, uint8_t> m_OwnerChanges;
 
         uint32_t m_CopyBatchSize = 8192u;
         uint32_t m_HyperTriggerCount = 5;
+        uint32_t m_TableCopyRange = 16u;
+        CostModel m_CostModel;
         uint8_t m_TriggersOwner = 1;
+        uint8_t m_CurrentOwner = 1;
+        unsigned int m_CurrentCounterRegId = Reg_InstructionCounter;
+        std::vector<uint8_t> m_RegionOwners;
+        unsigned int m_NextRegionOwner = 0;
 
         File* m_File = nullptr;
         STRChunk* m_StringsChunk = nullptr;
@@ -86,7 +118,14 @@ namespace LangUMS
         UPUSChunk* m_CuwpUsedChunk = nullptr;
 
         unsigned int m_StackPointer;
+        unsigned int m_LowestStackPointer;
+        unsigned int m_CopyStorageRegId = Reg_CopyStorage;
+        unsigned int m_MulLeftRegId = Reg_MulLeft;
+        unsigned int m_MulRightRegId = Reg_MulRight;
         unsigned int m_MultiplyAddress;
+        unsigned int m_MinMaxAddress;
+        unsigned int m_ISqrtAddress;
+        unsigned int m_PowAddress;
 
         std::vector<RegisterDef> m_RegisterMap;
         bool m_Debug = false;
@@ -0,0 +1,352 @@
+#include <cmath>
+
+#include "cost_model.h"
+
+namespace LangUMS
+{
+
+    // every trigger tests the instruction counter and its mutex and preserves itself
+    #define TRIGGER_CONDITION_OVERHEAD 2
+    #define TRIGGER_ACTION_OVERHEAD 1
+
+    // a game frame lasts 42ms on the fastest speed and a game second is 16 frames
+    #define MILLISECONDS_PER_FRAME 42
+    #define FRAMES_PER_GAME_SECOND 16
+
+    // without anything waiting the trigger lists only run once every two game seconds
+    #define FRAMES_PER_TRIGGER_CYCLE 32
+
+    // every hyper trigger holds this many Wait(0) actions, each one keeps the lists running for about a frame
+    #define WAITS_PER_HYPER_TRIGGER 63
+
+    // -Os and -Ot never lower the copy batch size below the default since multiplication is only correct up to it,
+    // they weigh larger sizes by how fast they copy values up to this range
+    #define MAX_COPY_BATCH_SIZE 65536
+    #define PLANNED_VALUE_RANGE 65535
+
+    bool CostModel::ParseLevel(const std::string& name, OptimizationLevel& retLevel)
+    {
+        if (name == "balanced")
+        {
+            retLevel = OptimizationLevel::Balanced;
+        }
+        else if (name == "size")
+        {
+            retLevel = OptimizationLevel::Size;
+        }
+        else if (name == "cycles")
+        {
+            retLevel = OptimizationLevel::Cycles;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* CostModel::GetLevelName(OptimizationLevel level)
+    {
+        switch (level)
+        {
+        case OptimizationLevel::Size:
+            return "size";
+        case OptimizationLevel::Cycles:
+            return "cycles";
+        default:
+            return "balanced";
+        }
+    }
+
+    bool CostModel::ParseHyperTriggerPlacement(const std::string& name, HyperTriggerPlacement& retPlacement)
+    {
+        if (name == "after-program")
+        {
+            retPlacement = HyperTriggerPlacement::AfterProgram;
+        }
+        else if (name == "start")
+        {
+            retPlacement = HyperTriggerPlacement::Start;
+        }
+        else if (name == "end")
+        {
+            retPlacement = HyperTriggerPlacement::End;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    uint32_t CostModel::GetCopyBatchSize() const
+    {
+        if (m_HasCopyBatchSize || m_Level == OptimizationLevel::Balanced)
+        {
+            return m_CopyBatchSize;
+        }
+
+        return ChooseCopyBatchSize();
+    }
+
+    uint32_t CostModel::ChooseCopyBatchSize() const
+    {
+        auto best = m_CopyBatchSize;
+        for (auto copyBatchSize = m_CopyBatchSize * 2; copyBatchSize <= MAX_COPY_BATCH_SIZE; copyBatchSize *= 2)
+        {
+            if (IsCheaper(EstimateCopyReg(copyBatchSize, PLANNED_VALUE_RANGE), EstimateCopyReg(best, PLANNED_VALUE_RANGE)))
+            {
+                best = copyBatchSize;
+            }
+        }
+
+        return best;
+    }
+
+    unsigned int CostModel::GetBatchSteps(uint32_t copyBatchSize) const
+    {
+        auto steps = 0u;
+        for (auto i = copyBatchSize; i >= 1; i /= 2)
+        {
+            steps++;
+        }
+
+        return steps;
+    }
+
+    CodeCost CostModel::EstimateDrainLoop(unsigned int conditionsPerStep, unsigned int actionsPerStep) const
+    {
+        return EstimateDrainLoop(conditionsPerStep, actionsPerStep, GetCopyBatchSize());
+    }
+
+    CodeCost CostModel::EstimateDrainLoop(unsigned int conditionsPerStep, unsigned int actionsPerStep, uint32_t copyBatchSize) const
+    {
+        auto steps = GetBatchSteps(copyBatchSize);
+
+        // one trigger per power of two plus the finishing trigger which tests for zero and jumps out
+        CodeCost cost;
+        cost.m_Triggers = steps + 1;
+        cost.m_Conditions = steps * (conditionsPerStep + TRIGGER_CONDITION_OVERHEAD) + 1 + TRIGGER_CONDITION_OVERHEAD;
+        cost.m_Actions = steps * (actionsPerStep + TRIGGER_ACTION_OVERHEAD) + 1 + TRIGGER_ACTION_OVERHEAD;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateCopyReg() const
+    {
+        auto copyBatchSize = GetCopyBatchSize();
+        return EstimateCopyReg(copyBatchSize, copyBatchSize);
+    }
+
+    CodeCost CostModel::EstimateCopyReg(uint32_t copyBatchSize, uint32_t value) const
+    {
+        // drain to storage then drain back into both registers
+        // the loops are pushed before the caller's continuation so returning costs a scan
+        auto cost = EstimateDrainLoop(1, 2, copyBatchSize) + EstimateDrainLoop(1, 3, copyBatchSize);
+        cost.m_Actions++;
+
+        // a scan drains up to twice the batch size minus one, both loops take that many scans
+        auto scans = (value + 2 * copyBatchSize - 2) / (2 * copyBatchSize - 1);
+        cost.m_Cycles = scans > 0 ? 2 * scans - 1 : 1;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateTableCopyReg() const
+    {
+        // one trigger per table entry plus the fallback into a regular copy
+        CodeCost table;
+        table.m_Triggers = m_TableCopyRange + 1;
+        table.m_Conditions = (m_TableCopyRange + 1) * (1 + TRIGGER_CONDITION_OVERHEAD);
+        table.m_Actions = m_TableCopyRange * (2 + TRIGGER_ACTION_OVERHEAD) + 2 + TRIGGER_ACTION_OVERHEAD;
+
+        // values inside the table finish in the same scan
+        auto cost = table + EstimateCopyReg();
+        cost.m_Cycles = m_TableCopyRange > 0 ? 0 : 1;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateFusedCopy(unsigned int count) const
+    {
+        CodeCost cost;
+        for (auto i = 0u; i < count; i++)
+        {
+            cost = cost + EstimateDrainLoop(1, 2) + EstimateDrainLoop(1, 3);
+        }
+
+        // the finishing triggers are shared between all copies
+        cost.m_Triggers -= 2 * (count - 1);
+        cost.m_Conditions -= 2 * (count - 1) * TRIGGER_CONDITION_OVERHEAD;
+        cost.m_Actions -= 2 * (count - 1) * (1 + TRIGGER_ACTION_OVERHEAD);
+        cost.m_Cycles = 1;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateAdd() const
+    {
+        // the loop is pushed after the caller so the whole addition runs in the same scan
+        return EstimateDrainLoop(1, 2);
+    }
+
+    CodeCost CostModel::EstimateMulConst(int value) const
+    {
+        auto cost = EstimateDrainLoop(1, 3) + EstimateDrainLoop(1, 2);
+        if (value % 2)
+        {
+            cost = cost + EstimateDrainLoop(1, 2);
+        }
+
+        cost.m_Actions += 2;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateMulByTwoAsAdd() const
+    {
+        // push of a zero, copy of the operand into it and an addition
+        auto cost = EstimateCopyReg() + EstimateAdd();
+        cost.m_Actions++;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateStackQuantityAction() const
+    {
+        // the variable is copied on top of the stack which is then drained one unit action per power of two
+        auto cost = EstimateCopyReg() + EstimateDrainLoop(1, 2, GetUnitQuantityBatchSize());
+        cost.m_Actions++;
+        return cost;
+    }
+
+    CodeCost CostModel::EstimateInPlaceQuantityAction() const
+    {
+        // the variable is drained into storage with the unit actions and storage is drained back into it once
+        // the variable is empty, both loops run in the same scan for quantities up to the limit
+        auto cost = EstimateDrainLoop(1, 3, GetUnitQuantityBatchSize()) + EstimateDrainLoop(1, 2);
+        cost.m_Actions += 2;
+        return cost;
+    }
+
+    bool CostModel::IsCheaper(const CodeCost& a, const CodeCost& b) const
+    {
+        switch (m_Level)
+        {
+        case OptimizationLevel::Size:
+            if (a.m_Triggers != b.m_Triggers)
+            {
+                return a.m_Triggers < b.m_Triggers;
+            }
+
+            return a.m_Cycles < b.m_Cycles;
+        case OptimizationLevel::Cycles:
+            if (a.m_Cycles != b.m_Cycles)
+            {
+                return a.m_Cycles < b.m_Cycles;
+            }
+
+            return a.m_Triggers < b.m_Triggers;
+        default:
+            // a scan is worth roughly one copy loop worth of triggers
+            auto scanCost = GetBatchSteps(GetCopyBatchSize()) + 1;
+            return a.m_Triggers + a.m_Cycles * scanCost < b.m_Triggers + b.m_Cycles * scanCost;
+        }
+    }
+
+    bool CostModel::ShouldUseTableCopy() const
+    {
+        if (m_Level == OptimizationLevel::Balanced || m_TableCopyRange == 0)
+        {
+            return false;
+        }
+
+        return IsCheaper(EstimateTableCopyReg(), EstimateCopyReg());
+    }
+
+    bool CostModel::ShouldFuseIndependentOps() const
+    {
+        if (m_HasFuseIndependentOps)
+        {
+            return m_FuseIndependentOps;
+        }
+
+        if (m_Level == OptimizationLevel::Balanced)
+        {
+            return false;
+        }
+
+        auto separate = EstimateCopyReg() + EstimateCopyReg();
+        return IsCheaper(EstimateFusedCopy(2), separate);
+    }
+
+    bool CostModel::ShouldMultiplyByTwoAsAdd() const
+    {
+        if (m_Level == OptimizationLevel::Balanced)
+        {
+            return true;
+        }
+
+        return IsCheaper(EstimateMulByTwoAsAdd(), EstimateMulConst(2));
+    }
+
+    bool CostModel::ShouldOutlineEventHandlers(unsigned int pollSiteCount) const
+    {
+        // a shared handler costs a call and a return trigger per site plus a cycle to jump back into it,
+        // any handler body is larger than that so sharing pays off from the second site on
+        // handlers can only be moved to another player's triggers when they are emitted as separate code
+        if (!m_RegionOwners.empty())
+        {
+            return pollSiteCount > 0;
+        }
+
+        if (m_Level == OptimizationLevel::Cycles)
+        {
+            return false;
+        }
+
+        return pollSiteCount > 1;
+    }
+
+    bool CostModel::ShouldUseInPlaceQuantity() const
+    {
+        if (m_Level == OptimizationLevel::Balanced)
+        {
+            return false;
+        }
+
+        return IsCheaper(EstimateInPlaceQuantityAction(), EstimateStackQuantityAction());
+    }
+
+    unsigned int CostModel::GetHyperTriggerWaitFrames() const
+    {
+        auto hyperTriggerCount = GetHyperTriggerCount();
+        if (hyperTriggerCount == 0)
+        {
+            return 0;
+        }
+
+        // a pending wait in any player's list makes the engine run all lists on the next frame,
+        // the owners work through their waits in parallel so the busiest owner decides how long that lasts
+        auto ownerCount = m_HyperTriggerOwners.empty() ? 1u : (unsigned int)m_HyperTriggerOwners.size();
+        auto triggersPerOwner = (hyperTriggerCount + ownerCount - 1) / ownerCount;
+        return triggersPerOwner * WAITS_PER_HYPER_TRIGGER;
+    }
+
+    double CostModel::EstimateScansPerGameSecond() const
+    {
+        auto waitFrames = GetHyperTriggerWaitFrames();
+        if (waitFrames >= FRAMES_PER_TRIGGER_CYCLE)
+        {
+            // the waits outlast the regular cycle so the preserved hyper triggers restart them before they run out
+            return FRAMES_PER_GAME_SECOND;
+        }
+
+        // one regular cycle plus a scan for every frame the waits are pending
+        return (double)(waitFrames + 1) * FRAMES_PER_GAME_SECOND / FRAMES_PER_TRIGGER_CYCLE;
+    }
+
+    unsigned int CostModel::GetSleepCycles(unsigned int milliseconds) const
+    {
+        auto scansPerMillisecond = EstimateScansPerGameSecond() / (FRAMES_PER_GAME_SECOND * MILLISECONDS_PER_FRAME);
+        auto cycles = (unsigned int)std::ceil(milliseconds * scansPerMillisecond - 1e-9);
+        return cycles > 0 ? cycles : 1;
+    }
+
+}
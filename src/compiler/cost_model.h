@@ -0,0 +1,190 @@
+#ifndef __LANGUMS_COST_MODEL_H
+#define __LANGUMS_COST_MODEL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace LangUMS
+{
+
+    enum class OptimizationLevel
+    {
+        Balanced = 0,   // historical lowering, the default
+        Size,           // fewest triggers (-Os)
+        Cycles          // fewest trigger cycles (-Ot)
+    };
+
+    enum class HyperTriggerPlacement
+    {
+        AfterProgram = 0,   // after the generated triggers and before any preserved map triggers, the default
+        Start,              // before every other trigger
+        End                 // after every other trigger including the preserved map triggers
+    };
+
+    // estimated cost of a piece of generated code
+    // m_Cycles is the worst-case number of extra trigger scans before execution continues
+    struct CodeCost
+    {
+        unsigned int m_Triggers = 0;
+        unsigned int m_Actions = 0;
+        unsigned int m_Conditions = 0;
+        unsigned int m_Cycles = 0;
+
+        CodeCost operator+(const CodeCost& other) const
+        {
+            CodeCost result;
+            result.m_Triggers = m_Triggers + other.m_Triggers;
+            result.m_Actions = m_Actions + other.m_Actions;
+            result.m_Conditions = m_Conditions + other.m_Conditions;
+            result.m_Cycles = m_Cycles + other.m_Cycles;
+            return result;
+        }
+    };
+
+    // Central place for every code generation decision that has more than one valid lowering.
+    // The estimates mirror what Compiler emits for each IR pattern. Size and Cycles pick
+    // whichever alternative the estimates favor, Balanced keeps the lowering of previous releases
+    // so existing maps compile to the exact same triggers.
+    class CostModel
+    {
+        public:
+        CostModel(OptimizationLevel level = OptimizationLevel::Balanced) : m_Level(level) {}
+
+        static bool ParseLevel(const std::string& name, OptimizationLevel& retLevel);
+        static const char* GetLevelName(OptimizationLevel level);
+
+        OptimizationLevel GetLevel() const
+        {
+            return m_Level;
+        }
+
+        // overrides the batch size the model would pick (--copy-batch-size)
+        void SetCopyBatchSize(uint32_t copyBatchSize)
+        {
+            m_CopyBatchSize = copyBatchSize;
+            m_HasCopyBatchSize = true;
+        }
+
+        uint32_t GetCopyBatchSize() const;
+
+        void SetTableCopyRange(uint32_t tableCopyRange)
+        {
+            m_TableCopyRange = tableCopyRange;
+        }
+
+        uint32_t GetTableCopyRange() const
+        {
+            return m_TableCopyRange;
+        }
+
+        // one hyper trigger already keeps the lists running every frame so the count is not chosen by the model,
+        // it only matters to maps which bring their own waits (--hyper-triggers)
+        void SetHyperTriggerCount(uint32_t hyperTriggerCount)
+        {
+            m_HyperTriggerCount = hyperTriggerCount;
+        }
+
+        uint32_t GetHyperTriggerCount() const
+        {
+            return m_HyperTriggerCount;
+        }
+
+        // overrides whether independent operations are fused (--fuse-ops)
+        void SetFuseIndependentOps(bool fuseIndependentOps)
+        {
+            m_FuseIndependentOps = fuseIndependentOps;
+            m_HasFuseIndependentOps = true;
+        }
+
+        // players the hyper triggers are distributed over round-robin, empty means the triggers owner
+        void SetHyperTriggerOwners(const std::vector<uint8_t>& owners)
+        {
+            m_HyperTriggerOwners = owners;
+        }
+
+        const std::vector<uint8_t>& GetHyperTriggerOwners() const
+        {
+            return m_HyperTriggerOwners;
+        }
+
+        void SetHyperTriggerPlacement(HyperTriggerPlacement placement)
+        {
+            m_HyperTriggerPlacement = placement;
+        }
+
+        HyperTriggerPlacement GetHyperTriggerPlacement() const
+        {
+            return m_HyperTriggerPlacement;
+        }
+
+        // extra players which independent code regions (event handlers, tasks and the shared multiply routine)
+        // are spread over round-robin, empty keeps every generated trigger on the triggers owner
+        void SetRegionOwners(const std::vector<uint8_t>& owners)
+        {
+            m_RegionOwners = owners;
+        }
+
+        const std::vector<uint8_t>& GetRegionOwners() const
+        {
+            return m_RegionOwners;
+        }
+
+        static bool ParseHyperTriggerPlacement(const std::string& name, HyperTriggerPlacement& retPlacement);
+
+        CodeCost EstimateDrainLoop(unsigned int conditionsPerStep, unsigned int actionsPerStep) const;
+        CodeCost EstimateCopyReg() const;
+        CodeCost EstimateCopyReg(uint32_t copyBatchSize, uint32_t value) const;
+        CodeCost EstimateTableCopyReg() const;
+        CodeCost EstimateFusedCopy(unsigned int count) const;
+        CodeCost EstimateAdd() const;
+        CodeCost EstimateMulConst(int value) const;
+        CodeCost EstimateMulByTwoAsAdd() const;
+        CodeCost EstimateStackQuantityAction() const;
+        CodeCost EstimateInPlaceQuantityAction() const;
+
+        bool IsCheaper(const CodeCost& a, const CodeCost& b) const;
+
+        bool ShouldUseTableCopy() const;
+        bool ShouldFuseIndependentOps() const;
+        bool ShouldMultiplyByTwoAsAdd() const;
+        bool ShouldOutlineEventHandlers(unsigned int pollSiteCount) const;
+        bool ShouldUseInPlaceQuantity() const;
+
+        // trigger actions store unit quantities in a byte so larger values can never be used in one action
+        static unsigned int GetUnitQuantityLimit()
+        {
+            return 255;
+        }
+
+        // the largest power of two drained per unit action, quantities above the limit take more than one scan
+        static unsigned int GetUnitQuantityBatchSize()
+        {
+            return (GetUnitQuantityLimit() + 1) / 2;
+        }
+
+        unsigned int GetHyperTriggerWaitFrames() const;
+        double EstimateScansPerGameSecond() const;
+        unsigned int GetSleepCycles(unsigned int milliseconds) const;
+
+        private:
+        uint32_t ChooseCopyBatchSize() const;
+
+        unsigned int GetBatchSteps(uint32_t copyBatchSize) const;
+        CodeCost EstimateDrainLoop(unsigned int conditionsPerStep, unsigned int actionsPerStep, uint32_t copyBatchSize) const;
+
+        OptimizationLevel m_Level = OptimizationLevel::Balanced;
+        uint32_t m_CopyBatchSize = 8192u;
+        bool m_HasCopyBatchSize = false;
+        uint32_t m_TableCopyRange = 16u;
+        uint32_t m_HyperTriggerCount = 5;
+        bool m_FuseIndependentOps = false;
+        bool m_HasFuseIndependentOps = false;
+        std::vector<uint8_t> m_HyperTriggerOwners;
+        HyperTriggerPlacement m_HyperTriggerPlacement = HyperTriggerPlacement::AfterProgram;
+        std::vector<uint8_t> m_RegionOwners;
+    };
+
+}
+
+#endif
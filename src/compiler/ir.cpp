@@ -35,6 +35,23 @@ namespace LangUMS
         }
 
         m_DebugStackFrames.clear();
+        m_Constants.clear();
+
+        for (auto& node : unitNodes)
+        {
+            if (node->GetType() == ASTNodeType::ConstDeclaration)
+            {
+                auto constant = (ASTConstDeclaration*)node.get();
+                auto& name = constant->GetName();
+
+                if (m_Constants.find(name) != m_Constants.end())
+                {
+                    throw IRCompilerException(SafePrintf("Duplicate constant declaration \"%\"", name), node.get());
+                }
+
+                m_Constants.insert(std::make_pair(name, constant->GetValues()));
+            }
+        }
 
         for (auto& node : unitNodes)
         {
@@ -48,8 +65,13 @@ namespace LangUMS
                     throw IRCompilerException(SafePrintf("Duplicate global variable declaration \"%\"", name), node.get());
                 }
 
+                if (m_Constants.find(name) != m_Constants.end())
+                {
+                    throw IRCompilerException(SafePrintf("Global variable \"%\" has the same name as a constant", name), node.get());
+                }
+
                 auto arraySize = variable->GetArraySize();
-                aliases.Allocate(name, arraySize, node.get());
+                aliases.Allocate(name, arraySize, node.get(), variable->IsArray());
 
                 auto& expression = variable->GetExpression();
 
@@ -144,191 +166,61 @@ namespace LangUMS
                 for (auto i = 0u; i < conditionsCount; i++)
                 {
                     auto condition = (ASTEventCondition*)eventDeclaration->GetCondition(i).get();
-                    auto& name = condition->GetName();
-
-                    if (name == "value")
-                    {
-                        unsigned int regId = 0;
-
-                        auto arg0 = condition->GetArgument(0);
-                        if (arg0->GetType() == ASTNodeType::Identifier)
-                        {
-                            auto identifier = (ASTIdentifier*)arg0.get();
-                            regId = aliases.GetAlias(identifier->GetName(), 0, identifier);
-                        }
-                        else if (arg0->GetType() == ASTNodeType::ArrayExpression)
-                        {
-                            auto arrayExpression = (ASTArrayExpression*)arg0.get();
-                            auto index = arrayExpression->GetIndex();
-                            if (index->GetType() != ASTNodeType::NumberLiteral)
-                            {
-                                throw IRCompilerException(SafePrintf("Invalid index for array expression in argument 0 in call to \"%\", expected number literal", name), condition);
-                            }
-
-                            auto arrayIndex = (ASTNumberLiteral*)index.get();
-                            regId = aliases.GetAlias(arrayExpression->GetIdentifier(), arrayIndex->GetValue(), arrayExpression);
-                        }
-                        else
-                        {
-                            throw IRCompilerException(SafePrintf("Invalid argument type for argument 0 in call to \"%\", expected global variable name", name), condition);
-                        }
-
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
-
-                        EmitInstruction(new IRRegCondInstruction(regId, comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "bring")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
-                        auto unitId = ParseUnitTypeArgument(condition->GetArgument(3), name, 3);
-                        auto locationName = ParseLocationArgument(condition->GetArgument(4), name, 4);
-
-                        EmitInstruction(new IRBringCondInstruction(playerId, unitId, locationName, comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "commands" || name == "killed" || name == "deaths")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
-                        auto unitId = ParseUnitTypeArgument(condition->GetArgument(3), name, 3);
-
-                        if (name == "commands")
-                        {
-                            EmitInstruction(new IRCmdCondInstruction(playerId, unitId, comparison, quantity), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "killed")
-                        {
-                            EmitInstruction(new IRKillCondInstruction(playerId, unitId, comparison, quantity), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "deaths")
-                        {
-                            EmitInstruction(new IRDeathCondInstruction(playerId, unitId, comparison, quantity), m_Instructions, condition, aliases);
-                        }
-                    }
-                    else if (name == "commands_least" || name == "commands_most")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto unitId = ParseUnitTypeArgument(condition->GetArgument(1), name, 1);
-
-                        std::string locationName;
-
-                        if (condition->GetChildCount() > 2)
-                        {
-                            locationName = ParseLocationArgument(condition->GetArgument(2), name, 2);
-                        }
+                    EmitInstruction(ParseCondition(condition, aliases), m_Instructions, condition, aliases);
+                }
+            }
+        }
 
-                        if (name == "commands_least")
-                        {
-                            EmitInstruction(new IRCmdLeastCondInstruction(playerId, unitId, locationName), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "commands_most")
-                        {
-                            EmitInstruction(new IRCmdMostCondInstruction(playerId, unitId, locationName), m_Instructions, condition, aliases);
-                        }
-                    }
-                    else if (name == "killed_least" || name == "killed_most")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto unitId = ParseUnitTypeArgument(condition->GetArgument(1), name, 1);
+        EmitInstruction(new IRChkPlayers(), m_Instructions, nullptr, aliases);
 
-                        if (name == "killed_least")
-                        {
-                            EmitInstruction(new IRKillLeastCondInstruction(playerId, unitId), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "killed_most")
-                        {
-                            EmitInstruction(new IRKillMostCondInstruction(playerId, unitId), m_Instructions, condition, aliases);
-                        }
-                    }
-                    else if (name == "accumulate")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
-                        auto resType = ParseResourceTypeArgument(condition->GetArgument(3), name, 3);
+        auto main = m_FunctionDeclarations["main"];
 
-                        EmitInstruction(new IRAccumCondInstruction(playerId, resType, comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "least_resources" || name == "most_resources")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto resType = ParseResourceTypeArgument(condition->GetArgument(1), name, 1);
+        // every spawned function runs on an instruction counter of its own
+        m_Tasks.clear();
+        m_CurrentTask = nullptr;
+        std::set<ASTFunctionDeclaration*> visited;
+        CollectTasks(main, visited);
 
-                        if (name == "least_resources")
-                        {
-                            EmitInstruction(new IRLeastResCondInstruction(playerId, resType), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "most_resources")
-                        {
-                            EmitInstruction(new IRMostResCondInstruction(playerId, resType), m_Instructions, condition, aliases);
-                        }
-                    }
-                    else if (name == "score")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto scoreType = ParseScoreTypeArgument(condition->GetArgument(1), name, 1);
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(2), name, 2);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(3), name, 3);
+        for (auto& node : unitNodes)
+        {
+            if (node->GetType() == ASTNodeType::EventDeclaration)
+            {
+                CollectTasks(node.get(), visited);
+            }
+        }
 
-                        EmitInstruction(new IRScoreCondInstruction(playerId, scoreType, comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "lowest_score" || name == "highest_score")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto scoreType = ParseScoreTypeArgument(condition->GetArgument(1), name, 1);
+        for (auto task : m_Tasks)
+        {
+            aliases.Allocate(SafePrintf("$task_%", task->GetName()), 1, nullptr);
+        }
 
-                        if (name == "lowest_score")
-                        {
-                            EmitInstruction(new IRLowScoreCondInstruction(playerId, scoreType), m_Instructions, condition, aliases);
-                        }
-                        else if (name == "highest_score")
-                        {
-                            EmitInstruction(new IRHiScoreCondInstruction(playerId, scoreType), m_Instructions, condition, aliases);
-                        }
-                    }
-                    else if (name == "elapsed_time")
-                    {
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(0), name, 0);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(1), name, 1);
+        // handlers called from more than one place are emitted once and shared by every poll_events() call
+        // unless one of the calls could happen in the middle of an expression with values still on the stack
+        std::unordered_map<ASTFunctionDeclaration*, unsigned int> fnCounts;
+        auto hasNestedCalls = false;
+        auto pollSiteCount = CountPollEventsCalls(main, fnCounts, hasNestedCalls);
 
-                        EmitInstruction(new IRTimeCondInstruction(comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "countdown")
-                    {
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(0), name, 0);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(1), name, 1);
+        m_EventHandlerIndices.clear();
+        m_OutlineEventHandlers = m_EventCount > 0 && !hasNestedCalls && m_CostModel.ShouldOutlineEventHandlers(pollSiteCount);
+        if (m_OutlineEventHandlers)
+        {
+            EmitEventHandlers(m_Instructions, aliases);
+        }
 
-                        EmitInstruction(new IRCountdownCondInstruction(comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else if (name == "opponents")
-                    {
-                        auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
-                        auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
-                        auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+        auto mainIndex = EmitFunction(main, m_Instructions, aliases);
 
-                        EmitInstruction(new IROpponentsCondInstruction(playerId, comparison, quantity), m_Instructions, condition, aliases);
-                    }
-                    else
-                    {
-                        throw IRCompilerException(SafePrintf("Unknown condition type \"%\"", name), condition);
-                    }
-                }
-            }
+        if (!m_Tasks.empty())
+        {
+            EmitTasks(mainIndex, aliases);
         }
 
-        EmitInstruction(new IRChkPlayers(), m_Instructions, nullptr, aliases);
-
-        auto main = m_FunctionDeclarations["main"];
-        EmitFunction(main, m_Instructions, aliases);
         return true;
     }
 
     void IRCompiler::Optimize()
     {
         IROptimizer optimizer;
+        optimizer.SetFuseIndependentOps(m_CostModel.ShouldFuseIndependentOps());
         m_Instructions = optimizer.Process(std::move(m_Instructions));
     }
 
@@ -374,6 +266,222 @@ namespace LangUMS
         instructions.push_back(std::unique_ptr<IIRInstruction>(instruction));
     }
 
+    void IRCompiler::EmitEventHandlers(std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases)
+    {
+        auto skipIndex = instructions.size();
+        EmitInstruction(new IRJmpInstruction(0), instructions, m_Unit, aliases);
+
+        // the return site lives in its own register so handlers can use multiplication which clobbers the indirect jump register
+        aliases.Allocate("$event_return", 1, nullptr);
+        m_EventReturnRegId = aliases.GetGlobalAlias("$event_return", 0);
+
+        auto nextSwitchId = (int)Switch_ReservedEnd;
+
+        for (auto& node : m_Unit->GetChildren())
+        {
+            if (node->GetType() != ASTNodeType::EventDeclaration)
+            {
+                continue;
+            }
+
+            auto frame = std::make_shared<StackFrame>();
+            frame->m_ASTNode = node.get();
+            frame->m_FunctionName = "EventHandler";
+            m_DebugStackFrames.push_back(frame);
+
+            auto eventDeclaration = (ASTEventDeclaration*)node.get();
+            auto body = eventDeclaration->GetBody();
+            if (body->GetType() != ASTNodeType::BlockStatement)
+            {
+                throw IRCompilerException("Event body must be a block statement", node.get());
+            }
+
+            // the body is emitted in place so absolute jumps inside it stay valid
+            auto startIndex = instructions.size();
+            m_EventHandlerIndices.push_back(startIndex);
+            EmitBlockStatement((ASTBlockStatement*)body.get(), instructions, aliases);
+
+            for (auto i = startIndex; i < instructions.size(); i++)
+            {
+                auto& instruction = instructions[i];
+                if (instruction->GetType() == IRInstructionType::Jmp)
+                {
+                    auto jmp = (IRJmpInstruction*)instruction.get();
+                    if (jmp->GetOffset() == JMP_TO_END_OFFSET_CONSTANT)
+                    {
+                        jmp->SetOffset(instructions.size() - i);
+                    }
+                }
+            }
+
+            EmitInstruction(new IRSetSwInstruction(nextSwitchId++, false), instructions, node.get(), aliases);
+            EmitInstruction(new IRRetInstruction(m_EventReturnRegId, (int)startIndex - (int)instructions.size()), instructions, node.get(), aliases);
+
+            m_DebugStackFrames.pop_back();
+        }
+
+        auto skip = (IRJmpInstruction*)instructions[skipIndex].get();
+        skip->SetOffset(instructions.size() - skipIndex);
+
+        // handler locals must not share registers with code that runs while a handler can be called
+        aliases.ReserveFreedRegisters();
+    }
+
+    unsigned int IRCompiler::CountPollEventsCalls(IASTNode* node, std::unordered_map<ASTFunctionDeclaration*, unsigned int>& fnCounts, bool& retHasNestedCalls)
+    {
+        auto count = 0u;
+
+        if (node->GetType() == ASTNodeType::FunctionCall)
+        {
+            auto fnCall = (ASTFunctionCall*)node;
+            auto& fnName = fnCall->GetFunctionName();
+            auto calls = 0u;
+
+            if (fnName == "poll_events")
+            {
+                calls = 1;
+            }
+            else
+            {
+                auto fn = m_FunctionDeclarations.find(fnName);
+                if (fn != m_FunctionDeclarations.end())
+                {
+                    // functions are inlined so every call repeats the calls inside of them
+                    auto cached = fnCounts.find(fn->second);
+                    if (cached != fnCounts.end())
+                    {
+                        calls = cached->second;
+                    }
+                    else
+                    {
+                        fnCounts[fn->second] = 0;
+                        calls = CountPollEventsCalls(fn->second, fnCounts, retHasNestedCalls);
+                        fnCounts[fn->second] = calls;
+                    }
+                }
+            }
+
+            if (calls > 0)
+            {
+                auto parent = node->GetParent();
+                auto isStatement = parent == nullptr ||
+                    parent->GetType() == ASTNodeType::BlockStatement ||
+                    parent->GetType() == ASTNodeType::VariableDeclaration ||
+                    parent->GetType() == ASTNodeType::ReturnStatement ||
+                    (parent->GetType() == ASTNodeType::AssignmentExpression && parent->GetChild(1).get() == node);
+
+                if (!isStatement)
+                {
+                    retHasNestedCalls = true;
+                }
+            }
+
+            count += calls;
+        }
+
+        for (auto& child : node->GetChildren())
+        {
+            if (child != nullptr)
+            {
+                count += CountPollEventsCalls(child.get(), fnCounts, retHasNestedCalls);
+            }
+        }
+
+        return count;
+    }
+
+    void IRCompiler::CollectTasks(IASTNode* node, std::set<ASTFunctionDeclaration*>& visited)
+    {
+        ASTFunctionDeclaration* callee = nullptr;
+
+        if (node->GetType() == ASTNodeType::SpawnTaskStatement)
+        {
+            auto spawnTask = (ASTSpawnTaskStatement*)node;
+            auto& fnName = spawnTask->GetFunctionName();
+
+            auto fn = m_FunctionDeclarations.find(fnName);
+            if (fn == m_FunctionDeclarations.end())
+            {
+                throw IRCompilerException(SafePrintf("Invalid task function name \"%\"", fnName), node);
+            }
+
+            if (fnName == "main")
+            {
+                throw IRCompilerException("main() cannot be spawned as a task", node);
+            }
+
+            if (fn->second->GetArgumentCount() > 0)
+            {
+                throw IRCompilerException(SafePrintf("Task function \"%\" cannot take arguments", fnName), node);
+            }
+
+            if (std::find(m_Tasks.begin(), m_Tasks.end(), fn->second) == m_Tasks.end())
+            {
+                m_Tasks.push_back(fn->second);
+            }
+
+            callee = fn->second;
+        }
+        else if (node->GetType() == ASTNodeType::FunctionCall)
+        {
+            auto fn = m_FunctionDeclarations.find(((ASTFunctionCall*)node)->GetFunctionName());
+            if (fn != m_FunctionDeclarations.end())
+            {
+                callee = fn->second;
+            }
+        }
+
+        if (callee != nullptr && visited.insert(callee).second)
+        {
+            CollectTasks(callee, visited);
+        }
+
+        for (auto& child : node->GetChildren())
+        {
+            if (child != nullptr)
+            {
+                CollectTasks(child.get(), visited);
+            }
+        }
+    }
+
+    void IRCompiler::EmitTasks(unsigned int mainIndex, RegisterAliases& aliases)
+    {
+        // returning from main lands here and goes back to the start of main instead of running into the first task
+        EmitInstruction(new IRJmpInstruction(mainIndex, true), m_Instructions, nullptr, aliases);
+
+        // tasks run alongside main and each other so none of them may reuse registers freed by another
+        aliases.ReserveFreedRegisters();
+
+        std::unordered_map<unsigned int, unsigned int> taskIndices;
+
+        for (auto task : m_Tasks)
+        {
+            m_CurrentTask = task;
+
+            auto counterRegId = aliases.GetGlobalAlias(SafePrintf("$task_%", task->GetName()), 0);
+            taskIndices[counterRegId] = m_Instructions.size();
+
+            EmitInstruction(new IRTaskInstruction(counterRegId), m_Instructions, task, aliases);
+            EmitFunction(task, m_Instructions, aliases);
+
+            // a finished task parks its instruction counter at zero until it is spawned again
+            EmitInstruction(new IRSetRegInstruction(counterRegId, 0), m_Instructions, task, aliases);
+            aliases.ReserveFreedRegisters();
+        }
+
+        m_CurrentTask = nullptr;
+
+        for (auto& instruction : m_Instructions)
+        {
+            if (instruction->GetType() == IRInstructionType::StartTask)
+            {
+                auto startTask = (IRStartTaskInstruction*)instruction.get();
+                startTask->SetTarget(taskIndices[startTask->GetCounterRegisterId()]);
+            }
+        }
+    }
+
     void IRCompiler::EmitFunctionCall(ASTFunctionCall* fnCall, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases, bool ignoreReturnValue)
     {
         auto stackFrame = std::make_shared<StackFrame>();
@@ -383,7 +491,26 @@ namespace LangUMS
 
         auto& fnName = fnCall->GetFunctionName();
 
-        if (fnName == "poll_events")
+        if (fnName == "poll_events" && m_CurrentTask != nullptr)
+        {
+            throw IRCompilerException("poll_events() cannot be called from a task, events are polled by main", fnCall);
+        }
+
+        if (fnName == "poll_events" && m_OutlineEventHandlers)
+        {
+            EmitInstruction(new IRChkPlayers(), instructions, nullptr, aliases);
+            EmitInstruction(new IRSetSwInstruction(Switch_EventsMutex, true), instructions, fnCall, aliases);
+
+            auto switchId = (int)Switch_ReservedEnd;
+            for (auto handlerIndex : m_EventHandlerIndices)
+            {
+                EmitInstruction(new IRJmpIfSwNotSetInstruction(switchId++, 2), instructions, fnCall, aliases);
+                EmitInstruction(new IRCallInstruction(handlerIndex, m_EventReturnRegId), instructions, fnCall, aliases);
+            }
+
+            EmitInstruction(new IRSetSwInstruction(Switch_EventsMutex, false), instructions, fnCall, aliases);
+        }
+        else if (fnName == "poll_events")
         {
             EmitInstruction(new IRChkPlayers(), instructions, nullptr, aliases);
             EmitInstruction(new IRSetSwInstruction(Switch_EventsMutex, true), instructions, fnCall, aliases);
@@ -474,7 +601,85 @@ namespace LangUMS
                 }
             }
 
-            EmitInstruction(isPresent, instructions, fnCall, aliases);
+            EmitInstruction(isPresent, instructions, fnCall, aliases);
+        }
+        else if (fnName == "fill")
+        {
+            if (fnCall->GetChildCount() != 2)
+            {
+                throw IRCompilerException("fill() takes exactly two arguments", fnCall);
+            }
+
+            auto array = fnCall->GetArgument(0);
+            if (!IsWholeArray(array.get(), aliases))
+            {
+                throw IRCompilerException("Invalid argument type for argument 0 in call to \"fill\", expected array", array.get());
+            }
+
+            auto regIds = GetWholeArrayRegisters(array.get(), aliases);
+            auto& value = fnCall->GetArgument(1);
+            int constant;
+
+            if (GetConstantValue(value.get(), aliases, constant))
+            {
+                // constant writes are single actions which share triggers anyway
+                for (auto regId : regIds)
+                {
+                    EmitInstruction(new IRSetRegInstruction(regId, constant), instructions, fnCall, aliases);
+                }
+            }
+            else
+            {
+                // the first element receives the value and every other element is copied from it in one loop
+                EmitExpression(value.get(), instructions, aliases);
+                EmitInstruction(new IRPopInstruction(regIds[0]), instructions, fnCall, aliases);
+
+                for (auto i = 1u; i < regIds.size(); i += MAX_FILL_REGISTERS)
+                {
+                    auto end = std::min((unsigned int)regIds.size(), i + MAX_FILL_REGISTERS);
+                    std::vector<unsigned int> dstRegIds(regIds.begin() + i, regIds.begin() + end);
+                    EmitInstruction(new IRFillInstruction(regIds[0], dstRegIds), instructions, fnCall, aliases);
+                }
+            }
+        }
+        else if (fnName == "sum")
+        {
+            if (fnCall->GetChildCount() != 1)
+            {
+                throw IRCompilerException("sum() takes exactly one argument", fnCall);
+            }
+
+            auto array = fnCall->GetArgument(0);
+            if (!IsWholeArray(array.get(), aliases))
+            {
+                throw IRCompilerException("Invalid argument type for argument 0 in call to \"sum\", expected array", array.get());
+            }
+
+            if (!ignoreReturnValue)
+            {
+                auto regIds = GetWholeArrayRegisters(array.get(), aliases);
+
+                for (auto i = 0u; i < regIds.size(); i += MAX_FUSED_COPIES)
+                {
+                    auto end = std::min((unsigned int)regIds.size(), i + MAX_FUSED_COPIES);
+                    std::vector<unsigned int> chunk(regIds.begin() + i, regIds.begin() + end);
+                    EmitInstruction(new IRSumInstruction(chunk), instructions, fnCall, aliases);
+
+                    if (i > 0)
+                    {
+                        EmitInstruction(new IRAddInstruction(), instructions, fnCall, aliases);
+                    }
+                }
+            }
+        }
+        else if (IsBoundedRandomCall(fnCall))
+        {
+            auto range = ParseRandomRange(fnCall, aliases);
+
+            if (!ignoreReturnValue)
+            {
+                EmitInstruction(new IRRndInstruction(range), instructions, fnCall, aliases);
+            }
         }
         else if (fnName == "rnd256" || fnName == "random")
         {
@@ -1104,6 +1309,32 @@ namespace LangUMS
                 throw IRCompilerException("sleep() called without arguments", fnCall);
             }
 
+            auto quantity = ParseQuantityArgument(fnCall->GetArgument(0), fnName, 0);
+
+            if (!m_NonBlockingSleep)
+            {
+                EmitInstruction(new IRWaitInstruction(quantity), instructions, fnCall, aliases);
+            }
+            else
+            {
+                // a wait action would pause every trigger of its owner, only the caller is suspended and counts down its own timer instead
+                auto timerName = m_CurrentTask != nullptr ? SafePrintf("$sleep_%", m_CurrentTask->GetName()) : std::string("$sleep");
+                if (!aliases.HasGlobalAlias(timerName, 0))
+                {
+                    aliases.Allocate(timerName, 1, nullptr);
+                }
+
+                auto timerRegId = aliases.GetGlobalAlias(timerName, 0);
+                EmitInstruction(new IRSleepInstruction(timerRegId, quantity), instructions, fnCall, aliases);
+            }
+        }
+        else if (fnName == "wait")
+        {
+            if (!fnCall->HasChildren())
+            {
+                throw IRCompilerException("wait() called without arguments", fnCall);
+            }
+
             auto quantity = ParseQuantityArgument(fnCall->GetArgument(0), fnName, 0);
             EmitInstruction(new IRWaitInstruction(quantity), instructions, fnCall, aliases);
         }
@@ -1131,7 +1362,11 @@ namespace LangUMS
             auto playerId = ParsePlayerIdArgument(fnCall->GetArgument(1), fnName, 1);
 
             bool isLiteral = false;
-            auto regId = ParseQuantityExpression(fnCall->GetArgument(2), fnName, 2, instructions, aliases, isLiteral);
+            auto regId = 0;
+            if (!GetInPlaceQuantityRegister(fnCall->GetArgument(2).get(), aliases, regId))
+            {
+                regId = ParseQuantityExpression(fnCall->GetArgument(2), fnName, 2, instructions, aliases, isLiteral);
+            }
 
             std::string locName;
             if (fnCall->GetChildCount() >= 4)
@@ -1261,7 +1496,11 @@ namespace LangUMS
             auto dstPlayerId = ParsePlayerIdArgument(fnCall->GetArgument(2), fnName, 2);
 
             bool isLiteral = false;
-            auto regId = ParseQuantityExpression(fnCall->GetArgument(3), fnName, 3, instructions, aliases, isLiteral);
+            auto regId = 0;
+            if (!GetInPlaceQuantityRegister(fnCall->GetArgument(3).get(), aliases, regId))
+            {
+                regId = ParseQuantityExpression(fnCall->GetArgument(3), fnName, 3, instructions, aliases, isLiteral);
+            }
 
             auto locName = ParseLocationArgument(fnCall->GetArgument(4), fnName, 4);
 
@@ -1310,6 +1549,17 @@ namespace LangUMS
 
             EmitInstruction(new IRPlayWAVInstruction(playerId, wavFilename, 0), instructions, fnCall, aliases);
         }
+        else if ((fnName == "min" || fnName == "max" || fnName == "abs_diff" || fnName == "clamp" || fnName == "pow" || fnName == "isqrt") &&
+            m_FunctionDeclarations.find(fnName) == m_FunctionDeclarations.end())
+        {
+            // user functions with the same name take precedence so existing maps keep working
+            EmitMathFunction(fnCall, instructions, aliases);
+
+            if (ignoreReturnValue)
+            {
+                EmitInstruction(new IRPopInstruction(), instructions, fnCall, aliases);
+            }
+        }
         else if (m_FunctionDeclarations.find(fnName) != m_FunctionDeclarations.end())
         {
             auto declaration = m_FunctionDeclarations[fnName];
@@ -1344,6 +1594,139 @@ namespace LangUMS
         m_DebugStackFrames.pop_back();
     }
 
+    void IRCompiler::EmitMathFunction(ASTFunctionCall* fnCall, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases)
+    {
+        auto& fnName = fnCall->GetFunctionName();
+
+        auto argCount = 2u;
+        if (fnName == "clamp")
+        {
+            argCount = 3;
+        }
+        else if (fnName == "isqrt")
+        {
+            argCount = 1;
+        }
+
+        if (fnCall->GetChildCount() != argCount)
+        {
+            throw IRCompilerException(SafePrintf("%() takes exactly % argument(s)", fnName, argCount), fnCall);
+        }
+
+        std::vector<uint32_t> values;
+        for (auto i = 0u; i < argCount; i++)
+        {
+            int value;
+            if (GetConstantValue(fnCall->GetArgument(i).get(), aliases, value))
+            {
+                values.push_back((uint32_t)value);
+            }
+        }
+
+        if (values.size() == argCount)
+        {
+            EmitInstruction(new IRPushInstruction(EvaluateMathFunction(fnName, values), true), instructions, fnCall, aliases);
+            return;
+        }
+
+        if (fnName == "clamp")
+        {
+            // clamp(x, lo, hi) is max(x, lo) followed by min(.., hi), both run on the shared min/max routine
+            EmitExpression(fnCall->GetArgument(0).get(), instructions, aliases);
+            EmitExpression(fnCall->GetArgument(1).get(), instructions, aliases);
+            EmitInstruction(new IRMathInstruction(MathFunction::Max), instructions, fnCall, aliases);
+            EmitExpression(fnCall->GetArgument(2).get(), instructions, aliases);
+            EmitInstruction(new IRMathInstruction(MathFunction::Min), instructions, fnCall, aliases);
+            return;
+        }
+
+        for (auto i = 0u; i < argCount; i++)
+        {
+            EmitExpression(fnCall->GetArgument(i).get(), instructions, aliases);
+        }
+
+        if (fnName == "pow")
+        {
+            // the routine calls the shared multiply routine so it keeps its state in registers of its own
+            if (!aliases.HasGlobalAlias("$pow", 0))
+            {
+                aliases.Allocate("$pow", 4, nullptr);
+            }
+
+            EmitInstruction(new IRPowInstruction(aliases.GetGlobalAlias("$pow", 0), aliases.GetGlobalAlias("$pow", 1),
+                aliases.GetGlobalAlias("$pow", 2), aliases.GetGlobalAlias("$pow", 3)), instructions, fnCall, aliases);
+        }
+        else if (fnName == "min")
+        {
+            EmitInstruction(new IRMathInstruction(MathFunction::Min), instructions, fnCall, aliases);
+        }
+        else if (fnName == "max")
+        {
+            EmitInstruction(new IRMathInstruction(MathFunction::Max), instructions, fnCall, aliases);
+        }
+        else if (fnName == "abs_diff")
+        {
+            EmitInstruction(new IRMathInstruction(MathFunction::AbsDiff), instructions, fnCall, aliases);
+        }
+        else if (fnName == "isqrt")
+        {
+            EmitInstruction(new IRMathInstruction(MathFunction::ISqrt), instructions, fnCall, aliases);
+        }
+    }
+
+    uint32_t IRCompiler::EvaluateMathFunction(const std::string& fnName, const std::vector<uint32_t>& values) const
+    {
+        if (fnName == "min")
+        {
+            return std::min(values[0], values[1]);
+        }
+        else if (fnName == "max")
+        {
+            return std::max(values[0], values[1]);
+        }
+        else if (fnName == "abs_diff")
+        {
+            return values[0] > values[1] ? values[0] - values[1] : values[1] - values[0];
+        }
+        else if (fnName == "clamp")
+        {
+            return std::min(std::max(values[0], values[1]), values[2]);
+        }
+        else if (fnName == "pow")
+        {
+            uint32_t result = 1;
+            auto base = values[0];
+            for (auto exponent = values[1]; exponent != 0; exponent >>= 1)
+            {
+                if (exponent & 1)
+                {
+                    result *= base;
+                }
+
+                base *= base;
+            }
+
+            return result;
+        }
+
+        auto remainder = values[0];
+        uint32_t result = 0;
+        for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2)
+        {
+            if (remainder >= result + bit)
+            {
+                remainder -= result + bit;
+                result = (result >> 1) + bit;
+            }
+            else
+            {
+                result >>= 1;
+            }
+        }
+
+        return result;
+    }
+
     void IRCompiler::EmitBinaryExpression(ASTBinaryExpression* expression, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases)
     {
         auto& rhs = expression->GetLHSValue();
@@ -1381,7 +1764,7 @@ namespace LangUMS
                     return;
                 }
 
-                if (value == 2) // multiplication by 2 is converted to an addition
+                if (value == 2 && m_CostModel.ShouldMultiplyByTwoAsAdd()) // multiplication by 2 is converted to an addition
                 {
                     EmitExpression(lhs->GetType() == ASTNodeType::NumberLiteral ? rhs.get() : lhs.get(), instructions, aliases);
                     EmitInstruction(new IRPushInstruction(0, true), instructions, expression, aliases);
@@ -1432,7 +1815,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1483,7 +1866,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1534,7 +1917,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1571,7 +1954,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1620,7 +2003,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1657,7 +2040,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1708,7 +2091,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1745,7 +2128,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1796,7 +2179,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1833,7 +2216,7 @@ namespace LangUMS
                     auto identifier = (ASTIdentifier*)other;
                     regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                 }
-                else if (other->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(other, aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)other;
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1889,7 +2272,7 @@ namespace LangUMS
                         auto identifier = (ASTIdentifier*)other;
                         regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                     }
-                    else if (other->GetType() == ASTNodeType::ArrayExpression)
+                    else if (IsStaticArrayExpression(other, aliases))
                     {
                         auto arrayExpression = (ASTArrayExpression*)other;
                         auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -1947,7 +2330,7 @@ namespace LangUMS
                         auto identifier = (ASTIdentifier*)other;
                         regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression);
                     }
-                    else if (other->GetType() == ASTNodeType::ArrayExpression)
+                    else if (IsStaticArrayExpression(other, aliases))
                     {
                         auto arrayExpression = (ASTArrayExpression*)other;
                         auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -2032,6 +2415,27 @@ namespace LangUMS
                     EmitInstruction(new IRPushInstruction(regId), instructions, expression, aliases);
                 }
             }
+            else if (IsDynamicArrayExpression(lhs.get(), aliases))
+            {
+                auto arrayExpression = (ASTArrayExpression*)lhs.get();
+                auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                auto elementRegIds = GetArrayElementRegisters(arrayExpression, aliases);
+
+                EmitInstruction(new IRPushIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+                EmitInstruction(new IRPushInstruction(1, true), instructions, expression, aliases);
+                EmitInstruction(new IRAddInstruction(), instructions, expression, aliases);
+                EmitInstruction(new IRPopIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+
+                if (pushToStack)
+                {
+                    EmitInstruction(new IRPushIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+                }
+            }
+            else if (IsConstantArrayExpression(lhs.get()))
+            {
+                auto arrayExpression = (ASTArrayExpression*)lhs.get();
+                throw IRCompilerException(SafePrintf("Cannot modify constant \"%\"", arrayExpression->GetIdentifier()), expression);
+            }
             else if (lhs->GetType() == ASTNodeType::ArrayExpression)
             {
                 auto arrayExpression = (ASTArrayExpression*)lhs.get();
@@ -2068,6 +2472,27 @@ namespace LangUMS
                     EmitInstruction(new IRPushInstruction(regId), instructions, expression, aliases);
                 }
             }
+            else if (IsDynamicArrayExpression(lhs.get(), aliases))
+            {
+                auto arrayExpression = (ASTArrayExpression*)lhs.get();
+                auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                auto elementRegIds = GetArrayElementRegisters(arrayExpression, aliases);
+
+                EmitInstruction(new IRPushInstruction(1, true), instructions, expression, aliases);
+                EmitInstruction(new IRPushIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+                EmitInstruction(new IRSubInstruction(), instructions, expression, aliases);
+                EmitInstruction(new IRPopIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+
+                if (pushToStack)
+                {
+                    EmitInstruction(new IRPushIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+                }
+            }
+            else if (IsConstantArrayExpression(lhs.get()))
+            {
+                auto arrayExpression = (ASTArrayExpression*)lhs.get();
+                throw IRCompilerException(SafePrintf("Cannot modify constant \"%\"", arrayExpression->GetIdentifier()), expression);
+            }
             else if (lhs->GetType() == ASTNodeType::ArrayExpression)
             {
                 auto arrayExpression = (ASTArrayExpression*)lhs.get();
@@ -2121,6 +2546,29 @@ namespace LangUMS
                 EmitPostfixExpression(unaryExpression, instructions, aliases, true);
             }
         }
+        else if (IsConstantArrayExpression(expression))
+        {
+            auto arrayExpression = (ASTArrayExpression*)expression;
+            int value;
+
+            if (GetConstantValue(expression, aliases, value))
+            {
+                EmitInstruction(new IRPushInstruction(value, true), instructions, expression, aliases);
+            }
+            else
+            {
+                auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                auto& values = m_Constants[arrayExpression->GetIdentifier()];
+                EmitInstruction(new IRTableLoadInstruction(-1, indexRegId, values), instructions, expression, aliases);
+            }
+        }
+        else if (IsDynamicArrayExpression(expression, aliases))
+        {
+            auto arrayExpression = (ASTArrayExpression*)expression;
+            auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+            auto elementRegIds = GetArrayElementRegisters(arrayExpression, aliases);
+            EmitInstruction(new IRPushIndexedInstruction(indexRegId, elementRegIds), instructions, expression, aliases);
+        }
         else if (expression->GetType() == ASTNodeType::ArrayExpression)
         {
             auto arrayExpression = (ASTArrayExpression*)expression;
@@ -2155,7 +2603,7 @@ namespace LangUMS
                 auto variableDeclaration = (ASTVariableDeclaration*)statement.get();
 
                 auto& name = variableDeclaration->GetName();
-                aliases.Allocate(name, variableDeclaration->GetArraySize(), statement.get());
+                aliases.Allocate(name, variableDeclaration->GetArraySize(), statement.get(), variableDeclaration->IsArray());
                 auto regId = aliases.GetAlias(name, 0, variableDeclaration);
                 m_DebugStackFrames.back()->m_Variables.push_back(std::make_pair(regId, name));
 
@@ -2183,10 +2631,23 @@ namespace LangUMS
 
                 aliases.Allocate(variableDeclaration->GetName(), 1, statement.get());
                 auto regId = RegisterNameToIndex(variableDeclaration->GetName(), 0, aliases, expression.get());
-                if (expression->GetType() == ASTNodeType::NumberLiteral)
+                int value;
+
+                if (GetConstantValue(expression.get(), aliases, value))
                 {
-                    auto number = (ASTNumberLiteral*)expression.get();
-                    EmitInstruction(new IRSetRegInstruction(regId, number->GetValue()), instructions, expression.get(), aliases);
+                    EmitInstruction(new IRSetRegInstruction(regId, value), instructions, expression.get(), aliases);
+                }
+                else if (IsConstantArrayExpression(expression.get()))
+                {
+                    auto arrayExpression = (ASTArrayExpression*)expression.get();
+                    auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                    auto& values = m_Constants[arrayExpression->GetIdentifier()];
+                    EmitInstruction(new IRTableLoadInstruction(regId, indexRegId, values), instructions, expression.get(), aliases);
+                }
+                else if (IsBoundedRandomCall(expression.get()))
+                {
+                    auto range = ParseRandomRange((ASTFunctionCall*)expression.get(), aliases);
+                    EmitInstruction(new IRRndInstruction(range, regId), instructions, expression.get(), aliases);
                 }
                 else
                 {
@@ -2194,6 +2655,54 @@ namespace LangUMS
                     EmitInstruction(new IRPopInstruction(regId), instructions, expression.get(), aliases);
                 }
             }
+            else if (statement->GetType() == ASTNodeType::AssignmentExpression &&
+                IsDynamicArrayExpression(((ASTAssignmentExpression*)statement.get())->GetLHSValue().get(), aliases))
+            {
+                auto expression = (ASTAssignmentExpression*)statement.get();
+                auto arrayExpression = (ASTArrayExpression*)expression->GetLHSValue().get();
+                auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                auto elementRegIds = GetArrayElementRegisters(arrayExpression, aliases);
+
+                auto& rhs = expression->GetRHSValue();
+                int value;
+
+                if (GetConstantValue(rhs.get(), aliases, value))
+                {
+                    EmitInstruction(new IRSetIndexedInstruction(indexRegId, elementRegIds, value), instructions, rhs.get(), aliases);
+                }
+                else
+                {
+                    EmitExpression(rhs.get(), instructions, aliases);
+                    EmitInstruction(new IRPopIndexedInstruction(indexRegId, elementRegIds), instructions, rhs.get(), aliases);
+                }
+            }
+            else if (statement->GetType() == ASTNodeType::AssignmentExpression &&
+                IsWholeArray(((ASTAssignmentExpression*)statement.get())->GetLHSValue().get(), aliases) &&
+                IsWholeArray(((ASTAssignmentExpression*)statement.get())->GetRHSValue().get(), aliases))
+            {
+                auto expression = (ASTAssignmentExpression*)statement.get();
+                auto dstRegIds = GetWholeArrayRegisters(expression->GetLHSValue().get(), aliases);
+                auto srcRegIds = GetWholeArrayRegisters(expression->GetRHSValue().get(), aliases);
+
+                if (dstRegIds.size() != srcRegIds.size())
+                {
+                    throw IRCompilerException(SafePrintf("Cannot assign an array of % elements to an array of % elements",
+                        srcRegIds.size(), dstRegIds.size()), expression);
+                }
+
+                // all elements are copied by shared loops, as many at once as the conditions of the finishing trigger allow,
+                // an array copied onto itself is left alone as the restore loop would add every element to itself
+                for (auto i = 0u; dstRegIds != srcRegIds && i < dstRegIds.size(); i += MAX_FUSED_COPIES)
+                {
+                    auto fusedCopy = new IRFusedCopyInstruction();
+                    for (auto q = i; q < dstRegIds.size() && q < i + MAX_FUSED_COPIES; q++)
+                    {
+                        fusedCopy->AddCopy(dstRegIds[q], srcRegIds[q]);
+                    }
+
+                    EmitInstruction(fusedCopy, instructions, expression, aliases);
+                }
+            }
             else if (statement->GetType() == ASTNodeType::AssignmentExpression)
             {
                 auto expression = (ASTAssignmentExpression*)statement.get();
@@ -2218,6 +2727,11 @@ namespace LangUMS
 
                     auto& name = arrayExpression->GetIdentifier();
 
+                    if (IsConstantArrayExpression(arrayExpression))
+                    {
+                        throw IRCompilerException(SafePrintf("Cannot assign to constant \"%\"", name), expression);
+                    }
+
                     if (!IsRegisterName(name, aliases, expression))
                     {
                         throw IRCompilerException("Assignment expression has invalid register on the left side", expression);
@@ -2237,11 +2751,23 @@ namespace LangUMS
                 }
 
                 auto& rhs = expression->GetRHSValue();
+                int value;
 
-                if (rhs->GetType() == ASTNodeType::NumberLiteral)
+                if (GetConstantValue(rhs.get(), aliases, value))
+                {
+                    EmitInstruction(new IRSetRegInstruction(lhsRegIndex, value), instructions, rhs.get(), aliases);
+                }
+                else if (IsConstantArrayExpression(rhs.get()))
                 {
-                    auto number = (ASTNumberLiteral*)rhs.get();
-                    EmitInstruction(new IRSetRegInstruction(lhsRegIndex, number->GetValue()), instructions, rhs.get(), aliases);
+                    auto arrayExpression = (ASTArrayExpression*)rhs.get();
+                    auto indexRegId = GetArrayIndexRegister(arrayExpression, aliases);
+                    auto& values = m_Constants[arrayExpression->GetIdentifier()];
+                    EmitInstruction(new IRTableLoadInstruction(lhsRegIndex, indexRegId, values), instructions, rhs.get(), aliases);
+                }
+                else if (IsBoundedRandomCall(rhs.get()))
+                {
+                    auto range = ParseRandomRange((ASTFunctionCall*)rhs.get(), aliases);
+                    EmitInstruction(new IRRndInstruction(range, lhsRegIndex), instructions, rhs.get(), aliases);
                 }
                 else if (rhs->GetType() == ASTNodeType::Identifier)
                 {
@@ -2255,7 +2781,7 @@ namespace LangUMS
 
                     EmitInstruction(new IRCopyRegInstruction(lhsRegIndex, rhsRegIndex), instructions, rhs.get(), aliases);
                 }
-                else if (rhs->GetType() == ASTNodeType::ArrayExpression)
+                else if (IsStaticArrayExpression(rhs.get(), aliases))
                 {
                     auto arrayExpression = (ASTArrayExpression*)rhs.get();
                     auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
@@ -2381,9 +2907,16 @@ namespace LangUMS
                         throw IRCompilerException("Disallowed if statement with empty body", expression.get());
                     }
 
-                    auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
-
-                    auto regId = RegisterNameToIndex(arrayExpression->GetIdentifier(), arrayIndex, aliases, expression.get());
+                    auto regId = (int)Reg_StackTop;
+                    if (!IsStaticArrayExpression(arrayExpression, aliases))
+                    {
+                        EmitExpression(arrayExpression, instructions, aliases);
+                    }
+                    else
+                    {
+                        auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
+                        regId = RegisterNameToIndex(arrayExpression->GetIdentifier(), arrayIndex, aliases, expression.get());
+                    }
                     auto offset = 1;
                     if (elseBodyInstructions.size() > 0)
                     {
@@ -2598,11 +3131,135 @@ namespace LangUMS
                         instructions.push_back(std::move(instruction));
                     }
 
-                    EmitInstruction(new IRJmpInstruction(loopStart, true), instructions, expression.get(), aliases);
-                }
-                else
-                {
-                    throw IRCompilerException("Unsupported type in expression", expression.get());
+                    EmitInstruction(new IRJmpInstruction(loopStart, true), instructions, expression.get(), aliases);
+                }
+                else
+                {
+                    throw IRCompilerException("Unsupported type in expression", expression.get());
+                }
+            }
+            else if (statement->GetType() == ASTNodeType::SwitchStatement)
+            {
+                auto switchStatement = (ASTSwitchStatement*)statement.get();
+                auto& expression = switchStatement->GetExpression();
+                auto caseCount = switchStatement->GetCaseCount();
+
+                std::set<int> caseValues;
+                auto defaultCase = -1;
+
+                for (auto q = 0u; q < caseCount; q++)
+                {
+                    auto switchCase = (ASTSwitchCase*)switchStatement->GetCase(q).get();
+                    if (switchCase->GetBody()->GetType() != ASTNodeType::BlockStatement)
+                    {
+                        throw IRCompilerException("Invalid AST. Switch case body must be a block statement", switchCase);
+                    }
+
+                    if (switchCase->IsDefault())
+                    {
+                        defaultCase = (int)q;
+                        continue;
+                    }
+
+                    for (auto value : switchCase->GetValues())
+                    {
+                        if (!caseValues.insert(value).second)
+                        {
+                            throw IRCompilerException(SafePrintf("Duplicate case value % in switch statement", value), switchCase);
+                        }
+                    }
+                }
+
+                if (expression->GetType() == ASTNodeType::NumberLiteral)
+                {
+                    // the matching case is known at compile time
+                    auto value = ((ASTNumberLiteral*)expression.get())->GetValue();
+                    auto matchingCase = defaultCase;
+
+                    for (auto q = 0u; q < caseCount; q++)
+                    {
+                        auto switchCase = (ASTSwitchCase*)switchStatement->GetCase(q).get();
+                        auto& values = switchCase->GetValues();
+
+                        if (std::find(values.begin(), values.end(), value) != values.end())
+                        {
+                            matchingCase = (int)q;
+                            break;
+                        }
+                    }
+
+                    if (matchingCase != -1)
+                    {
+                        auto switchCase = (ASTSwitchCase*)switchStatement->GetCase(matchingCase).get();
+                        EmitBlockStatement((ASTBlockStatement*)switchCase->GetBody().get(), instructions, aliases);
+                    }
+                }
+                else
+                {
+                    unsigned int regId;
+
+                    if (expression->GetType() == ASTNodeType::Identifier)
+                    {
+                        auto identifier = (ASTIdentifier*)expression.get();
+                        regId = RegisterNameToIndex(identifier->GetName(), 0, aliases, expression.get());
+                    }
+                    else if (IsStaticArrayExpression(expression.get(), aliases))
+                    {
+                        auto arrayExpression = (ASTArrayExpression*)expression.get();
+                        auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
+                        regId = RegisterNameToIndex(arrayExpression->GetIdentifier(), arrayIndex, aliases, expression.get());
+                    }
+                    else
+                    {
+                        EmitExpression(expression.get(), instructions, aliases);
+                        regId = Reg_StackTop;
+                    }
+
+                    // case bodies are emitted in place so jumps inside them keep their absolute offsets
+                    auto jmpTableIndex = instructions.size();
+                    auto jmpTable = new IRJmpTableInstruction(regId, 0);
+                    EmitInstruction(jmpTable, instructions, expression.get(), aliases);
+
+                    std::vector<size_t> jmpToEndIndices;
+
+                    for (auto q = 0u; q < caseCount; q++)
+                    {
+                        auto switchCase = (ASTSwitchCase*)switchStatement->GetCase(q).get();
+                        auto caseOffset = (int)(instructions.size() - jmpTableIndex);
+
+                        if (switchCase->IsDefault())
+                        {
+                            jmpTable->SetDefaultOffset(caseOffset);
+                        }
+                        else
+                        {
+                            for (auto value : switchCase->GetValues())
+                            {
+                                jmpTable->AddEntry(value, caseOffset);
+                            }
+                        }
+
+                        EmitBlockStatement((ASTBlockStatement*)switchCase->GetBody().get(), instructions, aliases);
+
+                        if (q + 1 < caseCount)
+                        {
+                            jmpToEndIndices.push_back(instructions.size());
+                            EmitInstruction(new IRJmpInstruction(0), instructions, switchCase, aliases);
+                        }
+                    }
+
+                    auto endIndex = instructions.size();
+
+                    if (defaultCase == -1)
+                    {
+                        jmpTable->SetDefaultOffset((int)(endIndex - jmpTableIndex));
+                    }
+
+                    for (auto index : jmpToEndIndices)
+                    {
+                        auto jmp = (IRJmpInstruction*)instructions[index].get();
+                        jmp->SetOffset((int)(endIndex - index));
+                    }
                 }
             }
             else if (statement->GetType() == ASTNodeType::ReturnStatement)
@@ -2625,6 +3282,22 @@ namespace LangUMS
 
                 EmitInstruction(new IRJmpInstruction(JMP_TO_END_OFFSET_CONSTANT), instructions, statement.get(), aliases);
             }
+            else if (statement->GetType() == ASTNodeType::SpawnTaskStatement)
+            {
+                auto spawnTask = (ASTSpawnTaskStatement*)statement.get();
+                auto counterRegId = aliases.GetGlobalAlias(SafePrintf("$task_%", spawnTask->GetFunctionName()), 0);
+
+                // the target is filled in once the task has been emitted after main
+                EmitInstruction(new IRStartTaskInstruction(counterRegId, 0), instructions, statement.get(), aliases);
+            }
+            else if (statement->GetType() == ASTNodeType::YieldStatement)
+            {
+                EmitInstruction(new IRYieldInstruction(), instructions, statement.get(), aliases);
+            }
+            else if (statement->GetType() == ASTNodeType::TriggersBlock)
+            {
+                EmitTriggersBlock((ASTTriggersBlock*)statement.get(), instructions, aliases);
+            }
             else
             {
                 throw IRCompilerException("Unsupported statement type in function body", statement.get());
@@ -2805,6 +3478,448 @@ namespace LangUMS
         }
     }
 
+    bool IRCompiler::HasVariableIndex(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const
+    {
+        auto& index = arrayExpression->GetIndex();
+        if (index->GetType() != ASTNodeType::Identifier)
+        {
+            return false;
+        }
+
+        // player names are constant indices and take precedence over variables
+        auto& name = ((ASTIdentifier*)index.get())->GetName();
+        return PlayerNameToId(name) == -1 && aliases.HasAlias(name, 0, arrayExpression);
+    }
+
+    bool IRCompiler::IsConstantArrayExpression(IASTNode* node) const
+    {
+        if (node->GetType() != ASTNodeType::ArrayExpression)
+        {
+            return false;
+        }
+
+        auto arrayExpression = (ASTArrayExpression*)node;
+        return m_Constants.find(arrayExpression->GetIdentifier()) != m_Constants.end();
+    }
+
+    void IRCompiler::EmitTriggersBlock(ASTTriggersBlock* triggersBlock, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases)
+    {
+        if (!triggersBlock->HasChildren())
+        {
+            throw IRCompilerException("Empty triggers block", triggersBlock);
+        }
+
+        auto triggers = new IRTriggersInstruction();
+
+        for (auto& child : triggersBlock->GetChildren())
+        {
+            auto rawTrigger = (ASTRawTrigger*)child.get();
+            auto conditionsCount = rawTrigger->GetConditionsCount();
+            auto actionsCount = rawTrigger->GetActionsCount();
+
+            if (conditionsCount > MAX_RAW_TRIGGER_CONDITIONS)
+            {
+                throw IRCompilerException(SafePrintf("Maximum trigger conditions reached (% conditions per trigger)", MAX_RAW_TRIGGER_CONDITIONS), rawTrigger);
+            }
+
+            if (actionsCount > MAX_RAW_TRIGGER_ACTIONS)
+            {
+                throw IRCompilerException(SafePrintf("Maximum trigger actions reached (% actions per trigger)", MAX_RAW_TRIGGER_ACTIONS), rawTrigger);
+            }
+
+            RawTrigger trigger;
+
+            for (auto i = 0u; i < conditionsCount; i++)
+            {
+                auto condition = (ASTEventCondition*)rawTrigger->GetCondition(i).get();
+
+                // these test whichever player runs the trigger, every trigger of a block runs as the block's owner
+                // so the block keeps its order and its exits all come from one player
+                auto& conditionName = condition->GetName();
+                if (conditionName == "least_resources" || conditionName == "most_resources" ||
+                    conditionName == "lowest_score" || conditionName == "highest_score" ||
+                    conditionName == "commands_least" || conditionName == "commands_most" ||
+                    conditionName == "killed_least" || conditionName == "killed_most" ||
+                    conditionName == "opponents")
+                {
+                    throw IRCompilerException(SafePrintf("%() tests the player running the trigger and cannot be used in a triggers block, use an event handler instead", conditionName), condition);
+                }
+
+                auto instruction = ParseCondition(condition, aliases);
+                instruction->SetASTNode(condition);
+                trigger.m_Conditions.push_back(std::unique_ptr<IIRInstruction>(instruction));
+            }
+
+            for (auto i = 0u; i < actionsCount; i++)
+            {
+                auto action = (ASTRawTriggerAction*)rawTrigger->GetAction(i).get();
+
+                if (action->GetName() == "exit")
+                {
+                    if (action->HasChildren())
+                    {
+                        throw IRCompilerException("exit() takes no arguments", action);
+                    }
+
+                    trigger.m_Exits = true;
+                    continue;
+                }
+
+                auto instruction = ParseRawTriggerAction(action, aliases);
+                instruction->SetASTNode(action);
+                trigger.m_Actions.push_back(std::unique_ptr<IIRInstruction>(instruction));
+            }
+
+            triggers->AddTrigger(std::move(trigger));
+        }
+
+        EmitInstruction(triggers, instructions, triggersBlock, aliases);
+    }
+
+    IIRInstruction* IRCompiler::ParseCondition(ASTEventCondition* condition, RegisterAliases& aliases)
+    {
+        auto& name = condition->GetName();
+
+        if (name == "value")
+        {
+            auto regId = ParseVariableArgument(condition->GetArgument(0), name, 0, aliases);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+
+            return new IRRegCondInstruction(regId, comparison, quantity);
+        }
+        else if (name == "bring")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+            auto unitId = ParseUnitTypeArgument(condition->GetArgument(3), name, 3);
+            auto locationName = ParseLocationArgument(condition->GetArgument(4), name, 4);
+
+            return new IRBringCondInstruction(playerId, unitId, locationName, comparison, quantity);
+        }
+        else if (name == "commands" || name == "killed" || name == "deaths")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+            auto unitId = ParseUnitTypeArgument(condition->GetArgument(3), name, 3);
+
+            if (name == "commands")
+            {
+                return new IRCmdCondInstruction(playerId, unitId, comparison, quantity);
+            }
+            else if (name == "killed")
+            {
+                return new IRKillCondInstruction(playerId, unitId, comparison, quantity);
+            }
+            else if (name == "deaths")
+            {
+                return new IRDeathCondInstruction(playerId, unitId, comparison, quantity);
+            }
+        }
+        else if (name == "commands_least" || name == "commands_most")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto unitId = ParseUnitTypeArgument(condition->GetArgument(1), name, 1);
+
+            std::string locationName;
+
+            if (condition->GetChildCount() > 2)
+            {
+                locationName = ParseLocationArgument(condition->GetArgument(2), name, 2);
+            }
+
+            if (name == "commands_least")
+            {
+                return new IRCmdLeastCondInstruction(playerId, unitId, locationName);
+            }
+            else if (name == "commands_most")
+            {
+                return new IRCmdMostCondInstruction(playerId, unitId, locationName);
+            }
+        }
+        else if (name == "killed_least" || name == "killed_most")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto unitId = ParseUnitTypeArgument(condition->GetArgument(1), name, 1);
+
+            if (name == "killed_least")
+            {
+                return new IRKillLeastCondInstruction(playerId, unitId);
+            }
+            else if (name == "killed_most")
+            {
+                return new IRKillMostCondInstruction(playerId, unitId);
+            }
+        }
+        else if (name == "accumulate")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+            auto resType = ParseResourceTypeArgument(condition->GetArgument(3), name, 3);
+
+            return new IRAccumCondInstruction(playerId, resType, comparison, quantity);
+        }
+        else if (name == "least_resources" || name == "most_resources")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto resType = ParseResourceTypeArgument(condition->GetArgument(1), name, 1);
+
+            if (name == "least_resources")
+            {
+                return new IRLeastResCondInstruction(playerId, resType);
+            }
+            else if (name == "most_resources")
+            {
+                return new IRMostResCondInstruction(playerId, resType);
+            }
+        }
+        else if (name == "score")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto scoreType = ParseScoreTypeArgument(condition->GetArgument(1), name, 1);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(2), name, 2);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(3), name, 3);
+
+            return new IRScoreCondInstruction(playerId, scoreType, comparison, quantity);
+        }
+        else if (name == "lowest_score" || name == "highest_score")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto scoreType = ParseScoreTypeArgument(condition->GetArgument(1), name, 1);
+
+            if (name == "lowest_score")
+            {
+                return new IRLowScoreCondInstruction(playerId, scoreType);
+            }
+            else if (name == "highest_score")
+            {
+                return new IRHiScoreCondInstruction(playerId, scoreType);
+            }
+        }
+        else if (name == "elapsed_time")
+        {
+            auto comparison = ParseComparisonArgument(condition->GetArgument(0), name, 0);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(1), name, 1);
+
+            return new IRTimeCondInstruction(comparison, quantity);
+        }
+        else if (name == "countdown")
+        {
+            auto comparison = ParseComparisonArgument(condition->GetArgument(0), name, 0);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(1), name, 1);
+
+            return new IRCountdownCondInstruction(comparison, quantity);
+        }
+        else if (name == "opponents")
+        {
+            auto playerId = ParsePlayerIdArgument(condition->GetArgument(0), name, 0);
+            auto comparison = ParseComparisonArgument(condition->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(condition->GetArgument(2), name, 2);
+
+            return new IROpponentsCondInstruction(playerId, comparison, quantity);
+        }
+
+        throw IRCompilerException(SafePrintf("Unknown condition type \"%\"", name), condition);
+    }
+
+    IIRInstruction* IRCompiler::ParseRawTriggerAction(ASTRawTriggerAction* action, RegisterAliases& aliases)
+    {
+        auto& name = action->GetName();
+
+        // only actions which map to a single trigger action with constant arguments are allowed here
+        if (name == "set_value" || name == "add_value" || name == "sub_value")
+        {
+            if (action->GetChildCount() != 2)
+            {
+                throw IRCompilerException(SafePrintf("%() takes exactly two arguments", name), action);
+            }
+
+            auto regId = ParseVariableArgument(action->GetArgument(0), name, 0, aliases);
+            auto quantity = ParseQuantityArgument(action->GetArgument(1), name, 1);
+
+            if (name == "set_value")
+            {
+                return new IRSetRegInstruction(regId, quantity);
+            }
+            else if (name == "add_value")
+            {
+                return new IRIncRegInstruction(regId, quantity);
+            }
+
+            return new IRDecRegInstruction(regId, quantity);
+        }
+        else if (name == "set_deaths" || name == "add_deaths" || name == "remove_deaths")
+        {
+            if (action->GetChildCount() != 3)
+            {
+                throw IRCompilerException(SafePrintf("%() takes exactly three arguments", name), action);
+            }
+
+            auto playerId = ParsePlayerIdArgument(action->GetArgument(0), name, 0);
+            auto unitId = ParseUnitTypeArgument(action->GetArgument(1), name, 1);
+            auto quantity = ParseQuantityArgument(action->GetArgument(2), name, 2);
+
+            if (name == "set_deaths")
+            {
+                return new IRSetDeathsInstruction(playerId, unitId, quantity, true);
+            }
+            else if (name == "add_deaths")
+            {
+                return new IRIncDeathsInstruction(playerId, unitId, quantity, true);
+            }
+
+            return new IRDecDeathsInstruction(playerId, unitId, quantity, true);
+        }
+
+        throw IRCompilerException(SafePrintf("Unknown trigger action \"%\"", name), action);
+    }
+
+    unsigned int IRCompiler::ParseVariableArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex, RegisterAliases& aliases)
+    {
+        if (node->GetType() == ASTNodeType::Identifier)
+        {
+            auto identifier = (ASTIdentifier*)node.get();
+            return aliases.GetAlias(identifier->GetName(), 0, identifier);
+        }
+        else if (node->GetType() == ASTNodeType::ArrayExpression)
+        {
+            auto arrayExpression = (ASTArrayExpression*)node.get();
+            auto index = arrayExpression->GetIndex();
+            if (index->GetType() != ASTNodeType::NumberLiteral)
+            {
+                throw IRCompilerException(SafePrintf("Invalid index for array expression in argument % in call to \"%\", expected number literal", argIndex, fnName), node.get());
+            }
+
+            auto arrayIndex = (ASTNumberLiteral*)index.get();
+            return aliases.GetAlias(arrayExpression->GetIdentifier(), arrayIndex->GetValue(), arrayExpression);
+        }
+
+        throw IRCompilerException(SafePrintf("Invalid argument type for argument % in call to \"%\", expected variable name", argIndex, fnName), node.get());
+    }
+
+    bool IRCompiler::IsWholeArray(IASTNode* node, RegisterAliases& aliases) const
+    {
+        if (node->GetType() != ASTNodeType::Identifier)
+        {
+            return false;
+        }
+
+        return aliases.IsArray(((ASTIdentifier*)node)->GetName(), node);
+    }
+
+    std::vector<unsigned int> IRCompiler::GetWholeArrayRegisters(IASTNode* node, RegisterAliases& aliases) const
+    {
+        auto& name = ((ASTIdentifier*)node)->GetName();
+
+        std::vector<unsigned int> regIds;
+        for (auto i = 0u; aliases.HasAlias(name, i, node); i++)
+        {
+            regIds.push_back(aliases.GetAlias(name, i, node));
+        }
+
+        return regIds;
+    }
+
+    bool IRCompiler::IsBoundedRandomCall(IASTNode* node) const
+    {
+        if (node->GetType() != ASTNodeType::FunctionCall)
+        {
+            return false;
+        }
+
+        auto fnCall = (ASTFunctionCall*)node;
+        return fnCall->GetFunctionName() == "random" && fnCall->GetChildCount() == 1;
+    }
+
+    unsigned int IRCompiler::ParseRandomRange(ASTFunctionCall* fnCall, RegisterAliases& aliases)
+    {
+        // there are only eight random switches so the range is limited to what they can express
+        int range;
+        if (!GetConstantValue(fnCall->GetArgument(0).get(), aliases, range))
+        {
+            throw IRCompilerException("random() expects a constant range", fnCall);
+        }
+
+        if (range < 1 || range > 256)
+        {
+            throw IRCompilerException(SafePrintf("random() range must be between 1 and 256, got %", range), fnCall);
+        }
+
+        return (unsigned int)range;
+    }
+
+    bool IRCompiler::IsDynamicArrayExpression(IASTNode* node, RegisterAliases& aliases) const
+    {
+        if (node->GetType() != ASTNodeType::ArrayExpression || IsConstantArrayExpression(node))
+        {
+            return false;
+        }
+
+        return HasVariableIndex((ASTArrayExpression*)node, aliases);
+    }
+
+    bool IRCompiler::IsStaticArrayExpression(IASTNode* node, RegisterAliases& aliases) const
+    {
+        if (node->GetType() != ASTNodeType::ArrayExpression || IsConstantArrayExpression(node))
+        {
+            return false;
+        }
+
+        return !HasVariableIndex((ASTArrayExpression*)node, aliases);
+    }
+
+    bool IRCompiler::GetConstantValue(IASTNode* node, RegisterAliases& aliases, int& retValue)
+    {
+        if (node->GetType() == ASTNodeType::NumberLiteral)
+        {
+            retValue = ((ASTNumberLiteral*)node)->GetValue();
+            return true;
+        }
+
+        if (!IsConstantArrayExpression(node) || HasVariableIndex((ASTArrayExpression*)node, aliases))
+        {
+            return false;
+        }
+
+        auto arrayExpression = (ASTArrayExpression*)node;
+        auto& values = m_Constants[arrayExpression->GetIdentifier()];
+        auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
+
+        if (arrayIndex >= values.size())
+        {
+            throw IRCompilerException(SafePrintf("Array access out of bounds for \"%[%]\"", arrayExpression->GetIdentifier(), arrayIndex), node);
+        }
+
+        retValue = values[arrayIndex];
+        return true;
+    }
+
+    unsigned int IRCompiler::GetArrayIndexRegister(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const
+    {
+        auto identifier = (ASTIdentifier*)arrayExpression->GetIndex().get();
+        return RegisterNameToIndex(identifier->GetName(), 0, aliases, arrayExpression);
+    }
+
+    std::vector<unsigned int> IRCompiler::GetArrayElementRegisters(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const
+    {
+        auto& name = arrayExpression->GetIdentifier();
+        if (!aliases.HasAlias(name, 0, arrayExpression))
+        {
+            throw IRCompilerException(SafePrintf("Invalid register name \"%\"", name), arrayExpression);
+        }
+
+        std::vector<unsigned int> regIds;
+        for (auto i = 0u; aliases.HasAlias(name, i, arrayExpression); i++)
+        {
+            regIds.push_back(aliases.GetAlias(name, i, arrayExpression));
+        }
+
+        return regIds;
+    }
+
     uint8_t IRCompiler::ParsePlayerIdArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex)
     {
         if (node->GetType() != ASTNodeType::Identifier)
@@ -3341,6 +4456,37 @@ namespace LangUMS
         throw IRCompilerException(SafePrintf("Invalid unit property type \"%\"", propName), node);
     }
 
+    bool IRCompiler::GetInPlaceQuantityRegister(IASTNode* node, RegisterAliases& aliases, int& retRegId)
+    {
+        // a plain variable can be decomposed where it lives instead of being copied on the stack first
+        if (!m_CostModel.ShouldUseInPlaceQuantity())
+        {
+            return false;
+        }
+
+        if (node->GetType() == ASTNodeType::Identifier)
+        {
+            auto& name = ((ASTIdentifier*)node)->GetName();
+            if (name == "All" || !IsRegisterName(name, aliases, node))
+            {
+                return false;
+            }
+
+            retRegId = RegisterNameToIndex(name, 0, aliases, node);
+            return retRegId != -1;
+        }
+
+        if (IsStaticArrayExpression(node, aliases))
+        {
+            auto arrayExpression = (ASTArrayExpression*)node;
+            auto arrayIndex = ParseArrayExpression(arrayExpression->GetIndex());
+            retRegId = RegisterNameToIndex(arrayExpression->GetIdentifier(), arrayIndex, aliases, node);
+            return retRegId != -1;
+        }
+
+        return false;
+    }
+
     int IRCompiler::ParseQuantityExpression(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex,
         std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases, bool& isLiteral)
     {
@@ -3361,10 +4507,8 @@ namespace LangUMS
                 regId = Reg_StackTop;
             }
         }
-        else if (node->GetType() == ASTNodeType::NumberLiteral)
+        else if (GetConstantValue(node.get(), aliases, regId))
         {
-            auto unitQuantity = (ASTNumberLiteral*)node.get();
-            regId = unitQuantity->GetValue();
             isLiteral = true;
         }
         else
@@ -12,11 +12,16 @@
 
 #define MAX_EVENT_CONDITIONS 63
 #define JMP_TO_END_OFFSET_CONSTANT 0xB4DF00D
+#define MAX_FUSED_COPIES 14 // a trigger has 16 conditions, two of them are taken by the address check
+#define MAX_FILL_REGISTERS 61 // a trigger has 64 actions, the copy back from storage needs three for itself
+#define MAX_RAW_TRIGGER_CONDITIONS 14 // the address check takes two of the 16 conditions
+#define MAX_RAW_TRIGGER_ACTIONS 62 // one action preserves the trigger and one is kept for the exit jump
 
 #include "ir_constants.h"
 #include "ir_instructions.h"
 #include "ir_exceptions.h"
 #include "register_aliases.h"
+#include "cost_model.h"
 
 namespace LangUMS
 {
@@ -29,6 +34,16 @@ namespace LangUMS
         bool Compile(const std::shared_ptr<IASTNode>& ast);
         void Optimize();
 
+        void SetCostModel(const CostModel& costModel)
+        {
+            m_CostModel = costModel;
+        }
+
+        void SetNonBlockingSleep(bool nonBlockingSleep)
+        {
+            m_NonBlockingSleep = nonBlockingSleep;
+        }
+
         const std::vector<std::unique_ptr<IIRInstruction>>& GetInstructions() const
         {
             return m_Instructions;
@@ -45,12 +60,19 @@ namespace LangUMS
         void EmitInstruction(IIRInstruction* instruction, std::vector<std::unique_ptr<IIRInstruction>>& instructions, IASTNode* node, RegisterAliases& aliases);
 
         void EmitFunctionCall(ASTFunctionCall* fnCall, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases, bool ignoreReturnValue);
+        void EmitEventHandlers(std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
+        unsigned int CountPollEventsCalls(IASTNode* node, std::unordered_map<ASTFunctionDeclaration*, unsigned int>& fnCounts, bool& retHasNestedCalls);
+        void CollectTasks(IASTNode* node, std::set<ASTFunctionDeclaration*>& visited);
+        void EmitTasks(unsigned int mainIndex, RegisterAliases& aliases);
+        void EmitMathFunction(ASTFunctionCall* fnCall, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
+        uint32_t EvaluateMathFunction(const std::string& fnName, const std::vector<uint32_t>& values) const;
         void EmitBinaryExpression(ASTBinaryExpression* expression, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
         void EmitNotExpression(ASTUnaryExpression* expression, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
         void EmitPostfixExpression(ASTUnaryExpression* expression, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases, bool pushToStack);
         void EmitExpression(IASTNode* expression, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
         unsigned int EmitBlockStatement(ASTBlockStatement* blockStatement, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
         unsigned int EmitFunction(ASTFunctionDeclaration* fn, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
+        void EmitTriggersBlock(ASTTriggersBlock* triggersBlock, std::vector<std::unique_ptr<IIRInstruction>>& instructions, RegisterAliases& aliases);
 
         bool IsRegisterName(const std::string& name, RegisterAliases& aliases, IASTNode* node) const;
         int RegisterNameToIndex(const std::string& name, unsigned int arrayIndex, RegisterAliases& aliases, IASTNode* node) const;
@@ -59,9 +81,24 @@ namespace LangUMS
         int PlayerNameToId(const std::string& name) const;
 
         unsigned int ParseArrayExpression(const std::shared_ptr<IASTNode>& expression);
+        bool HasVariableIndex(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const;
+        bool IsConstantArrayExpression(IASTNode* node) const;
+        bool IsDynamicArrayExpression(IASTNode* node, RegisterAliases& aliases) const;
+        bool IsStaticArrayExpression(IASTNode* node, RegisterAliases& aliases) const;
+        bool GetConstantValue(IASTNode* node, RegisterAliases& aliases, int& retValue);
+        bool IsBoundedRandomCall(IASTNode* node) const;
+        unsigned int ParseRandomRange(ASTFunctionCall* fnCall, RegisterAliases& aliases);
+        unsigned int GetArrayIndexRegister(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const;
+        std::vector<unsigned int> GetArrayElementRegisters(ASTArrayExpression* arrayExpression, RegisterAliases& aliases) const;
+        bool IsWholeArray(IASTNode* node, RegisterAliases& aliases) const;
+        std::vector<unsigned int> GetWholeArrayRegisters(IASTNode* node, RegisterAliases& aliases) const;
+        IIRInstruction* ParseCondition(ASTEventCondition* condition, RegisterAliases& aliases);
+        IIRInstruction* ParseRawTriggerAction(ASTRawTriggerAction* action, RegisterAliases& aliases);
+        unsigned int ParseVariableArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex, RegisterAliases& aliases);
         uint8_t ParsePlayerIdArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
         ConditionComparison ParseComparisonArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
         int ParseQuantityArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
+        bool GetInPlaceQuantityRegister(IASTNode* node, RegisterAliases& aliases, int& retRegId);
         uint8_t ParseUnitTypeArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
         uint32_t ParseAIScriptArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
         std::string ParseLocationArgument(const std::shared_ptr<IASTNode>& node, const std::string& fnName, unsigned int argIndex);
@@ -82,9 +119,17 @@ namespace LangUMS
         std::unordered_map<std::string, ASTFunctionDeclaration*> m_FunctionDeclarations;
         std::unordered_map<ASTFunctionDeclaration*, unsigned int> m_FunctionIndices;
         std::unordered_map<std::string, unsigned int> m_UnitProperties;
+        std::unordered_map<std::string, std::vector<int>> m_Constants;
 
         unsigned int m_EventCount = 0;
+        bool m_OutlineEventHandlers = false;
+        bool m_NonBlockingSleep = false;
+        std::vector<unsigned int> m_EventHandlerIndices;
+        unsigned int m_EventReturnRegId = 0;
+        std::vector<ASTFunctionDeclaration*> m_Tasks;
+        ASTFunctionDeclaration* m_CurrentTask = nullptr;
         std::set<std::string> m_WavFilenames;
+        CostModel m_CostModel;
 
         std::vector<std::shared_ptr<StackFrame>> m_DebugStackFrames;
         IASTNode* m_Unit;
@@ -19,12 +19,22 @@ namespace LangUMS
         IncReg,         // increments a register by a constant value
         DecReg,         // decrements a register by a constant value
         CopyReg,        // copies a register's value to another register
+        FusedCopy,      // copies, pushes, adds or spawns from several independent registers in one shared decomposition loop
+        PushIndexed,    // pushes the array element selected by the value of an index register on top of the stack
+        PopIndexed,     // pops a value from the stack into the array element selected by the value of an index register
+        SetIndexed,     // sets the array element selected by the value of an index register to a constant value
+        TableLoad,      // sets a register or pushes the entry of a constant table selected by the value of an index register
+        Fill,           // copies a register's value to several registers at once
+        Sum,            // pushes the sum of several registers on top of the stack
         Add,            // pops two values off the stack and adds them together, pushes the result on the stack
         Sub,            // pops two values off the stack, subtracts the second from the first, pushes the result on the stack
         Mul,            // pops two values off the stack, multiplies them together, pushes the result on the stack
         MulConst,       // pops a value off the stack and multiplies it with a constant, pushes the result on the stack
         Div,            // pops two values off the stack, divides the second by the first, pushes the result on the stack
+        Math,           // pops one or two values off the stack and pushes the result of a shared math routine on the stack
+        Pow,            // pops two values off the stack, raises the second to the power of the first, pushes the result on the stack
         Rnd256,         // pushes a random value between 0 and 255 on top of the stack
+        Rnd,            // sets a register or pushes a random value between 0 and a range (exclusive)
         Jmp,            // jumps to an instruction using a relative or an absolute offset
         JmpIfEq,        // jumps to an instruction if a register is equal to a constant
         JmpIfNotEq,     // jumps to an instruction if a register is not equal to a constant
@@ -34,6 +44,13 @@ namespace LangUMS
         JmpIfGrtOrEq,   // jumps to an instruction if a register is greater than or equal to a constant
         JmpIfSwNotSet,  // jumps to an instruction if a switch is not set
         JmpIfSwSet,     // jumps to an instruction if a switch is set
+        JmpTable,       // jumps to one of several instructions depending on the value of a register
+        Call,           // jumps to a subroutine, the return site is kept in a register
+        Ret,            // returns from a subroutine to the call site kept in a register
+        StartTask,      // starts a task by pointing its instruction counter register at the task's first instruction
+        Task,           // marks the start of a task, the following instructions run on the task's own instruction counter
+        Yield,          // suspends the current task or main until the next trigger cycle
+        Sleep,          // suspends the current task or main for an amount of time without blocking any other triggers
         SetSw,          // sets a switch
         ChkPlayers,     // runs checks which players are in-game
         IsPresent,      // pushes 1 or 0 on top of the stack depending on whether given players are in-game or not
@@ -77,6 +94,7 @@ namespace LangUMS
         LeaderboardCpu, // whether to show cpu players in the leaderboard
         PlayWAV,        // plays a .wav file
         Transmission,   // combined display msg, unit portrait and play wav
+        Triggers,       // hand written triggers which run at the same address until one of them exits
 
         Event,          // conditions
         RegCond,        // Register value condition
@@ -369,6 +387,291 @@ namespace LangUMS
         unsigned int m_SrcRegId = 0;
     };
 
+    struct FusedCopyEntry
+    {
+        unsigned int m_DstRegId = 0;
+        unsigned int m_SrcRegId = 0;
+        bool m_IsPush = false; // if true the destination is the next free stack slot
+        bool m_IsAdd = false; // if true the source is added to the destination instead of replacing it
+
+        // if true the source is the quantity of a spawn and there is no destination
+        bool m_IsSpawn = false;
+        uint8_t m_PlayerId = 0;
+        uint8_t m_UnitId = 0;
+        std::string m_LocationName;
+        int m_PropsSlot = -1;
+    };
+
+    class IRFusedCopyInstruction : public IIRInstruction
+    {
+        public:
+        IRFusedCopyInstruction () : IIRInstruction (IRInstructionType::FusedCopy)
+        {}
+
+        void AddCopy (unsigned int dstRegId, unsigned int srcRegId)
+        {
+            FusedCopyEntry entry;
+            entry.m_DstRegId = dstRegId;
+            entry.m_SrcRegId = srcRegId;
+            m_Entries.push_back(entry);
+        }
+
+        void AddPush (unsigned int srcRegId)
+        {
+            FusedCopyEntry entry;
+            entry.m_SrcRegId = srcRegId;
+            entry.m_IsPush = true;
+            m_Entries.push_back(entry);
+        }
+
+        void AddAddition (unsigned int dstRegId, unsigned int srcRegId)
+        {
+            FusedCopyEntry entry;
+            entry.m_DstRegId = dstRegId;
+            entry.m_SrcRegId = srcRegId;
+            entry.m_IsAdd = true;
+            m_Entries.push_back(entry);
+        }
+
+        void AddSpawn (unsigned int srcRegId, uint8_t playerId, uint8_t unitId, const std::string& locationName, int propsSlot)
+        {
+            FusedCopyEntry entry;
+            entry.m_SrcRegId = srcRegId;
+            entry.m_IsSpawn = true;
+            entry.m_PlayerId = playerId;
+            entry.m_UnitId = unitId;
+            entry.m_LocationName = locationName;
+            entry.m_PropsSlot = propsSlot;
+            m_Entries.push_back(entry);
+        }
+
+        const std::vector<FusedCopyEntry>& GetEntries () const
+        {
+            return m_Entries;
+        }
+
+        std::string DebugDump () const
+        {
+            std::string dump = "FUSED";
+
+            for (auto i = 0u; i < m_Entries.size(); i++)
+            {
+                auto& entry = m_Entries[i];
+                dump += i == 0 ? " " : ", ";
+
+                if (entry.m_IsPush)
+                {
+                    dump += SafePrintf ("PUSH %", RegisterIdToString (entry.m_SrcRegId));
+                }
+                else if (entry.m_IsAdd)
+                {
+                    dump += SafePrintf ("ADD % %", RegisterIdToString (entry.m_DstRegId), RegisterIdToString (entry.m_SrcRegId));
+                }
+                else if (entry.m_IsSpawn)
+                {
+                    dump += SafePrintf ("SPAWN % % % %", CHK::PlayersByName[entry.m_PlayerId], CHK::UnitsByName[entry.m_UnitId], RegisterIdToString (entry.m_SrcRegId), entry.m_LocationName);
+
+                    if (entry.m_PropsSlot != -1)
+                    {
+                        dump += SafePrintf (" [SLOT %]", entry.m_PropsSlot);
+                    }
+                }
+                else
+                {
+                    dump += SafePrintf ("CPY % %", RegisterIdToString (entry.m_DstRegId), RegisterIdToString (entry.m_SrcRegId));
+                }
+            }
+
+            return dump;
+        }
+
+        private:
+        std::vector<FusedCopyEntry> m_Entries;
+    };
+
+    // array elements are addressed through the value of an index register at runtime
+    // an index past the end of the array reads as 0 and discards writes
+    class IRPushIndexedInstruction : public IIRInstruction
+    {
+        public:
+        IRPushIndexedInstruction (unsigned int indexRegId, const std::vector<unsigned int>& elementRegIds) :
+            m_IndexRegId (indexRegId), m_ElementRegIds (elementRegIds), IIRInstruction (IRInstructionType::PushIndexed)
+        {}
+
+        unsigned int GetIndexRegisterId () const
+        {
+            return m_IndexRegId;
+        }
+
+        const std::vector<unsigned int>& GetElementRegisterIds () const
+        {
+            return m_ElementRegIds;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("PUSHIDX % %", RegisterIdToString (m_IndexRegId), ElementsToString (m_ElementRegIds));
+        }
+
+        private:
+        unsigned int m_IndexRegId = 0;
+        std::vector<unsigned int> m_ElementRegIds;
+    };
+
+    class IRPopIndexedInstruction : public IIRInstruction
+    {
+        public:
+        IRPopIndexedInstruction (unsigned int indexRegId, const std::vector<unsigned int>& elementRegIds) :
+            m_IndexRegId (indexRegId), m_ElementRegIds (elementRegIds), IIRInstruction (IRInstructionType::PopIndexed)
+        {}
+
+        unsigned int GetIndexRegisterId () const
+        {
+            return m_IndexRegId;
+        }
+
+        const std::vector<unsigned int>& GetElementRegisterIds () const
+        {
+            return m_ElementRegIds;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("POPIDX % %", RegisterIdToString (m_IndexRegId), ElementsToString (m_ElementRegIds));
+        }
+
+        private:
+        unsigned int m_IndexRegId = 0;
+        std::vector<unsigned int> m_ElementRegIds;
+    };
+
+    class IRSetIndexedInstruction : public IIRInstruction
+    {
+        public:
+        IRSetIndexedInstruction (unsigned int indexRegId, const std::vector<unsigned int>& elementRegIds, int value) :
+            m_IndexRegId (indexRegId), m_ElementRegIds (elementRegIds), m_Value (value), IIRInstruction (IRInstructionType::SetIndexed)
+        {}
+
+        unsigned int GetIndexRegisterId () const
+        {
+            return m_IndexRegId;
+        }
+
+        const std::vector<unsigned int>& GetElementRegisterIds () const
+        {
+            return m_ElementRegIds;
+        }
+
+        int GetValue () const
+        {
+            return m_Value;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("SETIDX % % %", RegisterIdToString (m_IndexRegId), ElementsToString (m_ElementRegIds), m_Value);
+        }
+
+        private:
+        unsigned int m_IndexRegId = 0;
+        std::vector<unsigned int> m_ElementRegIds;
+        int m_Value = 0;
+    };
+
+    // the table values only exist in the generated trigger actions, no registers are allocated for them
+    class IRTableLoadInstruction : public IIRInstruction
+    {
+        public:
+        IRTableLoadInstruction (int dstRegId, unsigned int indexRegId, const std::vector<int>& values) :
+            m_DstRegId (dstRegId), m_IndexRegId (indexRegId), m_Values (values), IIRInstruction (IRInstructionType::TableLoad)
+        {}
+
+        // -1 pushes the value on top of the stack
+        int GetDestinationRegisterId () const
+        {
+            return m_DstRegId;
+        }
+
+        unsigned int GetIndexRegisterId () const
+        {
+            return m_IndexRegId;
+        }
+
+        const std::vector<int>& GetValues () const
+        {
+            return m_Values;
+        }
+
+        std::string DebugDump () const
+        {
+            std::string values;
+            for (auto i = 0u; i < m_Values.size(); i++)
+            {
+                values += SafePrintf (i == 0 ? "%" : " %", m_Values[i]);
+            }
+
+            if (m_DstRegId == -1)
+            {
+                return SafePrintf ("TBL PUSH % {%}", RegisterIdToString (m_IndexRegId), values);
+            }
+
+            return SafePrintf ("TBL % % {%}", RegisterIdToString (m_DstRegId), RegisterIdToString (m_IndexRegId), values);
+        }
+
+        private:
+        int m_DstRegId = -1;
+        unsigned int m_IndexRegId = 0;
+        std::vector<int> m_Values;
+    };
+
+    class IRFillInstruction : public IIRInstruction
+    {
+        public:
+        IRFillInstruction (unsigned int srcRegId, const std::vector<unsigned int>& dstRegIds) :
+            m_SrcRegId (srcRegId), m_DstRegIds (dstRegIds), IIRInstruction (IRInstructionType::Fill)
+        {}
+
+        unsigned int GetSourceRegisterId () const
+        {
+            return m_SrcRegId;
+        }
+
+        const std::vector<unsigned int>& GetDestinationRegisterIds () const
+        {
+            return m_DstRegIds;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("FILL % %", ElementsToString (m_DstRegIds), RegisterIdToString (m_SrcRegId));
+        }
+
+        private:
+        unsigned int m_SrcRegId = 0;
+        std::vector<unsigned int> m_DstRegIds;
+    };
+
+    class IRSumInstruction : public IIRInstruction
+    {
+        public:
+        IRSumInstruction (const std::vector<unsigned int>& regIds) :
+            m_RegIds (regIds), IIRInstruction (IRInstructionType::Sum)
+        {}
+
+        const std::vector<unsigned int>& GetRegisterIds () const
+        {
+            return m_RegIds;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("SUM %", ElementsToString (m_RegIds));
+        }
+
+        private:
+        std::vector<unsigned int> m_RegIds;
+    };
+
     class IRAddInstruction : public IIRInstruction
     {
         public:
@@ -405,6 +708,88 @@ namespace LangUMS
         }
     };
 
+    enum class MathFunction
+    {
+        Min = 0,
+        Max,
+        AbsDiff,
+        ISqrt
+    };
+
+    class IRMathInstruction : public IIRInstruction
+    {
+        public:
+        IRMathInstruction (MathFunction function) :
+            m_Function (function), IIRInstruction (IRInstructionType::Math)
+        {}
+
+        MathFunction GetFunction () const
+        {
+            return m_Function;
+        }
+
+        std::string DebugDump () const
+        {
+            switch (m_Function)
+            {
+            case MathFunction::Min:
+                return "MIN";
+            case MathFunction::Max:
+                return "MAX";
+            case MathFunction::AbsDiff:
+                return "ABSDIFF";
+            case MathFunction::ISqrt:
+                return "ISQRT";
+            }
+
+            return "MATH";
+        }
+
+        private:
+        MathFunction m_Function;
+    };
+
+    class IRPowInstruction : public IIRInstruction
+    {
+        public:
+        IRPowInstruction (unsigned int baseRegId, unsigned int exponentRegId, unsigned int resultRegId, unsigned int returnRegId) :
+            m_BaseRegId (baseRegId), m_ExponentRegId (exponentRegId), m_ResultRegId (resultRegId), m_ReturnRegId (returnRegId),
+            IIRInstruction (IRInstructionType::Pow)
+        {}
+
+        unsigned int GetBaseRegisterId () const
+        {
+            return m_BaseRegId;
+        }
+
+        unsigned int GetExponentRegisterId () const
+        {
+            return m_ExponentRegId;
+        }
+
+        unsigned int GetResultRegisterId () const
+        {
+            return m_ResultRegId;
+        }
+
+        unsigned int GetReturnRegisterId () const
+        {
+            return m_ReturnRegId;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("POW % % % %", RegisterIdToString (m_BaseRegId), RegisterIdToString (m_ExponentRegId),
+                RegisterIdToString (m_ResultRegId), RegisterIdToString (m_ReturnRegId));
+        }
+
+        private:
+        unsigned int m_BaseRegId = 0;
+        unsigned int m_ExponentRegId = 0;
+        unsigned int m_ResultRegId = 0;
+        unsigned int m_ReturnRegId = 0;
+    };
+
     class IRMulConstInstruction : public IIRInstruction
     {
         public:
@@ -449,6 +834,38 @@ namespace LangUMS
         }
     };
 
+    class IRRndInstruction : public IIRInstruction
+    {
+        public:
+        IRRndInstruction (unsigned int range, int dstRegId = -1) : // if dstRegId == -1 the value is pushed on top of the stack
+            m_Range (range), m_DstRegId (dstRegId), IIRInstruction (IRInstructionType::Rnd)
+        {}
+
+        unsigned int GetRange () const
+        {
+            return m_Range;
+        }
+
+        int GetDestinationRegisterId () const
+        {
+            return m_DstRegId;
+        }
+
+        std::string DebugDump () const
+        {
+            if (m_DstRegId == -1)
+            {
+                return SafePrintf ("RND PUSH %", m_Range);
+            }
+
+            return SafePrintf ("RND % %", RegisterIdToString (m_DstRegId), m_Range);
+        }
+
+        private:
+        unsigned int m_Range = 0;
+        int m_DstRegId = -1;
+    };
+
     class IRDisplayMsgInstruction : public IIRInstruction
     {
         public:
@@ -943,6 +1360,214 @@ namespace LangUMS
         bool m_IsAbsolute = false;
     };
 
+    struct JmpTableEntry
+    {
+        unsigned int m_Value = 0;
+        int m_Offset = 0;
+    };
+
+    class IRJmpTableInstruction : public IIRInstruction
+    {
+        public:
+        IRJmpTableInstruction (unsigned int regId, int defaultOffset) :
+            m_RegisterId (regId), m_DefaultOffset (defaultOffset), IIRInstruction (IRInstructionType::JmpTable)
+        {}
+
+        void AddEntry (unsigned int value, int offset)
+        {
+            JmpTableEntry entry;
+            entry.m_Value = value;
+            entry.m_Offset = offset;
+            m_Entries.push_back(entry);
+        }
+
+        const std::vector<JmpTableEntry>& GetEntries () const
+        {
+            return m_Entries;
+        }
+
+        unsigned int GetRegisterId () const
+        {
+            return m_RegisterId;
+        }
+
+        int GetDefaultOffset () const
+        {
+            return m_DefaultOffset;
+        }
+
+        void SetDefaultOffset (int offset)
+        {
+            m_DefaultOffset = offset;
+        }
+
+        std::string DebugDump () const
+        {
+            auto dump = SafePrintf ("JTBL %", RegisterIdToString (m_RegisterId));
+
+            for (auto& entry : m_Entries)
+            {
+                dump += SafePrintf (entry.m_Offset >= 0 ? " %:+%" : " %:%", entry.m_Value, entry.m_Offset);
+            }
+
+            dump += SafePrintf (m_DefaultOffset >= 0 ? " DEFAULT +%" : " DEFAULT %", m_DefaultOffset);
+            return dump;
+        }
+
+        private:
+        unsigned int m_RegisterId = 0;
+        int m_DefaultOffset = 0;
+        std::vector<JmpTableEntry> m_Entries;
+    };
+
+    class IRCallInstruction : public IIRInstruction
+    {
+        public:
+        IRCallInstruction (unsigned int target, unsigned int retRegId) :
+            m_Target (target), m_RetRegId (retRegId), IIRInstruction (IRInstructionType::Call)
+        {}
+
+        // absolute index of the first instruction of the subroutine
+        unsigned int GetTarget () const
+        {
+            return m_Target;
+        }
+
+        unsigned int GetReturnRegisterId () const
+        {
+            return m_RetRegId;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("CALL % %", m_Target, RegisterIdToString (m_RetRegId));
+        }
+
+        private:
+        unsigned int m_Target = 0;
+        unsigned int m_RetRegId = 0;
+    };
+
+    class IRRetInstruction : public IIRInstruction
+    {
+        public:
+        IRRetInstruction (unsigned int retRegId, int entryOffset) :
+            m_RetRegId (retRegId), m_EntryOffset (entryOffset), IIRInstruction (IRInstructionType::Ret)
+        {}
+
+        unsigned int GetReturnRegisterId () const
+        {
+            return m_RetRegId;
+        }
+
+        // relative offset of the first instruction of the subroutine, returns go back to the calls targeting it
+        int GetEntryOffset () const
+        {
+            return m_EntryOffset;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("RET % %", RegisterIdToString (m_RetRegId), m_EntryOffset);
+        }
+
+        private:
+        unsigned int m_RetRegId = 0;
+        int m_EntryOffset = 0;
+    };
+
+    class IRStartTaskInstruction : public IIRInstruction
+    {
+        public:
+        IRStartTaskInstruction (unsigned int counterRegId, unsigned int target) :
+            m_CounterRegId (counterRegId), m_Target (target), IIRInstruction (IRInstructionType::StartTask)
+        {}
+
+        unsigned int GetCounterRegisterId () const
+        {
+            return m_CounterRegId;
+        }
+
+        // absolute index of the task's TASK instruction
+        unsigned int GetTarget () const
+        {
+            return m_Target;
+        }
+
+        void SetTarget (unsigned int target)
+        {
+            m_Target = target;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("TASKSTART % %", RegisterIdToString (m_CounterRegId), m_Target);
+        }
+
+        private:
+        unsigned int m_CounterRegId = 0;
+        unsigned int m_Target = 0;
+    };
+
+    class IRTaskInstruction : public IIRInstruction
+    {
+        public:
+        IRTaskInstruction (unsigned int counterRegId) :
+            m_CounterRegId (counterRegId), IIRInstruction (IRInstructionType::Task)
+        {}
+
+        unsigned int GetCounterRegisterId () const
+        {
+            return m_CounterRegId;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("TASK %", RegisterIdToString (m_CounterRegId));
+        }
+
+        private:
+        unsigned int m_CounterRegId = 0;
+    };
+
+    class IRYieldInstruction : public IIRInstruction
+    {
+        public:
+        IRYieldInstruction () : IIRInstruction (IRInstructionType::Yield) {}
+
+        std::string DebugDump () const
+        {
+            return "YIELD";
+        }
+    };
+
+    class IRSleepInstruction : public IIRInstruction
+    {
+        public:
+        IRSleepInstruction (unsigned int timerRegId, unsigned int milliseconds) :
+            m_TimerRegId (timerRegId), m_Milliseconds (milliseconds), IIRInstruction (IRInstructionType::Sleep)
+        {}
+
+        unsigned int GetTimerRegisterId () const
+        {
+            return m_TimerRegId;
+        }
+
+        unsigned int GetMilliseconds () const
+        {
+            return m_Milliseconds;
+        }
+
+        std::string DebugDump () const
+        {
+            return SafePrintf ("SLEEP % %", RegisterIdToString (m_TimerRegId), m_Milliseconds);
+        }
+
+        private:
+        unsigned int m_TimerRegId = 0;
+        unsigned int m_Milliseconds = 0;
+    };
+
     class IRSetSwInstruction : public IIRInstruction
     {
         public:
@@ -2728,6 +3353,63 @@ namespace LangUMS
         unsigned int m_SwitchId;
     };
 
+    struct RawTrigger
+    {
+        std::vector<std::unique_ptr<IIRInstruction>> m_Conditions;
+        std::vector<std::unique_ptr<IIRInstruction>> m_Actions;
+        bool m_Exits = false; // if true the trigger moves execution past the block
+    };
+
+    class IRTriggersInstruction : public IIRInstruction
+    {
+        public:
+        IRTriggersInstruction () : IIRInstruction (IRInstructionType::Triggers)
+        {}
+
+        void AddTrigger (RawTrigger&& trigger)
+        {
+            m_Triggers.push_back (std::move (trigger));
+        }
+
+        const std::vector<RawTrigger>& GetTriggers () const
+        {
+            return m_Triggers;
+        }
+
+        std::string DebugDump () const
+        {
+            std::string dump = "TRIGGERS";
+
+            for (auto i = 0u; i < m_Triggers.size (); i++)
+            {
+                auto& trigger = m_Triggers[i];
+                dump += i == 0 ? " WHEN " : "; WHEN ";
+
+                for (auto q = 0u; q < trigger.m_Conditions.size (); q++)
+                {
+                    dump += (q == 0 ? "" : ", ") + trigger.m_Conditions[q]->DebugDump ();
+                }
+
+                dump += " DO ";
+
+                for (auto q = 0u; q < trigger.m_Actions.size (); q++)
+                {
+                    dump += (q == 0 ? "" : ", ") + trigger.m_Actions[q]->DebugDump ();
+                }
+
+                if (trigger.m_Exits)
+                {
+                    dump += trigger.m_Actions.empty () ? "EXIT" : ", EXIT";
+                }
+            }
+
+            return dump;
+        }
+
+        private:
+        std::vector<RawTrigger> m_Triggers;
+    };
+
     class IRRegCondInstruction : public IIRInstruction
     {
         public:
@@ -7,6 +7,11 @@ namespace LangUMS
     {
         m_Instructions = std::move(instructions);
 
+        if (m_FuseIndependentOps)
+        {
+            FuseIndependentCopies();
+        }
+
         return std::move(m_Instructions);
     }
 
@@ -45,99 +50,349 @@ namespace LangUMS
         return madeChanges;
     }
 
-    std::vector<bool> IROptimizer::CalculateJmpTargets(const std::vector<std::unique_ptr<IIRInstruction>>& instructions)
+    bool IROptimizer::FuseIndependentCopies()
     {
-        std::vector<bool> jmpTargets;
-        jmpTargets.resize(instructions.size());
+        auto jmpTargets = CalculateJmpTargets(m_Instructions);
 
-        for (auto i = 0u; i < instructions.size(); i++)
+        bool madeChanges = false;
+
+        for (auto i = 0u; i < m_Instructions.size(); i++)
         {
-            auto& instruction = instructions[i];
-            if (instruction->GetType() == IRInstructionType::Jmp)
+            FusedCopyEntry entry;
+            if (MatchFusableOp(jmpTargets, i, entry) == 0)
             {
-                auto jmp = (IRJmpInstruction*)instruction.get();
-                auto offset = jmp->GetOffset();
+                continue;
+            }
 
-                if (!jmp->IsAbsolute())
-                {
-                    offset += i;
-                }
+            // registers read or written by the group so far, anything touching them ends the group
+            std::set<unsigned int> touched;
+            std::vector<FusedCopyEntry> entries;
+            std::vector<unsigned int> fused;
 
-                if (offset >= (int)jmpTargets.size())
+            for (auto q = i; q < m_Instructions.size() && entries.size() < MAX_FUSED_COPIES; q++)
+            {
+                if (q != i && jmpTargets[q])
                 {
-                    throw IRCompilerException("Out of bounds jump", 0);
+                    break; // a jump into the middle of the group would skip the fused copy
                 }
 
-                jmpTargets[offset] = true;
-            }
-            else if (instruction->GetType() == IRInstructionType::JmpIfEq)
-            {
-                auto jmp = (IRJmpIfEqInstruction*)instruction.get();
-                auto offset = jmp->GetOffset();
+                auto instruction = m_Instructions[q].get();
+                auto type = instruction->GetType();
 
-                if (!jmp->IsAbsolute())
+                auto length = MatchFusableOp(jmpTargets, q, entry);
+                if (length != 0)
                 {
-                    offset += i;
+                    auto hasDestination = !entry.m_IsPush && !entry.m_IsSpawn;
+
+                    if (touched.find(entry.m_SrcRegId) != touched.end() ||
+                        (hasDestination && touched.find(entry.m_DstRegId) != touched.end()))
+                    {
+                        break;
+                    }
+
+                    touched.insert(entry.m_SrcRegId);
+                    if (hasDestination)
+                    {
+                        touched.insert(entry.m_DstRegId);
+                    }
+
+                    entries.push_back(entry);
+                    for (auto k = 0u; k < length; k++)
+                    {
+                        fused.push_back(q + k);
+                    }
+
+                    q += length - 1;
                 }
+                else if (type == IRInstructionType::SetReg ||
+                    type == IRInstructionType::IncReg ||
+                    type == IRInstructionType::DecReg)
+                {
+                    // single action register writes stay where they are, later copies may be hoisted past them
+                    unsigned int regId;
+                    if (type == IRInstructionType::SetReg)
+                    {
+                        regId = ((IRSetRegInstruction*)instruction)->GetRegisterId();
+                    }
+                    else if (type == IRInstructionType::IncReg)
+                    {
+                        regId = ((IRIncRegInstruction*)instruction)->GetRegisterId();
+                    }
+                    else
+                    {
+                        regId = ((IRDecRegInstruction*)instruction)->GetRegisterId();
+                    }
 
-                if (offset >= (int)jmpTargets.size())
+                    if (regId >= Reg_StackTop || touched.find(regId) != touched.end())
+                    {
+                        break;
+                    }
+
+                    touched.insert(regId);
+                }
+                else if (type != IRInstructionType::Nop)
                 {
-                    throw IRCompilerException("Out of bounds jump", 0);
+                    break;
                 }
-
-                jmpTargets[offset] = true;
             }
-            else if (instruction->GetType() == IRInstructionType::JmpIfNotEq)
+
+            if (entries.size() < 2)
             {
-                auto jmp = (IRJmpIfNotEqInstruction*)instruction.get();
-                auto offset = jmp->GetOffset();
+                continue;
+            }
+
+            auto fusedCopy = new IRFusedCopyInstruction();
+            fusedCopy->SetASTNode(m_Instructions[i]->GetASTNode());
+            fusedCopy->SetDebugStackFrames(m_Instructions[i]->GetDebugStackFrames());
 
-                if (!jmp->IsAbsolute())
+            for (auto& fusedEntry : entries)
+            {
+                if (fusedEntry.m_IsPush)
                 {
-                    offset += i;
+                    fusedCopy->AddPush(fusedEntry.m_SrcRegId);
                 }
-
-                if (offset >= (int)jmpTargets.size())
+                else if (fusedEntry.m_IsAdd)
                 {
-                    throw IRCompilerException("Out of bounds jump", 0);
+                    fusedCopy->AddAddition(fusedEntry.m_DstRegId, fusedEntry.m_SrcRegId);
                 }
-
-                jmpTargets[offset] = true;
-            }
-            else if (instruction->GetType() == IRInstructionType::JmpIfSwSet)
-            {
-                auto jmp = (IRJmpIfSwSetInstruction*)instruction.get();
-                auto offset = jmp->GetOffset();
-
-                if (!jmp->IsAbsolute())
+                else if (fusedEntry.m_IsSpawn)
                 {
-                    offset += i;
+                    fusedCopy->AddSpawn(fusedEntry.m_SrcRegId, fusedEntry.m_PlayerId, fusedEntry.m_UnitId, fusedEntry.m_LocationName, fusedEntry.m_PropsSlot);
                 }
-
-                if (offset >= (int)jmpTargets.size())
+                else
                 {
-                    throw IRCompilerException("Out of bounds jump", 0);
+                    fusedCopy->AddCopy(fusedEntry.m_DstRegId, fusedEntry.m_SrcRegId);
                 }
+            }
 
-                jmpTargets[offset] = true;
+            for (auto index : fused)
+            {
+                m_Instructions[index] = std::make_unique<IRNopInstruction>();
             }
-            else if (instruction->GetType() == IRInstructionType::JmpIfSwNotSet)
+
+            m_Instructions[i] = std::unique_ptr<IIRInstruction>(fusedCopy);
+            i = fused.back();
+            madeChanges = true;
+        }
+
+        return madeChanges;
+    }
+
+    unsigned int IROptimizer::MatchFusableOp(const std::vector<bool>& jmpTargets, unsigned int index, FusedCopyEntry& retEntry) const
+    {
+        retEntry = FusedCopyEntry();
+
+        auto instruction = m_Instructions[index].get();
+
+        if (instruction->GetType() == IRInstructionType::CopyReg)
+        {
+            auto copyReg = (IRCopyRegInstruction*)instruction;
+            auto dstRegId = copyReg->GetDestinationRegisterId();
+            auto srcRegId = copyReg->GetSourceRegisterId();
+
+            if (dstRegId == srcRegId || !IsFusableRegister(dstRegId) || !IsFusableRegister(srcRegId))
             {
-                auto jmp = (IRJmpIfSwNotSetInstruction*)instruction.get();
-                auto offset = jmp->GetOffset();
+                return 0;
+            }
 
-                if (!jmp->IsAbsolute())
-                {
-                    offset += i;
-                }
+            retEntry.m_DstRegId = dstRegId;
+            retEntry.m_SrcRegId = srcRegId;
+            return 1;
+        }
+        else if (instruction->GetType() == IRInstructionType::Spawn)
+        {
+            // a spawn taking its quantity straight from a variable, see IRCompiler::GetInPlaceQuantityRegister()
+            auto spawn = (IRSpawnInstruction*)instruction;
+            if (spawn->IsValueLiteral() || !IsFusableRegister(spawn->GetRegisterId()))
+            {
+                return 0;
+            }
+
+            retEntry.m_SrcRegId = spawn->GetRegisterId();
+            SetSpawnEntry(spawn, retEntry);
+            return 1;
+        }
+        else if (instruction->GetType() != IRInstructionType::Push)
+        {
+            return 0;
+        }
+
+        auto push = (IRPushInstruction*)instruction;
+        if (push->IsValueLiteral() || !IsFusableRegister(push->GetRegisterId()))
+        {
+            return 0;
+        }
+
+        retEntry.m_SrcRegId = push->GetRegisterId();
+        retEntry.m_IsPush = true;
+
+        auto next = index + 1;
+        if (next >= m_Instructions.size() || jmpTargets[next])
+        {
+            return 1;
+        }
+
+        // PUSH x, SPAWN [STACK 0] spawns the value of x
+        if (m_Instructions[next]->GetType() == IRInstructionType::Spawn)
+        {
+            auto spawn = (IRSpawnInstruction*)m_Instructions[next].get();
+            if (!spawn->IsValueLiteral() && spawn->GetRegisterId() == Reg_StackTop)
+            {
+                retEntry.m_IsPush = false;
+                SetSpawnEntry(spawn, retEntry);
+                return 2;
+            }
+
+            return 1;
+        }
+
+        // PUSH x, PUSH y, ADD, POP x adds y to x
+        if (next + 2 >= m_Instructions.size() || jmpTargets[next + 1] || jmpTargets[next + 2] ||
+            m_Instructions[next]->GetType() != IRInstructionType::Push ||
+            m_Instructions[next + 1]->GetType() != IRInstructionType::Add ||
+            m_Instructions[next + 2]->GetType() != IRInstructionType::Pop)
+        {
+            return 1;
+        }
+
+        auto secondPush = (IRPushInstruction*)m_Instructions[next].get();
+        if (secondPush->IsValueLiteral() || !IsFusableRegister(secondPush->GetRegisterId()) ||
+            secondPush->GetRegisterId() == push->GetRegisterId())
+        {
+            return 1;
+        }
+
+        auto pop = (IRPopInstruction*)m_Instructions[next + 2].get();
+        if (pop->GetRegisterId() == (int)push->GetRegisterId())
+        {
+            retEntry.m_DstRegId = push->GetRegisterId();
+            retEntry.m_SrcRegId = secondPush->GetRegisterId();
+        }
+        else if (pop->GetRegisterId() == (int)secondPush->GetRegisterId())
+        {
+            retEntry.m_DstRegId = secondPush->GetRegisterId();
+            retEntry.m_SrcRegId = push->GetRegisterId();
+        }
+        else
+        {
+            return 1;
+        }
 
-                if (offset >= (int)jmpTargets.size())
+        retEntry.m_IsPush = false;
+        retEntry.m_IsAdd = true;
+        return 4;
+    }
+
+    void IROptimizer::SetSpawnEntry(IRSpawnInstruction* spawn, FusedCopyEntry& retEntry) const
+    {
+        retEntry.m_IsSpawn = true;
+        retEntry.m_PlayerId = spawn->GetPlayerId();
+        retEntry.m_UnitId = spawn->GetUnitId();
+        retEntry.m_LocationName = spawn->GetLocationName();
+        retEntry.m_PropsSlot = spawn->GetPropsSlot();
+    }
+
+    bool IROptimizer::IsFusableRegister(unsigned int regId) const
+    {
+        return regId >= Reg_ReservedEnd && regId < Reg_StackTop;
+    }
+
+    int IROptimizer::GetJmpTargetIndex(IIRInstruction* instruction, unsigned int index) const
+    {
+        int offset;
+        bool isAbsolute;
+
+        switch (instruction->GetType())
+        {
+        case IRInstructionType::Jmp:
+            offset = ((IRJmpInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfEq:
+            offset = ((IRJmpIfEqInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfEqInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfNotEq:
+            offset = ((IRJmpIfNotEqInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfNotEqInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfLess:
+            offset = ((IRJmpIfLessInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfLessInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfGrt:
+            offset = ((IRJmpIfGrtInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfGrtInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfLessOrEq:
+            offset = ((IRJmpIfLessOrEqualInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfLessOrEqualInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfGrtOrEq:
+            offset = ((IRJmpIfGrtOrEqualInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfGrtOrEqualInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfSwSet:
+            offset = ((IRJmpIfSwSetInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfSwSetInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpIfSwNotSet:
+            offset = ((IRJmpIfSwNotSetInstruction*)instruction)->GetOffset();
+            isAbsolute = ((IRJmpIfSwNotSetInstruction*)instruction)->IsAbsolute();
+            break;
+        case IRInstructionType::JmpTable:
+            offset = ((IRJmpTableInstruction*)instruction)->GetDefaultOffset();
+            isAbsolute = false;
+            break;
+        case IRInstructionType::Call:
+            offset = ((IRCallInstruction*)instruction)->GetTarget();
+            isAbsolute = true;
+            break;
+        case IRInstructionType::StartTask:
+            offset = ((IRStartTaskInstruction*)instruction)->GetTarget();
+            isAbsolute = true;
+            break;
+        default:
+            return -1;
+        }
+
+        return isAbsolute ? offset : (int)index + offset;
+    }
+
+    std::vector<bool> IROptimizer::CalculateJmpTargets(const std::vector<std::unique_ptr<IIRInstruction>>& instructions)
+    {
+        std::vector<bool> jmpTargets;
+        jmpTargets.resize(instructions.size());
+
+        for (auto i = 0u; i < instructions.size(); i++)
+        {
+            if (instructions[i]->GetType() == IRInstructionType::JmpTable)
+            {
+                auto jmpTable = (IRJmpTableInstruction*)instructions[i].get();
+                for (auto& entry : jmpTable->GetEntries())
                 {
-                    throw IRCompilerException("Out of bounds jump", 0);
+                    jmpTargets[std::min((int)i + entry.m_Offset, (int)jmpTargets.size() - 1)] = true;
                 }
+            }
 
-                jmpTargets[offset] = true;
+            auto targetIndex = GetJmpTargetIndex(instructions[i].get(), i);
+            if (targetIndex == -1)
+            {
+                continue;
+            }
+
+            if (targetIndex < 0)
+            {
+                throw IRCompilerException("Out of bounds jump", 0);
             }
+
+            // the backend treats jumps past the end as jumps to the last instruction
+            if (targetIndex >= (int)jmpTargets.size())
+            {
+                targetIndex = (int)jmpTargets.size() - 1;
+            }
+
+            jmpTargets[targetIndex] = true;
         }
 
         return jmpTargets;
@@ -11,11 +11,25 @@ namespace LangUMS
         public:
         std::vector<std::unique_ptr<IIRInstruction>> Process(std::vector<std::unique_ptr<IIRInstruction>> instructions);
 
+        void SetFuseIndependentOps(bool fuseIndependentOps)
+        {
+            m_FuseIndependentOps = fuseIndependentOps;
+        }
+
         private:
         bool EliminateRedundantPushPopPairs();
+        bool FuseIndependentCopies();
+
+        // returns how many instructions the fusable operation at index spans or 0 if there is none
+        unsigned int MatchFusableOp(const std::vector<bool>& jmpTargets, unsigned int index, FusedCopyEntry& retEntry) const;
+        void SetSpawnEntry(IRSpawnInstruction* spawn, FusedCopyEntry& retEntry) const;
+        bool IsFusableRegister(unsigned int regId) const;
+        int GetJmpTargetIndex(IIRInstruction* instruction, unsigned int index) const;
 
         std::vector<std::unique_ptr<IIRInstruction>> m_Instructions;
         std::vector<bool> CalculateJmpTargets(const std::vector<std::unique_ptr<IIRInstruction>>& instructions);
+
+        bool m_FuseIndependentOps = false;
     };
 
 }
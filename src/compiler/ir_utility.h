@@ -32,6 +32,22 @@ namespace LangUMS
         }
     }
 
+    inline std::string ElementsToString(const std::vector<unsigned int>& regIds)
+    {
+        std::string result = "[";
+        for (auto i = 0u; i < regIds.size(); i++)
+        {
+            if (i > 0)
+            {
+                result += " ";
+            }
+
+            result += RegisterIdToString(regIds[i]);
+        }
+
+        return result + "]";
+    }
+
     inline std::string SwitchToString(unsigned int switchId)
     {
         if (switchId == Switch_ArithmeticUnderflow)
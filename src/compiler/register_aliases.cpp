@@ -110,9 +110,36 @@ namespace LangUMS
         return Reg_ReservedEnd + registers[index];
     }
 
-    void RegisterAliases::Allocate(const std::string& name, unsigned int count, IASTNode* node)
+    bool RegisterAliases::IsArray(const std::string& name, IASTNode* node) const
     {
+        // a local variable hides a global one of the same name
         auto fn = FindFunctionDeclarationForNode(node);
+        if (fn != nullptr)
+        {
+            auto localAliases = m_Aliases.find(fn);
+            if (localAliases == m_Aliases.end() || localAliases->second.find(name) == localAliases->second.end())
+            {
+                fn = nullptr;
+            }
+        }
+
+        auto arrays = m_Arrays.find(fn);
+        return arrays != m_Arrays.end() && arrays->second.find(name) != arrays->second.end();
+    }
+
+    void RegisterAliases::Allocate(const std::string& name, unsigned int count, IASTNode* node, bool isArray)
+    {
+        auto fn = FindFunctionDeclarationForNode(node);
+
+        if (isArray)
+        {
+            m_Arrays[fn].insert(name);
+        }
+        else
+        {
+            m_Arrays[fn].erase(name);
+        }
+
         if (fn == nullptr)
         {
             auto& registers = m_GlobalAliases[name];
@@ -133,6 +160,8 @@ namespace LangUMS
     void RegisterAliases::Deallocate(const std::string& name, IASTNode* node)
     {
         auto fn = FindFunctionDeclarationForNode(node);
+        m_Arrays[fn].erase(name);
+
         if (fn == nullptr)
         {
             auto& registers = m_GlobalAliases[name];
@@ -148,6 +177,12 @@ namespace LangUMS
         localAliases.erase(name);
     }
 
+    void RegisterAliases::ReserveFreedRegisters()
+    {
+        // registers released so far are never handed out again
+        m_FreeIds.clear();
+    }
+
     const std::unordered_map<std::string, std::vector<unsigned int>>& RegisterAliases::GetAliases(IASTNode* node) const
     {
         auto fn = FindFunctionDeclarationForNode(node);
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace LangUMS
 {
@@ -17,8 +18,10 @@ namespace LangUMS
         bool HasGlobalAlias(const std::string& name, unsigned int index) const;
         int GetAlias(const std::string& name, unsigned int index, IASTNode* node) const;
         int GetGlobalAlias(const std::string& name, unsigned int index) const;
-        void Allocate(const std::string& name, unsigned int count, IASTNode* node);
+        bool IsArray(const std::string& name, IASTNode* node) const;
+        void Allocate(const std::string& name, unsigned int count, IASTNode* node, bool isArray = false);
         void Deallocate(const std::string& name, IASTNode* node);
+        void ReserveFreedRegisters();
         const std::unordered_map<std::string, std::vector<unsigned int>>& GetAliases(IASTNode* node) const;
 
         private:
@@ -27,6 +30,7 @@ namespace LangUMS
         std::unordered_map<ASTFunctionDeclaration*, std::unordered_map<std::string, std::vector<unsigned int>>> m_Aliases;
         std::unordered_map<std::string, std::vector<unsigned int>> m_GlobalAliases;
         std::unordered_map<std::string, std::vector<unsigned int>> m_DummyEmptyAliases;
+        std::unordered_map<ASTFunctionDeclaration*, std::unordered_set<std::string>> m_Arrays;
         std::vector<unsigned int> m_FreeIds;
         unsigned int m_NextFreeId = 0;
     };
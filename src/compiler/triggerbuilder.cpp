@@ -7,8 +7,8 @@ namespace LangUMS
     std::vector<RegisterDef> g_RegisterMap;
     std::unordered_map<unsigned int, std::set<IIRInstruction*>> g_AddressToInstructionMap;
 
-    TriggerBuilder::TriggerBuilder(int address, IIRInstruction* instruction, uint8_t playerId)
-        : m_Address(address), m_Instruction(instruction), m_PlayerMask(playerId)
+    TriggerBuilder::TriggerBuilder(int address, IIRInstruction* instruction, uint8_t playerId, unsigned int counterRegId)
+        : m_Address(address), m_CounterRegId(counterRegId), m_Instruction(instruction), m_PlayerMask(playerId)
     {
         using namespace CHK;
 
@@ -27,8 +27,13 @@ namespace LangUMS
 
         if (address >= 0)
         {
-            Cond_TestReg(Reg_InstructionCounter, address, TriggerComparisonType::Exactly);
-            Cond_TestSwitch(Switch_InstructionCounterMutex, false);
+            Cond_TestReg(m_CounterRegId, address, TriggerComparisonType::Exactly);
+
+            // the mutex only guards the main instruction counter while an indirect jump is resolved
+            if (m_CounterRegId == Reg_InstructionCounter)
+            {
+                Cond_TestSwitch(Switch_InstructionCounterMutex, false);
+            }
         }
 
         // actions
@@ -540,7 +545,7 @@ namespace LangUMS
 
     void TriggerBuilder::Action_JumpTo(unsigned int address)
     {
-        Action_SetReg(Reg_InstructionCounter, address);
+        Action_SetReg(m_CounterRegId, address);
     }
 
     void TriggerBuilder::Action_PreserveTrigger()
@@ -18,7 +18,7 @@ namespace LangUMS
     class TriggerBuilder
     {
         public:
-        TriggerBuilder(int address, IIRInstruction* instruction, uint8_t playerId);
+        TriggerBuilder(int address, IIRInstruction* instruction, uint8_t playerId, unsigned int counterRegId);
         void AssociateInstruction(IIRInstruction* instruction);
 
         void SetOwner(uint8_t playerId);
@@ -149,6 +149,7 @@ namespace LangUMS
         private:
         bool m_HasChanges = false;
         unsigned int m_Address = 0;
+        unsigned int m_CounterRegId = 0;
         unsigned int m_NextCondition = 0;
         unsigned int m_NextAction = 0;
         
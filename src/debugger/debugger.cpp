@@ -22,18 +22,10 @@
 namespace LangUMS
 {
 
-    Debugger::Debugger(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, const std::string& source, const std::shared_ptr<IASTNode>& ast) :
+    Debugger::Debugger(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, const SourceBuffer& source, const std::shared_ptr<IASTNode>& ast) :
         m_Source(source)
     {
         m_AST = ast.get();
-        m_SourceLines = Split(source);
-
-        auto i = 0u;
-        for (auto& line : m_SourceLines)
-        {
-            m_LineStartIndices.push_back(i);
-            i += line.length() + 1;
-        }
 
         for (auto& instruction : instructions)
         {
@@ -226,7 +218,7 @@ namespace LangUMS
 
     std::vector<IIRInstruction*> Debugger::SourceLineToInstructions(unsigned int lineNumber)
     {
-        auto startIndex = m_LineStartIndices[lineNumber - 1];
+        auto startIndex = (int)m_Source.GetSourceMap().GetLineStart(lineNumber);
         
         std::vector<IASTNode*> nodes;
         int closestDistance = std::numeric_limits<int>::max();
@@ -9,6 +9,7 @@
 
 #include "../compiler/ir.h"
 #include "../ast/ast.h"
+#include "../source_buffer.h"
 #include "debugger_thread.h"
 
 namespace LangUMS
@@ -17,7 +18,7 @@ namespace LangUMS
     class Debugger
     {
         public:
-        Debugger(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, const std::string& source, const std::shared_ptr<IASTNode>& ast);
+        Debugger(const std::vector<std::unique_ptr<IIRInstruction>>& instructions, const SourceBuffer& source, const std::shared_ptr<IASTNode>& ast);
 
         DebuggerThreadState GetState() const;
         
@@ -45,20 +46,17 @@ namespace LangUMS
 
         const std::string& GetSource() const
         {
-            return m_Source;
+            return m_Source.GetText();
         }
 
         int CharIndexToLineNumber(int charIndex)
         {
-            for (auto i = 0u; i < m_LineStartIndices.size(); i++)
-            {
-                if (m_LineStartIndices[i] > charIndex)
-                {
-                    return i;
-                }
-            }
-
-            return 0;
+            return m_Source.GetSourceMap().GetLineNumber(charIndex);
+        }
+
+        const SourceBuffer& GetSourceBuffer() const
+        {
+            return m_Source;
         }
 
         private:
@@ -70,9 +68,7 @@ namespace LangUMS
 
         // read only
         std::vector<IIRInstruction*> m_Instructions;
-        std::string m_Source;
-        std::vector<std::string> m_SourceLines;
-        std::vector<int> m_LineStartIndices;
+        SourceBuffer m_Source;
 
         std::string m_ProcessName;
 
@@ -22,7 +22,6 @@ namespace LangUMS
             }
         }
 
-        auto sourceLines = Split(m_Debugger->GetSource());
         std::cout << std::endl;
 
         while (true)
@@ -111,7 +110,7 @@ namespace LangUMS
 
     void DebuggerCli::Where()
     {
-        auto lines = Split(m_Debugger->GetSource());
+        auto& source = m_Debugger->GetSourceBuffer();
 
         auto charIndex = m_Debugger->GetCurrentSourceCharIndex();
         if (charIndex == 0)
@@ -120,16 +119,16 @@ namespace LangUMS
         }
         else
         {
-            auto lineNumber = GetLineNumber(m_Debugger->GetSource(), charIndex);
+            auto location = source.GetSourceMap().GetLocation(charIndex);
+            auto lineNumber = source.GetSourceMap().GetLineNumber(charIndex);
 
-            for (auto i = 0u; i < lineNumber; i++)
+            std::cout << "Line: " << location.m_LineNumber << ", Char: " << location.m_Column;
+            if (!location.m_FileName.empty())
             {
-                charIndex -= lines[i].length();
+                std::cout << " in " << location.m_FileName;
             }
 
-            std::cout << "Line: " << lineNumber - 1 << ", Char: " << (int)charIndex;
-
-            std::cout << ">>> " << trim(lines[lineNumber - 1]);
+            std::cout << ">>> " << trim(source.GetLine(lineNumber));
         }
     }
 
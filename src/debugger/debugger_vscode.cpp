@@ -31,8 +31,6 @@ namespace LangUMS
     bool DebuggerVSCode::Run()
     {
         LOG_F("Starting VS code debug session.");
-        
-        m_SourceLines = Split(m_Debugger->GetSource());
 
         while (m_Debugger->GetState() != DebuggerThreadState::Attached)
         {
@@ -44,8 +44,6 @@ namespace LangUMS
 
         void RunEventsThread();
 
-        std::vector<std::string> m_SourceLines;
-        
         Debugger* m_Debugger = nullptr;
         LogInterfaceVSCode* m_LogInterface = nullptr;
 
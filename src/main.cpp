@@ -36,6 +36,25 @@ using namespace std::experimental;
 #define SCENARIO_FILENAME "staredit\\scenario.chk"
 #define DEFAULT_PROCESS_NAME "starcraft.exe"
 
+bool ParsePlayerList(const std::string& list, std::vector<uint8_t>& retPlayers)
+{
+    std::stringstream ss(list);
+    std::string item;
+
+    while (std::getline(ss, item, ','))
+    {
+        auto player = std::atoi(trim(item).c_str());
+        if (player < 1 || player > 8)
+        {
+            return false;
+        }
+
+        retPlayers.push_back((uint8_t)player);
+    }
+
+    return !retPlayers.empty();
+}
+
 int main(int argc, char* argv[])
 {
     cxxopts::Options opts("LangUMS " VERSION, "LangUMS compiler");
@@ -47,11 +66,20 @@ int main(int argc, char* argv[])
         ("d,dst", "Path to destination .scx map file.", cxxopts::value<std::string>())
         ("l,lang", "Path to source .l source file.", cxxopts::value<std::string>())
         ("r,reg", "Optional registers file.", cxxopts::value<std::string>())
+        ("D,define", "Defines a preprocessor macro as NAME or NAME=VALUE, can be given multiple times.", cxxopts::value<std::vector<std::string>>())
         ("strip", "Strips unnecessary data from the resulting .scx. Will make the file unopenable in editors.", cxxopts::value<bool>())
         ("preserve-triggers", "Preserves already existing triggers in the map (use with caution!).", cxxopts::value<bool>())
         ("copy-batch-size", "Maximum number value that can be copied in one cycle. Must be a power of 2. Higher values will increase the amount of emitted triggers (default: 8192).", cxxopts::value<unsigned int>())
+        ("optimize-for", "Whether code generation should favor fewer triggers or fewer cycles. One of \"balanced\", \"size\" (-Os) or \"cycles\" (-Ot) (default: balanced).", cxxopts::value<std::string>())
+        ("table-copy-range", "Values below this are copied with a single cycle lookup table when optimizing for cycles (default: 16).", cxxopts::value<unsigned int>())
+        ("hyper-triggers", "Number of hyper triggers which make the trigger lists run every game frame, 0 disables them (default: 5).", cxxopts::value<unsigned int>())
+        ("hyper-trigger-owners", "Comma separated list of players the hyper triggers are spread over (default: the triggers owner).", cxxopts::value<std::string>())
+        ("hyper-trigger-placement", "Where the hyper triggers go. One of \"after-program\", \"start\" or \"end\" (after any preserved triggers) (default: after-program).", cxxopts::value<std::string>())
+        ("distribute-triggers", "Comma separated list of extra players which event handlers, tasks and the multiply routine are spread over to keep each trigger list short.", cxxopts::value<std::string>())
         ("triggers-owner", "The index of the player which holds the main logic triggers (default: 1).", cxxopts::value<unsigned int>())
         ("disable-optimization", "Disables all forms of compiler optimization (useful to debug compiler issues).", cxxopts::value<bool>())
+        ("non-blocking-sleep", "Makes sleep() suspend only the task (or main()) which called it instead of pausing all of the triggers.", cxxopts::value<bool>())
+        ("fuse-ops", "Batches independent copies, pushes, additions and spawns in a basic block into shared loops whatever the cost model prefers. Fewer cycles at the cost of extra conditions per trigger.", cxxopts::value<bool>())
         ("disable-compression", "Disables compression of the resulting map file. Results in much larger file sizes but you can open the map in StarEdit.", cxxopts::value<bool>())
         ("dump-ir", "Dumps the intermediate representation during compilation.", cxxopts::value<bool>())
         ("ir", "Dumps the intermediate representation to a file.", cxxopts::value<std::string>())
@@ -63,9 +91,29 @@ int main(int argc, char* argv[])
         ("debug-vscode", "Internal. Used by the VS Code debugger extension to communicate with LangUMS.", cxxopts::value<bool>())
         ;
 
+    // -Os and -Ot would otherwise be parsed as a group of short options
+    static char optimizeForSize[] = "--optimize-for=size";
+    static char optimizeForCycles[] = "--optimize-for=cycles";
+
+    std::vector<char*> args(argv, argv + argc);
+    for (auto& arg : args)
+    {
+        if (std::string(arg) == "-Os")
+        {
+            arg = optimizeForSize;
+        }
+        else if (std::string(arg) == "-Ot")
+        {
+            arg = optimizeForCycles;
+        }
+    }
+
+    auto argsCount = (int)args.size();
+    auto argsData = args.data();
+
     try
     {
-        opts.parse(argc, argv);
+        opts.parse(argsCount, argsData);
     }
     catch (...)
     {
@@ -140,28 +188,21 @@ int main(int argc, char* argv[])
 
     LOG_F("Code source: %", langPath);
 
-    std::ifstream sourceFile(langPath.generic_u8string());
-    if (!sourceFile.is_open())
-    {
-        LOG_EXITERR("\n(!) Failed to open \"%\" for reading.", langPath.generic_u8string());
-        return 1;
-    }
-
-    std::string str;
-    std::string source;
-    while (std::getline(sourceFile, str))
-    {
-        source += str;
-        source.push_back('\n');
-    }
-
-    source.push_back('\n');
-
     Preprocessor preprocessor(langPath.relative_path().remove_filename().generic_u8string());
+    SourceBuffer source;
 
     try
     {
-        source = preprocessor.Process(source);
+        if (opts.count("define") > 0)
+        {
+            for (auto& define : opts["define"].as<std::vector<std::string>>())
+            {
+                preprocessor.AddDefine(define);
+            }
+        }
+
+        auto text = preprocessor.ProcessFile(langPath.generic_u8string());
+        source = SourceBuffer(std::move(text), preprocessor.GetSourceMap());
     }
     catch (const PreprocessorException& ex)
     {
@@ -384,7 +425,7 @@ int main(int argc, char* argv[])
 
     try
     {
-        ast = std::shared_ptr<IASTNode>(parser.Parse(source));
+        ast = parser.Parse(source);
 
         if (!disableOptimization)
         {
@@ -393,20 +434,127 @@ int main(int argc, char* argv[])
     }
     catch (const TemplateInstantiatorException& ex)
     {
-        PrintTemplateInstantiatorException(parser.GetSourceBuffer(), ex);
+        PrintTemplateInstantiatorException(source, ex);
         LOG_EXITERR("");
         return -1;
     }
     catch (const ParserException& ex)
     {
-        PrintParserException(parser.GetSourceBuffer(), ex);
+        PrintParserException(source, ex);
         LOG_EXITERR("");
         return 1;
     }
 
-    source = parser.GetSourceBuffer();
+    auto optimizationLevel = OptimizationLevel::Balanced;
+    if (opts.count("optimize-for") > 0)
+    {
+        if (!CostModel::ParseLevel(opts["optimize-for"].as<std::string>(), optimizationLevel))
+        {
+            LOG_EXITERR("\n(!) optimize-for must be one of \"balanced\", \"size\" or \"cycles\"");
+            return 1;
+        }
+
+        LOG_F("Optimizing for %", CostModel::GetLevelName(optimizationLevel));
+    }
+
+    CostModel costModel(optimizationLevel);
+
+    if (opts.count("copy-batch-size") > 0)
+    {
+        auto copyBatchSize = opts["copy-batch-size"].as<unsigned int>();
+
+        if ((copyBatchSize & (copyBatchSize - 1)) != 0)
+        {
+            LOG_EXITERR("\n(!) copy-batch-size must be a power of 2!");
+            return 1;
+        }
+
+        LOG_F("Copy batch size: %", copyBatchSize);
+
+        if (copyBatchSize <= 64)
+        {
+            LOG_F("(!) WARNING! Copy batch size is set to an extremely low value (<= 64). Arithmetic operations will be VERY slow to execute.");
+            LOG_F("(!) Multiplication and division will most likely produce incorrect results.");
+        }
+        else if (copyBatchSize < 1024)
+        {
+            LOG_F("(!) WARNING! Copy batch size is set to a moderately low value (< 1024).");
+            LOG_F("(!) Arithmetic operations with large numbers will be slow to execute and there are certain limitations to multiplication and division.");
+        }
+
+        costModel.SetCopyBatchSize(copyBatchSize);
+    }
+
+    if (opts.count("table-copy-range") > 0)
+    {
+        auto tableCopyRange = opts["table-copy-range"].as<unsigned int>();
+        LOG_F("Table copy range: %", tableCopyRange);
+        costModel.SetTableCopyRange(tableCopyRange);
+    }
+
+    if (opts.count("hyper-triggers") > 0)
+    {
+        auto hyperTriggerCount = opts["hyper-triggers"].as<unsigned int>();
+        LOG_F("Hyper triggers: %", hyperTriggerCount);
+        costModel.SetHyperTriggerCount(hyperTriggerCount);
+
+        if (hyperTriggerCount == 0)
+        {
+            LOG_F("(!) WARNING! Hyper triggers are disabled. The triggers will only run once every two game seconds.");
+        }
+    }
+
+    if (opts.count("hyper-trigger-owners") > 0)
+    {
+        std::vector<uint8_t> hyperTriggerOwners;
+        if (!ParsePlayerList(opts["hyper-trigger-owners"].as<std::string>(), hyperTriggerOwners))
+        {
+            LOG_EXITERR("\n(!) hyper-trigger-owners must be a list of players between 1 and 8");
+            return 1;
+        }
+
+        costModel.SetHyperTriggerOwners(hyperTriggerOwners);
+    }
+
+    if (opts.count("distribute-triggers") > 0)
+    {
+        std::vector<uint8_t> regionOwners;
+        if (!ParsePlayerList(opts["distribute-triggers"].as<std::string>(), regionOwners))
+        {
+            LOG_EXITERR("\n(!) distribute-triggers must be a list of players between 1 and 8");
+            return 1;
+        }
+
+        costModel.SetRegionOwners(regionOwners);
+    }
+
+    if (opts.count("hyper-trigger-placement") > 0)
+    {
+        auto placement = HyperTriggerPlacement::AfterProgram;
+        if (!CostModel::ParseHyperTriggerPlacement(opts["hyper-trigger-placement"].as<std::string>(), placement))
+        {
+            LOG_EXITERR("\n(!) hyper-trigger-placement must be one of \"after-program\", \"start\" or \"end\"");
+            return 1;
+        }
+
+        costModel.SetHyperTriggerPlacement(placement);
+    }
+
+    if (opts.count("fuse-ops") > 0)
+    {
+        costModel.SetFuseIndependentOps(true);
+    }
+
+    if (optimizationLevel != OptimizationLevel::Balanced)
+    {
+        LOG_F("Copy batch size: %, hyper triggers: %", costModel.GetCopyBatchSize(), costModel.GetHyperTriggerCount());
+    }
+
+    LOG_F("Expected trigger scans per game second: %", costModel.EstimateScansPerGameSecond());
 
     IRCompiler ir;
+    ir.SetCostModel(costModel);
+    ir.SetNonBlockingSleep(opts.count("non-blocking-sleep") > 0);
     
     try
     {
@@ -607,32 +755,26 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (opts.count("copy-batch-size") > 0)
+    for (auto owner : costModel.GetHyperTriggerOwners())
     {
-        auto copyBatchSize = opts["copy-batch-size"].as<unsigned int>();
-
-        if ((copyBatchSize & (copyBatchSize - 1)) != 0)
+        if (owner != triggersOwner && ownrChunk->GetPlayerType(owner - 1) == PlayerType::Human)
         {
-            LOG_EXITERR("\n(!) copy-batch-size must be a power of 2!");
-            return 1;
+            LOG_F("(!) Warning! Hyper trigger owner (player %) is a Human player, the triggers will slow down if he leaves.", (int)owner);
         }
+    }
 
-        LOG_F("Copy batch size: %", copyBatchSize);
+    for (auto owner : costModel.GetRegionOwners())
+    {
+        LOG_F("Player % owns part of the LangUMS triggers.", (int)owner);
 
-        if (copyBatchSize <= 64)
+        if (owner != triggersOwner && ownrChunk->GetPlayerType(owner - 1) == PlayerType::Human)
         {
-            LOG_F("(!) WARNING! Copy batch size is set to an extremely low value (<= 64). Arithmetic operations will be VERY slow to execute.");
-            LOG_F("(!) Multiplication and division will most likely produce incorrect results.");
+            LOG_F("(!) Warning! Player % is a Human player, him leaving the game will break LangUMS in a bad way.", (int)owner);
         }
-        else if (copyBatchSize < 1024)
-        {
-            LOG_F("(!) WARNING! Copy batch size is set to a moderately low value (< 1024).");
-            LOG_F("(!) Arithmetic operations with large numbers will be slow to execute and there are certain limitations to multiplication and division.");
-        }
-
-        compiler.SetCopyBatchSize(copyBatchSize);
     }
 
+    compiler.SetCostModel(costModel);
+
     if (opts.count("reg") > 0)
     {
         auto regPath = filesystem::path(opts["reg"].as<std::string>());
@@ -0,0 +1,41 @@
+#ifndef __LANGUMS_MAPPED_FILE_H
+#define __LANGUMS_MAPPED_FILE_H
+
+#include <string>
+
+namespace LangUMS
+{
+
+    // read-only view of a whole file mapped into memory
+    class MappedFile
+    {
+        public:
+        MappedFile() {}
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const std::string& path);
+        void Close();
+
+        const char* GetData() const
+        {
+            return m_Data;
+        }
+
+        size_t GetSize() const
+        {
+            return m_Size;
+        }
+
+        private:
+        void* m_File = nullptr;
+        void* m_Mapping = nullptr;
+        const char* m_Data = nullptr;
+        size_t m_Size = 0;
+    };
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+namespace LangUMS
+{
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& path)
+    {
+        Close();
+
+        auto file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(file, &info) != 0)
+        {
+            close(file);
+            return false;
+        }
+
+        // empty files can not be mapped
+        if (info.st_size == 0)
+        {
+            close(file);
+            return true;
+        }
+
+        // the mapping stays valid after the descriptor is closed
+        auto data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_Data = (const char*)data;
+        m_Size = (size_t)info.st_size;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_Data != nullptr)
+        {
+            munmap((void*)m_Data, m_Size);
+            m_Data = nullptr;
+        }
+
+        m_Size = 0;
+    }
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifdef _WIN32
+
+#include <windows.h>
+
+#include "mapped_file.h"
+
+namespace LangUMS
+{
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& path)
+    {
+        Close();
+
+        auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        m_File = file;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            Close();
+            return false;
+        }
+
+        // empty files can not be mapped
+        if (size.QuadPart == 0)
+        {
+            return true;
+        }
+
+        m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_Mapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        m_Data = (const char*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_Data == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        m_Size = (size_t)size.QuadPart;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_Data != nullptr)
+        {
+            UnmapViewOfFile(m_Data);
+            m_Data = nullptr;
+        }
+
+        if (m_Mapping != nullptr)
+        {
+            CloseHandle(m_Mapping);
+            m_Mapping = nullptr;
+        }
+
+        if (m_File != nullptr)
+        {
+            CloseHandle(m_File);
+            m_File = nullptr;
+        }
+
+        m_Size = 0;
+    }
+
+}
+
+#endif
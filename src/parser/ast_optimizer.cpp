@@ -40,8 +40,9 @@ namespace LangUMS
             {
                 auto lhsNumber = (ASTNumberLiteral*)lhs.get();
                 auto rhsNumber = (ASTNumberLiteral*)rhs.get();
-                auto result = CalculateConstantBinaryExpression(lhsNumber->GetValue(), rhsNumber->GetValue(), expression->GetOperator());
-                return std::shared_ptr<IASTNode>(new ASTNumberLiteral(result, node->GetCharIndex()));
+                // the first child holds the right hand side operand, see ConcatenateStrings() and IRCompiler::EmitBinaryExpression()
+                auto result = CalculateConstantBinaryExpression(rhsNumber->GetValue(), lhsNumber->GetValue(), expression->GetOperator());
+                return std::make_shared<ASTNumberLiteral>(result, node->GetCharIndex());
             }
         }
         else if (node->GetType() == ASTNodeType::UnaryExpression)
@@ -54,7 +55,7 @@ namespace LangUMS
             {
                 auto valueNumber = (ASTNumberLiteral*)value.get();
                 auto result = valueNumber->GetValue() > 0 ? 0 : 1;
-                return std::shared_ptr<IASTNode>(new ASTNumberLiteral(result, node->GetCharIndex()));
+                return std::make_shared<ASTNumberLiteral>(result, node->GetCharIndex());
             }
         }
 
@@ -89,7 +90,7 @@ namespace LangUMS
             auto lhsString = (ASTStringLiteral*)lhs.get();
             auto rhsString = (ASTStringLiteral*)rhs.get();
             auto result = rhsString->GetValue() + lhsString->GetValue();
-            return std::shared_ptr<IASTNode>(new ASTStringLiteral(result, node->GetCharIndex()));
+            return std::make_shared<ASTStringLiteral>(result, node->GetCharIndex());
         }
 
         return node;
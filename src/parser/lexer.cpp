@@ -0,0 +1,284 @@
+#include <cctype>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+
+#include "../log.h"
+#include "parser.h"
+#include "lexer.h"
+
+namespace LangUMS
+{
+
+    static const char* g_Keywords[] =
+    {
+        "fn",
+        "global",
+        "const",
+        "unit",
+        "for",
+        "in",
+        "var",
+        "return",
+        "spawn_task",
+        "triggers",
+        "yield",
+        "if",
+        "else",
+        "while",
+        "switch",
+        "case",
+        "default",
+        "when",
+        "do",
+        "true",
+        "false",
+    };
+
+    static const char* g_TwoCharSymbols[] =
+    {
+        "==",
+        "!=",
+        "<=",
+        ">=",
+        "||",
+        "&&",
+        "++",
+        "--",
+        "=>",
+    };
+
+    static inline bool IsIdentifierStart(char c)
+    {
+        return std::isalpha((unsigned char)c) || c == '_';
+    }
+
+    static inline bool IsIdentifierChar(char c)
+    {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    Lexer::Lexer()
+    {
+        for (auto keyword : g_Keywords)
+        {
+            Intern(keyword, (unsigned int)strlen(keyword));
+        }
+    }
+
+    void Lexer::Process(const std::string& buffer)
+    {
+        m_Lexemes.clear();
+        m_Strings.clear();
+        m_Lexemes.reserve(buffer.size() / 4);
+
+        auto index = 0u;
+        auto size = (unsigned int)buffer.size();
+
+        while (true)
+        {
+            while (index < size && std::isspace((unsigned char)buffer[index]))
+            {
+                index++;
+            }
+
+            Lexeme lexeme;
+            lexeme.m_Offset = index;
+
+            if (index >= size)
+            {
+                lexeme.m_Type = LexemeType::EndOfInput;
+                lexeme.m_Value = 0;
+                m_Lexemes.push_back(lexeme);
+                break;
+            }
+
+            auto c = buffer[index];
+
+            if (IsIdentifierStart(c))
+            {
+                auto start = index;
+                while (index < size && IsIdentifierChar(buffer[index]))
+                {
+                    index++;
+                }
+
+                lexeme.m_Type = LexemeType::Identifier;
+                lexeme.m_Value = Intern(buffer.data() + start, index - start);
+            }
+            else if (std::isdigit((unsigned char)c))
+            {
+                lexeme.m_Type = LexemeType::Number;
+                lexeme.m_Value = NumberLiteral(buffer, index);
+            }
+            else if (c == '"')
+            {
+                lexeme.m_Type = LexemeType::String;
+                lexeme.m_Value = (int)m_Strings.size();
+                m_Strings.push_back(StringLiteral(buffer, index));
+            }
+            else
+            {
+                lexeme.m_Type = LexemeType::Symbol;
+                lexeme.m_Value = MakeSymbol(c);
+
+                if (index + 1 < size)
+                {
+                    for (auto symbol : g_TwoCharSymbols)
+                    {
+                        if (symbol[0] == c && symbol[1] == buffer[index + 1])
+                        {
+                            lexeme.m_Value = MakeSymbol(symbol[0], symbol[1]);
+                            index++;
+                            break;
+                        }
+                    }
+                }
+
+                index++;
+            }
+
+            m_Lexemes.push_back(lexeme);
+        }
+    }
+
+    int Lexer::Intern(const char* chars, unsigned int length)
+    {
+        m_Scratch.assign(chars, length);
+
+        auto it = m_IdentifierIds.find(m_Scratch);
+        if (it != m_IdentifierIds.end())
+        {
+            return it->second;
+        }
+
+        auto id = (int)m_Identifiers.size();
+        m_Identifiers.push_back(m_Scratch);
+        m_IdentifierIds.insert(std::make_pair(m_Scratch, id));
+        return id;
+    }
+
+    int Lexer::NumberLiteral(const std::string& buffer, unsigned int& index)
+    {
+        auto size = (unsigned int)buffer.size();
+        uint32_t value = 0;
+
+        if (buffer[index] == '0' && index + 1 < size && std::tolower(buffer[index + 1]) == 'x')
+        {
+            index += 2;
+
+            while (index < size && std::isxdigit((unsigned char)buffer[index]))
+            {
+                auto c = std::tolower(buffer[index++]);
+                value = value * 16 + (std::isdigit(c) ? c - '0' : c - 'a' + 10);
+            }
+
+            return (int)value;
+        }
+
+        while (index < size && std::isdigit((unsigned char)buffer[index]))
+        {
+            value = value * 10 + (buffer[index++] - '0');
+        }
+
+        return (int)value;
+    }
+
+    std::string Lexer::StringLiteral(const std::string& buffer, unsigned int& index)
+    {
+        auto size = (unsigned int)buffer.size();
+        auto start = index++;
+
+        std::string value;
+
+        if (buffer.compare(index, 2, "\"\"") == 0)
+        {
+            // multi-line string
+            index += 2;
+
+            auto end = buffer.find("\"\"\"", index);
+            if (end == std::string::npos)
+            {
+                throw ParserException(start, "Unexpected end of input");
+            }
+
+            // whitespace in front of the closing quotes only indents them
+            auto valueEnd = end;
+            while (valueEnd > index && std::isspace((unsigned char)buffer[valueEnd - 1]))
+            {
+                valueEnd--;
+            }
+
+            value = buffer.substr(index, valueEnd - index);
+            index = (unsigned int)end + 3;
+        }
+        else
+        {
+            while (true)
+            {
+                if (index >= size)
+                {
+                    throw ParserException(start, "Unexpected end of input");
+                }
+
+                auto c = buffer[index];
+                if (c == '\n')
+                {
+                    throw ParserException(index, "Invalid string value, expected '\"'");
+                }
+
+                index++;
+
+                if (c == '"')
+                {
+                    break;
+                }
+
+                value.push_back(c);
+            }
+        }
+
+        std::string processed;
+
+        auto inHexValue = false;
+        std::string hexValue;
+
+        for (auto i = 0u; i < value.length(); i++)
+        {
+            auto c = value[i];
+            if (c == '<')
+            {
+                inHexValue = true;
+            }
+            else if (inHexValue && c == '>')
+            {
+                unsigned int x;
+                std::stringstream ss;
+                ss << std::hex << hexValue;
+                ss >> x;
+
+                if (x == 0)
+                {
+                    throw ParserException(index, SafePrintf("Invalid hexadecimal value \"%\" in string \"%\"", hexValue, value));
+                }
+                else
+                {
+                    processed.push_back((char)x);
+                }
+
+                inHexValue = false;
+            }
+            else if (inHexValue)
+            {
+                hexValue.push_back(c);
+            }
+            else
+            {
+                processed.push_back(c);
+            }
+        }
+
+        return processed;
+    }
+
+}
@@ -0,0 +1,96 @@
+#ifndef __LANGUMS_LEXER_H
+#define __LANGUMS_LEXER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace LangUMS
+{
+
+    enum class LexemeType
+    {
+        Identifier,
+        Number,
+        String,
+        Symbol,
+        EndOfInput
+    };
+
+    // keywords are interned first so an identifier's id doubles as its keyword id
+    enum class KeywordId
+    {
+        Fn = 0,
+        Global,
+        Const,
+        Unit,
+        For,
+        In,
+        Var,
+        Return,
+        SpawnTask,
+        Triggers,
+        Yield,
+        If,
+        Else,
+        While,
+        Switch,
+        Case,
+        Default,
+        When,
+        Do,
+        True,
+        False,
+        Count
+    };
+
+    struct Lexeme
+    {
+        LexemeType m_Type;
+        unsigned int m_Offset;
+        int m_Value; // identifier id, number value, string id or symbol
+    };
+
+    // symbols of up to two characters are stored as their characters packed into one value
+    constexpr int MakeSymbol(char first, char second = 0)
+    {
+        return (unsigned char)first | ((unsigned char)second << 8);
+    }
+
+    class Lexer
+    {
+        public:
+        Lexer();
+
+        void Process(const std::string& buffer);
+
+        const std::vector<Lexeme>& GetLexemes() const
+        {
+            return m_Lexemes;
+        }
+
+        const std::string& GetIdentifier(int id) const
+        {
+            return m_Identifiers[id];
+        }
+
+        const std::string& GetString(int id) const
+        {
+            return m_Strings[id];
+        }
+
+        private:
+        int Intern(const char* chars, unsigned int length);
+        int NumberLiteral(const std::string& buffer, unsigned int& index);
+        std::string StringLiteral(const std::string& buffer, unsigned int& index);
+
+        std::vector<Lexeme> m_Lexemes;
+        std::vector<std::string> m_Identifiers;
+        std::unordered_map<std::string, int> m_IdentifierIds;
+        std::vector<std::string> m_Strings;
+        std::string m_Scratch;
+    };
+
+}
+
+#endif
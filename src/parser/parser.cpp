@@ -5,10 +5,11 @@
 namespace LangUMS
 {
 
-    std::unique_ptr<IASTNode> Parser::Parse(const std::string& input)
+    std::shared_ptr<IASTNode> Parser::Parse(const SourceBuffer& source)
     {
-        m_Buffer = input;
-        m_CurrentChar = 0;
+        m_Source = source;
+        m_Lexer.Process(m_Source.GetText());
+        m_CurrentLexeme = 0;
 
         auto unit = Unit();
         TemplateInstantiator templateInstantiator;
@@ -16,140 +17,40 @@ namespace LangUMS
         return unit;
     }
 
-    ExpressionToken Parser::Token()
+    std::shared_ptr<IASTNode> Parser::Unit()
     {
-        auto c = Peek();
-
-        if (c == '(')
-        {
-            Next();
-            Whitespace();
-            ExpressionToken token;
-            token.m_Type = TokenType::LeftParenthesis;
-            return token;
-        }
-
-        if (c == ')')
-        {
-            Next();
-            Whitespace();
-            ExpressionToken token;
-            token.m_Type = TokenType::RightParenthesis;
-            return token;
-        }
-
-        if (c == '[')
-        {
-            Next();
-            Whitespace();
-            ExpressionToken token;
-            token.m_Type = TokenType::LeftSquareBracket;
-            return token;
-        }
-
-        if (c == ']')
-        {
-            Next();
-            Whitespace();
-            ExpressionToken token;
-            token.m_Type = TokenType::RightSquareBracket;
-            return token;
-        }
-
-        if (std::isdigit(c) || (c == '-' && std::isdigit(Peek(1))) || PeekKeyword("0x"))
-        {
-            ExpressionToken token;
-            token.m_Type = TokenType::NumberLiteral;
-            token.m_NumberValue = NumberLiteral();
-            return token;
-        }
-
-        if (c == '"')
-        {
-            ExpressionToken token;
-            token.m_Type = TokenType::StringLiteral;
-            token.m_Value = StringLiteral();
-            return token;
-        }
-
-        if (IsOperator(c))
-        {
-            ExpressionToken token;
-            token.m_Type = TokenType::Operator;
-            token.m_OperatorType = Operator();
-            return token;
-        }
-
-        if (c == ',')
-        {
-            ExpressionToken token;
-            token.m_Type = TokenType::FunctionArgumentSeparator;
-            Next();
-            return token;
-        }
-
-        ExpressionToken token;
-        token.m_Type = TokenType::Identifier;
-        token.m_Value = Identifier();
-
-        if (Peek() == '(')
-        {
-            token.m_Type = TokenType::FunctionName;
-        }
-
-        if (token.m_Value == "true" || token.m_Value == "false")
-        {
-            token.m_Type = TokenType::BooleanLiteral;
-        }
-
-        return token;
-    }
-
-    std::unique_ptr<IASTNode> Parser::Unit()
-    {
-        auto unit = std::make_unique<IASTNode>(m_CurrentChar, ASTNodeType::Unit);
+        auto unit = std::make_shared<IASTNode>(CharIndex(), ASTNodeType::Unit);
 
         while (!EndOfStream())
         {
-            Whitespace();
-
-            if (EndOfStream())
-            {
-                break;
-            }
-
-            if (PeekKeyword("fn"))
+            if (PeekKeyword(KeywordId::Fn))
             {
-                auto i = 0;
-                auto c = Peek(i);
-                while (c != '(' && c != '<')
-                {
-                    i++;
-                    c = Peek(i);
-                }
-
-                if (c == '(')
+                if (PeekSymbol('(', 2))
                 {
                     unit->AddChild(FunctionDeclaration());
                 }
-                else if(c == '<')
+                else if (PeekSymbol('<', 2))
                 {
                     unit->AddChild(TemplateFunction());
                 }
                 else
                 {
-                    throw ParserException(m_CurrentChar, "Unexpected input");
+                    throw ParserException(CharIndex(), "Unexpected input");
                 }
             }
-            else if (PeekKeyword("global"))
+            else if (PeekKeyword(KeywordId::Global))
             {
                 unit->AddChild(GlobalVariableDeclaration());
             }
-            else if (PeekKeyword("unit"))
+            else if (PeekKeyword(KeywordId::Const))
+            {
+                unit->AddChild(ConstDeclaration());
+            }
+            else if (PeekKeyword(KeywordId::Unit))
             {
                 unit->AddChild(UnitProperties());
             }
-            else if (PeekKeyword("for"))
+            else if (PeekKeyword(KeywordId::For))
             {
                 unit->AddChild(UnitScopeRepeatTemplate());
             }
@@ -162,383 +63,232 @@ namespace LangUMS
         return unit;
     }
 
-    OperatorType Parser::Operator()
+    bool Parser::PeekOperator(OperatorType& retOperator) const
     {
-        auto next = Next();
-
-        auto c = Peek();
-
-        if (next == '=' && c == '=')
+        auto& lexeme = Peek();
+        if (lexeme.m_Type != LexemeType::Symbol)
         {
-            Next();
-            return OperatorType::Equals;
+            return false;
         }
 
-        if (next == '!' && c == '=')
+        switch (lexeme.m_Value)
         {
-            Next();
-            return OperatorType::NotEquals;
+        case MakeSymbol('|', '|'): retOperator = OperatorType::Or; return true;
+        case MakeSymbol('&', '&'): retOperator = OperatorType::And; return true;
+        case MakeSymbol('=', '='): retOperator = OperatorType::Equals; return true;
+        case MakeSymbol('!', '='): retOperator = OperatorType::NotEquals; return true;
+        case MakeSymbol('>'): retOperator = OperatorType::GreaterThan; return true;
+        case MakeSymbol('>', '='): retOperator = OperatorType::GreaterThanOrEquals; return true;
+        case MakeSymbol('<'): retOperator = OperatorType::LessThan; return true;
+        case MakeSymbol('<', '='): retOperator = OperatorType::LessThanOrEquals; return true;
+        case MakeSymbol('+'): retOperator = OperatorType::Add; return true;
+        case MakeSymbol('-'): retOperator = OperatorType::Subtract; return true;
+        case MakeSymbol('/'): retOperator = OperatorType::Divide; return true;
+        case MakeSymbol('*'): retOperator = OperatorType::Multiply; return true;
+        case MakeSymbol('!'): retOperator = OperatorType::Not; return true;
+        case MakeSymbol('+', '+'): retOperator = OperatorType::PostfixIncrement; return true;
+        case MakeSymbol('-', '-'): retOperator = OperatorType::PostfixDecrement; return true;
         }
-        else if (next == '!')
+
+        return false;
+    }
+
+    std::shared_ptr<IASTNode> Parser::Expression()
+    {
+        if (PeekSymbol(';') || PeekSymbol('{') || PeekSymbol('}') || EndOfStream())
         {
-            return OperatorType::Not;
+            throw ParserException(CharIndex(), "Empty expression");
         }
 
-        if (next == '<' && c == '=')
+        return BinaryExpression(0);
+    }
+
+    static inline int GetOperatorPrecedence(OperatorType op)
+    {
+        switch (op)
+        {
+        case OperatorType::Or: return 0;
+        case OperatorType::And: return 1;
+        case OperatorType::Equals:
+        case OperatorType::NotEquals: return 2;
+        case OperatorType::GreaterThan:
+        case OperatorType::GreaterThanOrEquals:
+        case OperatorType::LessThan:
+        case OperatorType::LessThanOrEquals: return 3;
+        case OperatorType::Add:
+        case OperatorType::Subtract: return 4;
+        case OperatorType::Divide:
+        case OperatorType::Multiply: return 5;
+        }
+
+        return -1;
+    }
+
+    std::shared_ptr<IASTNode> Parser::BinaryExpression(int minPrecedence)
+    {
+        // operators of the same precedence group to the left, so a / b * c is (a / b) * c
+        auto lhs = UnaryExpression();
+
+        OperatorType op;
+        while (PeekOperator(op) && op < OperatorType::Not && GetOperatorPrecedence(op) >= minPrecedence)
         {
+            auto charIndex = CharIndex();
             Next();
-            return OperatorType::LessThanOrEquals;
-        }
-        else if (next == '<')
-        {
-            return OperatorType::LessThan;
+
+            auto rhs = BinaryExpression(GetOperatorPrecedence(op) + 1);
+
+            // the right hand side comes first, see IRCompiler::EmitBinaryExpression()
+            auto binaryExpression = std::make_shared<ASTBinaryExpression>(op, charIndex);
+            binaryExpression->AddChild(std::move(rhs));
+            binaryExpression->AddChild(std::move(lhs));
+            lhs = binaryExpression;
         }
 
-        if (next == '>' && c == '=')
+        return lhs;
+    }
+
+    std::shared_ptr<IASTNode> Parser::UnaryExpression()
+    {
+        OperatorType op;
+        if (PeekOperator(op) && op >= OperatorType::Not)
         {
+            auto unaryExpression = std::make_shared<ASTUnaryExpression>(op, CharIndex());
             Next();
-            return OperatorType::GreaterThanOrEquals;
-        }
-        else if (next == '>')
-        {
-            return OperatorType::GreaterThan;
+
+            unaryExpression->AddChild(UnaryExpression());
+            return unaryExpression;
         }
 
-        if (next == '|' && c == '|')
+        auto value = PrimaryExpression();
+
+        while (PeekOperator(op) && (op == OperatorType::PostfixIncrement || op == OperatorType::PostfixDecrement))
         {
+            auto unaryExpression = std::make_shared<ASTUnaryExpression>(op, CharIndex());
             Next();
-            return OperatorType::Or;
+
+            unaryExpression->AddChild(std::move(value));
+            value = unaryExpression;
         }
 
-        if (next == '&' && c == '&')
+        return value;
+    }
+
+    std::shared_ptr<IASTNode> Parser::PrimaryExpression()
+    {
+        auto& lexeme = Peek();
+        auto charIndex = lexeme.m_Offset;
+
+        if (lexeme.m_Type == LexemeType::Number || (PeekSymbol('-') && Peek(1).m_Type == LexemeType::Number))
         {
-            Next();
-            return OperatorType::And;
+            return std::make_shared<ASTNumberLiteral>(NumberLiteral(), charIndex);
         }
 
-        if (next == '+' && c == '+')
+        if (lexeme.m_Type == LexemeType::String)
         {
-            Next();
-            return OperatorType::PostfixIncrement;
+            return std::make_shared<ASTStringLiteral>(StringLiteral(), charIndex);
         }
 
-        if (next == '-' && c == '-')
+        if (PeekSymbol('('))
         {
-            Next();
-            return OperatorType::PostfixDecrement;
+            Symbol('(');
+            auto value = BinaryExpression(0);
+            Symbol(')');
+            return value;
         }
 
-        switch (next)
+        if (lexeme.m_Type != LexemeType::Identifier)
         {
-        case '+': return OperatorType::Add;
-        case '-': return OperatorType::Subtract;
-        case '*': return OperatorType::Multiply;
-        case '/': return OperatorType::Divide;
+            throw ParserException(charIndex, "Missing value in expression");
         }
 
-        throw ParserException(m_CurrentChar, "Invalid operator");
-    }
-
-    std::unique_ptr<IASTNode> Parser::Expression()
-    {
-        std::vector<ExpressionToken> stack;
-        std::vector<ExpressionToken> output;
+        if (PeekKeyword(KeywordId::True) || PeekKeyword(KeywordId::False))
+        {
+            Next();
+            return std::make_shared<ASTNumberLiteral>(lexeme.m_Value == (int)KeywordId::True ? 1 : 0, charIndex);
+        }
 
-        int insideFunctionCall = 0;
+        auto& identifier = Identifier();
 
-        while (true)
+        if (PeekSymbol('('))
         {
-            auto c = Peek();
-            if (c == ';' || c == '{')
-            {
-                break;
-            }
-
-            auto token = Token();
+            Symbol('(');
 
-            switch (token.m_Type)
-            {
-            case TokenType::BooleanLiteral:
-            case TokenType::StringLiteral:
-            case TokenType::NumberLiteral:
-            case TokenType::Identifier:
-                output.push_back(token);
-                continue;
-            }
+            auto node = std::make_shared<ASTFunctionCall>(identifier, charIndex);
 
-            if (token.m_Type == TokenType::FunctionName)
-            {
-                stack.push_back(token);
-            }
-            if (token.m_Type == TokenType::FunctionArgumentSeparator)
+            if (!PeekSymbol(')'))
             {
-                auto fnIndex = (int)stack.size() - 1;
-                while (stack[fnIndex].m_Type != TokenType::FunctionName)
+                while (true)
                 {
-                    fnIndex--;
-                    if (fnIndex < 0)
-                    {
-                        throw ParserException(m_CurrentChar, "Syntax error");
-                    }
-                }
+                    node->AddChild(BinaryExpression(0));
 
-                stack[fnIndex].m_NumberValue++;
-
-                while (stack.back().m_Type != TokenType::LeftParenthesis)
-                {
-                    output.push_back(stack.back());
-                    stack.pop_back();
-
-                    if (stack.size() == 0)
-                    {
-                        throw ParserException(m_CurrentChar, "Mismatched parenthesis");
-                    }
-                }
-            }
-            else if (token.m_Type == TokenType::Operator)
-            {
-                auto o1 = token.m_OperatorType;
-
-                while (stack.size() > 0 && stack.back().m_Type == TokenType::Operator)
-                {
-                    auto o2 = stack.back().m_OperatorType;
-                    if ((int)o1 <= (int)o2)
-                    {
-                        output.push_back(stack.back());
-                        stack.pop_back();
-                    }
-                    else
+                    if (!PeekSymbol(','))
                     {
                         break;
                     }
-                }
-
-                while (stack.size() > 0 && stack.back().m_Type == TokenType::FunctionName)
-                {
-                    output.push_back(stack.back());
-                    stack.pop_back();
-                }
-
-                stack.push_back(token);
-            }
-            else if (token.m_Type == TokenType::LeftParenthesis)
-            {
-                if (stack.size() > 0 && stack.back().m_Type == TokenType::FunctionName || insideFunctionCall > 0)
-                {
-                    insideFunctionCall++;
-
-                    if (Peek() != ')')
-                    {
-                        stack.back().m_NumberValue++;
-                    }
-                }
-
-                stack.push_back(token);
-            }
-            else if (token.m_Type == TokenType::RightParenthesis)
-            {
-                if (insideFunctionCall > 0)
-                {
-                    insideFunctionCall--;
-                }
-
-                while (stack.size() > 0 && stack.back().m_Type != TokenType::LeftParenthesis)
-                {
-                    output.push_back(stack.back());
-                    stack.pop_back();
-                }
-
-                if (stack.size() < 1)
-                {
-                    throw ParserException(m_CurrentChar, "Mismatched parenthesis");
-                }
-
-                auto& back = stack.back();
-
-                if (back.m_Type == TokenType::Identifier || back.m_Type == TokenType::FunctionName)
-                {
-                    output.push_back(stack.back());
-                }
-
-                stack.pop_back();
-            }
-            else if (token.m_Type == TokenType::LeftSquareBracket)
-            {
-                if (output.size() == 0)
-                {
-                    throw ParserException(m_CurrentChar, "Syntax error. Unexpected \"[\"");
-                }
-
-                if (output.back().m_Type != TokenType::Identifier)
-                {
-                    throw ParserException(m_CurrentChar, "Syntax error. Unexpected \"[\"");
-                }
 
-                auto identifier = output.back();
-                output.pop_back();
-
-                if (std::isdigit(Peek()))
-                {
-                    auto arrayIndex = NumberLiteral();
-                    if (arrayIndex < 0)
-                    {
-                        throw ParserException(m_CurrentChar, SafePrintf("Invalid array index %", arrayIndex));
-                    }
-
-                    token.m_NumberValue = arrayIndex;
-                }
-                else
-                {
-                    token.m_NumberValue = -1;
-                    token.m_Value = Identifier();
+                    Symbol(',');
                 }
-
-                token.m_ArrayIdentifier = identifier.m_Value;
-                token.m_Type = TokenType::ArrayOperator;
-                output.push_back(token);
-
-                Symbol(']');
-            }
-            else if (token.m_Type == TokenType::RightSquareBracket)
-            {
-                throw ParserException(m_CurrentChar, "Syntax error. Unexpected \"]\"");
             }
-        }
 
-        while (stack.size() > 0)
-        {
-            auto token = stack.back();
-            stack.pop_back();
+            Symbol(')');
 
-            if (token.m_Type == TokenType::LeftParenthesis || token.m_Type == TokenType::RightParenthesis)
+            // arguments are stored last to first, see ASTFunctionCall::GetArgument()
+            auto argCount = node->GetChildCount();
+            for (auto i = 0u; i < argCount / 2; i++)
             {
-                throw ParserException(m_CurrentChar, "Mismatched parenthesis");
+                auto argument = node->GetChild(i);
+                node->SetChild(i, node->GetChild(argCount - i - 1));
+                node->SetChild(argCount - i - 1, argument);
             }
 
-            output.push_back(token);
+            return node;
         }
 
-        if (output.size() == 0)
+        if (PeekSymbol('['))
         {
-            throw ParserException(m_CurrentChar, "Empty expression");
-        }
-
-        auto token = output.back();
-        output.pop_back();
-        return ExpressionTokenToNode(token, output);
-    }
+            Symbol('[');
 
-    std::unique_ptr<IASTNode> Parser::ExpressionTokenToNode(const ExpressionToken& token, std::vector<ExpressionToken>& next)
-    {
-        std::unique_ptr<IASTNode> node = nullptr;
+            auto arrayExpression = std::make_shared<ASTArrayExpression>(identifier, charIndex);
+            auto indexCharIndex = CharIndex();
 
-        if (token.m_Type == TokenType::Operator)
-        {
-            if (token.m_OperatorType == OperatorType::Not ||
-                token.m_OperatorType == OperatorType::PostfixIncrement ||
-                token.m_OperatorType == OperatorType::PostfixDecrement)
+            if (Peek().m_Type == LexemeType::Number || PeekSymbol('-'))
             {
-                if (next.size() == 0)
+                auto arrayIndex = NumberLiteral();
+                if (arrayIndex < 0)
                 {
-                    throw ParserException(m_CurrentChar, "Missing value in unary expression");
+                    throw ParserException(indexCharIndex, SafePrintf("Invalid array index %", arrayIndex));
                 }
 
-                auto nxt = next.back();
-                next.pop_back();
-
-                auto unaryExpression = new ASTUnaryExpression(token.m_OperatorType, m_CurrentChar);
-                unaryExpression->AddChild(ExpressionTokenToNode(nxt, next));
-                node = std::unique_ptr<IASTNode>(unaryExpression);
+                arrayExpression->AddChild(std::make_shared<ASTNumberLiteral>(arrayIndex, indexCharIndex));
             }
             else
             {
-                if (next.size() < 2)
-                {
-                    throw ParserException(m_CurrentChar, "Missing value in binary expression");
-                }
-
-                auto nxt = next.back();
-                next.pop_back();
-
-                auto binaryExpression = new ASTBinaryExpression(token.m_OperatorType, m_CurrentChar);
-                binaryExpression->AddChild(ExpressionTokenToNode(nxt, next));
-
-                nxt = next.back();
-                next.pop_back();
-                binaryExpression->AddChild(ExpressionTokenToNode(nxt, next));
-                node = std::unique_ptr<IASTNode>(binaryExpression);
+                arrayExpression->AddChild(std::make_shared<ASTIdentifier>(Identifier(), indexCharIndex));
             }
-        }
-        else if (token.m_Type == TokenType::Identifier)
-        {
-            node = std::unique_ptr<IASTNode>(new ASTIdentifier(token.m_Value, m_CurrentChar));
-        }
-        else if (token.m_Type == TokenType::FunctionName)
-        {
-            auto argCount = token.m_NumberValue;
 
-            auto functionCall = new ASTFunctionCall(token.m_Value, m_CurrentChar);
-            node = std::unique_ptr<IASTNode>(functionCall);
-
-            for (auto i = 0; i < argCount; i++)
-            {
-                auto nxt = next.back();
-                next.pop_back();
-
-                node->AddChild(ExpressionTokenToNode(nxt, next));
-            }
-        }
-        else if (token.m_Type == TokenType::BooleanLiteral)
-        {
-            node = std::unique_ptr<IASTNode>(new ASTNumberLiteral(token.m_Value == "true" ? 1 : 0, m_CurrentChar));
-        }
-        else if (token.m_Type == TokenType::NumberLiteral)
-        {
-            node = std::unique_ptr<IASTNode>(new ASTNumberLiteral(token.m_NumberValue, m_CurrentChar));
-        }
-        else if (token.m_Type == TokenType::StringLiteral)
-        {
-            node = std::unique_ptr<IASTNode>(new ASTStringLiteral(token.m_Value, m_CurrentChar));
-        }
-        else if (token.m_Type == TokenType::ArrayOperator)
-        {
-            if (token.m_NumberValue != -1)
-            {
-                auto arrayExpression = new ASTArrayExpression(token.m_ArrayIdentifier, m_CurrentChar);
-                arrayExpression->AddChild(std::unique_ptr<IASTNode>(new ASTNumberLiteral(token.m_NumberValue, m_CurrentChar)));
-                node = std::unique_ptr<IASTNode>(arrayExpression);
-            }
-            else
-            {
-                auto arrayExpression = new ASTArrayExpression(token.m_ArrayIdentifier, m_CurrentChar);
-                arrayExpression->AddChild(std::unique_ptr<IASTNode>(new ASTIdentifier(token.m_Value, m_CurrentChar)));
-                node = std::unique_ptr<IASTNode>(arrayExpression);
-            }
-        }
-        else
-        {
-            throw ParserException(m_CurrentChar, "Invalid token type in expression");
+            Symbol(']');
+            return arrayExpression;
         }
 
-        return node;
+        return std::make_shared<ASTIdentifier>(identifier, charIndex);
     }
 
-    std::unique_ptr<IASTNode> Parser::ExpressionStatement()
+    std::shared_ptr<IASTNode> Parser::ExpressionStatement()
     {
         auto identifier = Identifier();
 
-        std::unique_ptr<IASTNode> arrayIndex = nullptr;
-        if (Peek() == '[')
+        std::shared_ptr<IASTNode> arrayIndex = nullptr;
+        if (PeekSymbol('['))
         {
             Symbol('[');
 
-            if (std::isdigit(Peek()))
+            if (Peek().m_Type == LexemeType::Number)
             {
-                arrayIndex = std::unique_ptr<IASTNode>(new ASTNumberLiteral(NumberLiteral(), m_CurrentChar));
+                arrayIndex = std::make_shared<ASTNumberLiteral>(NumberLiteral(), CharIndex());
             }
             else
             {
-                arrayIndex = std::unique_ptr<IASTNode>(new ASTIdentifier(Identifier(), m_CurrentChar));
+                arrayIndex = std::make_shared<ASTIdentifier>(Identifier(), CharIndex());
             }
 
             Symbol(']');
@@ -546,272 +296,368 @@ namespace LangUMS
 
         OperatorType op;
 
-        if (PeekKeyword("++"))
+        if (PeekSymbol("++"))
         {
-            Keyword("++");
+            Symbol("++");
             op = OperatorType::PostfixIncrement;
         }
-        else if (PeekKeyword("--"))
+        else if (PeekSymbol("--"))
         {
-            Keyword("--");
+            Symbol("--");
             op = OperatorType::PostfixDecrement;
         }
         else
         {
-            throw new ParserException(m_CurrentChar, "Invalid expression statement");
+            throw ParserException(CharIndex(), "Invalid expression statement");
         }
 
-        auto unaryExpression = new ASTUnaryExpression(op, m_CurrentChar);
+        auto unaryExpression = std::make_shared<ASTUnaryExpression>(op, CharIndex());
 
         if (arrayIndex == nullptr)
         {
-            unaryExpression->AddChild(std::shared_ptr<IASTNode>(new ASTIdentifier(identifier, m_CurrentChar)));
+            unaryExpression->AddChild(std::make_shared<ASTIdentifier>(identifier, CharIndex()));
         }
         else
         {
-            auto arrayExpression = new ASTArrayExpression(identifier, m_CurrentChar);
+            auto arrayExpression = std::make_shared<ASTArrayExpression>(identifier, CharIndex());
             arrayExpression->AddChild(std::move(arrayIndex));
-            unaryExpression->AddChild(std::shared_ptr<IASTNode>(arrayExpression));
+            unaryExpression->AddChild(arrayExpression);
         }
 
-        return std::unique_ptr<IASTNode>(unaryExpression);
+        return unaryExpression;
     }
 
-    std::unique_ptr<IASTNode> Parser::AssignmentExpression()
+    std::shared_ptr<IASTNode> Parser::AssignmentExpression()
     {
-        auto assignmentExpression = new ASTAssignmentExpression(m_CurrentChar);
+        auto assignmentExpression = std::make_shared<ASTAssignmentExpression>(CharIndex());
 
-        auto i = 0;
-        while (Peek(i) != '=' && Peek(i) != '[')
-        {
-            i++;
-        }
-
-        auto c = Peek(i);
-        if (c == '[')
+        if (PeekSymbol('[', 1))
         {
             auto identifier = Identifier();
             Symbol('[');
 
-            auto arrayExpression = new ASTArrayExpression(identifier, m_CurrentChar);
+            auto arrayExpression = std::make_shared<ASTArrayExpression>(identifier, CharIndex());
 
-            if (std::isdigit(Peek()))
+            if (Peek().m_Type == LexemeType::Number)
             {
-                arrayExpression->AddChild(std::unique_ptr<IASTNode>(new ASTNumberLiteral(NumberLiteral(), m_CurrentChar)));
+                arrayExpression->AddChild(std::make_shared<ASTNumberLiteral>(NumberLiteral(), CharIndex()));
             }
             else
             {
-                arrayExpression->AddChild(std::unique_ptr<IASTNode>(new ASTIdentifier(Identifier(), m_CurrentChar)));
+                arrayExpression->AddChild(std::make_shared<ASTIdentifier>(Identifier(), CharIndex()));
             }
 
             Symbol(']');
 
-            assignmentExpression->AddChild(std::unique_ptr<IASTNode>(arrayExpression));
+            assignmentExpression->AddChild(arrayExpression);
         }
         else
         {
-            assignmentExpression->AddChild(std::unique_ptr<IASTNode>(new ASTIdentifier(Identifier(), m_CurrentChar)));
+            assignmentExpression->AddChild(std::make_shared<ASTIdentifier>(Identifier(), CharIndex()));
         }
 
         Symbol('=');
         assignmentExpression->AddChild(Expression());
 
-        return std::unique_ptr<IASTNode>(assignmentExpression);
+        return assignmentExpression;
     }
 
-    std::unique_ptr<IASTNode> Parser::VariableDeclaration()
+    std::shared_ptr<IASTNode> Parser::VariableDeclaration()
     {
-        Keyword("var");
+        Keyword(KeywordId::Var);
 
         auto name = Identifier();
 
         auto arraySize = 1;
-        std::unique_ptr<IASTNode> assignmentExpression;
+        auto isArray = false;
+        std::shared_ptr<IASTNode> assignmentExpression;
 
-        if (Peek() == '=')
+        if (PeekSymbol('='))
         {
             Symbol('=');
             assignmentExpression = Expression();
         }
-        else if (Peek() == '[')
+        else if (PeekSymbol('['))
         {
             Symbol('[');
 
             arraySize = NumberLiteral();
+            isArray = true;
             if (arraySize <= 0)
             {
-                throw ParserException(m_CurrentChar, SafePrintf("Invalid array size %", arraySize));
+                throw ParserException(CharIndex(), SafePrintf("Invalid array size %", arraySize));
             }
 
             Symbol(']');
         }
 
-        auto variableDeclaration = new ASTVariableDeclaration(name, arraySize, m_CurrentChar);
+        auto variableDeclaration = std::make_shared<ASTVariableDeclaration>(name, arraySize, isArray, CharIndex());
 
         if (assignmentExpression != nullptr)
         {
             variableDeclaration->AddChild(std::move(assignmentExpression));
         }
 
-        return std::unique_ptr<IASTNode>(variableDeclaration);
+        return variableDeclaration;
     }
 
-    std::unique_ptr<IASTNode> Parser::ReturnStatement()
+    std::shared_ptr<IASTNode> Parser::ReturnStatement()
     {
-        Keyword("return");
-        auto returnStatement = new ASTReturnStatement(m_CurrentChar);
+        Keyword(KeywordId::Return);
+        auto returnStatement = std::make_shared<ASTReturnStatement>(CharIndex());
 
-        if (Peek() != ';')
+        if (!PeekSymbol(';'))
         {
             returnStatement->AddChild(Expression());
         }
 
-        return std::unique_ptr<IASTNode>(returnStatement);
+        return returnStatement;
+    }
+
+    std::shared_ptr<IASTNode> Parser::SpawnTaskStatement()
+    {
+        Keyword(KeywordId::SpawnTask);
+        auto charIndex = CharIndex();
+        auto functionName = Identifier();
+
+        Symbol('(');
+        Symbol(')');
+
+        return std::make_shared<ASTSpawnTaskStatement>(functionName, charIndex);
     }
 
-    std::unique_ptr<IASTNode> Parser::Statement()
+    std::shared_ptr<IASTNode> Parser::Statement()
     {
-        std::unique_ptr<IASTNode> statement = nullptr;
+        std::shared_ptr<IASTNode> statement = nullptr;
 
-        if (PeekKeyword("for"))
+        if (PeekKeyword(KeywordId::For))
         {
             return RepeatTemplate();
         }
 
-        if (PeekKeyword("var"))
+        if (PeekKeyword(KeywordId::Var))
         {
             statement = VariableDeclaration();
             Symbol(';');
             return statement;
         }
 
-        if (PeekKeyword("return"))
+        if (PeekKeyword(KeywordId::Return))
         {
             statement = ReturnStatement();
             Symbol(';');
             return statement;
         }
 
-        int i = 0;
-        auto c = Peek(0);
-        while (c != '(' && c != '=' && c != '+' && c != '-')
+        if (PeekKeyword(KeywordId::SpawnTask))
         {
-            i++;
-            c = Peek(i);
+            statement = SpawnTaskStatement();
+            Symbol(';');
+            return statement;
         }
 
-        bool requiresSemicolon = true;
+        if (PeekKeyword(KeywordId::Triggers))
+        {
+            return TriggersBlock();
+        }
 
-        if (c == '(')
+        if (PeekKeyword(KeywordId::Yield))
         {
-            if (PeekKeyword("if"))
-            {
-                statement = IfStatement();
-                requiresSemicolon = false;
-            }
-            else if (PeekKeyword("while"))
-            {
-                statement = WhileStatement();
-                requiresSemicolon = false;
-            }
-            else
-            {
-                statement = Expression();
-            }
+            Keyword(KeywordId::Yield);
+            statement = std::make_shared<ASTYieldStatement>(CharIndex());
+            Symbol(';');
+            return statement;
         }
-        else if (c == '=')
+
+        if (PeekKeyword(KeywordId::If))
         {
-            statement = AssignmentExpression();
+            return IfStatement();
         }
-        else if ((c == '+' && Peek(i + 1) == '+') || (c == '-' && Peek(i + 1) == '-'))
+
+        if (PeekKeyword(KeywordId::While))
         {
-            statement = ExpressionStatement();
+            return WhileStatement();
         }
-        else
+
+        if (PeekKeyword(KeywordId::Switch))
         {
-            throw ParserException(m_CurrentChar, "Invalid statement");
+            return SwitchStatement();
         }
 
-        if (requiresSemicolon)
+        auto i = 0u;
+        while (!PeekSymbol('(', i) && !PeekSymbol('=', i) && !PeekSymbol("++", i) && !PeekSymbol("--", i))
         {
-            Symbol(';');
+            if (Peek(i).m_Type == LexemeType::EndOfInput || PeekSymbol(';', i) || PeekSymbol('{', i) || PeekSymbol('}', i))
+            {
+                throw ParserException(CharIndex(), "Invalid statement");
+            }
+
+            i++;
+        }
+
+        if (PeekSymbol('(', i))
+        {
+            statement = Expression();
+        }
+        else if (PeekSymbol('=', i))
+        {
+            statement = AssignmentExpression();
+        }
+        else
+        {
+            statement = ExpressionStatement();
         }
 
+        Symbol(';');
         return statement;
     }
 
-    std::unique_ptr<IASTNode> Parser::BlockStatement()
+    std::shared_ptr<IASTNode> Parser::BlockStatement()
     {
         Symbol('{');
 
-        auto blockStatement = new ASTBlockStatement(m_CurrentChar);
+        auto blockStatement = std::make_shared<ASTBlockStatement>(CharIndex());
         
-        while (true)
+        while (!PeekSymbol('}'))
         {
-            auto c = Peek();
-            if (c == '}')
-            {
-                break;
-            }
-
             blockStatement->AddChild(Statement());
         }
 
         Symbol('}');
 
-        return std::unique_ptr<IASTNode>(blockStatement);
+        return blockStatement;
     }
     
-    std::unique_ptr<IASTNode> Parser::IfStatement()
+    std::shared_ptr<IASTNode> Parser::IfStatement()
     {
-        Keyword("if");
+        Keyword(KeywordId::If);
 
-        auto ifStatement = new ASTIfStatement(m_CurrentChar);
+        auto ifStatement = std::make_shared<ASTIfStatement>(CharIndex());
         ifStatement->AddChild(Expression());
         ifStatement->AddChild(BlockStatement());
 
-        if (PeekKeyword("else"))
+        if (PeekKeyword(KeywordId::Else))
         {
-            Keyword("else");
+            Keyword(KeywordId::Else);
             ifStatement->AddChild(BlockStatement());
         }
 
-        return std::unique_ptr<IASTNode>(ifStatement);
+        return ifStatement;
     }
 
-    std::unique_ptr<IASTNode> Parser::WhileStatement()
+    std::shared_ptr<IASTNode> Parser::WhileStatement()
     {
-        Keyword("while");
+        Keyword(KeywordId::While);
 
-        auto whileStatement = new ASTWhileStatement(m_CurrentChar);
+        auto whileStatement = std::make_shared<ASTWhileStatement>(CharIndex());
         whileStatement->AddChild(Expression());
         whileStatement->AddChild(BlockStatement());
 
-        return std::unique_ptr<IASTNode>(whileStatement);
+        return whileStatement;
     }
 
-    std::unique_ptr<IASTNode> Parser::TemplateFunction()
+    std::shared_ptr<IASTNode> Parser::SwitchStatement()
     {
-        Keyword("fn");
+        Keyword(KeywordId::Switch);
 
-        auto functionName = Identifier();
+        auto switchStatement = std::make_shared<ASTSwitchStatement>(CharIndex());
+        switchStatement->AddChild(Expression());
 
-        Symbol('<');
+        Symbol('{');
 
-        std::vector<std::string> templateArgs;
+        auto hasDefault = false;
 
-        while (true)
+        while (!PeekSymbol('}'))
         {
-            auto c = Peek();
-            if (c == '>')
+            auto charIndex = CharIndex();
+            std::vector<int> values;
+            auto isDefault = false;
+
+            if (PeekKeyword(KeywordId::Default))
             {
-                break;
+                Keyword(KeywordId::Default);
+
+                if (hasDefault)
+                {
+                    throw ParserException(CharIndex(), "Switch statement has more than one default case");
+                }
+
+                hasDefault = true;
+                isDefault = true;
             }
+            else if (PeekKeyword(KeywordId::Case))
+            {
+                Keyword(KeywordId::Case);
 
+                while (true)
+                {
+                    auto value = NumberLiteral();
+                    if (value < 0)
+                    {
+                        throw ParserException(CharIndex(), SafePrintf("Invalid case value %", value));
+                    }
+
+                    values.push_back(value);
+
+                    if (!PeekSymbol(','))
+                    {
+                        break;
+                    }
+
+                    Symbol(',');
+                }
+            }
+            else
+            {
+                throw ParserException(CharIndex(), "Syntax error. Expected \"case\" or \"default\".");
+            }
+
+            Symbol(':');
+
+            std::shared_ptr<IASTNode> body;
+
+            if (PeekSymbol('{'))
+            {
+                body = BlockStatement();
+            }
+            else
+            {
+                // cases don't fall through so the statements up to the next label form the body
+                auto blockStatement = std::make_shared<ASTBlockStatement>(CharIndex());
+
+                while (!PeekSymbol('}') && !PeekKeyword(KeywordId::Case) && !PeekKeyword(KeywordId::Default))
+                {
+                    blockStatement->AddChild(Statement());
+                }
+
+                body = blockStatement;
+            }
+
+            auto switchCase = std::make_shared<ASTSwitchCase>(values, isDefault, charIndex);
+            switchCase->AddChild(std::move(body));
+            switchStatement->AddChild(switchCase);
+        }
+
+        Symbol('}');
+
+        return switchStatement;
+    }
+
+    std::shared_ptr<IASTNode> Parser::TemplateFunction()
+    {
+        Keyword(KeywordId::Fn);
+
+        auto functionName = Identifier();
+
+        Symbol('<');
+
+        std::vector<std::string> templateArgs;
+
+        while (!PeekSymbol('>'))
+        {
             templateArgs.push_back(Identifier());
 
-            c = Peek();
-            if (c == ',')
+            if (PeekSymbol(','))
             {
                 Next();
             }
@@ -822,18 +668,11 @@ namespace LangUMS
 
         std::vector<std::string> args;
 
-        while (true)
+        while (!PeekSymbol(')'))
         {
-            auto c = Peek();
-            if (c == ')')
-            {
-                break;
-            }
-
             args.push_back(Identifier());
 
-            c = Peek();
-            if (c == ',')
+            if (PeekSymbol(','))
             {
                 Next();
             }
@@ -841,15 +680,15 @@ namespace LangUMS
 
         Symbol(')');
 
-        auto templateDeclaration = new ASTTemplateFunction(functionName, args, templateArgs, m_CurrentChar);
+        auto templateDeclaration = std::make_shared<ASTTemplateFunction>(functionName, args, templateArgs, CharIndex());
         templateDeclaration->AddChild(BlockStatement());
 
-        return std::unique_ptr<IASTNode>(templateDeclaration);
+        return templateDeclaration;
     }
 
-    std::unique_ptr<IASTNode> Parser::FunctionDeclaration()
+    std::shared_ptr<IASTNode> Parser::FunctionDeclaration()
     {
-        Keyword("fn");
+        Keyword(KeywordId::Fn);
 
         auto functionName = Identifier();
 
@@ -857,18 +696,11 @@ namespace LangUMS
 
         std::vector<std::string> args;
 
-        while (true)
+        while (!PeekSymbol(')'))
         {
-            auto c = Peek();
-            if (c == ')')
-            {
-                break;
-            }
-
             args.push_back(Identifier());
 
-            c = Peek();
-            if (c == ',')
+            if (PeekSymbol(','))
             {
                 Next();
             }
@@ -876,40 +708,42 @@ namespace LangUMS
 
         Symbol(')');
 
-        auto functionDeclaration = new ASTFunctionDeclaration(functionName, args, m_CurrentChar);
+        auto functionDeclaration = std::make_shared<ASTFunctionDeclaration>(functionName, args, CharIndex());
         functionDeclaration->AddChild(BlockStatement());
 
-        return std::unique_ptr<IASTNode>(functionDeclaration);
+        return functionDeclaration;
     }
 
-    std::unique_ptr<IASTNode> Parser::GlobalVariableDeclaration()
+    std::shared_ptr<IASTNode> Parser::GlobalVariableDeclaration()
     {
-        Keyword("global");
+        Keyword(KeywordId::Global);
 
         auto name = Identifier();
 
         auto arraySize = 1;
-        std::unique_ptr<IASTNode> assignmentExpression;
+        auto isArray = false;
+        std::shared_ptr<IASTNode> assignmentExpression;
 
-        if (Peek() == '=')
+        if (PeekSymbol('='))
         {
             Symbol('=');
             assignmentExpression = Expression();
         }
-        else if (Peek() == '[')
+        else if (PeekSymbol('['))
         {
             Symbol('[');
 
             arraySize = NumberLiteral();
+            isArray = true;
             if (arraySize <= 0)
             {
-                throw ParserException(m_CurrentChar, SafePrintf("Invalid array size %", arraySize));
+                throw ParserException(CharIndex(), SafePrintf("Invalid array size %", arraySize));
             }
 
             Symbol(']');
         }
 
-        auto variableDeclaration = new ASTVariableDeclaration(name, arraySize, m_CurrentChar);
+        auto variableDeclaration = std::make_shared<ASTVariableDeclaration>(name, arraySize, isArray, CharIndex());
 
         if (assignmentExpression != nullptr)
         {
@@ -918,85 +752,219 @@ namespace LangUMS
 
         Symbol(';');
 
-        return std::unique_ptr<IASTNode>(variableDeclaration);
+        return variableDeclaration;
     }
 
-    std::unique_ptr<IASTNode> Parser::EventCondition()
+    std::shared_ptr<IASTNode> Parser::ConstDeclaration()
     {
-        auto conditionName = Identifier();
-        auto condition = new ASTEventCondition(conditionName, m_CurrentChar);
+        Keyword(KeywordId::Const);
+
+        auto charIndex = CharIndex();
+        auto name = Identifier();
+
+        auto arraySize = -1;
+
+        Symbol('[');
+
+        if (!PeekSymbol(']'))
+        {
+            arraySize = NumberLiteral();
+            if (arraySize <= 0)
+            {
+                throw ParserException(CharIndex(), SafePrintf("Invalid array size %", arraySize));
+            }
+        }
+
+        Symbol(']');
+        Symbol('=');
+        Symbol('{');
+
+        std::vector<int> values;
+
+        while (!PeekSymbol('}'))
+        {
+            values.push_back(NumberLiteral());
+
+            if (!PeekSymbol(','))
+            {
+                break;
+            }
+
+            Symbol(',');
+        }
 
+        Symbol('}');
+        Symbol(';');
+
+        if (values.empty())
+        {
+            throw ParserException(charIndex, SafePrintf("Constant array \"%\" has no values", name));
+        }
+
+        if (arraySize != -1)
+        {
+            if (values.size() > (size_t)arraySize)
+            {
+                throw ParserException(charIndex, SafePrintf("Too many values for constant array \"%[%]\"", name, arraySize));
+            }
+
+            // missing values are zero like in C
+            values.resize(arraySize, 0);
+        }
+
+        return std::make_shared<ASTConstDeclaration>(name, values, charIndex);
+    }
+
+    void Parser::ConstantArgumentList(IASTNode* node)
+    {
         Symbol('(');
 
-        auto c = Peek();
-        while (c != ')')
+        while (!PeekSymbol(')'))
         {
-            if (c == '"')
+            if (Peek().m_Type == LexemeType::String)
             {
-                condition->AddChild(std::shared_ptr<IASTNode>(new ASTStringLiteral(StringLiteral(), m_CurrentChar)));
+                node->AddChild(std::make_shared<ASTStringLiteral>(StringLiteral(), CharIndex()));
             }
-            else if (std::isdigit(c))
+            else if (Peek().m_Type == LexemeType::Number)
             {
-                condition->AddChild(std::shared_ptr<IASTNode>(new ASTNumberLiteral(NumberLiteral(), m_CurrentChar)));
+                node->AddChild(std::make_shared<ASTNumberLiteral>(NumberLiteral(), CharIndex()));
             }
             else
             {
                 auto identifier = Identifier();
 
-                if (Peek() == '[')
+                if (PeekSymbol('['))
                 {
                     Symbol('[');
                     auto arrayIndex = NumberLiteral();
                     Symbol(']');
 
-                    auto arrayExpression = new ASTArrayExpression(identifier, m_CurrentChar);
-                    arrayExpression->AddChild(std::unique_ptr<IASTNode>(new ASTNumberLiteral(arrayIndex, m_CurrentChar)));
-                    condition->AddChild(std::shared_ptr<IASTNode>(arrayExpression));
+                    auto arrayExpression = std::make_shared<ASTArrayExpression>(identifier, CharIndex());
+                    arrayExpression->AddChild(std::make_shared<ASTNumberLiteral>(arrayIndex, CharIndex()));
+                    node->AddChild(arrayExpression);
                 }
                 else
                 {
-                    condition->AddChild(std::shared_ptr<IASTNode>(new ASTIdentifier(identifier, m_CurrentChar)));
+                    node->AddChild(std::make_shared<ASTIdentifier>(identifier, CharIndex()));
                 }
             }
 
-            c = Peek();
-            if (c == ')')
+            if (PeekSymbol(')'))
+            {
+                break;
+            }
+
+            Symbol(',');
+        }
+
+        Symbol(')');
+    }
+
+    std::shared_ptr<IASTNode> Parser::EventCondition()
+    {
+        auto conditionName = Identifier();
+        auto condition = std::make_shared<ASTEventCondition>(conditionName, CharIndex());
+        ConstantArgumentList(condition.get());
+        return condition;
+    }
+
+    std::shared_ptr<IASTNode> Parser::TriggersBlock()
+    {
+        Keyword(KeywordId::Triggers);
+
+        auto triggersBlock = std::make_shared<ASTTriggersBlock>(CharIndex());
+
+        Symbol('{');
+
+        while (!PeekSymbol('}'))
+        {
+            triggersBlock->AddChild(RawTrigger());
+        }
+
+        Symbol('}');
+
+        return triggersBlock;
+    }
+
+    std::shared_ptr<IASTNode> Parser::RawTrigger()
+    {
+        auto charIndex = CharIndex();
+        std::vector<std::shared_ptr<IASTNode>> conditions;
+        std::vector<std::shared_ptr<IASTNode>> actions;
+
+        Keyword(KeywordId::When);
+        Symbol('(');
+
+        while (!PeekSymbol(')'))
+        {
+            conditions.push_back(EventCondition());
+
+            if (PeekSymbol(')'))
+            {
+                break;
+            }
+
+            Symbol(',');
+        }
+
+        Symbol(')');
+        Keyword(KeywordId::Do);
+        Symbol('(');
+
+        while (!PeekSymbol(')'))
+        {
+            auto actionName = Identifier();
+            auto action = std::make_shared<ASTRawTriggerAction>(actionName, CharIndex());
+            ConstantArgumentList(action.get());
+            actions.push_back(action);
+
+            if (PeekSymbol(')'))
             {
                 break;
             }
 
             Symbol(',');
-            c = Peek();
         }
 
         Symbol(')');
+        Symbol(';');
+
+        auto rawTrigger = std::make_shared<ASTRawTrigger>((unsigned int)conditions.size(), charIndex);
+
+        for (auto& condition : conditions)
+        {
+            rawTrigger->AddChild(std::move(condition));
+        }
+
+        for (auto& action : actions)
+        {
+            rawTrigger->AddChild(std::move(action));
+        }
 
-        return std::unique_ptr<IASTNode>(condition);
+        return rawTrigger;
     }
 
-    std::unique_ptr<IASTNode> Parser::EventDeclaration()
+    std::shared_ptr<IASTNode> Parser::EventDeclaration()
     {
-        auto eventDeclaration = new ASTEventDeclaration(m_CurrentChar);
+        auto eventDeclaration = std::make_shared<ASTEventDeclaration>(CharIndex());
 
         eventDeclaration->AddChild(EventCondition());
 
-        auto c = Peek();
-        while (c == ',')
+        while (PeekSymbol(','))
         {
             Next();
             eventDeclaration->AddChild(EventCondition());
-            c = Peek();
         }
 
-        Keyword("=>");
+        Symbol("=>");
 
         eventDeclaration->AddChild(BlockStatement());
-        return std::unique_ptr<IASTNode>(eventDeclaration);
+        return eventDeclaration;
     }
     
-    std::unique_ptr<IASTNode> Parser::UnitScopeRepeatTemplate()
+    std::shared_ptr<IASTNode> Parser::UnitScopeRepeatTemplate()
     {
-        Keyword("for");
+        Keyword(KeywordId::For);
         Symbol('<');
 
         std::vector<std::string> iterators;
@@ -1005,7 +973,7 @@ namespace LangUMS
         {
             iterators.push_back(Identifier());
 
-            if (Peek() == '>')
+            if (PeekSymbol('>'))
             {
                 break;
             }
@@ -1015,32 +983,30 @@ namespace LangUMS
 
         Symbol('>');
 
-        Keyword("in");
+        Keyword(KeywordId::In);
 
-        auto repeatTemplate = new ASTRepeatTemplate(iterators, m_CurrentChar);
+        auto repeatTemplate = std::make_shared<ASTRepeatTemplate>(iterators, CharIndex());
 
         for (auto i = 0u; i < iterators.size(); i++)
         {
             Symbol('(');
 
-            auto c = Peek();
-            while (c != ')')
+            while (!PeekSymbol(')'))
             {
-                if (std::isdigit(c))
+                if (Peek().m_Type == LexemeType::Number)
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTNumberLiteral(NumberLiteral(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTNumberLiteral>(NumberLiteral(), CharIndex()));
                 }
-                else if (c == '"')
+                else if (Peek().m_Type == LexemeType::String)
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTStringLiteral(StringLiteral(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTStringLiteral>(StringLiteral(), CharIndex()));
                 }
                 else
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTIdentifier(Identifier(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTIdentifier>(Identifier(), CharIndex()));
                 }
 
-                c = Peek();
-                if (c == ',')
+                if (PeekSymbol(','))
                 {
                     Symbol(',');
                 }
@@ -1051,30 +1017,24 @@ namespace LangUMS
             if (i != iterators.size() - 1)
             {
                 Symbol(',');
-                c = Peek();
             }
         }
 
         Symbol('{');
 
-        while (Peek() != '}')
+        while (!PeekSymbol('}'))
         {
             repeatTemplate->AddChild(EventDeclaration());
-
-            if (Peek() == '}')
-            {
-                break;
-            }
         }
 
         Symbol('}');
 
-        return std::unique_ptr<IASTNode>(repeatTemplate);
+        return repeatTemplate;
     }
 
-    std::unique_ptr<IASTNode> Parser::RepeatTemplate()
+    std::shared_ptr<IASTNode> Parser::RepeatTemplate()
     {
-        Keyword("for");
+        Keyword(KeywordId::For);
         Symbol('<');
 
         std::vector<std::string> iterators;
@@ -1083,7 +1043,7 @@ namespace LangUMS
         {
             iterators.push_back(Identifier());
             
-            if (Peek() == '>')
+            if (PeekSymbol('>'))
             {
                 break;
             }
@@ -1092,35 +1052,32 @@ namespace LangUMS
         }
 
         Symbol('>');
-        Keyword("in");
+        Keyword(KeywordId::In);
 
-        auto repeatTemplate = new ASTRepeatTemplate(iterators, m_CurrentChar);
+        auto repeatTemplate = std::make_shared<ASTRepeatTemplate>(iterators, CharIndex());
 
         for (auto i = 0u; i < iterators.size(); i++)
         {
             Symbol('(');
 
-            auto c = Peek();
-            while (c != ')')
+            while (!PeekSymbol(')'))
             {
-                if (std::isdigit(c))
+                if (Peek().m_Type == LexemeType::Number)
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTNumberLiteral(NumberLiteral(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTNumberLiteral>(NumberLiteral(), CharIndex()));
                 }
-                else if (c == '"')
+                else if (Peek().m_Type == LexemeType::String)
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTStringLiteral(StringLiteral(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTStringLiteral>(StringLiteral(), CharIndex()));
                 }
                 else
                 {
-                    repeatTemplate->AddListItem(iterators[i], std::shared_ptr<IASTNode>(new ASTIdentifier(Identifier(), m_CurrentChar)));
+                    repeatTemplate->AddListItem(iterators[i], std::make_shared<ASTIdentifier>(Identifier(), CharIndex()));
                 }
 
-                c = Peek();
-                if (c == ',')
+                if (PeekSymbol(','))
                 {
                     Symbol(',');
-                    c = Peek();
                 }
             }
             
@@ -1134,221 +1091,90 @@ namespace LangUMS
 
         repeatTemplate->AddChild(BlockStatement());
         
-        return std::unique_ptr<IASTNode>(repeatTemplate);
+        return repeatTemplate;
     }
 
-    std::unique_ptr<IASTNode> Parser::UnitProperties()
+    std::shared_ptr<IASTNode> Parser::UnitProperties()
     {
-        Keyword("unit");
+        Keyword(KeywordId::Unit);
 
         auto name = Identifier();
 
         Symbol('{');
 
-        auto unitProperties = new ASTUnitProperties(name, m_CurrentChar);
+        auto unitProperties = std::make_shared<ASTUnitProperties>(name, CharIndex());
 
         unitProperties->AddChild(UnitProperty());
 
-        auto c = Peek();
-        while (c == ',')
+        while (PeekSymbol(','))
         {
             Next();
             unitProperties->AddChild(UnitProperty());
-            c = Peek();
         }
 
         Symbol('}');
 
-        return std::unique_ptr<IASTNode>(unitProperties);
+        return unitProperties;
     }
 
-    std::unique_ptr<IASTNode> Parser::UnitProperty()
+    std::shared_ptr<IASTNode> Parser::UnitProperty()
     {
         auto name = Identifier();
         Symbol('=');
 
-        auto c = Peek();
-
-        if (PeekKeyword("true"))
+        if (PeekKeyword(KeywordId::True))
         {
-            Keyword("true");
-            return std::unique_ptr<IASTNode>(new ASTUnitProperty(name, 1, m_CurrentChar));
+            Keyword(KeywordId::True);
+            return std::make_shared<ASTUnitProperty>(name, 1, CharIndex());
         }
 
-        if (PeekKeyword("false"))
+        if (PeekKeyword(KeywordId::False))
         {
-            Keyword("false");
-            return std::unique_ptr<IASTNode>(new ASTUnitProperty(name, 0, m_CurrentChar));
+            Keyword(KeywordId::False);
+            return std::make_shared<ASTUnitProperty>(name, 0, CharIndex());
         }
 
-        return std::unique_ptr<IASTNode>(new ASTUnitProperty(name, NumberLiteral(), m_CurrentChar));
+        return std::make_shared<ASTUnitProperty>(name, NumberLiteral(), CharIndex());
     }
 
-    std::string Parser::Identifier()
+    const std::string& Parser::Identifier()
     {
-        std::string identifier;
-        static std::string validIdentifierChars = "abcdefghijklmnopqrstuvwxyzABCEDFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-
-        auto c = Peek();
-        while (validIdentifierChars.find(c) != std::string::npos)
+        auto& lexeme = Next();
+        if (lexeme.m_Type != LexemeType::Identifier)
         {
-            identifier.push_back(Next());
-
-            if (EndOfStream())
-            {
-                break;
-            }
-
-            c = Peek();
+            throw ParserException(lexeme.m_Offset, "Syntax error");
         }
 
-        if (identifier.length() == 0)
-        {
-            throw ParserException(m_CurrentChar, "Syntax error");
-        }
-
-        if (std::isdigit(identifier[0]))
-        {
-            throw ParserException(m_CurrentChar, SafePrintf("Invalid identifier \"%\"", identifier));
-        }
-
-        Whitespace();
-
-        return identifier;
+        return m_Lexer.GetIdentifier(lexeme.m_Value);
     }
 
     int Parser::NumberLiteral()
     {
-        std::string s;
-
-        auto isHex = false;
-        if (PeekKeyword("0x"))
+        auto isNegative = false;
+        if (PeekSymbol('-'))
         {
-            Keyword("0x");
-            isHex = true;
+            Next();
+            isNegative = true;
         }
 
-        while (true)
+        auto& lexeme = Next();
+        if (lexeme.m_Type != LexemeType::Number)
         {
-            auto c = Peek();
-
-            if (isHex)
-            {
-                c = std::tolower(c);
-            }
-
-            if ((!isHex && (!std::isdigit(c) && c != '-')) || (isHex && !std::isxdigit(c)))
-            {
-                break;
-            }
-
-            if (EndOfStream())
-            {
-                break;
-            }
-
-            s.push_back(Next());
+            throw ParserException(lexeme.m_Offset, "Syntax error. Expected a number.");
         }
 
-        Whitespace();
-
-        if (!isHex)
-        {
-            return std::atoi(s.c_str());
-        }
-        else
-        {
-            std::stringstream toHex;
-            toHex << std::hex << s;
-            unsigned int value;
-            toHex >> value;
-            return value;
-        }
+        return isNegative ? -lexeme.m_Value : lexeme.m_Value;
     }
 
-    std::string Parser::StringLiteral()
+    const std::string& Parser::StringLiteral()
     {
-        auto next = Next();
-        if (next != '"')
-        {
-            throw ParserException(m_CurrentChar, "Invalid string value, expected '\"'");
-        }
-
-        std::string value;
-
-        auto c = Peek();
-        if (c == '"' && Peek(1) == '"')
-        {
-            Next();
-            Next();
-
-            // multi-line string
-
-            while (!PeekKeyword("\"\"\""))
-            {
-                value.push_back(Next(false));
-            }
-
-            Keyword("\"\"\"");
-        }
-        else
+        auto& lexeme = Next();
+        if (lexeme.m_Type != LexemeType::String)
         {
-            while (c != '"')
-            {
-                value.push_back(Next(false));
-                c = Peek(0, false);
-                if (c == '\n')
-                {
-                    throw ParserException(m_CurrentChar, "Invalid string value, expected '\"'");
-                }
-            }
-
-            Next(false);
+            throw ParserException(lexeme.m_Offset, "Invalid string value, expected '\"'");
         }
 
-        std::string processed;
-
-        auto inHexValue = false;
-        std::string hexValue;
-
-        for (auto i = 0u; i < value.length(); i++)
-        {
-            auto c = value[i];
-            if (c == '<')
-            {
-                inHexValue = true;
-            }
-            else if (inHexValue && c == '>')
-            {
-                unsigned int x;
-                std::stringstream ss;
-                ss << std::hex << hexValue;
-                ss >> x;
-
-                if (x == 0)
-                {
-                    throw ParserException(m_CurrentChar, SafePrintf("Invalid hexadecimal value \"%\" in string \"%\"", hexValue, value));
-                }
-                else
-                {
-                    processed.push_back((char)x);
-                }
-
-                inHexValue = false;
-            }
-            else if (inHexValue)
-            {
-                hexValue.push_back(c);
-            }
-            else
-            {
-                processed.push_back(c);
-            }
-        }
-
-        Whitespace();
-
-        return processed;
+        return m_Lexer.GetString(lexeme.m_Value);
     }
 
 }
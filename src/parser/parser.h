@@ -8,36 +8,13 @@
 #include <cctype>
 
 #include "../log.h"
+#include "../source_buffer.h"
 #include "../ast/ast.h"
+#include "lexer.h"
 
 namespace LangUMS
 {
 
-    enum class TokenType
-    {
-        BooleanLiteral,
-        NumberLiteral,
-        StringLiteral,
-        Identifier,
-        Operator,
-        ArrayOperator,
-        LeftParenthesis,
-        RightParenthesis,
-        LeftSquareBracket,
-        RightSquareBracket,
-        FunctionName,
-        FunctionArgumentSeparator
-    };
-
-    struct ExpressionToken
-    {
-        std::string m_Value;
-        int m_NumberValue = 0;
-        TokenType m_Type;
-        OperatorType m_OperatorType;
-        std::string m_ArrayIdentifier;
-    };
-
     class ParserException : public std::exception
     {
         public:
@@ -56,165 +33,140 @@ namespace LangUMS
     class Parser
     {
         public:
-        std::unique_ptr<IASTNode> Parse(const std::string& input);
+        std::shared_ptr<IASTNode> Parse(const SourceBuffer& source);
 
-        const std::string& GetSourceBuffer() const
+        const SourceBuffer& GetSourceBuffer() const
         {
-            return m_Buffer;
+            return m_Source;
         }
 
         private:
-        ExpressionToken Token();
-
-        std::unique_ptr<IASTNode> Unit();
-        std::unique_ptr<IASTNode> Expression();
-        std::unique_ptr<IASTNode> ExpressionTokenToNode(const ExpressionToken& token, std::vector<ExpressionToken>& next);
-
-        std::unique_ptr<IASTNode> ExpressionStatement();
-        std::unique_ptr<IASTNode> AssignmentExpression();
-        std::unique_ptr<IASTNode> VariableDeclaration();
-        std::unique_ptr<IASTNode> ReturnStatement();
-        std::unique_ptr<IASTNode> Statement();
-        std::unique_ptr<IASTNode> BlockStatement();
-        std::unique_ptr<IASTNode> IfStatement();
-        std::unique_ptr<IASTNode> WhileStatement();
-        std::unique_ptr<IASTNode> TemplateFunction();
-        std::unique_ptr<IASTNode> FunctionDeclaration();
-        std::unique_ptr<IASTNode> GlobalVariableDeclaration();
-
-        std::unique_ptr<IASTNode> EventCondition();
-        std::unique_ptr<IASTNode> EventDeclaration();
-
-        std::unique_ptr<IASTNode> UnitScopeRepeatTemplate();
-        std::unique_ptr<IASTNode> RepeatTemplate();
-
-        std::unique_ptr<IASTNode> UnitProperties();
-        std::unique_ptr<IASTNode> UnitProperty();
-
-        OperatorType Operator();
-        std::string Identifier();
+        std::shared_ptr<IASTNode> Unit();
+        std::shared_ptr<IASTNode> Expression();
+        std::shared_ptr<IASTNode> BinaryExpression(int minPrecedence);
+        std::shared_ptr<IASTNode> UnaryExpression();
+        std::shared_ptr<IASTNode> PrimaryExpression();
+
+        std::shared_ptr<IASTNode> ExpressionStatement();
+        std::shared_ptr<IASTNode> AssignmentExpression();
+        std::shared_ptr<IASTNode> VariableDeclaration();
+        std::shared_ptr<IASTNode> ReturnStatement();
+        std::shared_ptr<IASTNode> Statement();
+        std::shared_ptr<IASTNode> BlockStatement();
+        std::shared_ptr<IASTNode> IfStatement();
+        std::shared_ptr<IASTNode> WhileStatement();
+        std::shared_ptr<IASTNode> SwitchStatement();
+        std::shared_ptr<IASTNode> SpawnTaskStatement();
+        std::shared_ptr<IASTNode> TemplateFunction();
+        std::shared_ptr<IASTNode> FunctionDeclaration();
+        std::shared_ptr<IASTNode> GlobalVariableDeclaration();
+        std::shared_ptr<IASTNode> ConstDeclaration();
+
+        void ConstantArgumentList(IASTNode* node);
+        std::shared_ptr<IASTNode> EventCondition();
+        std::shared_ptr<IASTNode> EventDeclaration();
+
+        std::shared_ptr<IASTNode> TriggersBlock();
+        std::shared_ptr<IASTNode> RawTrigger();
+
+        std::shared_ptr<IASTNode> UnitScopeRepeatTemplate();
+        std::shared_ptr<IASTNode> RepeatTemplate();
+
+        std::shared_ptr<IASTNode> UnitProperties();
+        std::shared_ptr<IASTNode> UnitProperty();
+
+        bool PeekOperator(OperatorType& retOperator) const;
+        const std::string& Identifier();
         int NumberLiteral();
-        std::string StringLiteral();
+        const std::string& StringLiteral();
 
-        inline bool IsOperator(char c)
+        inline const Lexeme& Peek(unsigned int lookahead = 0) const
         {
-            switch (c)
+            auto& lexemes = m_Lexer.GetLexemes();
+            auto index = m_CurrentLexeme + lookahead;
+
+            // the last lexeme is always the end of input
+            if (index >= lexemes.size())
             {
-            case '=': return true;
-            case '!': return true;
-            case '<': return true;
-            case '>': return true;
-            case '+': return true;
-            case '-': return true;
-            case '*': return true;
-            case '/': return true;
-            case '|': return true;
-            case '&': return true;
+                return lexemes.back();
             }
 
-            return false;
+            return lexemes[index];
         }
 
-        inline void Symbol(char symbol)
+        inline const Lexeme& Next()
         {
-            if (Next() != symbol)
+            auto& lexeme = Peek();
+            if (lexeme.m_Type == LexemeType::EndOfInput)
             {
-                throw ParserException(m_CurrentChar, SafePrintf("Syntax error. Expected \"%\".", symbol));
+                throw ParserException(lexeme.m_Offset, "Unexpected end of input");
             }
 
-            Whitespace();
+            m_CurrentLexeme++;
+            return lexeme;
         }
 
-        inline bool PeekKeyword(const std::string& keyword)
+        inline bool PeekSymbol(char symbol, unsigned int lookahead = 0) const
         {
-            auto i = 0u;
-            while (i < keyword.length())
-            {
-                auto c = Peek(i);
-                if (c != keyword[i])
-                {
-                    return false;
-                }
-
-                i++;
-            }
+            auto& lexeme = Peek(lookahead);
+            return lexeme.m_Type == LexemeType::Symbol && lexeme.m_Value == MakeSymbol(symbol);
+        }
 
-            return true;
+        inline bool PeekSymbol(const char* symbol, unsigned int lookahead = 0) const
+        {
+            auto& lexeme = Peek(lookahead);
+            return lexeme.m_Type == LexemeType::Symbol && lexeme.m_Value == MakeSymbol(symbol[0], symbol[1]);
         }
 
-        inline void Keyword(const std::string& keyword)
+        inline void Symbol(char symbol)
         {
-            auto i = 0u;
-            while (i < keyword.length())
+            if (!PeekSymbol(symbol))
             {
-                auto c = Next();
-                if (c != keyword[i])
-                {
-                    throw ParserException(m_CurrentChar, SafePrintf("Syntax error. Expected \"%\".", keyword));
-                }
-
-                i++;
+                throw ParserException(CharIndex(), SafePrintf("Syntax error. Expected \"%\".", symbol));
             }
 
-            Whitespace();
+            m_CurrentLexeme++;
         }
 
-        inline void Whitespace()
+        inline void Symbol(const char* symbol)
         {
-            if (EndOfStream())
+            if (!PeekSymbol(symbol))
             {
-                return;
+                throw ParserException(CharIndex(), SafePrintf("Syntax error. Expected \"%\".", symbol));
             }
 
-            while (std::isspace(Peek(0, false)))
-            {
-                Next(false);
-
-                if (EndOfStream())
-                {
-                    break;
-                }
-            }
+            m_CurrentLexeme++;
         }
 
-        inline char Peek(int chars = 0, bool ignoreWhitespace = true)
+        inline bool PeekKeyword(KeywordId keyword, unsigned int lookahead = 0) const
         {
-            auto index = m_CurrentChar;
-            while (ignoreWhitespace && std::isspace(m_Buffer[index]))
-            {
-                index++;
-            }
- 
-            if (index + chars >= m_Buffer.size())
-            {
-                throw ParserException(index, "Unexpected end of input");
-            }
-
-            return m_Buffer[index + chars];
+            auto& lexeme = Peek(lookahead);
+            return lexeme.m_Type == LexemeType::Identifier && lexeme.m_Value == (int)keyword;
         }
 
-        inline char Next(bool ignoreWhitespace = true)
+        inline void Keyword(KeywordId keyword)
         {
-            if (m_CurrentChar >= m_Buffer.size())
+            if (!PeekKeyword(keyword))
             {
-                throw ParserException(m_CurrentChar, "Unexpected end of input");
+                throw ParserException(CharIndex(), SafePrintf("Syntax error. Expected \"%\".", m_Lexer.GetIdentifier((int)keyword)));
             }
 
-            while (ignoreWhitespace && std::isspace(m_Buffer[m_CurrentChar])) 
-            {
-                m_CurrentChar++;
-            }
+            m_CurrentLexeme++;
+        }
 
-            return m_Buffer[m_CurrentChar++];
+        inline unsigned int CharIndex() const
+        {
+            return Peek().m_Offset;
         }
 
-        inline bool EndOfStream()
+        inline bool EndOfStream() const
         {
-            return m_CurrentChar >= m_Buffer.size();
+            return Peek().m_Type == LexemeType::EndOfInput;
         }
 
-        std::string m_Buffer;
-        unsigned int m_CurrentChar = 0;
+        SourceBuffer m_Source;
+        Lexer m_Lexer;
+        unsigned int m_CurrentLexeme = 0;
     };
 
 }
@@ -1,69 +1,511 @@
 #include <sstream>
-#include <fstream>
-#include <streambuf>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <experimental/filesystem>
 
 #include "../stringutil.h"
+#include "../ast/ast.h"
 
 #include "preprocessor.h"
 
 namespace LangUMS
 {
 
+    static inline bool IsIdentifierStart(char c)
+    {
+        return std::isalpha((unsigned char)c) || c == '_';
+    }
+
+    static inline bool IsIdentifierChar(char c)
+    {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    // returns the index just past the string literal starting at index (or past the end of a multi-line string we are in)
+    static unsigned int SkipStringLiteral(const std::string& text, unsigned int index, bool& inMultiLineString)
+    {
+        auto size = (unsigned int)text.size();
+
+        if (!inMultiLineString)
+        {
+            if (text.compare(index, 3, "\"\"\"") != 0)
+            {
+                index++;
+                while (index < size && text[index] != '"')
+                {
+                    index++;
+                }
+
+                return index < size ? index + 1 : size;
+            }
+
+            inMultiLineString = true;
+            index += 3;
+        }
+
+        auto end = text.find("\"\"\"", index);
+        if (end == std::string::npos)
+        {
+            return size;
+        }
+
+        inMultiLineString = false;
+        return (unsigned int)end + 3;
+    }
+
+    // the start of a // comment outside of any string literal, npos if there is none
+    static size_t FindLineComment(const std::string& text)
+    {
+        auto size = (unsigned int)text.size();
+        auto inMultiLineString = false;
+
+        for (auto index = 0u; index < size; )
+        {
+            if (text[index] == '"')
+            {
+                index = SkipStringLiteral(text, index, inMultiLineString);
+            }
+            else if (text.compare(index, 2, "//") == 0)
+            {
+                return index;
+            }
+            else
+            {
+                index++;
+            }
+        }
+
+        return std::string::npos;
+    }
+
+    struct ConditionOperator
+    {
+        const char* m_Symbol;
+        OperatorType m_Type;
+        int m_Precedence;
+    };
+
+    // two character operators go first so "<=" is not read as "<"
+    static const ConditionOperator g_ConditionOperators[] =
+    {
+        { "||", OperatorType::Or, 0 },
+        { "&&", OperatorType::And, 1 },
+        { "==", OperatorType::Equals, 2 },
+        { "!=", OperatorType::NotEquals, 2 },
+        { "<=", OperatorType::LessThanOrEquals, 3 },
+        { ">=", OperatorType::GreaterThanOrEquals, 3 },
+        { "<", OperatorType::LessThan, 3 },
+        { ">", OperatorType::GreaterThan, 3 },
+        { "+", OperatorType::Add, 4 },
+        { "-", OperatorType::Subtract, 4 },
+        { "*", OperatorType::Multiply, 5 },
+        { "/", OperatorType::Divide, 5 },
+    };
+
+    static void SkipWhitespace(const std::string& text, unsigned int& index)
+    {
+        while (index < text.size() && std::isspace((unsigned char)text[index]))
+        {
+            index++;
+        }
+    }
+
+    static const ConditionOperator* PeekConditionOperator(const std::string& text, unsigned int index)
+    {
+        for (auto& op : g_ConditionOperators)
+        {
+            if (text.compare(index, strlen(op.m_Symbol), op.m_Symbol) == 0)
+            {
+                return &op;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static int EvaluateConditionBinary(const std::string& text, unsigned int& index, int minPrecedence);
+
+    static int EvaluateConditionUnary(const std::string& text, unsigned int& index)
+    {
+        SkipWhitespace(text, index);
+
+        if (index >= text.size())
+        {
+            throw PreprocessorException("Unexpected end of expression");
+        }
+
+        auto c = text[index];
+
+        if (c == '!' || c == '-')
+        {
+            index++;
+            auto value = EvaluateConditionUnary(text, index);
+            return c == '!' ? !value : -value;
+        }
+
+        if (c == '(')
+        {
+            index++;
+            auto value = EvaluateConditionBinary(text, index, 0);
+            SkipWhitespace(text, index);
+
+            if (index >= text.size() || text[index] != ')')
+            {
+                throw PreprocessorException("Expected \")\"");
+            }
+
+            index++;
+            return value;
+        }
+
+        if (std::isdigit((unsigned char)c))
+        {
+            auto start = index;
+            while (index < text.size() && std::isalnum((unsigned char)text[index]))
+            {
+                index++;
+            }
+
+            auto isHex = text.compare(start, 2, "0x") == 0 || text.compare(start, 2, "0X") == 0;
+            return (int)std::stoul(text.substr(start, index - start), nullptr, isHex ? 16 : 10);
+        }
+
+        if (IsIdentifierStart(c))
+        {
+            auto start = index;
+            while (index < text.size() && IsIdentifierChar(text[index]))
+            {
+                index++;
+            }
+
+            // like in C identifiers that are not macros evaluate to zero
+            return text.compare(start, index - start, "true") == 0 ? 1 : 0;
+        }
+
+        throw PreprocessorException(SafePrintf("Unexpected \"%\"", c));
+    }
+
+    static int EvaluateConditionBinary(const std::string& text, unsigned int& index, int minPrecedence)
+    {
+        auto lhs = EvaluateConditionUnary(text, index);
+
+        while (true)
+        {
+            SkipWhitespace(text, index);
+
+            auto op = PeekConditionOperator(text, index);
+            if (op == nullptr || op->m_Precedence < minPrecedence)
+            {
+                return lhs;
+            }
+
+            index += (unsigned int)strlen(op->m_Symbol);
+            auto rhs = EvaluateConditionBinary(text, index, op->m_Precedence + 1);
+
+            switch (op->m_Type)
+            {
+                case OperatorType::Or:
+                    lhs = (lhs != 0 || rhs != 0) ? 1 : 0;
+                    break;
+                case OperatorType::And:
+                    lhs = (lhs != 0 && rhs != 0) ? 1 : 0;
+                    break;
+                case OperatorType::Equals:
+                    lhs = (lhs == rhs) ? 1 : 0;
+                    break;
+                case OperatorType::NotEquals:
+                    lhs = (lhs != rhs) ? 1 : 0;
+                    break;
+                case OperatorType::GreaterThan:
+                    lhs = (lhs > rhs) ? 1 : 0;
+                    break;
+                case OperatorType::GreaterThanOrEquals:
+                    lhs = (lhs >= rhs) ? 1 : 0;
+                    break;
+                case OperatorType::LessThan:
+                    lhs = (lhs < rhs) ? 1 : 0;
+                    break;
+                case OperatorType::LessThanOrEquals:
+                    lhs = (lhs <= rhs) ? 1 : 0;
+                    break;
+                case OperatorType::Add:
+                    lhs = lhs + rhs;
+                    break;
+                case OperatorType::Subtract:
+                    lhs = lhs - rhs;
+                    break;
+                case OperatorType::Multiply:
+                    lhs = lhs * rhs;
+                    break;
+                case OperatorType::Divide:
+                    if (rhs == 0)
+                    {
+                        throw PreprocessorException("Division by zero");
+                    }
+
+                    lhs = lhs / rhs;
+                    break;
+            }
+        }
+    }
+
+    // reads the line starting at index without its line ending, returns false at the end of the data
+    static bool ReadLine(const char* data, size_t size, size_t& index, std::string& retLine)
+    {
+        if (index >= size)
+        {
+            return false;
+        }
+
+        auto newLine = (const char*)memchr(data + index, '\n', size - index);
+        auto end = newLine != nullptr ? (size_t)(newLine - data) : size;
+
+        retLine.assign(data + index, end - index);
+        if (!retLine.empty() && retLine.back() == '\r')
+        {
+            retLine.pop_back();
+        }
+
+        index = end + 1;
+        return true;
+    }
+
     std::string Preprocessor::Process(const std::string& input)
     {
-        std::istringstream iss(input);
+        return ProcessSource(input.data(), input.size(), "");
+    }
+
+    std::string Preprocessor::ProcessSource(const char* data, size_t size, const std::string& fileName)
+    {
         std::string output;
+        output.reserve(size);
+
+        auto conditionalDepth = m_Conditionals.size();
+        auto fileIndex = m_SourceMap.AddFile(fileName);
+        auto lineNumber = 0u;
 
-        for (std::string line; std::getline(iss, line); )
+        std::string line;
+        for (auto index = (size_t)0; ReadLine(data, size, index, line); )
         {
-            line = ProcessLine(line);
-            output.append(line);
-            output.append("\n");
+            // an #include adds the lines of the included file before this one
+            try
+            {
+                output.append(ProcessLine(line));
+            }
+            catch (const PreprocessorException& ex)
+            {
+                // errors from an #include'd file already point into that file
+                if (ex.HasLocation())
+                {
+                    throw;
+                }
+
+                throw PreprocessorException(ex.what(), fileName, lineNumber + 1);
+            }
+
+            output.push_back('\n');
+            m_SourceMap.AddLine(fileIndex, ++lineNumber);
+        }
+
+        if (m_Conditionals.size() > conditionalDepth)
+        {
+            throw PreprocessorException("Missing #endif", fileName, std::max(lineNumber, 1u));
         }
 
         return output;
     }
 
+    std::string Preprocessor::ProcessFile(const std::string& path)
+    {
+        using namespace std::experimental;
+
+        auto canonicalPath = filesystem::canonical(path).generic_u8string();
+        auto& file = LoadSourceFile(canonicalPath);
+
+        if (!m_IncludeStack.empty())
+        {
+            m_SourceFiles[m_IncludeStack.back()].m_Includes.push_back(canonicalPath);
+        }
+
+        if (file.m_IsOnce || (!file.m_GuardMacro.empty() && m_Defines.find(file.m_GuardMacro) != m_Defines.end()))
+        {
+            return "";
+        }
+
+        if (std::find(m_IncludeStack.begin(), m_IncludeStack.end(), canonicalPath) != m_IncludeStack.end())
+        {
+            throw PreprocessorException(SafePrintf("Recursive #include of \"%\"", path));
+        }
+
+        m_IncludeStack.push_back(canonicalPath);
+        auto output = ProcessSource(file.m_File->GetData(), file.m_File->GetSize(), path);
+        m_IncludeStack.pop_back();
+
+        return output;
+    }
+
+    // a guarded file only needs to be preprocessed again if its guard macro was #undef'd
+    static std::string FindIncludeGuard(const char* data, size_t size)
+    {
+        std::string guard;
+
+        auto lineCount = 0u;
+        auto depth = 0;
+        auto closed = false;
+
+        std::string line;
+        for (auto index = (size_t)0; ReadLine(data, size, index, line); )
+        {
+            auto trimmed = trim(line);
+
+            if (trimmed.empty() || trimmed.compare(0, 2, "//") == 0)
+            {
+                continue;
+            }
+
+            if (closed)
+            {
+                return "";
+            }
+
+            auto space = trimmed.find_first_of(" \t");
+            auto cmd = trimmed.substr(0, space);
+            auto argument = space == std::string::npos ? std::string() : trim(trimmed.substr(space));
+
+            lineCount++;
+
+            if (lineCount == 1)
+            {
+                if (cmd != "#ifndef" || argument.empty())
+                {
+                    return "";
+                }
+
+                guard = argument;
+                depth = 1;
+            }
+            else if (lineCount == 2)
+            {
+                if (cmd != "#define" || argument.substr(0, argument.find_first_of(" \t")) != guard)
+                {
+                    return "";
+                }
+            }
+            else if (cmd == "#if" || cmd == "#ifdef" || cmd == "#ifndef")
+            {
+                depth++;
+            }
+            else if ((cmd == "#else" || cmd == "#elif") && depth == 1)
+            {
+                return "";
+            }
+            else if (cmd == "#endif")
+            {
+                closed = --depth == 0;
+            }
+        }
+
+        return closed ? guard : "";
+    }
+
+    SourceFile& Preprocessor::LoadSourceFile(const std::string& path)
+    {
+        auto it = m_SourceFiles.find(path);
+        if (it != m_SourceFiles.end())
+        {
+            return it->second;
+        }
+
+        auto mappedFile = std::make_unique<MappedFile>();
+        if (!mappedFile->Open(path))
+        {
+            throw PreprocessorException(SafePrintf("Failed to open \"%\" for reading", path));
+        }
+
+        auto& file = m_SourceFiles[path];
+        file.m_File = std::move(mappedFile);
+        file.m_GuardMacro = FindIncludeGuard(file.m_File->GetData(), file.m_File->GetSize());
+        return file;
+    }
+
+    void Preprocessor::AddDefine(const std::string& define)
+    {
+        auto equals = define.find('=');
+        if (equals == std::string::npos)
+        {
+            Define(define + " 1");
+        }
+        else
+        {
+            Define(define.substr(0, equals) + " " + define.substr(equals + 1));
+        }
+    }
+
+    // the text after a directive's name without a trailing comment, empty if there is none
+    static std::string GetDirectiveArgument(const std::string& directive, size_t space)
+    {
+        if (space == std::string::npos)
+        {
+            return "";
+        }
+
+        auto argument = directive.substr(space);
+        return trim(argument.substr(0, FindLineComment(argument)));
+    }
+
     std::string Preprocessor::ProcessLine(const std::string& line)
     {
         using namespace std::experimental;
 
         auto trimmed = trim(line);
-        if (trimmed[0] == '#')
+        auto isDirective = trimmed[0] == '#' && !m_InMultiLineString;
+
+        // skipped lines become empty so line numbers stay the same
+        if ((isDirective && ProcessConditional(trimmed)) || !IsActive())
+        {
+            return "";
+        }
+
+        if (isDirective)
         {
             auto space = trimmed.find_first_of(' ');
             auto cmd = trimmed.substr(0, space);
             if (cmd == "#define")
             {
-                trimmed = trim(trimmed.substr(space));
-                space = trimmed.find_first_of(' ');
-                auto key = trimmed.substr(0, space);
-                auto value = trim(trimmed.substr(space));
-
-                m_Defines.erase(key);
-                m_Defines.insert(std::make_pair(key, value));
+                Define(space == std::string::npos ? "" : trim(trimmed.substr(space)));
                 return "";
             }
             else if (cmd == "#undef")
             {
-                trimmed = trim(trimmed.substr(space));
+                trimmed = GetDirectiveArgument(trimmed, space);
                 space = trimmed.find_first_of(' ');
                 auto key = trimmed.substr(0, space);
                 m_Defines.erase(key);
+                return "";
             }
             else if (cmd == "#include")
             {
-                trimmed = trim(trimmed.substr(space));
+                trimmed = GetDirectiveArgument(trimmed, space);
                 auto path = filesystem::path(m_RootFolder);
                 path.append(trimmed);
 
                 if (!filesystem::is_regular_file(path))
                 {
-                    throw new PreprocessorException(SafePrintf("Failed to #include from \"%\"", trimmed));
+                    throw PreprocessorException(SafePrintf("Failed to #include from \"%\"", trimmed));
                 }
 
-                return ReadIncludeFile(path.generic_u8string());
+                return ProcessFile(path.generic_u8string());
+            }
+            else if (cmd == "#pragma")
+            {
+                trimmed = GetDirectiveArgument(trimmed, space);
+                if (trimmed == "once" && !m_IncludeStack.empty())
+                {
+                    m_SourceFiles[m_IncludeStack.back()].m_IsOnce = true;
+                }
+
+                return "";
             }
             else if (cmd == "#src")
             {
@@ -81,33 +523,454 @@ namespace LangUMS
             }
         }
 
-        auto outLine = line;
+        return ExpandMacros(line, m_InMultiLineString);
+    }
+
+    bool Preprocessor::ProcessConditional(const std::string& line)
+    {
+        // a trailing comment is not part of the condition, the same as in #define
+        auto directive = trim(line.substr(0, FindLineComment(line)));
+
+        auto space = directive.find_first_of(" \t");
+        auto cmd = directive.substr(0, space);
+        auto argument = space == std::string::npos ? std::string() : trim(directive.substr(space));
 
-        for (auto& pair : m_Defines)
+        if (cmd == "#if" || cmd == "#ifdef" || cmd == "#ifndef")
         {
-            auto& search = pair.first;
-            auto& replace = pair.second;
+            if (argument.empty())
+            {
+                throw PreprocessorException(SafePrintf("Missing condition after %", cmd));
+            }
+
+            ConditionalBlock block;
 
-            auto pos = 0u;
-            while ((pos = outLine.find(search, pos)) != std::string::npos)
+            if (IsActive())
             {
-                outLine.replace(pos, search.length(), replace);
-                pos += replace.length();
+                if (cmd == "#if")
+                {
+                    block.m_IsActive = EvaluateCondition(argument) != 0;
+                }
+                else
+                {
+                    block.m_IsActive = (m_Defines.find(argument) != m_Defines.end()) == (cmd == "#ifdef");
+                }
+
+                block.m_WasTaken = block.m_IsActive;
+            }
+            else
+            {
+                // nothing inside a skipped block is ever kept
+                block.m_WasTaken = true;
             }
+
+            m_Conditionals.push_back(block);
         }
+        else if (cmd == "#elif" || cmd == "#else")
+        {
+            if (m_Conditionals.empty())
+            {
+                throw PreprocessorException(SafePrintf("% without #if", cmd));
+            }
+
+            auto& block = m_Conditionals.back();
+            if (block.m_HasElse)
+            {
+                throw PreprocessorException(SafePrintf("% after #else", cmd));
+            }
 
-        auto commentStart = outLine.find("//");
-        if (commentStart == std::string::npos)
+            if (cmd == "#else")
+            {
+                block.m_HasElse = true;
+                block.m_IsActive = !block.m_WasTaken;
+            }
+            else
+            {
+                block.m_IsActive = !block.m_WasTaken && EvaluateCondition(argument) != 0;
+            }
+
+            block.m_WasTaken = block.m_WasTaken || block.m_IsActive;
+        }
+        else if (cmd == "#endif")
         {
-            return outLine;
+            if (m_Conditionals.empty())
+            {
+                throw PreprocessorException("#endif without #if");
+            }
+
+            m_Conditionals.pop_back();
+        }
+        else
+        {
+            return false;
         }
 
-        return outLine.substr(0, commentStart);
+        return true;
     }
 
-    std::string Preprocessor::ReadIncludeFile(const std::string& path)
+    int Preprocessor::EvaluateCondition(const std::string& expression)
     {
-        return Process(std::string((std::istreambuf_iterator<char>(std::ifstream(path))), std::istreambuf_iterator<char>()));
+        // resolve defined(NAME) and defined NAME before the macros are expanded
+        std::string resolved;
+        auto size = (unsigned int)expression.size();
+        auto index = 0u;
+
+        while (index < size)
+        {
+            if (!IsIdentifierStart(expression[index]))
+            {
+                resolved.push_back(expression[index++]);
+                continue;
+            }
+
+            auto start = index;
+            while (index < size && IsIdentifierChar(expression[index]))
+            {
+                index++;
+            }
+
+            if (expression.compare(start, index - start, "defined") != 0)
+            {
+                resolved.append(expression, start, index - start);
+                continue;
+            }
+
+            SkipWhitespace(expression, index);
+            auto hasParenthesis = index < size && expression[index] == '(';
+            if (hasParenthesis)
+            {
+                index++;
+                SkipWhitespace(expression, index);
+            }
+
+            auto nameStart = index;
+            while (index < size && IsIdentifierChar(expression[index]))
+            {
+                index++;
+            }
+
+            if (nameStart == index)
+            {
+                throw PreprocessorException(SafePrintf("Missing macro name after \"defined\" in \"%\"", expression));
+            }
+
+            auto isDefined = m_Defines.find(expression.substr(nameStart, index - nameStart)) != m_Defines.end();
+
+            if (hasParenthesis)
+            {
+                SkipWhitespace(expression, index);
+                if (index >= size || expression[index] != ')')
+                {
+                    throw PreprocessorException(SafePrintf("Missing \")\" after \"defined\" in \"%\"", expression));
+                }
+
+                index++;
+            }
+
+            resolved.append(isDefined ? "1" : "0");
+        }
+
+        auto inString = false;
+        auto expanded = ExpandMacros(resolved, inString);
+
+        try
+        {
+            index = 0u;
+            auto value = EvaluateConditionBinary(expanded, index, 0);
+            SkipWhitespace(expanded, index);
+
+            if (index < expanded.size())
+            {
+                throw PreprocessorException(SafePrintf("Unexpected \"%\"", expanded[index]));
+            }
+
+            return value;
+        }
+        catch (const PreprocessorException& ex)
+        {
+            throw PreprocessorException(SafePrintf("Invalid condition \"%\": %", expression, ex.what()));
+        }
+    }
+
+    void Preprocessor::Define(const std::string& definition)
+    {
+        auto size = (unsigned int)definition.size();
+        auto index = 0u;
+
+        while (index < size && IsIdentifierChar(definition[index]))
+        {
+            index++;
+        }
+
+        if (index == 0 || !IsIdentifierStart(definition[0]))
+        {
+            throw PreprocessorException(SafePrintf("Invalid macro name in \"#define %\"", definition));
+        }
+
+        auto name = definition.substr(0, index);
+        Macro macro;
+
+        // like in C only a parenthesis right after the name makes a function-like macro
+        if (index < size && definition[index] == '(')
+        {
+            auto end = definition.find(')', index);
+            if (end == std::string::npos)
+            {
+                throw PreprocessorException(SafePrintf("Missing \")\" in definition of macro \"%\"", name));
+            }
+
+            auto arguments = definition.substr(index + 1, end - index - 1);
+            if (arguments.find_first_not_of(" \t") != std::string::npos)
+            {
+                std::istringstream iss(arguments);
+                for (std::string argument; std::getline(iss, argument, ','); )
+                {
+                    argument = trim(argument);
+                    if (argument.empty() || !IsIdentifierStart(argument[0]) ||
+                        !std::all_of(argument.begin(), argument.end(), IsIdentifierChar))
+                    {
+                        throw PreprocessorException(SafePrintf("Invalid argument \"%\" in definition of macro \"%\"", argument, name));
+                    }
+
+                    macro.m_Arguments.push_back(argument);
+                }
+            }
+
+            macro.m_IsFunction = true;
+            index = (unsigned int)end + 1;
+        }
+
+        auto value = definition.substr(index);
+        auto commentStart = FindLineComment(value);
+        if (commentStart != std::string::npos)
+        {
+            value = value.substr(0, commentStart);
+        }
+
+        value = trim(value);
+        if (value.find_first_not_of(" \t") != std::string::npos)
+        {
+            macro.m_Value = value;
+        }
+
+        m_Defines[name] = std::move(macro);
+    }
+
+    std::string Preprocessor::ExpandMacros(const std::string& text, bool& inMultiLineString)
+    {
+        std::string output;
+        output.reserve(text.size());
+
+        auto size = (unsigned int)text.size();
+        auto index = 0u;
+
+        while (index < size)
+        {
+            auto c = text[index];
+
+            if (inMultiLineString || c == '"')
+            {
+                // string contents are never expanded
+                auto end = SkipStringLiteral(text, index, inMultiLineString);
+                output.append(text, index, end - index);
+                index = end;
+            }
+            else if (c == '/' && index + 1 < size && text[index + 1] == '/')
+            {
+                break;
+            }
+            else if (IsIdentifierStart(c))
+            {
+                auto start = index;
+                while (index < size && IsIdentifierChar(text[index]))
+                {
+                    index++;
+                }
+
+                std::string name(text, start, index - start);
+
+                auto it = m_Defines.find(name);
+                if (it == m_Defines.end() ||
+                    std::find(m_ExpandingMacros.begin(), m_ExpandingMacros.end(), &it->first) != m_ExpandingMacros.end())
+                {
+                    output.append(name);
+                }
+                else
+                {
+                    ExpandMacro(it->first, it->second, text, index, output);
+                }
+            }
+            else if (std::isdigit((unsigned char)c))
+            {
+                // skip whole numbers so the tail of 0x1F is not mistaken for an identifier
+                auto start = index;
+                while (index < size && IsIdentifierChar(text[index]))
+                {
+                    index++;
+                }
+
+                output.append(text, start, index - start);
+            }
+            else
+            {
+                output.push_back(c);
+                index++;
+            }
+        }
+
+        return output;
+    }
+
+    void Preprocessor::ExpandMacro(const std::string& name, const Macro& macro, const std::string& text, unsigned int& index, std::string& output)
+    {
+        std::string value;
+
+        if (macro.m_IsFunction)
+        {
+            auto next = index;
+            while (next < text.size() && std::isspace((unsigned char)text[next]))
+            {
+                next++;
+            }
+
+            // a function-like macro name without arguments is left alone
+            if (next >= text.size() || text[next] != '(')
+            {
+                output.append(name);
+                return;
+            }
+
+            std::vector<std::string> arguments;
+            index = ReadMacroArguments(name, text, next, arguments);
+
+            if (arguments.size() != macro.m_Arguments.size())
+            {
+                throw PreprocessorException(SafePrintf("Macro \"%\" expects % arguments but got %", name, macro.m_Arguments.size(), arguments.size()));
+            }
+
+            for (auto& argument : arguments)
+            {
+                auto inString = false;
+                argument = ExpandMacros(argument, inString);
+            }
+
+            value = SubstituteArguments(macro, arguments);
+        }
+        else
+        {
+            value = macro.m_Value;
+        }
+
+        // the result is rescanned for other macros but never for itself
+        m_ExpandingMacros.push_back(&name);
+        auto inString = false;
+        output.append(ExpandMacros(value, inString));
+        m_ExpandingMacros.pop_back();
+    }
+
+    unsigned int Preprocessor::ReadMacroArguments(const std::string& name, const std::string& text, unsigned int index, std::vector<std::string>& retArguments)
+    {
+        auto size = (unsigned int)text.size();
+        auto start = index + 1;
+        auto depth = 0;
+
+        while (index < size)
+        {
+            auto c = text[index];
+
+            if (c == '"')
+            {
+                auto inString = false;
+                index = SkipStringLiteral(text, index, inString);
+                continue;
+            }
+
+            if (c == '(')
+            {
+                depth++;
+            }
+            else if (c == ')' || (c == ',' && depth == 1))
+            {
+                if (c == ')' && --depth > 0)
+                {
+                    index++;
+                    continue;
+                }
+
+                auto argument = trim(text.substr(start, index - start));
+                if (c == ',' || !retArguments.empty() || argument.find_first_not_of(" \t") != std::string::npos)
+                {
+                    retArguments.push_back(argument);
+                }
+
+                if (c == ')')
+                {
+                    return index + 1;
+                }
+
+                start = index + 1;
+            }
+
+            index++;
+        }
+
+        throw PreprocessorException(SafePrintf("Missing \")\" after the arguments of macro \"%\", macro calls must fit on one line", name));
+    }
+
+    std::string Preprocessor::SubstituteArguments(const Macro& macro, const std::vector<std::string>& arguments)
+    {
+        auto& value = macro.m_Value;
+        auto size = (unsigned int)value.size();
+        auto index = 0u;
+
+        std::string output;
+        output.reserve(size);
+
+        while (index < size)
+        {
+            auto c = value[index];
+
+            if (c == '"')
+            {
+                auto inString = false;
+                auto end = SkipStringLiteral(value, index, inString);
+                output.append(value, index, end - index);
+                index = end;
+            }
+            else if (IsIdentifierChar(c))
+            {
+                auto start = index;
+                while (index < size && IsIdentifierChar(value[index]))
+                {
+                    index++;
+                }
+
+                auto length = index - start;
+                auto argumentIndex = 0u;
+                for (; argumentIndex < macro.m_Arguments.size(); argumentIndex++)
+                {
+                    if (macro.m_Arguments[argumentIndex].compare(0, std::string::npos, value, start, length) == 0)
+                    {
+                        break;
+                    }
+                }
+
+                if (argumentIndex < arguments.size() && IsIdentifierStart(value[start]))
+                {
+                    output.append(arguments[argumentIndex]);
+                }
+                else
+                {
+                    output.append(value, start, length);
+                }
+            }
+            else
+            {
+                output.push_back(c);
+                index++;
+            }
+        }
+
+        return output;
     }
 
 }
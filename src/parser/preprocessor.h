@@ -2,8 +2,13 @@
 #define __LANGUMS_PREPROCESSOR_H
 
 #include <string>
+#include <vector>
+#include <memory>
 #include <unordered_map>
 
+#include "../mapped_file.h"
+#include "../source_map.h"
+
 namespace LangUMS
 {
 
@@ -12,6 +17,49 @@ namespace LangUMS
         public:
         PreprocessorException(const char* error) : std::exception(error) {}
         PreprocessorException(const std::string& error) : std::exception(error.c_str()) {}
+        PreprocessorException(const std::string& error, const std::string& fileName, unsigned int lineNumber) :
+            std::exception(error.c_str()), m_FileName(fileName), m_LineNumber(lineNumber) {}
+
+        bool HasLocation() const
+        {
+            return m_LineNumber != 0;
+        }
+
+        const std::string& GetFileName() const
+        {
+            return m_FileName;
+        }
+
+        unsigned int GetLineNumber() const
+        {
+            return m_LineNumber;
+        }
+
+        private:
+        std::string m_FileName;
+        unsigned int m_LineNumber = 0;
+    };
+
+    struct Macro
+    {
+        std::string m_Value;
+        std::vector<std::string> m_Arguments;
+        bool m_IsFunction = false;
+    };
+
+    struct ConditionalBlock
+    {
+        bool m_IsActive = false; // lines of the current branch are kept
+        bool m_WasTaken = false; // a branch of this block was already kept, the rest are skipped
+        bool m_HasElse = false;
+    };
+
+    struct SourceFile
+    {
+        std::unique_ptr<MappedFile> m_File; // stays mapped for the whole run, the text is never copied
+        std::string m_GuardMacro; // set when the whole file is wrapped in #ifndef X / #define X / #endif
+        bool m_IsOnce = false; // marked with #pragma once
+        std::vector<std::string> m_Includes;
     };
 
     class Preprocessor
@@ -40,12 +88,50 @@ namespace LangUMS
         }
 
         std::string Process(const std::string& input);
+        std::string ProcessFile(const std::string& path);
+
+        // where each line of the output came from
+        const SourceMap& GetSourceMap() const
+        {
+            return m_SourceMap;
+        }
+
+        // every file read during this run keyed by canonical path, including what each one #includes
+        const std::unordered_map<std::string, SourceFile>& GetSourceFiles() const
+        {
+            return m_SourceFiles;
+        }
+
+        // accepts NAME or NAME=VALUE as passed with -D on the command line
+        void AddDefine(const std::string& define);
 
         private:
+        std::string ProcessSource(const char* data, size_t size, const std::string& fileName);
         std::string ProcessLine(const std::string& line);
-        std::string ReadIncludeFile(const std::string& path);
+        SourceFile& LoadSourceFile(const std::string& path);
+
+        void Define(const std::string& definition);
+        bool ProcessConditional(const std::string& line);
+        int EvaluateCondition(const std::string& expression);
+
+        bool IsActive() const
+        {
+            return m_Conditionals.empty() || m_Conditionals.back().m_IsActive;
+        }
+
+        std::string ExpandMacros(const std::string& text, bool& inMultiLineString);
+        void ExpandMacro(const std::string& name, const Macro& macro, const std::string& text, unsigned int& index, std::string& output);
+        unsigned int ReadMacroArguments(const std::string& name, const std::string& text, unsigned int index, std::vector<std::string>& retArguments);
+        std::string SubstituteArguments(const Macro& macro, const std::vector<std::string>& arguments);
+
+        std::unordered_map<std::string, Macro> m_Defines;
+        std::vector<const std::string*> m_ExpandingMacros;
+        std::vector<ConditionalBlock> m_Conditionals;
 
-        std::unordered_map<std::string, std::string> m_Defines;
+        std::unordered_map<std::string, SourceFile> m_SourceFiles;
+        std::vector<std::string> m_IncludeStack;
+        SourceMap m_SourceMap;
+        bool m_InMultiLineString = false;
         std::string m_RootFolder;
 
         std::string m_MapName;
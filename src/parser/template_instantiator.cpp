@@ -6,7 +6,7 @@
 namespace LangUMS
 {
 
-    void TemplateInstantiator::Process(const std::unique_ptr<IASTNode>& unit)
+    void TemplateInstantiator::Process(const std::shared_ptr<IASTNode>& unit)
     {
         m_Unit = unit.get();
 
@@ -121,9 +121,7 @@ namespace LangUMS
 
         std::vector<std::shared_ptr<IASTNode>> finalArgs;
         std::vector<std::string> finalArgNames;
-
-        auto& bodyChild = templateFunction->GetChild(0);
-        auto body = CloneNode(bodyChild.get());
+        std::unordered_map<std::string, std::shared_ptr<IASTNode>> replacements;
 
         for (auto i = 0u; i < args.size(); i++)
         {
@@ -131,7 +129,7 @@ namespace LangUMS
             auto& callArg = functionCall->GetArgument(i);
             if (templateArgsSet.count(argName) != 0)
             {
-                ReplaceIdentifier(body.get(), argName, callArg);
+                replacements[argName] = callArg;
 
                 if (callArg->GetType() == ASTNodeType::Identifier)
                 {
@@ -169,169 +167,145 @@ namespace LangUMS
             functionCall->AddChild(arg);
         }
 
+        // the generated name encodes the template arguments, calls with the same arguments share one instantiation
         if (m_InstantiatedTemplates.find(genFnName) != m_InstantiatedTemplates.end())
         {
             return;
         }
 
-        auto instantiatedFn = new ASTFunctionDeclaration(genFnName, finalArgNames, templateFunction->GetCharIndex());
+        auto& bodyChild = templateFunction->GetChild(0);
+        auto body = CloneNode(bodyChild.get(), replacements);
+
+        auto instantiatedFn = std::make_shared<ASTFunctionDeclaration>(genFnName, finalArgNames, templateFunction->GetCharIndex());
 
         instantiatedFn->AddChild(std::move(body));
-        InstantiateTemplateFunctions(instantiatedFn);
+        InstantiateTemplateFunctions(instantiatedFn.get());
 
-        m_Unit->AddChild(std::unique_ptr<IASTNode>(instantiatedFn));
+        m_Unit->AddChild(instantiatedFn);
 
-        m_InstantiatedTemplates.insert(std::make_pair(genFnName, instantiatedFn));
+        m_InstantiatedTemplates.insert(std::make_pair(genFnName, instantiatedFn.get()));
     }
 
-    std::vector<std::unique_ptr<IASTNode>> TemplateInstantiator::InstantiateRepeatTemplate(ASTRepeatTemplate* repeatTemplate)
+    std::vector<std::shared_ptr<IASTNode>> TemplateInstantiator::InstantiateRepeatTemplate(ASTRepeatTemplate* repeatTemplate)
     {
-        std::vector<std::unique_ptr<IASTNode>> nodes;
+        std::vector<std::shared_ptr<IASTNode>> nodes;
 
         auto& iterators = repeatTemplate->GetIterators();
         auto itemCount = repeatTemplate->GetArgumentList(iterators[0]).size();
 
-        for (auto i = 0u; i < itemCount; i++)
+        for (auto& iterator : iterators)
         {
-            auto firstChild = repeatTemplate->GetChild(0);
-            if (firstChild->GetType() == ASTNodeType::BlockStatement)
-            {
-                auto& statements = firstChild->GetChildren();
-                for (auto& statement : statements)
-                {
-                    auto newStatement = CloneNode(statement.get());
-
-                    for (auto& iterator : iterators)
-                    {
-                        auto& items = repeatTemplate->GetArgumentList(iterator);
-
-                        if (items.size() != itemCount)
-                        {
-                            throw TemplateInstantiatorException(SafePrintf("Argument list mismatch, expected % items but only got % for iterator \"%\"",
-                                itemCount, items.size(), iterator), repeatTemplate);
-                        }
+            auto& items = repeatTemplate->GetArgumentList(iterator);
 
-                        ReplaceIdentifier(newStatement.get(), iterator, items[i]);
-                    }
-
-                    nodes.push_back(std::move(newStatement));
-                }
-            }
-            else
+            if (items.size() != itemCount)
             {
-                auto& eventDeclarations = repeatTemplate->GetChildren();
-                for (auto& eventDeclaration : eventDeclarations)
-                {
-                    auto newStatement = CloneNode(eventDeclaration.get());
-
-                    for (auto& iterator : iterators)
-                    {
-                        auto& items = repeatTemplate->GetArgumentList(iterator);
-
-                        if (items.size() != itemCount)
-                        {
-                            throw TemplateInstantiatorException(SafePrintf("Argument list mismatch, expected % items but only got % for iterator \"%\"",
-                                itemCount, items.size(), iterator), repeatTemplate);
-                        }
-
-                        ReplaceIdentifier(newStatement.get(), iterator, items[i]);
-                    }
-
-                    nodes.push_back(std::move(newStatement));
-                }
+                throw TemplateInstantiatorException(SafePrintf("Argument list mismatch, expected % items but only got % for iterator \"%\"",
+                    itemCount, items.size(), iterator), repeatTemplate);
             }
         }
 
-        return nodes;
-    }
+        // either a block of statements or a list of event declarations
+        auto firstChild = repeatTemplate->GetChild(0);
+        auto& statements = firstChild->GetType() == ASTNodeType::BlockStatement ? firstChild->GetChildren() : repeatTemplate->GetChildren();
 
-    void TemplateInstantiator::ReplaceIdentifier(IASTNode* node, const std::string& identifierName, const std::shared_ptr<IASTNode>& replaceWith)
-    {
-        auto children = node->GetChildren();
-        node->RemoveChildren();
+        std::unordered_map<std::string, std::shared_ptr<IASTNode>> replacements;
 
-        for (auto& child : children)
+        for (auto i = 0u; i < itemCount; i++)
         {
-            if (child->GetType() == ASTNodeType::Identifier)
+            for (auto& iterator : iterators)
             {
-                auto identifier = (ASTIdentifier*)child.get();
-                auto& name = identifier->GetName();
-                if (name == identifierName)
-                {
-                    node->AddChild(replaceWith);
-                }
-                else
-                {
-                    node->AddChild(child);
-                }
+                replacements[iterator] = repeatTemplate->GetArgumentList(iterator)[i];
             }
-            else
+
+            for (auto& statement : statements)
             {
-                ReplaceIdentifier(child.get(), identifierName, replaceWith);
-                node->AddChild(child);
+                nodes.push_back(CloneNode(statement.get(), replacements));
             }
         }
+
+        return nodes;
     }
 
-    std::unique_ptr<IASTNode> TemplateInstantiator::CloneNode(IASTNode* node)
+    std::shared_ptr<IASTNode> TemplateInstantiator::CloneNode(IASTNode* node, const std::unordered_map<std::string, std::shared_ptr<IASTNode>>& replacements)
     {
-        IASTNode* newNode = nullptr;
+        std::shared_ptr<IASTNode> newNode;
 
         switch (node->GetType())
         {
         case ASTNodeType::Unit:
-            newNode = new IASTNode(node->GetCharIndex(), ASTNodeType::Unit);
+            newNode = std::make_shared<IASTNode>(node->GetCharIndex(), ASTNodeType::Unit);
             break;
         case ASTNodeType::FunctionDeclaration:
-            newNode = new ASTFunctionDeclaration(*(ASTFunctionDeclaration*)node);
+            newNode = std::make_shared<ASTFunctionDeclaration>(*(ASTFunctionDeclaration*)node);
             break;
         case ASTNodeType::TemplateFunction:
-            newNode = new ASTTemplateFunction(*(ASTTemplateFunction*)node);
+            newNode = std::make_shared<ASTTemplateFunction>(*(ASTTemplateFunction*)node);
             break;
         case ASTNodeType::BlockStatement:
-            newNode = new ASTBlockStatement(*(ASTBlockStatement*)node);
+            newNode = std::make_shared<ASTBlockStatement>(*(ASTBlockStatement*)node);
             break;
         case ASTNodeType::Identifier:
-            newNode = new ASTIdentifier(*(ASTIdentifier*)node);
+            newNode = std::make_shared<ASTIdentifier>(*(ASTIdentifier*)node);
             break;
         case ASTNodeType::StringLiteral:
-            newNode = new ASTStringLiteral(*(ASTStringLiteral*)node);
+            newNode = std::make_shared<ASTStringLiteral>(*(ASTStringLiteral*)node);
             break;
         case ASTNodeType::NumberLiteral:
-            newNode = new ASTNumberLiteral(*(ASTNumberLiteral*)node);
+            newNode = std::make_shared<ASTNumberLiteral>(*(ASTNumberLiteral*)node);
             break;
         case ASTNodeType::AssignmentExpression:
-            newNode = new ASTAssignmentExpression(*(ASTAssignmentExpression*)node);
+            newNode = std::make_shared<ASTAssignmentExpression>(*(ASTAssignmentExpression*)node);
             break;
         case ASTNodeType::FunctionCall:
-            newNode = new ASTFunctionCall(*(ASTFunctionCall*)node);
+            newNode = std::make_shared<ASTFunctionCall>(*(ASTFunctionCall*)node);
             break;
         case ASTNodeType::IfStatement:
-            newNode = new ASTIfStatement(*(ASTIfStatement*)node);
+            newNode = std::make_shared<ASTIfStatement>(*(ASTIfStatement*)node);
             break;
         case ASTNodeType::WhileStatement:
-            newNode = new ASTWhileStatement(*(ASTWhileStatement*)node);
+            newNode = std::make_shared<ASTWhileStatement>(*(ASTWhileStatement*)node);
+            break;
+        case ASTNodeType::SwitchStatement:
+            newNode = std::make_shared<ASTSwitchStatement>(*(ASTSwitchStatement*)node);
+            break;
+        case ASTNodeType::SwitchCase:
+            newNode = std::make_shared<ASTSwitchCase>(*(ASTSwitchCase*)node);
             break;
         case ASTNodeType::BinaryExpression:
-            newNode = new ASTBinaryExpression(*(ASTBinaryExpression*)node);
+            newNode = std::make_shared<ASTBinaryExpression>(*(ASTBinaryExpression*)node);
             break;
         case ASTNodeType::UnaryExpression:
-            newNode = new ASTUnaryExpression(*(ASTUnaryExpression*)node);
+            newNode = std::make_shared<ASTUnaryExpression>(*(ASTUnaryExpression*)node);
             break;
         case ASTNodeType::ReturnStatement:
-            newNode = new ASTReturnStatement(*(ASTReturnStatement*)node);
+            newNode = std::make_shared<ASTReturnStatement>(*(ASTReturnStatement*)node);
+            break;
+        case ASTNodeType::SpawnTaskStatement:
+            newNode = std::make_shared<ASTSpawnTaskStatement>(*(ASTSpawnTaskStatement*)node);
+            break;
+        case ASTNodeType::YieldStatement:
+            newNode = std::make_shared<ASTYieldStatement>(*(ASTYieldStatement*)node);
             break;
         case ASTNodeType::VariableDeclaration:
-            newNode = new ASTVariableDeclaration(*(ASTVariableDeclaration*)node);
+            newNode = std::make_shared<ASTVariableDeclaration>(*(ASTVariableDeclaration*)node);
             break;
         case ASTNodeType::EventCondition:
-            newNode = new ASTEventCondition(*(ASTEventCondition*)node);
+            newNode = std::make_shared<ASTEventCondition>(*(ASTEventCondition*)node);
             break;
         case ASTNodeType::EventDeclaration:
-            newNode = new ASTEventDeclaration(*(ASTEventDeclaration*)node);
+            newNode = std::make_shared<ASTEventDeclaration>(*(ASTEventDeclaration*)node);
             break;
         case ASTNodeType::ArrayExpression:
-            newNode = new ASTArrayExpression(*(ASTArrayExpression*)node);
+            newNode = std::make_shared<ASTArrayExpression>(*(ASTArrayExpression*)node);
+            break;
+        case ASTNodeType::TriggersBlock:
+            newNode = std::make_shared<ASTTriggersBlock>(*(ASTTriggersBlock*)node);
+            break;
+        case ASTNodeType::RawTrigger:
+            newNode = std::make_shared<ASTRawTrigger>(*(ASTRawTrigger*)node);
+            break;
+        case ASTNodeType::RawTriggerAction:
+            newNode = std::make_shared<ASTRawTriggerAction>(*(ASTRawTriggerAction*)node);
             break;
         default:
             throw TemplateInstantiatorException("Unsupported AST node type", node);
@@ -339,13 +313,24 @@ namespace LangUMS
 
         newNode->RemoveChildren();
 
+        // identifiers are substituted while cloning so the tree is only walked once
         auto& children = node->GetChildren();
         for (auto& child : children)
         {
-            newNode->AddChild(CloneNode(child.get()));
+            if (child->GetType() == ASTNodeType::Identifier)
+            {
+                auto it = replacements.find(((ASTIdentifier*)child.get())->GetName());
+                if (it != replacements.end())
+                {
+                    newNode->AddChild(it->second);
+                    continue;
+                }
+            }
+
+            newNode->AddChild(CloneNode(child.get(), replacements));
         }
 
-        return std::unique_ptr<IASTNode>(newNode);
+        return newNode;
     }
 
 }
\ No newline at end of file
@@ -28,17 +28,15 @@ namespace LangUMS
     class TemplateInstantiator
     {
         public:
-        void Process(const std::unique_ptr<IASTNode>& unit);
+        void Process(const std::shared_ptr<IASTNode>& unit);
 
         private:
         void InstantiateRepeatTemplates(IASTNode* node);
         void InstantiateTemplateFunctions(IASTNode* node);
         void InstantiateTemplateFunction(ASTTemplateFunction* templateFunction, ASTFunctionCall* functionCall);
-        std::vector<std::unique_ptr<IASTNode>> InstantiateRepeatTemplate(ASTRepeatTemplate* repeatTemplate);
+        std::vector<std::shared_ptr<IASTNode>> InstantiateRepeatTemplate(ASTRepeatTemplate* repeatTemplate);
 
-        void ReplaceIdentifier(IASTNode* node, const std::string& identifier, const std::shared_ptr<IASTNode>& replaceWith);
-        
-        std::unique_ptr<IASTNode> CloneNode(IASTNode* node);
+        std::shared_ptr<IASTNode> CloneNode(IASTNode* node, const std::unordered_map<std::string, std::shared_ptr<IASTNode>>& replacements);
 
         std::unordered_map<std::string, ASTTemplateFunction*> m_TemplateFunctions;
         std::unordered_map<std::string, ASTFunctionDeclaration*> m_InstantiatedTemplates;
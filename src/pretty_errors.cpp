@@ -4,6 +4,7 @@
 
 #include "log.h"
 #include "stringutil.h"
+#include "source_buffer.h"
 
 #include "parser/preprocessor.h"
 #include "parser/parser.h"
@@ -17,49 +18,69 @@
 namespace LangUMS
 {
 
-    void PrintCodeContext(const std::string& src, unsigned int charIndex)
+    std::string GetSourceLocationString(const SourceBuffer& source, unsigned int charIndex)
     {
-        auto lines = Split(src);
+        auto location = source.GetSourceMap().GetLocation(charIndex);
+        if (location.m_FileName.empty())
+        {
+            return SafePrintf("line %", location.m_LineNumber);
+        }
 
-        auto lineNumber = GetLineNumber(src, charIndex);
-        auto startLine = std::max(lineNumber - 2, 0u);
-        auto endLine = std::min(lineNumber + 1, lines.size() - 1);
+        return SafePrintf("line % of \"%\"", location.m_LineNumber, location.m_FileName);
+    }
+
+    void PrintCodeContext(const SourceBuffer& source, unsigned int charIndex)
+    {
+        auto lineNumber = source.GetSourceMap().GetLineNumber(charIndex);
+        auto startLine = std::max(lineNumber, 2u) - 1;
 
         LOG_F("\nNear code:");
 
-        for (auto i = startLine; i < endLine; i++)
+        for (auto i = startLine; i <= lineNumber; i++)
         {
-            LOG_F(">>> %", lines[i]);
+            LOG_F(">>> %", source.GetLine(i));
         }
     }
 
-    void PrintPreprocessorException(const std::string& src, const PreprocessorException& ex)
+    void PrintPreprocessorException(const SourceBuffer& source, const PreprocessorException& ex)
     {
-        LOG_F("\n(!) Preprocessor error: %", ex.what());
+        if (!ex.HasLocation())
+        {
+            LOG_F("\n(!) Preprocessor error: %", ex.what());
+            return;
+        }
+
+        if (ex.GetFileName().empty())
+        {
+            LOG_F("\n(!) Preprocessor error: % on line %", ex.what(), ex.GetLineNumber());
+            return;
+        }
+
+        LOG_F("\n(!) Preprocessor error: % on line % of \"%\"", ex.what(), ex.GetLineNumber(), ex.GetFileName());
     }
 
-    void PrintParserException(const std::string& src, const ParserException& ex)
+    void PrintParserException(const SourceBuffer& source, const ParserException& ex)
     {
         auto charIndex = ex.GetCharPosition();
-        auto lineNumber = GetLineNumber(src, charIndex);
+        auto location = GetSourceLocationString(source, charIndex);
 
-        LOG_F("\n(!) Parser error: % on line %", ex.what(), lineNumber);
-        PrintCodeContext(src, charIndex);
+        LOG_F("\n(!) Parser error: % on %", ex.what(), location);
+        PrintCodeContext(source, charIndex);
     }
 
-    void PrintTemplateInstantiatorException(const std::string& src, const TemplateInstantiatorException& ex)
+    void PrintTemplateInstantiatorException(const SourceBuffer& source, const TemplateInstantiatorException& ex)
     {
         auto astNode = ex.GetASTNode();
         auto astNodeType = astNode->GetTypeName();
 
         auto charIndex = astNode->GetCharIndex();
-        auto lineNumber = GetLineNumber(src, charIndex);
+        auto location = GetSourceLocationString(source, charIndex);
 
-        LOG_F("\n(!) Template instantiation error: % in % on line %", ex.what(), astNodeType, lineNumber);
-        PrintCodeContext(src, charIndex);
+        LOG_F("\n(!) Template instantiation error: % in % on %", ex.what(), astNodeType, location);
+        PrintCodeContext(source, charIndex);
     }
 
-    void PrintIRCompilerException(const std::string& src, const IRCompilerException& ex)
+    void PrintIRCompilerException(const SourceBuffer& source, const IRCompilerException& ex)
     {
         auto astNode = ex.GetASTNode();
 
@@ -68,19 +89,19 @@ namespace LangUMS
             auto astNodeType = astNode->GetTypeName();
 
             auto charIndex = astNode->GetCharIndex();
-            auto lineNumber = GetLineNumber(src, charIndex);
+            auto location = GetSourceLocationString(source, charIndex);
 
             auto fn = FindFunctionDeclarationForNode(astNode);
             if (fn != nullptr)
             {
-                LOG_F("\n(!) Compilation error: % in % on line % in function \"%\"", ex.what(), astNodeType, lineNumber, fn->GetName());
+                LOG_F("\n(!) Compilation error: % in % on % in function \"%\"", ex.what(), astNodeType, location, fn->GetName());
             }
             else
             {
-                LOG_F("\n(!) Compilation error: % in % on line %", ex.what(), astNodeType, lineNumber);
+                LOG_F("\n(!) Compilation error: % in % on %", ex.what(), astNodeType, location);
             }
 
-            PrintCodeContext(src, charIndex);
+            PrintCodeContext(source, charIndex);
         }
         else
         {
@@ -88,7 +109,7 @@ namespace LangUMS
         }
     }
 
-    void PrintCompilerException(const std::string& src, const CompilerException& ex)
+    void PrintCompilerException(const SourceBuffer& source, const CompilerException& ex)
     {
         auto instruction = ex.GetInstruction();
         if (!instruction)
@@ -101,20 +122,19 @@ namespace LangUMS
         auto astNodeType = astNode->GetTypeName();
 
         auto charIndex = astNode->GetCharIndex();
-        auto lineNumber = GetLineNumber(src, charIndex);
+        auto location = GetSourceLocationString(source, charIndex);
 
         auto fn = FindFunctionDeclarationForNode(astNode);
         if (fn != nullptr)
         {
-            LOG_F("\n(!) Codegen error: % in % on line % in function \"%\"", ex.what(), astNodeType, lineNumber, fn->GetName());
+            LOG_F("\n(!) Codegen error: % in % on % in function \"%\"", ex.what(), astNodeType, location, fn->GetName());
         }
         else
         {
-            LOG_F("\n(!) Codegen error: % in % on line %", ex.what(), astNodeType, lineNumber);
+            LOG_F("\n(!) Codegen error: % in % on %", ex.what(), astNodeType, location);
         }
 
-        LOG_F("\n(!) Codegen error: % in % on line %", ex.what(), astNodeType, lineNumber);
-        PrintCodeContext(src, charIndex);
+        PrintCodeContext(source, charIndex);
     }
 
 }
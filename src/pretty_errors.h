@@ -7,6 +7,7 @@
 
 #include "log.h"
 #include "stringutil.h"
+#include "source_buffer.h"
 
 #include "parser/preprocessor.h"
 #include "parser/parser.h"
@@ -18,12 +19,13 @@
 namespace LangUMS
 {
 
-    void PrintCodeContext(const std::string& src, unsigned int charIndex);
-    void PrintPreprocessorException(const std::string& src, const PreprocessorException& ex);
-    void PrintParserException(const std::string& src, const ParserException& ex);
-    void PrintTemplateInstantiatorException(const std::string& src, const TemplateInstantiatorException& ex);
-    void PrintIRCompilerException(const std::string& src, const IRCompilerException& ex);
-    void PrintCompilerException(const std::string& src, const CompilerException& ex);
+    std::string GetSourceLocationString(const SourceBuffer& source, unsigned int charIndex);
+    void PrintCodeContext(const SourceBuffer& source, unsigned int charIndex);
+    void PrintPreprocessorException(const SourceBuffer& source, const PreprocessorException& ex);
+    void PrintParserException(const SourceBuffer& source, const ParserException& ex);
+    void PrintTemplateInstantiatorException(const SourceBuffer& source, const TemplateInstantiatorException& ex);
+    void PrintIRCompilerException(const SourceBuffer& source, const IRCompilerException& ex);
+    void PrintCompilerException(const SourceBuffer& source, const CompilerException& ex);
 
 }
 
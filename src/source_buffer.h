@@ -0,0 +1,61 @@
+#ifndef __LANGUMS_SOURCE_BUFFER_H
+#define __LANGUMS_SOURCE_BUFFER_H
+
+#include <string>
+#include <memory>
+
+#include "source_map.h"
+
+namespace LangUMS
+{
+
+    // the preprocessed source and its source map, copies of a buffer share the same immutable text
+    class SourceBuffer
+    {
+        public:
+        SourceBuffer() : SourceBuffer(std::string(), SourceMap()) {}
+        explicit SourceBuffer(std::string&& text) : SourceBuffer(std::move(text), SourceMap()) {}
+
+        SourceBuffer(std::string&& text, SourceMap sourceMap)
+        {
+            sourceMap.IndexLines(text);
+            m_SourceMap = std::make_shared<SourceMap>(std::move(sourceMap));
+            m_Text = std::make_shared<std::string>(std::move(text));
+        }
+
+        const std::string& GetText() const
+        {
+            return *m_Text;
+        }
+
+        const char* GetData() const
+        {
+            return m_Text->data();
+        }
+
+        size_t GetSize() const
+        {
+            return m_Text->size();
+        }
+
+        const SourceMap& GetSourceMap() const
+        {
+            return *m_SourceMap;
+        }
+
+        // the text of a line without its line ending, line numbers start at 1
+        std::string GetLine(unsigned int lineNumber) const
+        {
+            auto start = m_SourceMap->GetLineStart(lineNumber);
+            auto end = lineNumber < m_SourceMap->GetLineCount() ? m_SourceMap->GetLineStart(lineNumber + 1) - 1 : (unsigned int)m_Text->size();
+            return m_Text->substr(start, end - start);
+        }
+
+        private:
+        std::shared_ptr<const std::string> m_Text;
+        std::shared_ptr<const SourceMap> m_SourceMap;
+    };
+
+}
+
+#endif
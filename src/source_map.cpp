@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "source_map.h"
+
+namespace LangUMS
+{
+
+    unsigned int SourceMap::AddFile(const std::string& fileName)
+    {
+        auto it = m_FileIndices.find(fileName);
+        if (it != m_FileIndices.end())
+        {
+            return it->second;
+        }
+
+        auto index = (unsigned int)m_FileNames.size();
+        m_FileNames.push_back(fileName);
+        m_FileIndices.insert(std::make_pair(fileName, index));
+        return index;
+    }
+
+    void SourceMap::IndexLines(const std::string& text)
+    {
+        m_LineStarts.clear();
+        m_LineStarts.push_back(0);
+
+        for (auto i = 0u; i < text.size(); i++)
+        {
+            if (text[i] == '\n')
+            {
+                m_LineStarts.push_back(i + 1);
+            }
+        }
+    }
+
+    unsigned int SourceMap::GetLineNumber(unsigned int charIndex) const
+    {
+        // line numbers start at 1, the first line always starts at 0
+        auto it = std::upper_bound(m_LineStarts.begin(), m_LineStarts.end(), charIndex);
+        return (unsigned int)(it - m_LineStarts.begin());
+    }
+
+    unsigned int SourceMap::GetLineStart(unsigned int lineNumber) const
+    {
+        if (lineNumber == 0 || lineNumber > m_LineStarts.size())
+        {
+            return lineNumber == 0 ? 0 : m_LineStarts.back();
+        }
+
+        return m_LineStarts[lineNumber - 1];
+    }
+
+    SourceLocation SourceMap::GetLocation(unsigned int charIndex) const
+    {
+        SourceLocation location;
+
+        auto lineNumber = GetLineNumber(charIndex);
+        location.m_LineNumber = lineNumber;
+        location.m_Column = charIndex - GetLineStart(lineNumber);
+
+        if (lineNumber - 1 < m_LineOrigins.size())
+        {
+            auto& origin = m_LineOrigins[lineNumber - 1];
+            location.m_FileName = m_FileNames[origin.m_FileIndex];
+            location.m_LineNumber = origin.m_LineNumber;
+        }
+
+        return location;
+    }
+
+}
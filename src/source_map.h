@@ -0,0 +1,58 @@
+#ifndef __LANGUMS_SOURCE_MAP_H
+#define __LANGUMS_SOURCE_MAP_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace LangUMS
+{
+
+    struct SourceLocation
+    {
+        std::string m_FileName; // empty if the source was not read from a file
+        unsigned int m_LineNumber = 0;
+        unsigned int m_Column = 0;
+    };
+
+    // maps offsets in the preprocessed source to line numbers and each line back to the file and line it came from
+    class SourceMap
+    {
+        public:
+        SourceMap() {}
+
+        unsigned int AddFile(const std::string& fileName);
+
+        // called by the preprocessor for every line it outputs, in order
+        void AddLine(unsigned int fileIndex, unsigned int lineNumber)
+        {
+            m_LineOrigins.push_back(LineOrigin{ fileIndex, lineNumber });
+        }
+
+        void IndexLines(const std::string& text);
+
+        unsigned int GetLineCount() const
+        {
+            return (unsigned int)m_LineStarts.size();
+        }
+
+        unsigned int GetLineNumber(unsigned int charIndex) const;
+        unsigned int GetLineStart(unsigned int lineNumber) const;
+        SourceLocation GetLocation(unsigned int charIndex) const;
+
+        private:
+        struct LineOrigin
+        {
+            unsigned int m_FileIndex;
+            unsigned int m_LineNumber;
+        };
+
+        std::vector<unsigned int> m_LineStarts;
+        std::vector<LineOrigin> m_LineOrigins;
+        std::vector<std::string> m_FileNames;
+        std::unordered_map<std::string, unsigned int> m_FileIndices;
+    };
+
+}
+
+#endif
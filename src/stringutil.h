@@ -27,20 +27,6 @@ namespace LangUMS
         return lines;
     }
 
-    inline unsigned int GetLineNumber(const std::string& src, int charIndex)
-    {
-        auto lineNumber = 1;
-        for (auto i = 0; i < std::min((int)src.length(), charIndex); i++)
-        {
-            if (src[i] == '\n')
-            {
-                lineNumber++;
-            }
-        }
-
-        return lineNumber;
-    }
-
     static std::string SafePrintf(const char *s)
     {
         std::stringstream ss;
@@ -14,12 +14,48 @@ using namespace LangUMS;
 using namespace std::experimental;
 
 // using system() is bad. TODO: portable wrapper for CreateProcess
-bool Compile(const std::string& langPath, const std::string& dstPath, const std::string& irPath, const std::string& logPath)
+bool Compile(const std::string& langPath, const std::string& dstPath, const std::string& irPath, const std::string& logPath, const std::string& extraArgs)
 {
-    auto cmd = SafePrintf("langums.exe --lang % --dst % --ir % --log-file % --quiet --dump-ir", langPath, dstPath, irPath, logPath);
+    auto cmd = SafePrintf("langums.exe --lang % --dst % --ir % --log-file % --quiet --dump-ir %", langPath, dstPath, irPath, logPath, extraArgs);
     return system(cmd.c_str()) == 0;
 }
 
+// a test can pass extra compiler arguments (e.g. -Ot or -D) in an optional .args file next to it
+std::string ReadTestArguments(filesystem::path path)
+{
+    std::string args;
+    if (!ReadTextFile(path.replace_extension("args").generic_u8string(), args))
+    {
+        return "";
+    }
+
+    for (auto& c : args)
+    {
+        if (c == '\r' || c == '\n')
+        {
+            c = ' ';
+        }
+    }
+
+    return args;
+}
+
+// a test which is expected to fail names (part of) the error message in a .error file instead of having .ir and .sha256 files
+bool ReadExpectedError(filesystem::path path, std::string& retError)
+{
+    if (!ReadTextFile(path.replace_extension("error").generic_u8string(), retError))
+    {
+        return false;
+    }
+
+    while (!retError.empty() && (retError.back() == '\r' || retError.back() == '\n'))
+    {
+        retError.pop_back();
+    }
+
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     Log::Instance()->AddInterface(std::unique_ptr<ILogInterface>(new LogInterfaceStdout()));
@@ -31,6 +67,7 @@ int main(int argc, char* argv[])
         ("h,help", "Prints this help message.", cxxopts::value<bool>())
         ("t,tests", "Path to tests directory.", cxxopts::value<std::string>())
         ("i,init", "Creates the initial .ir and .sha256 test files.", cxxopts::value<bool>())
+        ("r,record", "Records the .sha256 file of tests which don't have one yet once their IR matches.", cxxopts::value<bool>())
         ;
 
     try
@@ -76,6 +113,12 @@ int main(int argc, char* argv[])
                 continue;
             }
 
+            std::string expectedError;
+            if (ReadExpectedError(filename.path(), expectedError))
+            {
+                continue;
+            }
+
             LOG_F("Compiling %", filename);
             auto langPath = filename.path().generic_u8string();
             auto dstPath = (tmpPath / filename.path().filename().replace_extension("scx")).generic_u8string();
@@ -83,7 +126,7 @@ int main(int argc, char* argv[])
             auto irPath = tmp.replace_extension("ir").generic_u8string();
             auto logPath = (tmpPath / filename.path().filename().replace_extension("log")).generic_u8string();
 
-            if (!Compile(langPath, dstPath, irPath, logPath))
+            if (!Compile(langPath, dstPath, irPath, logPath, ReadTestArguments(filename.path())))
             {
                 LOG_F("Compilation failed for \"%\"", filename);
                 return 1;
@@ -109,6 +152,8 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    auto recordHashes = opts.count("record") != 0;
+
     LOG_F("Running tests...");
 
     std::vector<std::string> tested;
@@ -127,6 +172,38 @@ int main(int argc, char* argv[])
         LOG_F("- Testing \"%\"", filename);
         tested.push_back(testName);
 
+        auto langPath = filename.path().generic_u8string();
+
+        auto dstPath = (tmpPath / filename.path().filename().replace_extension("scx")).generic_u8string();
+        auto dstIrPath = (tmpPath / filename.path().filename().replace_extension("ir")).generic_u8string();
+        auto logPath = (tmpPath / filename.path().filename().replace_extension("log")).generic_u8string();
+
+        std::string expectedError;
+        if (ReadExpectedError(filename.path(), expectedError))
+        {
+            if (Compile(langPath, dstPath, dstIrPath, logPath, ReadTestArguments(filename.path())))
+            {
+                LOG_F("(!) Compilation succeeded for \"%\", expected error \"%\"", testName, expectedError);
+                failed.push_back(testName);
+                continue;
+            }
+
+            if (!ReadTextFile(logPath, logs[testName]))
+            {
+                LOG_F("Failed to read from \"%\"", logPath);
+                failed.push_back(testName);
+                continue;
+            }
+
+            if (logs[testName].find(expectedError) == std::string::npos)
+            {
+                LOG_F("(!) Expected error \"%\" not reported for \"%\"", expectedError, testName);
+                failed.push_back(testName);
+            }
+
+            continue;
+        }
+
         auto tmp = filename.path();
         auto irPath = tmp.replace_extension("ir").generic_u8string();
         auto hashPath = tmp.replace_extension("sha256").generic_u8string();
@@ -140,20 +217,9 @@ int main(int argc, char* argv[])
         }
 
         std::string expectedHash;
-        if (!ReadTextFile(hashPath, expectedHash))
-        {
-            LOG_F("Failed to read hash from \"%\"", hashPath);
-            failed.push_back(testName);
-            continue;
-        }
-
-        auto langPath = filename.path().generic_u8string();
+        auto hasExpectedHash = ReadTextFile(hashPath, expectedHash);
 
-        auto dstPath = (tmpPath / filename.path().filename().replace_extension("scx")).generic_u8string();
-        auto dstIrPath = (tmpPath / filename.path().filename().replace_extension("ir")).generic_u8string();
-        auto logPath = (tmpPath / filename.path().filename().replace_extension("log")).generic_u8string();
-
-        if (!Compile(langPath, dstPath, dstIrPath, logPath))
+        if (!Compile(langPath, dstPath, dstIrPath, logPath, ReadTestArguments(filename.path())))
         {
             LOG_F("Compilation failed for \"%\"", filename);
             failed.push_back(testName);
@@ -203,6 +269,27 @@ int main(int argc, char* argv[])
             continue;
         }
 
+        if (!hasExpectedHash)
+        {
+            // new tests get their hash recorded with --record once their IR is known to be right
+            if (!recordHashes)
+            {
+                LOG_F("(!) Missing hash for \"%\", got % (use --record to save it)", testName, hash);
+                failed.push_back(testName);
+                continue;
+            }
+
+            LOG_F("Recording hash % for \"%\"", hash, testName);
+
+            if (!WriteTextFile(hashPath, hash))
+            {
+                LOG_F("Failed to write to \"%\"", hashPath);
+                failed.push_back(testName);
+            }
+
+            continue;
+        }
+
         if (hash != expectedHash)
         {
             LOG_F("(!) Hash mismatch for \"%\", expected %, got %", testName, expectedHash, hash);